@@ -0,0 +1,293 @@
+/*
+    vactija as a loadable bash builtin, so a prompt can show the next
+    vakat without forking a process for it every time:
+
+        enable -f /usr/local/lib/bash/libvactija_builtin.so vactija
+        PROMPT_COMMAND='vactija -v VAKAT next'
+        PS1='[$VAKAT] \w \$ '
+
+    It answers from the cache only (see prompt.h) and never downloads
+    or exits the shell; run vactija itself once a day, or the daemon,
+    to keep the cache filled. Built with "make builtin" against the
+    bash headers (BASHINC in the Makefile).
+*/
+#include <config.h>
+
+#if defined (HAVE_UNISTD_H)
+#  include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "shell.h"
+#include "bashgetopt.h"
+#include "common.h"
+
+#include "../vactija.h"
+#include "../derived.h"
+#include "../format.h"
+#include "../locations.h"
+#include "../prompt.h"
+#include "../util/clocksource.h"
+#include "../util/hijri.h"
+#include "../config.h"
+
+#define ANSWER_MAX 1024
+
+static struct prompt state;
+
+/* Built-in templates of the actions, and the last one given with -f */
+static struct format *templates[PROMPT_ACTION_NUM];
+static struct format *custom = NULL;
+static char *custom_text = NULL;
+
+/*
+    Returns the compiled template, compiling it only if it is not the
+    one given the last time, or NULL (after an error) if it is invalid.
+*/
+static struct format *custom_format(const char *text)
+{
+
+    if (custom_text != NULL && strcmp(custom_text, text) == 0) {
+        return custom;
+    }
+
+    char err[FORMAT_ERR_MAX];
+    struct format *fmt = format_compile(text, err, sizeof err);
+
+    if (fmt == NULL) {
+
+        builtin_error("invalid format: %s", err);
+        return NULL;
+
+    }
+
+    format_free(custom);
+    free(custom_text);
+
+    custom = fmt;
+    custom_text = strdup(text);
+
+    return custom;
+
+}
+
+int vactija_builtin(WORD_LIST *list)
+{
+
+    char *var = NULL;
+    char *loc = (char *) cfg_loc;
+    char *directory = (char *) cfg_cachedir;
+    char *text = NULL;
+    int opt;
+
+    reset_internal_getopt();
+
+    while ((opt = internal_getopt(list, "v:l:d:f:")) != -1) {
+
+        switch (opt) {
+
+        case 'v':
+            var = list_optarg;
+            break;
+
+        case 'l':
+            loc = list_optarg;
+            break;
+
+        case 'd':
+            directory = list_optarg;
+            break;
+
+        case 'f':
+            text = list_optarg;
+            break;
+
+        CASE_HELPOPT;
+
+        default:
+            builtin_usage();
+            return EX_USAGE;
+
+        }
+
+    }
+
+    list = loptend;
+
+    if (list == NULL || list->next != NULL) {
+
+        builtin_usage();
+        return EX_USAGE;
+
+    }
+
+    int action = prompt_action(list->word->word);
+
+    if (action < 0) {
+
+        builtin_error("%s: unknown action (next, current or countdown)", list->word->word);
+        return EX_USAGE;
+
+    }
+
+    if (var != NULL && legal_identifier(var) == 0) {
+
+        sh_invalidid(var);
+        return EXECUTION_FAILURE;
+
+    }
+
+    int location = location_parse(loc);
+
+    if (location < 0) {
+
+        builtin_error("%s: unknown location", loc);
+        return EXECUTION_FAILURE;
+
+    }
+
+    struct format *fmt = (text != NULL) ? custom_format(text) : templates[action];
+
+    if (fmt == NULL) {
+        return EXECUTION_FAILURE;
+    }
+
+    char answer[ANSWER_MAX];
+
+    if (prompt_answer(&state, directory, location, action, fmt, clock_now(), answer, sizeof answer) < 0) {
+
+        builtin_error("no cached vaktija of %s for the days needed in %s", location_name(location), directory);
+        return EXECUTION_FAILURE;
+
+    }
+
+    if (var != NULL) {
+
+        bind_variable(var, answer, 0);
+
+    } else {
+
+        fputs(answer, stdout);
+        fflush(stdout);
+
+    }
+
+    return EXECUTION_SUCCESS;
+
+}
+
+/*
+    Called by enable -f. Sets up what the CLI sets up from config.h and
+    the environment (VACTIJA_NOW, for trying it out at another time) and
+    compiles the built-in templates.
+
+    Returns 1 on success, as bash expects.
+*/
+int vactija_builtin_load(char *name)
+{
+
+    (void) name;
+
+    derived_register(cfg_derived, sizeof cfg_derived / sizeof cfg_derived[0]);
+
+    if (hijri_set_adjustments(cfg_hijri_adjustments,
+                sizeof cfg_hijri_adjustments / sizeof cfg_hijri_adjustments[0]) != 0) {
+
+        builtin_error("invalid cfg_hijri_adjustments in config.h");
+        return 0;
+
+    }
+
+    if (clock_from_env() != 0) {
+
+        builtin_error("invalid VACTIJA_NOW or VACTIJA_CLOCK_SPEED");
+        return 0;
+
+    }
+
+    prompt_init(&state);
+
+    for (int i = 0; i < PROMPT_ACTION_NUM; i++) {
+
+        char err[FORMAT_ERR_MAX];
+
+        if ((templates[i] = format_compile(prompt_template(i), err, sizeof err)) == NULL) {
+
+            builtin_error("invalid built-in template: %s", err);
+
+            while (i-- > 0) {
+
+                format_free(templates[i]);
+                templates[i] = NULL;
+
+            }
+
+            return 0;
+
+        }
+
+    }
+
+    return 1;
+
+}
+
+/*
+    Called by enable -d.
+*/
+void vactija_builtin_unload(char *name)
+{
+
+    (void) name;
+
+    prompt_free(&state);
+
+    for (int i = 0; i < PROMPT_ACTION_NUM; i++) {
+
+        format_free(templates[i]);
+        templates[i] = NULL;
+
+    }
+
+    format_free(custom);
+    free(custom_text);
+
+    custom = NULL;
+    custom_text = NULL;
+
+}
+
+char *vactija_doc[] = {
+    "Show the next or current vakat from the vactija cache.",
+    "",
+    "Answers next, current or countdown for the location (-l, an ID",
+    "or name) from the cache directory (-d), without forking or",
+    "downloading anything. The parsed day is kept in the shell and only",
+    "read again when the date or its cache file changes.",
+    "",
+    "Options:",
+    "  -v var        assign the answer to the shell variable VAR instead",
+    "                of printing it",
+    "  -l location   the location, by default the one in config.h",
+    "  -d directory  the cache directory, by default the one in config.h",
+    "  -f format     a template, e.g. \"{next.name} {next.time}\"",
+    "",
+    "Exit Status:",
+    "Returns success unless an invalid option is given or the days the",
+    "answer needs (today, and yesterday before fajr or tomorrow after",
+    "isha) are not in the cache.",
+    (char *) NULL
+};
+
+struct builtin vactija_struct = {
+    "vactija",
+    vactija_builtin,
+    BUILTIN_ENABLED,
+    vactija_doc,
+    "vactija [-v var] [-l location] [-d directory] [-f format] next|current|countdown",
+    0
+};
@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vactija.h"
+#include "bundle.h"
+#include "record.h"
+#include "util/cachefile.h"
+#include "util/temporal.h"
+#include "util/hijri.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define BUNDLE_HEADER 16
+#define BUNDLE_INDEX_ENTRY 16
+#define BUNDLE_DATE_ENTRY 4
+
+/*
+    Packed deltas are read a few bytes at a time, so every location's
+    data is followed by this much padding.
+*/
+#define BUNDLE_PAD 4
+
+#define BLOCK_BASE_BITS 11
+#define BLOCK_WIDTH_BITS 4
+#define BLOCK_OFFSET_BITS 17
+
+static const char *weekdays[] = {
+    "nedjelja", "ponedjeljak", "utorak", "srijeda", "četvrtak", "petak", "subota"
+};
+
+static const char *months[] = {
+    "januar", "februar", "mart", "april", "maj", "juni",
+    "juli", "august", "septembar", "oktobar", "novembar", "decembar"
+};
+
+static uint16_t get_le16(const unsigned char *p)
+{
+
+    return (uint16_t) (p[0] | p[1] << 8);
+
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+
+}
+
+static void put_le16(unsigned char *p, uint16_t val)
+{
+
+    p[0] = val & 0xff;
+    p[1] = val >> 8;
+
+}
+
+static void put_le32(unsigned char *p, uint32_t val)
+{
+
+    for (int i = 0; i < 4; i++) {
+        p[i] = (val >> (8 * i)) & 0xff;
+    }
+
+}
+
+static uint32_t zigzag(int val)
+{
+
+    return (val < 0) ? ((uint32_t) -val << 1) - 1 : (uint32_t) val << 1;
+
+}
+
+static int unzigzag(uint32_t val)
+{
+
+    return (val & 1) ? -(int) ((val + 1) >> 1) : (int) (val >> 1);
+
+}
+
+/*
+    Reads width (at most 15) bits at the bit offset from the packed
+    deltas, least significant bit first.
+*/
+static uint32_t get_bits(const unsigned char *bits, uint32_t off, int width)
+{
+
+    const unsigned char *p = bits + (off >> 3);
+    uint32_t word = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16;
+
+    return (word >> (off & 7)) & ((1u << width) - 1);
+
+}
+
+static void put_bits(unsigned char *bits, uint32_t off, int width, uint32_t val)
+{
+
+    for (int i = 0; i < width; i++, off++) {
+
+        if (val & (1u << i)) {
+            bits[off >> 3] |= 1u << (off & 7);
+        }
+
+    }
+
+}
+
+static int nblocks(int ndays)
+{
+
+    return (ndays + BUNDLE_BLOCK - 1) / BUNDLE_BLOCK;
+
+}
+
+/*
+    Encodes the times of one location into a newly allocated buffer
+    (block table, then the packed deltas and padding).
+
+    Returns NULL if the times do not fit the format.
+*/
+static unsigned char *encode_location(const struct bundle_location *loc, int ndays, size_t *len)
+{
+
+    int blocks = nblocks(ndays);
+    size_t table = (size_t) blocks * PRAYER_TIME_NUM * 4;
+
+    /* The widest possible deltas, trimmed to what is used afterwards */
+    size_t maxbits = (size_t) PRAYER_TIME_NUM * ndays * 15;
+    unsigned char *buf = vcalloc(1, table + maxbits / 8 + 1 + BUNDLE_PAD);
+
+    if (buf == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to build the bundle!\n");
+        vactija_error(errcode);
+
+    }
+
+    unsigned char *bits = buf + table;
+    uint32_t off = 0;
+
+    for (int s = 0; s < PRAYER_TIME_NUM; s++) {
+
+        for (int b = 0; b < blocks; b++) {
+
+            int first = b * BUNDLE_BLOCK;
+            int last = (first + BUNDLE_BLOCK < ndays) ? first + BUNDLE_BLOCK : ndays;
+
+            uint32_t base = loc->times[first][s];
+            uint32_t widest = 0;
+
+            for (int d = first + 1; d < last; d++) {
+
+                uint32_t zz = zigzag(loc->times[d][s] - loc->times[d - 1][s]);
+
+                if (zz > widest) {
+                    widest = zz;
+                }
+
+            }
+
+            int width = 0;
+            while ((widest >> width) != 0) {
+                width++;
+            }
+
+            if (base >= (1u << BLOCK_BASE_BITS) || width >= (1 << BLOCK_WIDTH_BITS) ||
+                off >= (1u << BLOCK_OFFSET_BITS)) {
+
+                vfree(buf);
+                return NULL;
+
+            }
+
+            put_le32(buf + ((size_t) s * blocks + b) * 4,
+                    base | (uint32_t) width << BLOCK_BASE_BITS |
+                    off << (BLOCK_BASE_BITS + BLOCK_WIDTH_BITS));
+
+            for (int d = first + 1; d < last; d++, off += width) {
+                put_bits(bits, off, width, zigzag(loc->times[d][s] - loc->times[d - 1][s]));
+            }
+
+        }
+
+    }
+
+    *len = table + (off + 7) / 8 + BUNDLE_PAD;
+
+    return buf;
+
+}
+
+static int compare_locations(const void *a, const void *b)
+{
+
+    const struct bundle_location *x = a;
+    const struct bundle_location *y = b;
+
+    return (x->id > y->id) - (x->id < y->id);
+
+}
+
+/*
+    Writes a bundle for ndays days (from January 1st) of the year to
+    path. dates holds the Hijri date of each day, which is the same for
+    every location.
+
+    Returns 0 on success and -1 if the data does not fit the format (e.g
+    a vakat moving by more than two hours from one day to the next).
+*/
+int bundle_write(const char *path, int year, int ndays,
+        const struct bundle_location *locations, int nlocations,
+        const struct bundle_hijri *dates)
+{
+
+    if (ndays < 1 || ndays > 366 || nlocations < 0 || nlocations > UINT16_MAX) {
+        return -1;
+    }
+
+    struct bundle_location *sorted = vmalloc(sizeof *sorted * (nlocations > 0 ? nlocations : 1));
+    unsigned char **data = vmalloc(sizeof *data * (nlocations > 0 ? nlocations : 1));
+    size_t *datalen = vmalloc(sizeof *datalen * (nlocations > 0 ? nlocations : 1));
+
+    if (sorted == NULL || data == NULL || datalen == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to build the bundle!\n");
+        vactija_error(errcode);
+
+    }
+
+    memcpy(sorted, locations, sizeof *sorted * nlocations);
+    qsort(sorted, nlocations, sizeof *sorted, compare_locations);
+
+    size_t names = BUNDLE_HEADER + (size_t) nlocations * BUNDLE_INDEX_ENTRY +
+        (size_t) ndays * BUNDLE_DATE_ENTRY;
+    size_t size = names;
+
+    int failed = 0;
+
+    for (int i = 0; i < nlocations; i++) {
+
+        size += strlen(sorted[i].name);
+        data[i] = failed ? NULL : encode_location(&sorted[i], ndays, &datalen[i]);
+
+        if (data[i] == NULL) {
+            failed = 1;
+        }
+
+    }
+
+    unsigned char *buf = NULL;
+
+    if (!failed) {
+
+        size_t start = size;
+
+        for (int i = 0; i < nlocations; i++) {
+            size += datalen[i];
+        }
+
+        buf = vcalloc(1, size);
+
+        if (buf == NULL) {
+
+            int errcode = errno;
+            printf("Could not allocate enough memory to build the bundle!\n");
+            vactija_error(errcode);
+
+        }
+
+        size_t nameoff = names;
+        size_t dataoff = start;
+
+        for (int i = 0; i < nlocations; i++) {
+
+            unsigned char *entry = buf + BUNDLE_HEADER + (size_t) i * BUNDLE_INDEX_ENTRY;
+            size_t namelen = strlen(sorted[i].name);
+
+            put_le16(entry, (uint16_t) sorted[i].id);
+            put_le16(entry + 2, (uint16_t) namelen);
+            put_le32(entry + 4, (uint32_t) nameoff);
+            put_le32(entry + 8, (uint32_t) dataoff);
+            put_le32(entry + 12, (uint32_t) datalen[i]);
+
+            memcpy(buf + nameoff, sorted[i].name, namelen);
+            memcpy(buf + dataoff, data[i], datalen[i]);
+
+            nameoff += namelen;
+            dataoff += datalen[i];
+
+        }
+
+        unsigned char *date = buf + BUNDLE_HEADER + (size_t) nlocations * BUNDLE_INDEX_ENTRY;
+
+        for (int d = 0; d < ndays; d++, date += BUNDLE_DATE_ENTRY) {
+
+            date[0] = dates[d].day;
+            date[1] = dates[d].month;
+            put_le16(date + 2, dates[d].year);
+
+        }
+
+        memcpy(buf, BUNDLE_MAGIC, 4);
+        put_le16(buf + 4, BUNDLE_VERSION);
+        put_le16(buf + 6, (uint16_t) nlocations);
+        put_le16(buf + 8, (uint16_t) year);
+        put_le16(buf + 10, (uint16_t) ndays);
+        put_le32(buf + 12, record_checksum((const char *) buf + BUNDLE_HEADER, size - BUNDLE_HEADER));
+
+        write_cache_data(path, buf, size);
+
+    }
+
+    for (int i = 0; i < nlocations; i++) {
+        vfree(data[i]);
+    }
+
+    vfree(buf);
+    vfree(sorted);
+    vfree(data);
+    vfree(datalen);
+
+    return failed ? -1 : 0;
+
+}
+
+static const unsigned char *index_entry(const struct bundle *bundle, int loc)
+{
+
+    return bundle->map + BUNDLE_HEADER + (size_t) loc * BUNDLE_INDEX_ENTRY;
+
+}
+
+/*
+    Checks that everything the decoder is going to read lies within the
+    file, so that decoding itself never has to.
+*/
+static int bundle_valid(const struct bundle *bundle)
+{
+
+    size_t dates = BUNDLE_HEADER + (size_t) bundle->nlocations * BUNDLE_INDEX_ENTRY;
+
+    if (dates + (size_t) bundle->ndays * BUNDLE_DATE_ENTRY > bundle->size) {
+        return 0;
+    }
+
+    int blocks = nblocks(bundle->ndays);
+    size_t table = (size_t) blocks * PRAYER_TIME_NUM * 4;
+
+    for (int i = 0; i < bundle->nlocations; i++) {
+
+        const unsigned char *entry = index_entry(bundle, i);
+
+        size_t nameoff = get_le32(entry + 4);
+        size_t namelen = get_le16(entry + 2);
+        size_t dataoff = get_le32(entry + 8);
+        size_t datalen = get_le32(entry + 12);
+
+        if (nameoff + namelen > bundle->size || dataoff + datalen > bundle->size ||
+            datalen < table + BUNDLE_PAD) {
+            return 0;
+        }
+
+        if (i > 0 && get_le16(entry) <= get_le16(entry - BUNDLE_INDEX_ENTRY)) {
+            return 0;
+        }
+
+        size_t bits = (datalen - table - BUNDLE_PAD) * 8;
+
+        for (int b = 0; b < blocks * PRAYER_TIME_NUM; b++) {
+
+            uint32_t block = get_le32(bundle->map + dataoff + (size_t) b * 4);
+            uint32_t width = (block >> BLOCK_BASE_BITS) & ((1u << BLOCK_WIDTH_BITS) - 1);
+            uint32_t off = block >> (BLOCK_BASE_BITS + BLOCK_WIDTH_BITS);
+
+            int first = (b % blocks) * BUNDLE_BLOCK;
+            int last = (first + BUNDLE_BLOCK < bundle->ndays) ? first + BUNDLE_BLOCK : bundle->ndays;
+
+            if (off + (size_t) width * (last - first - 1) > bits) {
+                return 0;
+            }
+
+        }
+
+    }
+
+    return 1;
+
+}
+
+/*
+    Maps the bundle at path into memory. Only the parts that are used
+    are ever read from disk.
+
+    Returns NULL if there is no bundle at path or it is not valid.
+*/
+struct bundle *bundle_open(const char *path)
+{
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < BUNDLE_HEADER) {
+
+        close(fd);
+        return NULL;
+
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct bundle *bundle = vmalloc(sizeof *bundle);
+
+    if (bundle == NULL) {
+
+        munmap(map, st.st_size);
+        return NULL;
+
+    }
+
+    bundle->map = map;
+    bundle->size = st.st_size;
+    bundle->nlocations = get_le16(bundle->map + 6);
+    bundle->year = get_le16(bundle->map + 8);
+    bundle->ndays = get_le16(bundle->map + 10);
+
+    uint32_t checksum = record_checksum((const char *) bundle->map + BUNDLE_HEADER,
+            bundle->size - BUNDLE_HEADER);
+
+    if (memcmp(bundle->map, BUNDLE_MAGIC, 4) != 0 || get_le16(bundle->map + 4) != BUNDLE_VERSION ||
+        get_le32(bundle->map + 12) != checksum || !bundle_valid(bundle)) {
+
+        bundle_close(bundle);
+        return NULL;
+
+    }
+
+    return bundle;
+
+}
+
+void bundle_close(struct bundle *bundle)
+{
+
+    munmap((void *) bundle->map, bundle->size);
+    vfree(bundle);
+
+}
+
+/*
+    Returns the index of the location with the ID in the bundle, or -1
+    if the bundle does not have it.
+*/
+int bundle_find(const struct bundle *bundle, int id)
+{
+
+    int lo = 0;
+    int hi = bundle->nlocations;
+
+    while (lo < hi) {
+
+        int mid = lo + (hi - lo) / 2;
+        int midid = get_le16(index_entry(bundle, mid));
+
+        if (midid == id) {
+            return mid;
+        }
+
+        if (midid < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+
+    }
+
+    return -1;
+
+}
+
+/*
+    Decodes the vakat times (in minutes since 00:00) of the day of the
+    year (0 for January 1st) for the location (an index from bundle_find).
+
+    Returns 0 on success and -1 if the bundle does not cover the day.
+*/
+int bundle_day_times(const struct bundle *bundle, int loc, int yday, int *minutes)
+{
+
+    if (loc < 0 || loc >= bundle->nlocations || yday < 0 || yday >= bundle->ndays) {
+        return -1;
+    }
+
+    const unsigned char *data = bundle->map + get_le32(index_entry(bundle, loc) + 8);
+
+    int blocks = nblocks(bundle->ndays);
+    const unsigned char *bits = data + (size_t) blocks * PRAYER_TIME_NUM * 4;
+
+    int b = yday / BUNDLE_BLOCK;
+    int n = yday % BUNDLE_BLOCK;
+
+    for (int s = 0; s < PRAYER_TIME_NUM; s++) {
+
+        uint32_t block = get_le32(data + ((size_t) s * blocks + b) * 4);
+        int width = (block >> BLOCK_BASE_BITS) & ((1u << BLOCK_WIDTH_BITS) - 1);
+        uint32_t off = block >> (BLOCK_BASE_BITS + BLOCK_WIDTH_BITS);
+
+        int t = block & ((1u << BLOCK_BASE_BITS) - 1);
+
+        for (int k = 0; k < n && width > 0; k++, off += width) {
+            t += unzigzag(get_bits(bits, off, width));
+        }
+
+        minutes[s] = t;
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Decodes the whole year of the location at once, which streams
+    through the packed deltas once instead of restarting at each block.
+
+    minutes has to have room for bundle->ndays days. Returns 0 on
+    success and -1 if the location is not in the bundle.
+*/
+int bundle_year_times(const struct bundle *bundle, int loc, uint16_t (*minutes)[PRAYER_TIME_NUM])
+{
+
+    if (loc < 0 || loc >= bundle->nlocations) {
+        return -1;
+    }
+
+    const unsigned char *data = bundle->map + get_le32(index_entry(bundle, loc) + 8);
+
+    int blocks = nblocks(bundle->ndays);
+    const unsigned char *bits = data + (size_t) blocks * PRAYER_TIME_NUM * 4;
+
+    for (int s = 0; s < PRAYER_TIME_NUM; s++) {
+
+        for (int b = 0; b < blocks; b++) {
+
+            uint32_t block = get_le32(data + ((size_t) s * blocks + b) * 4);
+            int width = (block >> BLOCK_BASE_BITS) & ((1u << BLOCK_WIDTH_BITS) - 1);
+            uint32_t off = block >> (BLOCK_BASE_BITS + BLOCK_WIDTH_BITS);
+
+            int first = b * BUNDLE_BLOCK;
+            int last = (first + BUNDLE_BLOCK < bundle->ndays) ? first + BUNDLE_BLOCK : bundle->ndays;
+
+            int t = block & ((1u << BLOCK_BASE_BITS) - 1);
+            minutes[first][s] = t;
+
+            for (int d = first + 1; d < last; d++, off += width) {
+
+                if (width > 0) {
+                    t += unzigzag(get_bits(bits, off, width));
+                }
+
+                minutes[d][s] = t;
+
+            }
+
+        }
+
+    }
+
+    return 0;
+
+}
+
+static char *format_string(const char *fmt, ...)
+{
+
+    va_list ap;
+    va_start(ap, fmt);
+
+    char buf[128];
+    vsnprintf(buf, sizeof buf, fmt, ap);
+
+    va_end(ap);
+
+    char *str = vstrdup(buf);
+
+    if (str == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store vaktija data!\n");
+        vactija_error(errcode);
+
+    }
+
+    return str;
+
+}
+
+/*
+    Builds the vaktija for a day (month in range 1 - 12) of the bundle's
+    year for the location (an index from bundle_find), the same as if it
+    had been downloaded.
+
+    Returns NULL if the bundle does not cover the day.
+*/
+struct vaktija *bundle_day(const struct bundle *bundle, int loc, int month, int mday)
+{
+
+    struct tm date = { 0 };
+    date.tm_year = bundle->year - 1900;
+    date.tm_mon = month - 1;
+    date.tm_mday = mday;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+
+    if (month < 1 || month > 12 || mday < 1 || mday > days_in_month(bundle->year, month)) {
+        return NULL;
+    }
+
+    mktime(&date);
+
+    int minutes[PRAYER_TIME_NUM];
+
+    if (bundle_day_times(bundle, loc, date.tm_yday, minutes) != 0) {
+        return NULL;
+    }
+
+    const unsigned char *entry = index_entry(bundle, loc);
+    const unsigned char *hijri = bundle->map + BUNDLE_HEADER +
+        (size_t) bundle->nlocations * BUNDLE_INDEX_ENTRY + (size_t) date.tm_yday * BUNDLE_DATE_ENTRY;
+
+    struct vaktija *v = create_vaktija();
+
+    v->location = format_string("%.*s", get_le16(entry + 2),
+            (const char *) bundle->map + get_le32(entry + 4));
+
+    v->dates = vmalloc(sizeof *v->dates * DATUM_NUM);
+    v->prayers = vmalloc(sizeof *v->prayers * PRAYER_TIME_NUM);
+
+    if (v->dates == NULL || v->prayers == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store vaktija data!\n");
+        vactija_error(errcode);
+
+    }
+
+    if (hijri[1] >= 1 && hijri[1] <= 12) {
+        v->dates[0] = format_string("%d. %s %d", hijri[0], hijri_month_name(hijri[1]), get_le16(hijri + 2));
+    } else {
+        v->dates[0] = format_string("%s", ""); /* computed by ingest_vaktija */
+    }
+
+    v->dates[1] = format_string("%s, %d. %s %d", weekdays[date.tm_wday], mday, months[month - 1],
+            bundle->year);
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+        v->prayers[i] = format_string("%d:%02d", minutes[i] / 60, minutes[i] % 60);
+    }
+
+    v->year = bundle->year;
+    v->month = month;
+    v->day = mday;
+
+    ingest_vaktija(v, NULL);
+
+    return v;
+
+}
+
+/*
+    Parses a Hijri date the way the API writes it, e.g "18. redžeb 1443".
+
+    Returns 1 on success and 0 if it is not one.
+*/
+int parse_hijri(const char *str, struct bundle_hijri *res)
+{
+
+    struct hijri_date date;
+
+    if (!hijri_parse(str, &date) || date.day < 1) {
+        return 0;
+    }
+
+    res->day = date.day;
+    res->month = date.month;
+    res->year = date.year;
+
+    return 1;
+
+}
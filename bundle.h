@@ -0,0 +1,82 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vactija.h"
+
+/*
+    A bundle holds a whole year of vakat times for many locations in one
+    small file (about 1 KB per location), meant to be copied to machines
+    without network access. Everything is little endian:
+
+        header   "VKTB", u16 version, u16 locations, u16 year, u16 days,
+                 u32 checksum (FNV-1a of everything after the header)
+        index    per location (sorted by ID): u16 id, u16 name length,
+                 u32 name offset, u32 data offset, u32 data length
+        dates    per day: u8 hijri day, u8 hijri month, u16 hijri year
+        names    location names
+        data     per location: a table of u32 block entries (one per 32
+                 days for each of the 6 vakats), then the packed deltas
+
+    Each vakat of a location is one stream of minutes since 00:00. Every
+    32 days the stream starts a block with the absolute time, followed by
+    the zigzag encoded differences to the previous day, bit packed with
+    the width the largest of them needs. A block entry is the base time
+    (11 bits), the width (4 bits) and the bit offset of its deltas (17
+    bits). Any day can therefore be decoded by reading at most 31 deltas
+    from a known position, without touching the rest of the file.
+*/
+#define BUNDLE_MAGIC "VKTB"
+#define BUNDLE_VERSION 1
+#define BUNDLE_EXT "bundle"
+
+#define BUNDLE_BLOCK 32
+
+/*
+    A location's times (in minutes since 00:00) for every day of the
+    year, as given to bundle_write.
+*/
+struct bundle_location {
+
+    int id;
+    const char *name;
+    const uint16_t (*times)[PRAYER_TIME_NUM];
+
+};
+
+struct bundle_hijri {
+
+    uint8_t day;
+    uint8_t month; /* 1 - 12, or 0 if unknown */
+    uint16_t year;
+
+};
+
+struct bundle {
+
+    const unsigned char *map;
+    size_t size;
+
+    int year;
+    int ndays;
+    int nlocations;
+
+};
+
+int bundle_write(const char *path, int year, int ndays,
+        const struct bundle_location *locations, int nlocations,
+        const struct bundle_hijri *dates);
+
+struct bundle *bundle_open(const char *path);
+void bundle_close(struct bundle *bundle);
+
+int bundle_find(const struct bundle *bundle, int id);
+int bundle_day_times(const struct bundle *bundle, int loc, int yday, int *minutes);
+int bundle_year_times(const struct bundle *bundle, int loc, uint16_t (*minutes)[PRAYER_TIME_NUM]);
+struct vaktija *bundle_day(const struct bundle *bundle, int loc, int month, int mday);
+
+int parse_hijri(const char *str, struct bundle_hijri *res);
+
+#endif
@@ -0,0 +1,1080 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "vactija.h"
+#include "cachectl.h"
+#include "pack.h"
+#include "record.h"
+#include "bundle.h"
+#include "util/cachefile.h"
+#include "util/clocksource.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+/*
+    Temporary files older than this (in seconds) were left behind by a
+    write which never finished.
+*/
+#define STALE_TMP_AGE 3600
+
+enum cache_kind {
+
+    KIND_RECORD,      /* <key>.rec of a day */
+    KIND_DAY_JSON,    /* <key>.json of a day */
+    KIND_MONTH_JSON,  /* <key>.json of a month */
+    KIND_TMP,         /* unfinished write */
+    KIND_BUNDLE,
+    KIND_PACK,
+    KIND_OTHER,
+    KIND_COUNT
+
+};
+
+static const char *kind_names[KIND_COUNT] = {
+    "Day records", "Day JSON", "Month JSON", "Temporary files",
+    "Bundles", "Packs", "Other files"
+};
+
+struct cache_file {
+
+    char *name;
+    enum cache_kind kind;
+
+    char key[CACHE_KEY_MAX];
+    int date; /* yyyymmdd of the data, the last day for months */
+
+    long long size;
+    time_t mtime;
+
+    int valid;
+
+};
+
+struct cache_scan {
+
+    const char *dir;
+
+    struct cache_file *files;
+    size_t count;
+
+    char packpath[CACHE_PATH_MAX];
+    struct pack *pack;
+
+};
+
+struct parallel {
+
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+
+    void (*work)(void *ctx, size_t i);
+    void *ctx;
+
+};
+
+static void *parallel_worker(void *arg)
+{
+
+    struct parallel *p = arg;
+
+    while (1) {
+
+        pthread_mutex_lock(&p->lock);
+        size_t i = p->next++;
+        pthread_mutex_unlock(&p->lock);
+
+        if (i >= p->count) {
+            break;
+        }
+
+        p->work(p->ctx, i);
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Calls work(ctx, i) for every i below count, from up to workers
+    threads at once.
+*/
+static void parallel_for(size_t count, int workers, void (*work)(void *ctx, size_t i), void *ctx)
+{
+
+    struct parallel p = { count, 0, PTHREAD_MUTEX_INITIALIZER, work, ctx };
+
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    if ((size_t) workers > count) {
+        workers = (count > 0) ? count : 1;
+    }
+
+    pthread_t threads[workers];
+    int started = 0;
+
+    for (int i = 0; i < workers; i++) {
+
+        if (pthread_create(&threads[i], NULL, parallel_worker, &p) == 0) {
+            started++;
+        }
+
+    }
+
+    /* Without threads the work is still done, only slower */
+    if (started == 0) {
+        parallel_worker(&p);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&p.lock);
+
+}
+
+/*
+    Parses a day (<loc>-<yyyy>-<mm>-<dd>) or month (<loc>-<yyyy>-<mm>)
+    key, returning its date as yyyymmdd (the last day for a month), or 0
+    if key is neither.
+*/
+static int key_date(const char *key, int *month)
+{
+
+    char loc[16];
+    int year, mon, mday, n = 0;
+
+    *month = 0;
+
+    if (sscanf(key, "%15[0-9]-%4d-%2d-%2d%n", loc, &year, &mon, &mday, &n) == 4 && key[n] == '\0') {
+
+        if (mon < 1 || mon > 12 || mday < 1 || mday > 31) {
+            return 0;
+        }
+
+        return year * 10000 + mon * 100 + mday;
+
+    }
+
+    n = 0;
+
+    if (sscanf(key, "%15[0-9]-%4d-%2d%n", loc, &year, &mon, &n) == 3 && key[n] == '\0') {
+
+        if (mon < 1 || mon > 12) {
+            return 0;
+        }
+
+        *month = 1;
+        return year * 10000 + mon * 100 + 31;
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Works out what a cache file called name is from the name alone.
+*/
+static void classify_name(struct cache_file *f, const char *name)
+{
+
+    const char *ext = strrchr(name, '.');
+    size_t stem = (ext != NULL) ? (size_t) (ext - name) : strlen(name);
+    int year, n = 0, month;
+    long pid;
+
+    f->kind = KIND_OTHER;
+
+    if (ext == NULL) {
+        return;
+    }
+
+    ext++;
+
+    if (strcmp(ext, "tmp") == 0) {
+
+        /* Only <name>.<pid>.tmp of a name the cache has, as write_cache_data leaves them */
+        struct cache_file target = { 0 };
+        char base[CACHE_PATH_MAX];
+
+        snprintf(base, sizeof base, "%.*s", (int) stem, name);
+        char *dot = strrchr(base, '.');
+
+        if (dot != NULL && isdigit((unsigned char) dot[1]) &&
+            sscanf(dot, ".%ld%n", &pid, &n) == 1 && dot[n] == '\0') {
+
+            *dot = '\0';
+            classify_name(&target, base);
+
+            if (target.kind != KIND_OTHER && target.kind != KIND_TMP) {
+                f->kind = KIND_TMP;
+            }
+
+        }
+
+    } else if (strcmp(name, PACK_NAME) == 0) {
+
+        f->kind = KIND_PACK;
+
+    } else if (strcmp(ext, BUNDLE_EXT) == 0) {
+
+        if (sscanf(name, "vaktija-%4d.%n", &year, &n) == 1 && name + n == ext) {
+            f->kind = KIND_BUNDLE;
+        }
+
+    } else if (stem < PACK_KEY_MAX && (strcmp(ext, RECORD_EXT) == 0 || strcmp(ext, "json") == 0)) {
+
+        memcpy(f->key, name, stem);
+        f->key[stem] = '\0';
+        f->date = key_date(f->key, &month);
+
+        if (f->date == 0 || (month && strcmp(ext, "json") != 0)) {
+            return;
+        }
+
+        if (month) {
+            f->kind = KIND_MONTH_JSON;
+        } else {
+            f->kind = (strcmp(ext, RECORD_EXT) == 0) ? KIND_RECORD : KIND_DAY_JSON;
+        }
+
+    }
+
+}
+
+static void classify(struct cache_file *f)
+{
+
+    classify_name(f, f->name);
+
+}
+
+static void file_path(char *buf, const struct cache_scan *scan, const struct cache_file *f)
+{
+
+    snprintf(buf, CACHE_PATH_MAX, "%s/%s", scan->dir, f->name);
+
+}
+
+static void stat_file(void *ctx, size_t i)
+{
+
+    struct cache_scan *scan = ctx;
+    struct cache_file *f = &scan->files[i];
+
+    char path[CACHE_PATH_MAX];
+    file_path(path, scan, f);
+
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+
+        f->size = st.st_size;
+        f->mtime = st.st_mtime;
+
+    } else {
+
+        f->kind = KIND_OTHER;
+
+    }
+
+}
+
+/*
+    Lists the cache directory, stats every file in it and opens its
+    pack, if there is one.
+
+    Returns 0 on success and -1 if the directory can not be read.
+*/
+static int scan_cache(struct cache_scan *scan, const char *dir, int workers)
+{
+
+    memset(scan, 0, sizeof *scan);
+    scan->dir = dir;
+
+    if (cache_path(scan->packpath, sizeof scan->packpath, dir, "cache", "pack") < 0) {
+
+        printf("Cache directory path is too long!\n");
+        return -1;
+
+    }
+
+    DIR *d = opendir(dir);
+
+    if (d == NULL) {
+
+        printf("Could not open the cache directory %s: %s\n", dir, strerror(errno));
+        return -1;
+
+    }
+
+    size_t cap = 0;
+    struct dirent *ent;
+
+    while ((ent = readdir(d)) != NULL) {
+
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+
+        if (scan->count == cap) {
+
+            cap = (cap > 0) ? cap * 2 : 256;
+            struct cache_file *files = vrealloc(scan->files, sizeof *files * cap);
+
+            if (files == NULL) {
+
+                int errcode = errno;
+                printf("Could not allocate enough memory to scan the cache!\n");
+                vactija_error(errcode);
+
+            }
+
+            scan->files = files;
+
+        }
+
+        struct cache_file *f = &scan->files[scan->count++];
+        memset(f, 0, sizeof *f);
+
+        f->name = vstrdup(ent->d_name);
+        f->valid = 1;
+
+        if (f->name == NULL) {
+
+            int errcode = errno;
+            printf("Could not allocate enough memory to scan the cache!\n");
+            vactija_error(errcode);
+
+        }
+
+        classify(f);
+
+    }
+
+    closedir(d);
+
+    parallel_for(scan->count, workers, stat_file, scan);
+
+    scan->pack = pack_open(scan->packpath);
+
+    return 0;
+
+}
+
+static void free_scan(struct cache_scan *scan)
+{
+
+    for (size_t i = 0; i < scan->count; i++) {
+        vfree(scan->files[i].name);
+    }
+
+    vfree(scan->files);
+    pack_close(scan->pack);
+
+}
+
+static void remove_file(const struct cache_scan *scan, const struct cache_file *f)
+{
+
+    char path[CACHE_PATH_MAX];
+    file_path(path, scan, f);
+
+    if (unlink(path) != 0 && errno != ENOENT) {
+        printf("Could not remove %s: %s\n", path, strerror(errno));
+    }
+
+}
+
+/*
+    Reads a record or JSON file of a day, returning its contents (and
+    length in len) if they are valid, or NULL.
+*/
+static char *read_valid(const struct cache_scan *scan, const struct cache_file *f, size_t *len)
+{
+
+    char path[CACHE_PATH_MAX];
+    file_path(path, scan, f);
+
+    char *data = read_cache_data(path, len);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    int valid = 0;
+
+    if (f->kind == KIND_RECORD) {
+
+        struct vaktija *v = deserialize_record(data, *len);
+        valid = v != NULL;
+
+        if (v != NULL) {
+            delete_vaktija(v);
+        }
+
+    } else if (f->kind == KIND_DAY_JSON) {
+
+        valid = strlen(data) == *len && valid_vaktija(data);
+
+    }
+
+    if (!valid) {
+
+        vfree(data);
+        return NULL;
+
+    }
+
+    return data;
+
+}
+
+static void validate_file(void *ctx, size_t i)
+{
+
+    struct cache_scan *scan = ctx;
+    struct cache_file *f = &scan->files[i];
+
+    if (f->kind != KIND_RECORD && f->kind != KIND_DAY_JSON) {
+        return;
+    }
+
+    size_t len;
+    char *data = read_valid(scan, f, &len);
+
+    f->valid = data != NULL;
+    vfree(data);
+
+}
+
+static void format_size(char *buf, size_t len, long long size)
+{
+
+    if (size >= 1024 * 1024) {
+        snprintf(buf, len, "%.1f MB", size / (1024.0 * 1024.0));
+    } else if (size >= 1024) {
+        snprintf(buf, len, "%.1f KB", size / 1024.0);
+    } else {
+        snprintf(buf, len, "%lld B", size);
+    }
+
+}
+
+static void print_date(const char *label, int date)
+{
+
+    printf("%s%02d.%02d.%04d\n", label, date % 100, (date / 100) % 100, date / 10000);
+
+}
+
+/*
+    Runs the cache stats action: how many files of each kind the cache
+    directory holds and how much space they take, how many of the day
+    files are damaged, and which days are cached.
+*/
+int cache_stats(const char *dir, int workers)
+{
+
+    struct cache_scan scan;
+
+    if (scan_cache(&scan, dir, workers) != 0) {
+        return -1;
+    }
+
+    parallel_for(scan.count, workers, validate_file, &scan);
+
+    long long count[KIND_COUNT] = { 0 };
+    long long size[KIND_COUNT] = { 0 };
+    long long total = 0;
+    int invalid = 0;
+    int oldest = 0, newest = 0;
+
+    for (size_t i = 0; i < scan.count; i++) {
+
+        struct cache_file *f = &scan.files[i];
+
+        count[f->kind]++;
+        size[f->kind] += f->size;
+        total += f->size;
+        invalid += !f->valid;
+
+        if (f->kind == KIND_RECORD || f->kind == KIND_DAY_JSON) {
+
+            oldest = (oldest == 0 || f->date < oldest) ? f->date : oldest;
+            newest = (f->date > newest) ? f->date : newest;
+
+        }
+
+    }
+
+    printf("Cache directory: %s\n", dir);
+
+    char sizestr[32];
+
+    for (int k = 0; k < KIND_COUNT; k++) {
+
+        if (count[k] == 0) {
+            continue;
+        }
+
+        format_size(sizestr, sizeof sizestr, size[k]);
+        printf("%-16s %8lld %12s\n", kind_names[k], count[k], sizestr);
+
+    }
+
+    if (scan.pack != NULL) {
+
+        printf("%-16s %8u\n", "Packed days", scan.pack->count);
+
+        for (uint32_t i = 0; i < scan.pack->count; i++) {
+
+            int month;
+            int date = key_date(pack_key(scan.pack, i), &month);
+
+            if (date == 0 || month) {
+                continue;
+            }
+
+            oldest = (oldest == 0 || date < oldest) ? date : oldest;
+            newest = (date > newest) ? date : newest;
+
+        }
+
+    } else if (count[KIND_PACK] > 0) {
+
+        printf("The cache pack is damaged, run \"cache compact\" to rebuild it.\n");
+
+    }
+
+    format_size(sizestr, sizeof sizestr, total);
+    printf("%-16s %8zu %12s\n", "Total", scan.count, sizestr);
+
+    if (invalid > 0) {
+        printf("%d damaged day files (removed by \"cache compact\").\n", invalid);
+    }
+
+    if (oldest > 0) {
+
+        print_date("Oldest day: ", oldest);
+        print_date("Newest day: ", newest);
+
+    }
+
+    free_scan(&scan);
+
+    return 0;
+
+}
+
+struct compact_group {
+
+    size_t first;
+    size_t nfiles;
+
+    struct pack_entry entry;
+
+};
+
+struct compact {
+
+    struct cache_scan *scan;
+    struct compact_group *groups;
+
+};
+
+static int is_day_file(const struct cache_file *f)
+{
+
+    return f->kind == KIND_RECORD || f->kind == KIND_DAY_JSON;
+
+}
+
+static int compare_files(const void *a, const void *b)
+{
+
+    const struct cache_file *x = a;
+    const struct cache_file *y = b;
+
+    if (is_day_file(x) != is_day_file(y)) {
+        return is_day_file(y) - is_day_file(x);
+    }
+
+    int cmp = strcmp(x->key, y->key);
+
+    /* Records before JSON within a key */
+    return (cmp != 0) ? cmp : (int) x->kind - (int) y->kind;
+
+}
+
+static int compare_group_key(const void *key, const void *group)
+{
+
+    return strcmp(key, ((const struct compact_group *) group)->entry.key);
+
+}
+
+/*
+    Builds the pack entry of one day from its files. A valid record is
+    taken over as it is, otherwise one is made from the JSON. Whatever
+    the files lack is kept from the old pack.
+*/
+static void compact_group(void *ctx, size_t i)
+{
+
+    struct compact *c = ctx;
+    struct compact_group *g = &c->groups[i];
+    struct pack_entry *e = &g->entry;
+
+    for (size_t n = 0; n < g->nfiles; n++) {
+
+        struct cache_file *f = &c->scan->files[g->first + n];
+
+        size_t len;
+        char *data = read_valid(c->scan, f, &len);
+
+        f->valid = data != NULL;
+
+        if (data == NULL) {
+            continue;
+        }
+
+        if (f->kind == KIND_RECORD && e->record == NULL) {
+
+            e->record = data;
+            e->record_len = len;
+
+        } else if (f->kind == KIND_DAY_JSON && e->json == NULL) {
+
+            e->json = data;
+            e->json_len = len;
+
+        } else {
+
+            vfree(data);
+
+        }
+
+    }
+
+    const struct pack *old = c->scan->pack;
+    int idx = (old != NULL) ? pack_find(old, e->key) : -1;
+
+    if (e->record == NULL && idx >= 0) {
+        e->record = pack_record_data(old, idx, &e->record_len);
+    }
+
+    if (e->json == NULL && idx >= 0) {
+
+        e->json = pack_json(old, e->key);
+        e->json_len = (e->json != NULL) ? strlen(e->json) : 0;
+
+    }
+
+    if (e->record == NULL && e->json != NULL) {
+
+        struct vaktija *v = parse_data(e->json);
+        e->record = serialize_record(v, &e->record_len);
+        delete_vaktija(v);
+
+    }
+
+}
+
+static void free_entries(struct pack_entry *entries, size_t count)
+{
+
+    for (size_t i = 0; i < count; i++) {
+
+        vfree(entries[i].record);
+        vfree(entries[i].json);
+
+    }
+
+    vfree(entries);
+
+}
+
+/*
+    Runs the cache compact action: merges the record and JSON files of
+    every day in the cache directory (and the previous pack) into one
+    new pack, then removes the merged files. Damaged files are dropped,
+    month files are left alone.
+
+    Returns 0 on success.
+*/
+int cache_compact(const char *dir, int workers)
+{
+
+    struct cache_scan scan;
+
+    if (scan_cache(&scan, dir, workers) != 0) {
+        return -1;
+    }
+
+    /* Day files first, grouped by key */
+    qsort(scan.files, scan.count, sizeof *scan.files, compare_files);
+
+    size_t nfiles = 0;
+
+    while (nfiles < scan.count && is_day_file(&scan.files[nfiles])) {
+        nfiles++;
+    }
+
+    size_t oldcount = (scan.pack != NULL) ? scan.pack->count : 0;
+    struct compact_group *groups = vcalloc(nfiles + 1, sizeof *groups);
+    struct pack_entry *entries = vcalloc(nfiles + oldcount + 1, sizeof *entries);
+
+    if (groups == NULL || entries == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to compact the cache!\n");
+        vactija_error(errcode);
+
+    }
+
+    size_t ngroups = 0;
+
+    for (size_t i = 0; i < nfiles; i++) {
+
+        if (ngroups == 0 || strcmp(groups[ngroups - 1].entry.key, scan.files[i].key) != 0) {
+
+            groups[ngroups].first = i;
+            memcpy(groups[ngroups].entry.key, scan.files[i].key, PACK_KEY_MAX);
+            ngroups++;
+
+        }
+
+        groups[ngroups - 1].nfiles++;
+
+    }
+
+    struct compact c = { &scan, groups };
+    parallel_for(ngroups, workers, compact_group, &c);
+
+    size_t count = 0;
+    int dropped = 0;
+
+    for (size_t i = 0; i < ngroups; i++) {
+
+        if (groups[i].entry.record != NULL) {
+
+            entries[count++] = groups[i].entry;
+
+        } else {
+
+            vfree(groups[i].entry.json);
+            dropped++;
+
+        }
+
+    }
+
+    /* Days which are only in the old pack stay in it */
+    for (size_t i = 0; i < oldcount; i++) {
+
+        const char *key = pack_key(scan.pack, i);
+
+        if (bsearch(key, groups, ngroups, sizeof *groups, compare_group_key) != NULL) {
+            continue;
+        }
+
+        struct pack_entry *e = &entries[count];
+        snprintf(e->key, PACK_KEY_MAX, "%s", key);
+
+        e->record = pack_record_data(scan.pack, i, &e->record_len);
+        e->json = pack_json(scan.pack, key);
+        e->json_len = (e->json != NULL) ? strlen(e->json) : 0;
+
+        if (e->record != NULL) {
+
+            count++;
+
+        } else {
+
+            vfree(e->json);
+            e->json = NULL;
+            dropped++;
+
+        }
+
+    }
+
+    int invalid = 0;
+    int status = 0;
+
+    if (count == 0) {
+        unlink(scan.packpath);
+    }
+
+    if (count > 0 && pack_write(scan.packpath, entries, count) != 0) {
+
+        printf("Could not write the cache pack %s!\n", scan.packpath);
+        status = -1;
+
+    } else {
+
+        for (size_t i = 0; i < nfiles; i++) {
+
+            invalid += !scan.files[i].valid;
+            remove_file(&scan, &scan.files[i]);
+
+        }
+
+        printf("Packed %zu days (%zu files merged, %d damaged files and %d days dropped).\n",
+                count, nfiles, invalid, dropped);
+
+    }
+
+    free_entries(entries, count);
+    vfree(groups);
+    free_scan(&scan);
+
+    return status;
+
+}
+
+struct gc_item {
+
+    int date;
+    long long size;
+
+    long file;   /* index into the scan, or -1 for a pack entry */
+    int packidx;
+
+};
+
+static int compare_items(const void *a, const void *b)
+{
+
+    const struct gc_item *x = a;
+    const struct gc_item *y = b;
+
+    return (x->date > y->date) - (x->date < y->date);
+
+}
+
+/*
+    Returns the date (as yyyymmdd) days days before today.
+*/
+static int days_ago(int days)
+{
+
+    struct tm date;
+    clock_localtime(&date);
+
+    date.tm_mday -= days;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+    mktime(&date);
+
+    return (date.tm_year + 1900) * 10000 + (date.tm_mon + 1) * 100 + date.tm_mday;
+
+}
+
+/*
+    Writes the pack again without the entries marked in drop, or
+    removes it if none are left.
+*/
+static int rewrite_pack(struct cache_scan *scan, const char *drop)
+{
+
+    size_t npack = scan->pack->count;
+    struct pack_entry *entries = vcalloc(npack + 1, sizeof *entries);
+    size_t count = 0;
+
+    if (entries == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to clean the cache!\n");
+        vactija_error(errcode);
+
+    }
+
+    for (size_t i = 0; i < npack; i++) {
+
+        if (drop[i]) {
+            continue;
+        }
+
+        struct pack_entry *e = &entries[count++];
+        const char *key = pack_key(scan->pack, i);
+
+        snprintf(e->key, PACK_KEY_MAX, "%s", key);
+        e->record = pack_record_data(scan->pack, i, &e->record_len);
+        e->json = pack_json(scan->pack, key);
+        e->json_len = (e->json != NULL) ? strlen(e->json) : 0;
+
+    }
+
+    int status = 0;
+
+    if (count == 0) {
+
+        if (unlink(scan->packpath) != 0 && errno != ENOENT) {
+
+            printf("Could not remove %s: %s\n", scan->packpath, strerror(errno));
+            status = -1;
+
+        }
+
+    } else if (pack_write(scan->packpath, entries, count) != 0) {
+
+        printf("Could not write the cache pack %s!\n", scan->packpath);
+        status = -1;
+
+    }
+
+    free_entries(entries, count);
+
+    return status;
+
+}
+
+/*
+    Runs the cache gc action: removes cached days (files and pack
+    entries) older than max_age days and stale temporary files, then
+    the oldest days until the cache takes at most max_size bytes.
+    Either limit is off when it is 0. Bundles are never removed.
+
+    Returns 0 on success.
+*/
+int cache_gc(const char *dir, int workers, int max_age, long long max_size)
+{
+
+    struct cache_scan scan;
+
+    if (scan_cache(&scan, dir, workers) != 0) {
+        return -1;
+    }
+
+    size_t npack = (scan.pack != NULL) ? scan.pack->count : 0;
+    struct gc_item *items = vcalloc(scan.count + npack + 1, sizeof *items);
+    char *drop = vcalloc(npack + 1, 1);
+
+    if (items == NULL || drop == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to clean the cache!\n");
+        vactija_error(errcode);
+
+    }
+
+    time_t now = time(NULL);
+    int cutoff = (max_age > 0) ? days_ago(max_age) : 0;
+
+    long long total = 0;
+    long long freed = 0;
+    int removed = 0;
+    int packdrop = 0;
+    size_t nitems = 0;
+
+    for (size_t i = 0; i < scan.count; i++) {
+
+        struct cache_file *f = &scan.files[i];
+        int day = is_day_file(f) || f->kind == KIND_MONTH_JSON;
+
+        if ((f->kind == KIND_TMP && now - f->mtime > STALE_TMP_AGE) || (day && f->date < cutoff)) {
+
+            remove_file(&scan, f);
+            freed += f->size;
+            removed++;
+            continue;
+
+        }
+
+        if (day) {
+            items[nitems++] = (struct gc_item) { f->date, f->size, (long) i, -1 };
+        }
+
+        if (f->kind != KIND_PACK && f->kind != KIND_BUNDLE) {
+            total += f->size;
+        }
+
+    }
+
+    for (size_t i = 0; i < npack; i++) {
+
+        int month;
+        int date = key_date(pack_key(scan.pack, i), &month);
+        long long size = pack_entry_size(scan.pack, i);
+
+        if (date < cutoff) {
+
+            drop[i] = 1;
+            freed += size;
+            packdrop++;
+            continue;
+
+        }
+
+        items[nitems++] = (struct gc_item) { date, size, -1, (int) i };
+        total += size;
+
+    }
+
+    if (max_size > 0 && total > max_size) {
+
+        qsort(items, nitems, sizeof *items, compare_items);
+
+        for (size_t i = 0; i < nitems && total > max_size; i++) {
+
+            if (items[i].file >= 0) {
+
+                remove_file(&scan, &scan.files[items[i].file]);
+                removed++;
+
+            } else {
+
+                drop[items[i].packidx] = 1;
+                packdrop++;
+
+            }
+
+            total -= items[i].size;
+            freed += items[i].size;
+
+        }
+
+    }
+
+    int status = (packdrop > 0) ? rewrite_pack(&scan, drop) : 0;
+
+    char sizestr[32];
+    format_size(sizestr, sizeof sizestr, freed);
+    printf("Removed %d files and %d packed days, freeing %s.\n", removed, packdrop, sizestr);
+
+    format_size(sizestr, sizeof sizestr, total);
+    printf("The cache now takes %s.\n", sizestr);
+
+    vfree(drop);
+    vfree(items);
+    free_scan(&scan);
+
+    return status;
+
+}
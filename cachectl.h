@@ -0,0 +1,12 @@
+#ifndef CACHECTL_H
+#define CACHECTL_H
+
+/*
+    Maintenance of the keyed cache directory, behind "vactija cache".
+    workers is the number of threads the directory is scanned with.
+*/
+int cache_compact(const char *dir, int workers);
+int cache_stats(const char *dir, int workers);
+int cache_gc(const char *dir, int workers, int max_age, long long max_size);
+
+#endif
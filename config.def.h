@@ -1,11 +1,17 @@
 /*
     For location IDs, refer to the provided
-    locations.txt file.
+    locations.txt file. A name from it works too.
 
     77 is the ID for Sarajevo, which is set by default.
 */
 static const char *cfg_loc = "77";
 
+/*
+    -c picks the nearest location however far it is, but warns when it
+    is further away than this (in km), since its times will be off.
+*/
+static const double cfg_coords_max_km = 100;
+
 /*
     Whether vactija cache should be used.
 
@@ -26,6 +32,155 @@ static const int cfg_nocache = 0;
 static const int cfg_alwaysupdate = 0;
 
 /*
-    Default directory for the cache file.
+    Default cache directory, which holds one file per
+    location and date.
+*/
+static const char *cfg_cachedir = "/home/";
+
+/*
+    Address and port on which "vactija serve --http" listens
+    unless given as --http=[addr:]port.
+*/
+static const char *cfg_serve_addr = "0.0.0.0";
+static const int cfg_serve_port = 8080;
+
+/*
+    Number of threads the serve mode uses to fetch entries
+    missing from the cache from the upstream API.
+*/
+static const int cfg_serve_workers = 4;
+
+/*
+    Number of seconds the serve mode answers requests for an entry
+    from memory before looking at the cache directory (or upstream)
+    again, so that no response is held on to for good.
+*/
+static const int cfg_serve_ttl = 86400;
+
+/*
+    Number of seconds the serve mode answers requests for an entry
+    whose upstream fetch failed with an error, before trying again.
+*/
+static const int cfg_serve_negative_ttl = 5;
+
+/*
+    Number of days after today to fetch ahead of time, so that
+    the date changing at midnight never waits on the network.
+    0 disables prefetching.
+
+    A normal run after isha prefetches in the background, and
+    the serve mode does it for every location it has been asked
+    for, cfg_serve_prefetch_before seconds before midnight.
+*/
+static const int cfg_prefetch_days = 1;
+static const int cfg_serve_prefetch_before = 3600;
+
+/*
+    Number of seconds normal runs wait after a failed background
+    prefetch before trying again.
+*/
+static const int cfg_prefetch_backoff = 300;
+
+/*
+    How long downloads may take, in milliseconds. An attempt gives
+    up after cfg_fetch_timeout (or cfg_fetch_connect_timeout without
+    a connection), and failed attempts are retried cfg_fetch_retries
+    times, waiting cfg_fetch_backoff, then twice as long and so on.
+
+    If an attempt has no answer after cfg_fetch_hedge_after, a second
+    request is sent next to it and the first answer wins (0 disables
+    this). A download therefore takes at most about
+    (cfg_fetch_retries + 1) * cfg_fetch_timeout plus the backoffs.
+*/
+static const long cfg_fetch_connect_timeout = 3000;
+static const long cfg_fetch_timeout = 8000;
+static const int cfg_fetch_retries = 2;
+static const long cfg_fetch_backoff = 250;
+static const long cfg_fetch_hedge_after = 1500;
+
+/*
+    If a download fails, the most recent cached day up to this many
+    days back is used in its place (vakat times only move by a minute
+    or two a day), instead of failing.
+*/
+static const int cfg_fallback_days = 7;
+
+/*
+    Number of days of a date range (-y <date>..<date>) which are
+    downloaded at once when they are not in the cache yet.
+*/
+static const int cfg_range_workers = 8;
+
+/*
+    Threads scanning the cache directory in the cache actions.
+*/
+static const int cfg_cache_workers = 8;
+
+/*
+    Limits of cache gc: cached days older than cfg_cache_max_age days
+    are removed, then the oldest ones until the cache takes at most
+    cfg_cache_max_size bytes (bundles are not counted). 0 turns a
+    limit off.
+*/
+static const int cfg_cache_max_age = 400;
+static const long long cfg_cache_max_size = 50LL * 1024 * 1024;
+
+/*
+    Hooks file of the daemon action (see daemon.h for its format),
+    unless one is given as "vactija daemon <file>".
+
+    Hooks which are late by more than cfg_daemon_grace seconds (e.g
+    after the machine was suspended) are skipped rather than run, and
+    a day which could not be loaded is tried again after
+    cfg_daemon_retry seconds.
+*/
+static const char *cfg_hooks_file = "/etc/vactija/hooks";
+static const int cfg_daemon_grace = 60;
+static const int cfg_daemon_retry = 300;
+
+/*
+    Socket on which the daemon takes subscriptions from status bars and
+    the like ("vactija subscribe"). VACTIJA_SOCKET overrides it. NULL
+    puts it at $XDG_RUNTIME_DIR/vactija.sock, or in /tmp/vactija-<uid>
+    (a directory only the user may use) without XDG_RUNTIME_DIR.
+*/
+static const char *cfg_daemon_socket = NULL;
+
+/*
+    Address and port of a TCP listener on which the daemon answers
+    GET /metrics for Prometheus (0 for none). The daemon socket takes
+    the same request.
+*/
+static const char *cfg_daemon_metrics_addr = "127.0.0.1";
+static const int cfg_daemon_metrics_port = 0;
+
+/*
+    Number of vakats "vactija upcoming" prints if not told otherwise.
+*/
+static const int cfg_upcoming_count = 10;
+
+/*
+    Hijri months which did not start when the tabular calendar has it
+    (see util/hijri.h), as { year, month, shift in days }. Dates the API
+    gives are used as they are, these only matter for computed ones.
+*/
+static const struct hijri_adjustment cfg_hijri_adjustments[] = {
+    { 1443, 6, -1 } /* džumadel-uhra 1443 started on 3 January 2022 */
+};
+
+/*
+    Times derived from the vaktija, which are computed once when
+    the data is loaded and printed after the vakats. At most 8.
+
+    derive_night splits the night (maghrib until the next fajr)
+    in the ratio a/b. derive_offset is b seconds after vakat a
+    (0 - 5), e.g ishraq 15 minutes after sunrise. Other examples:
+
+    { "tahajjud", "Tahajjud starts on", derive_night, 1, 2 },
+    { "duha", "Duha starts on", derive_offset, 1, 20 * 60 },
 */
-static const char *cfg_cachedir = "/home/";
\ No newline at end of file
+static const struct derived_time cfg_derived[] = {
+    { "midnight", "Midnight is on", derive_night, 1, 2 },
+    { "third", "Last third of the night is on", derive_night, 2, 3 },
+    { "ishraq", "Ishraq is on", derive_offset, 1, 15 * 60 }
+};
@@ -0,0 +1,1545 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vactija.h"
+#include "daemon.h"
+#include "derived.h"
+#include "locations.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "util/timeheap.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+/* Offsets go at most this far from their time */
+#define HOOK_OFFSET_MAX (12 * 3600)
+
+/* Days kept loaded per location, enough for yesterday to the day after tomorrow */
+#define DAEMON_CACHED_DAYS 4
+
+#define DAEMON_MAX_EVENTS 64
+#define CLIENT_LINE_MAX 128
+#define MESSAGE_MAX 256
+
+/*
+    Heap ids of the events which are not hooks (those are the hook's
+    index): the minute tick, and the next boundary of each location.
+*/
+#define EVENT_TICK (-1)
+#define EVENT_LOCATION(loc) (-2 - (loc))
+#define EVENT_LOCATION_OF(id) (-2 - (id))
+
+struct cached_day {
+
+    long daynum;
+    struct vaktija *day;
+
+};
+
+static struct cached_day days[VAKTIJA_LOCATIONS][DAEMON_CACHED_DAYS];
+
+static const struct daemon_options *options;
+
+static struct hook *hooks = NULL;
+static int nhooks = 0;
+
+/* Time of the event each hook is waiting for, or 0 while it waits to retry loading */
+static time_t *due = NULL;
+
+static struct timeheap heap;
+static int timerfd = -1;
+
+/*
+    A connection on the daemon socket, subscribed to the events of a
+    location once it sent "subscribe <location> [ticks]".
+*/
+struct client {
+
+    int fd;
+    int dead;
+
+    int location; /* -1 until it subscribes */
+    int ticks;
+
+    size_t inlen;
+    char in[CLIENT_LINE_MAX];
+
+    struct client *next;
+
+};
+
+enum boundary {
+
+    BOUNDARY_NONE,
+    BOUNDARY_VAKAT,
+    BOUNDARY_DATE,
+    BOUNDARY_RETRY
+
+};
+
+/* What the state of a location is pushed as */
+struct location_state {
+
+    int current;
+    int next;
+    time_t next_at;
+    time_t midnight;
+
+};
+
+static struct client *clients = NULL;
+
+static int subscribers[VAKTIJA_LOCATIONS];
+static int tickers = 0;
+
+/* The event each location waits for, so that stale heap entries can be told apart */
+static time_t location_due[VAKTIJA_LOCATIONS];
+static enum boundary location_boundary[VAKTIJA_LOCATIONS];
+static time_t tick_due = 0;
+
+static int epfd = -1;
+static int listenfd = -1;
+static int metricsfd = -1;
+
+/* Markers used as epoll data for the non-client descriptors */
+static char timer_marker, signal_marker, listen_marker, metrics_marker;
+
+/*
+    Parses a line of a hooks file (see daemon.h) into hook.
+
+    Returns 0 on success, 1 if the line holds no hook (it is empty or a
+    comment) and -1 if it is not valid, with the reason in err.
+*/
+int hook_parse(const char *line, struct hook *hook, const char **err)
+{
+
+    char location[LOCATION_NAME_MAX];
+    char time[32];
+    char offset[16];
+    int n = 0;
+
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+
+    if (*line == '\0' || *line == '#') {
+        return 1;
+    }
+
+    if (sscanf(line, "%63s %31s %15s %n", location, time, offset, &n) != 3 || line[n] == '\0') {
+
+        *err = "expected <location> <time> <offset> <command>";
+        return -1;
+
+    }
+
+    if ((hook->location = location_parse(location)) < 0) {
+
+        *err = "unknown location";
+        return -1;
+
+    }
+
+    int vakat = vakat_find(time);
+    int derived = derived_find(time);
+
+    if (vakat < 0 && derived < 0) {
+
+        *err = "unknown time, expected a vakat or derived time";
+        return -1;
+
+    }
+
+    hook->time = (vakat >= 0) ? vakat : PRAYER_TIME_NUM + derived;
+
+    char *end;
+    long value = strtol(offset, &end, 10);
+    long unit = (*end == 's') ? 1 : (*end == 'h') ? 3600 : 60;
+
+    if (*end == 's' || *end == 'm' || *end == 'h') {
+        end++;
+    }
+
+    if ((offset[0] != '+' && offset[0] != '-') || end == offset + 1 || *end != '\0' ||
+        labs(value) > HOOK_OFFSET_MAX / unit) {
+
+        *err = "offset has to be [+-]N[s|m|h], at most 12 hours";
+        return -1;
+
+    }
+
+    hook->offset = (int) (value * unit);
+
+    /* The command goes as it is, without the line break */
+    size_t len = strcspn(line + n, "\r\n");
+
+    if ((hook->command = vstrndup(line + n, len)) == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the hooks!\n");
+        vactija_error(errcode);
+
+    }
+
+    return 0;
+
+}
+
+void hooks_free(struct hook *hooks, int count)
+{
+
+    for (int i = 0; i < count; i++) {
+        vfree(hooks[i].command);
+    }
+
+    vfree(hooks);
+
+}
+
+/*
+    Loads the hooks file at path, storing the number of hooks in count.
+
+    Returns NULL (after printing what is wrong) if it can not be read
+    or any line of it is not valid.
+*/
+struct hook *hooks_load(const char *path, int *count)
+{
+
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+
+        printf("Could not open the hooks file %s: %s\n", path, strerror(errno));
+        return NULL;
+
+    }
+
+    /* Allocated even for no hooks, as NULL is for errors */
+    int cap = 16;
+    struct hook *list = vmalloc(sizeof *list * cap);
+    *count = 0;
+
+    if (list == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the hooks!\n");
+        vactija_error(errcode);
+
+    }
+
+    char line[HOOK_LINE_MAX];
+    int lineno = 0;
+
+    while (fgets(line, sizeof line, fp) != NULL) {
+
+        lineno++;
+
+        if (*count == cap) {
+
+            cap *= 2;
+            struct hook *grown = vrealloc(list, sizeof *grown * cap);
+
+            if (grown == NULL) {
+
+                int errcode = errno;
+                printf("Could not allocate enough memory for the hooks!\n");
+                vactija_error(errcode);
+
+            }
+
+            list = grown;
+
+        }
+
+        const char *err = NULL;
+        int res = hook_parse(line, &list[*count], &err);
+
+        if (res < 0) {
+
+            printf("%s:%d: %s\n", path, lineno, err);
+
+            hooks_free(list, *count);
+            fclose(fp);
+
+            return NULL;
+
+        }
+
+        if (res == 0) {
+            (*count)++;
+        }
+
+    }
+
+    fclose(fp);
+
+    return list;
+
+}
+
+/*
+    Day number of the date (days since 1970-01-01), to key loaded days.
+*/
+static long day_number(const struct tm *date)
+{
+
+    long y = date->tm_year + 1900;
+    long m = date->tm_mon + 1;
+
+    y -= m <= 2;
+
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + date->tm_mday - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+
+}
+
+/*
+    Returns the vaktija of the location for the date, loading it only
+    if it is not loaded yet, or NULL if it can not be loaded.
+*/
+static struct vaktija *get_day(int location, struct tm date, daemon_load_fn load)
+{
+
+    long daynum = day_number(&date);
+    struct cached_day *slot = &days[location][daynum % DAEMON_CACHED_DAYS];
+
+    if (slot->day != NULL && slot->daynum == daynum) {
+
+        metric_add(METRIC_CACHE_HITS, 1);
+        return slot->day;
+
+    }
+
+    metric_add(METRIC_CACHE_MISSES, 1);
+    struct vaktija *v = load(location, date);
+
+    if (v == NULL) {
+        return NULL;
+    }
+
+    if (slot->day != NULL) {
+        delete_vaktija(slot->day);
+    }
+
+    slot->day = v;
+    slot->daynum = daynum;
+
+    return v;
+
+}
+
+/*
+    Returns when the hook is due on the day of the vaktija.
+*/
+static time_t hook_at(const struct hook *hook, const struct vaktija *vaktija)
+{
+
+    int secs = (hook->time < PRAYER_TIME_NUM) ?
+        vaktija->times[hook->time] : vaktija->derived[hook->time - PRAYER_TIME_NUM];
+
+    /* Derived times past midnight are normalised into the next day by mktime */
+    struct tm tm = { 0 };
+    tm.tm_year = vaktija->year - 1900;
+    tm.tm_mon = vaktija->month - 1;
+    tm.tm_mday = vaktija->day;
+    tm.tm_hour = secs / 3600;
+    tm.tm_min = (secs / 60) % 60;
+    tm.tm_sec = secs % 60;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm) + hook->offset;
+
+}
+
+/*
+    Returns the first time after after that the hook is due, or -1 if
+    a day it needs can not be loaded.
+
+    Yesterday is looked at too, since derived times and offsets can
+    move a day's event past midnight.
+*/
+time_t hook_next(const struct hook *hook, time_t after, daemon_load_fn load)
+{
+
+    struct tm date;
+    localtime_r(&after, &date);
+
+    for (int d = -1; d <= 2; d++) {
+
+        struct tm day = date;
+        day.tm_mday += d;
+        day.tm_hour = 12;
+        day.tm_min = 0;
+        day.tm_sec = 0;
+        day.tm_isdst = -1;
+        mktime(&day);
+
+        struct vaktija *v = get_day(hook->location, day, load);
+
+        if (v == NULL) {
+
+            /* Only matters for a few hooks, which then wait for today */
+            if (d < 0) {
+                continue;
+            }
+
+            return -1;
+
+        }
+
+        time_t at = hook_at(hook, v);
+
+        if (at > after) {
+            return at;
+        }
+
+    }
+
+    return -1;
+
+}
+
+static void log_time(void)
+{
+
+    char stamp[16];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof stamp, "%H:%M:%S", &tm);
+
+    printf("[%s] ", stamp);
+
+}
+
+static const char *time_name(int time)
+{
+
+    return (time < PRAYER_TIME_NUM) ? vakat_name(time) : derived_get(time - PRAYER_TIME_NUM)->name;
+
+}
+
+/*
+    Puts the next event of hook i after after into the heap, or a retry
+    if its day can not be loaded right now.
+*/
+static void schedule(int i, time_t after)
+{
+
+    time_t at = hook_next(&hooks[i], after, options->load);
+
+    if (at < 0) {
+
+        log_time();
+        printf("Could not load the vaktija of %s, trying again in %d seconds\n",
+                location_name(hooks[i].location), options->retry);
+
+        due[i] = 0;
+        timeheap_push(&heap, time(NULL) + options->retry, i);
+
+        return;
+
+    }
+
+    due[i] = at;
+    timeheap_push(&heap, at, i);
+
+}
+
+/*
+    Works out which vakat it is at now in the location and when the
+    next one comes. Returns -1 if the days for that are not available.
+*/
+static int location_state(int loc, time_t now, struct location_state *st)
+{
+
+    struct tm date;
+    localtime_r(&now, &date);
+
+    struct timeline tl;
+    timeline_init(&tl);
+
+    for (int d = -1; d <= 1; d++) {
+
+        struct tm day = date;
+        day.tm_mday += d;
+        day.tm_hour = 12;
+        day.tm_min = 0;
+        day.tm_sec = 0;
+        day.tm_isdst = -1;
+        mktime(&day);
+
+        struct vaktija *v = get_day(loc, day, options->load);
+
+        /* Without yesterday it is isha until fajr anyway */
+        if (v == NULL && d < 0) {
+            continue;
+        }
+
+        if (v == NULL || timeline_add_day(&tl, v) != 0) {
+            return -1;
+        }
+
+    }
+
+    int cur = timeline_current(&tl, now);
+    int next = timeline_next(&tl, now);
+
+    if (next < 0) {
+        return -1;
+    }
+
+    st->current = (cur >= 0) ? timeline_vakat(&tl, cur) : PRAYER_TIME_NUM - 1;
+    st->next = timeline_vakat(&tl, next);
+    st->next_at = tl.times[next];
+
+    date.tm_mday += 1;
+    date.tm_hour = 0;
+    date.tm_min = 0;
+    date.tm_sec = 0;
+    date.tm_isdst = -1;
+    st->midnight = mktime(&date);
+
+    return 0;
+
+}
+
+/*
+    Writes the message pushed to subscribers, one line of the form
+
+        <event> location=<id> date=<yyyy-mm-dd> current=<vakat>
+            next=<vakat> at=<HH:MM> left=<H:MM>
+
+    where event is hello, vakat, date or tick.
+*/
+static int format_message(char *buf, const char *event, int loc, const struct location_state *st, time_t now)
+{
+
+    struct tm today, at;
+    localtime_r(&now, &today);
+    localtime_r(&st->next_at, &at);
+
+    long left = (long) (st->next_at - now + 59) / 60;
+
+    return snprintf(buf, MESSAGE_MAX, "%s location=%d date=%04d-%02d-%02d current=%s next=%s at=%02d:%02d left=%ld:%02ld\n",
+            event, loc, today.tm_year + 1900, today.tm_mon + 1, today.tm_mday,
+            vakat_name(st->current), vakat_name(st->next), at.tm_hour, at.tm_min, left / 60, left % 60);
+
+}
+
+static void close_client(struct client *c)
+{
+
+    if (c->dead) {
+        return;
+    }
+
+    if (c->location >= 0) {
+
+        subscribers[c->location]--;
+        metric_add(METRIC_SUBSCRIPTIONS, -1);
+
+    }
+
+    if (c->ticks) {
+        tickers--;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    c->dead = 1;
+
+}
+
+/*
+    Frees the clients closed since the last time, which can not be done
+    while the list is being walked.
+*/
+static void sweep_clients(void)
+{
+
+    struct client **link = &clients;
+
+    while (*link != NULL) {
+
+        struct client *c = *link;
+
+        if (c->dead) {
+
+            *link = c->next;
+            vfree(c);
+
+        } else {
+
+            link = &c->next;
+
+        }
+
+    }
+
+}
+
+/*
+    Sends a message to the client. One that can not take it right away
+    is too slow or gone and is dropped, rather than buffered for.
+*/
+static void send_client(struct client *c, const char *msg, int len)
+{
+
+    if (send(c->fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+        close_client(c);
+    }
+
+}
+
+static void reply(struct client *c, const char *msg)
+{
+
+    send_client(c, msg, strlen(msg));
+
+}
+
+/*
+    Puts the next boundary of the location (its next vakat, or midnight
+    if that comes first) into the heap, if anyone is subscribed to it.
+*/
+static void schedule_location(int loc, time_t now)
+{
+
+    location_due[loc] = 0;
+    location_boundary[loc] = BOUNDARY_NONE;
+
+    if (subscribers[loc] == 0) {
+        return;
+    }
+
+    struct location_state st;
+    time_t at;
+
+    if (location_state(loc, now, &st) != 0) {
+
+        at = now + options->retry;
+        location_boundary[loc] = BOUNDARY_RETRY;
+
+    } else if (st.midnight < st.next_at) {
+
+        at = st.midnight;
+        location_boundary[loc] = BOUNDARY_DATE;
+
+    } else {
+
+        at = st.next_at;
+        location_boundary[loc] = BOUNDARY_VAKAT;
+
+    }
+
+    location_due[loc] = at;
+    timeheap_push(&heap, at, EVENT_LOCATION(loc));
+
+}
+
+static void schedule_tick(time_t now)
+{
+
+    tick_due = 0;
+
+    if (tickers == 0) {
+        return;
+    }
+
+    tick_due = (now / 60 + 1) * 60;
+    timeheap_push(&heap, tick_due, EVENT_TICK);
+
+}
+
+/*
+    Pushes the state of the location to every client subscribed to it
+    (only those with ticks on, for a tick).
+*/
+static void fan_out(const char *event, int loc, time_t now)
+{
+
+    struct location_state st;
+
+    if (location_state(loc, now, &st) != 0) {
+        return;
+    }
+
+    char msg[MESSAGE_MAX];
+    int len = format_message(msg, event, loc, &st, now);
+
+    for (struct client *c = clients; c != NULL; c = c->next) {
+
+        if (!c->dead && c->location == loc && (c->ticks || strcmp(event, "tick") != 0)) {
+            send_client(c, msg, len);
+        }
+
+    }
+
+}
+
+static void schedule_all(void)
+{
+
+    time_t now = time(NULL);
+
+    timeheap_clear(&heap);
+
+    for (int i = 0; i < nhooks; i++) {
+        schedule(i, now);
+    }
+
+    for (int loc = 0; loc < VAKTIJA_LOCATIONS; loc++) {
+        schedule_location(loc, now);
+    }
+
+    schedule_tick(now);
+
+}
+
+/*
+    Reads the hooks file again. If it is not valid, the hooks which
+    were there before stay.
+*/
+static int load_hooks(void)
+{
+
+    int count = 0;
+    struct hook *loaded = NULL;
+
+    if (options->hooks != NULL && (loaded = hooks_load(options->hooks, &count)) == NULL) {
+        return -1;
+    }
+
+    time_t *grown = vrealloc(due, sizeof *grown * (count > 0 ? count : 1));
+
+    if (grown == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the hooks!\n");
+        vactija_error(errcode);
+
+    }
+
+    hooks_free(hooks, nhooks);
+
+    hooks = loaded;
+    nhooks = count;
+    due = grown;
+
+    schedule_all();
+
+    if (options->hooks != NULL) {
+
+        log_time();
+        printf("Loaded %d hook(s) from %s\n", nhooks, options->hooks);
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Starts the command of hook i in the background, with the event in
+    its environment (VACTIJA_LOCATION, VACTIJA_TIME and VACTIJA_AT).
+*/
+static void run_hook(int i, time_t at)
+{
+
+    const struct hook *hook = &hooks[i];
+
+    char atstr[8];
+    struct tm tm;
+    localtime_r(&at, &tm);
+    strftime(atstr, sizeof atstr, "%H:%M", &tm);
+
+    log_time();
+    printf("%s %s %+ds: %s\n", location_name(hook->location), time_name(hook->time),
+            hook->offset, hook->command);
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+
+        perror("fork");
+        return;
+
+    }
+
+    if (pid > 0) {
+
+        metric_add(METRIC_HOOKS_RUN, 1);
+        return;
+
+    }
+
+    /* The daemon blocks these for its signalfd, the command should not */
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    setenv("VACTIJA_LOCATION", location_name(hook->location), 1);
+    setenv("VACTIJA_TIME", time_name(hook->time), 1);
+    setenv("VACTIJA_AT", atstr, 1);
+
+    execl("/bin/sh", "sh", "-c", hook->command, (char *) NULL);
+    _exit(127);
+
+}
+
+/*
+    Runs every hook due by now and schedules its next event, and pushes
+    the boundaries and ticks due to the subscribers. Hooks later than
+    the grace period (after a suspend, say) are skipped.
+*/
+static void run_due(void)
+{
+
+    time_t now = time(NULL);
+    struct timeheap_entry e;
+
+    while (timeheap_peek(&heap, &e) == 0 && e.at <= now) {
+
+        timeheap_pop(&heap, &e);
+
+        if (e.id == EVENT_TICK) {
+
+            if (e.at == tick_due) {
+
+                for (int loc = 0; loc < VAKTIJA_LOCATIONS; loc++) {
+
+                    if (subscribers[loc] > 0) {
+                        fan_out("tick", loc, now);
+                    }
+
+                }
+
+                schedule_tick(now);
+
+            }
+
+            continue;
+
+        }
+
+        if (e.id < 0) {
+
+            int loc = EVENT_LOCATION_OF(e.id);
+
+            /* Entries left over from an earlier schedule are skipped */
+            if (e.at != location_due[loc]) {
+                continue;
+            }
+
+            if (location_boundary[loc] == BOUNDARY_VAKAT) {
+                fan_out("vakat", loc, now);
+            } else if (location_boundary[loc] == BOUNDARY_DATE) {
+                fan_out("date", loc, now);
+            }
+
+            schedule_location(loc, now);
+            continue;
+
+        }
+
+        if (due[e.id] == 0) {
+
+            schedule(e.id, now);
+            continue;
+
+        }
+
+        if (now - e.at <= options->grace) {
+
+            run_hook(e.id, e.at);
+
+        } else {
+
+            log_time();
+            printf("Skipped %s %s, %ld seconds late\n", location_name(hooks[e.id].location),
+                    time_name(hooks[e.id].time), (long) (now - e.at));
+
+        }
+
+        schedule(e.id, e.at);
+
+    }
+
+}
+
+/*
+    Sets the timer to the earliest event, the only one the daemon
+    wakes up for.
+*/
+static void arm_timer(void)
+{
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof its);
+
+    struct timeheap_entry e;
+
+    if (timeheap_peek(&heap, &e) == 0) {
+
+        /* An event in the past still has to fire, and 0 would disarm the timer */
+        its.it_value.tv_sec = (e.at > 0) ? e.at : 1;
+
+    }
+
+    /* Cancelled when the clock is set, so the events are worked out again */
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) != 0) {
+        perror("timerfd_settime");
+    }
+
+}
+
+static void reap_children(void)
+{
+
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+
+        if ((WIFEXITED(status) && WEXITSTATUS(status) != 0) || WIFSIGNALED(status)) {
+            metric_add(METRIC_HOOKS_FAILED, 1);
+        }
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+
+            log_time();
+            printf("Hook (pid %d) exited with status %d\n", (int) pid, WEXITSTATUS(status));
+
+        } else if (WIFSIGNALED(status)) {
+
+            log_time();
+            printf("Hook (pid %d) was killed by signal %d\n", (int) pid, WTERMSIG(status));
+
+        }
+
+    }
+
+}
+
+/*
+    Answers an HTTP request (of which only the request line is looked
+    at) with the metrics, or 404 for anything but /metrics, and closes
+    the connection.
+*/
+static void send_metrics(struct client *c, const char *request)
+{
+
+    char path[16] = "";
+    sscanf(request, "GET %15s", path);
+
+    if (strcmp(path, "/metrics") != 0) {
+
+        reply(c, "HTTP/1.1 404 Not Found\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot Found\n");
+        close_client(c);
+
+        return;
+
+    }
+
+    char *text = metrics_render();
+    size_t textlen = strlen(text);
+
+    char head[160];
+    int headlen = snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %zu\r\nConnection: close\r\n\r\n", textlen);
+
+    char *msg = vmalloc(headlen + textlen);
+
+    if (msg != NULL) {
+
+        memcpy(msg, head, headlen);
+        memcpy(msg + headlen, text, textlen);
+        send_client(c, msg, headlen + textlen);
+
+    }
+
+    vfree(msg);
+    vfree(text);
+
+    close_client(c);
+
+}
+
+/*
+    Handles a line from a client. The only command is
+
+        subscribe <location> [ticks]
+
+    which is answered with a hello message of the location's state,
+    after which the client gets a message at every vakat and date
+    change (and every minute with ticks). Subscribing again moves the
+    subscription. A line starting with GET is taken as a scrape of the
+    metrics (see send_metrics).
+*/
+static void client_command(struct client *c, char *line)
+{
+
+    if (strncmp(line, "GET ", 4) == 0) {
+
+        send_metrics(c, line);
+        return;
+
+    }
+
+    char location[LOCATION_NAME_MAX];
+    char ticks[8] = "";
+    int n = sscanf(line, "subscribe %63s %7s", location, ticks);
+    int loc = (n >= 1) ? location_parse(location) : -1;
+
+    if (n < 1 || (n == 2 && strcmp(ticks, "ticks") != 0)) {
+
+        reply(c, "error expected: subscribe <location> [ticks]\n");
+        return;
+
+    }
+
+    if (loc < 0) {
+
+        reply(c, "error unknown location\n");
+        return;
+
+    }
+
+    if (c->location >= 0) {
+        subscribers[c->location]--;
+    } else {
+        metric_add(METRIC_SUBSCRIPTIONS, 1);
+    }
+
+    tickers += (n == 2) - c->ticks;
+
+    c->location = loc;
+    c->ticks = n == 2;
+
+    time_t now = time(NULL);
+
+    if (subscribers[loc]++ == 0) {
+        schedule_location(loc, now);
+    }
+
+    if (c->ticks && tick_due == 0) {
+        schedule_tick(now);
+    }
+
+    struct location_state st;
+
+    if (location_state(loc, now, &st) != 0) {
+
+        reply(c, "error no vaktija for the location yet\n");
+        return;
+
+    }
+
+    char msg[MESSAGE_MAX];
+    send_client(c, msg, format_message(msg, "hello", loc, &st, now));
+
+}
+
+static void client_read(struct client *c)
+{
+
+    for (;;) {
+
+        ssize_t n = recv(c->fd, c->in + c->inlen, sizeof c->in - c->inlen - 1, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        if (n <= 0) {
+
+            close_client(c);
+            return;
+
+        }
+
+        c->inlen += n;
+        c->in[c->inlen] = '\0';
+
+        char *line = c->in;
+        char *end;
+
+        while (!c->dead && (end = strchr(line, '\n')) != NULL) {
+
+            *end = '\0';
+            client_command(c, line);
+            line = end + 1;
+
+        }
+
+        if (c->dead) {
+            return;
+        }
+
+        c->inlen -= line - c->in;
+        memmove(c->in, line, c->inlen);
+
+        if (c->inlen == sizeof c->in - 1) {
+
+            close_client(c);
+            return;
+
+        }
+
+    }
+
+}
+
+static void accept_clients(int listener)
+{
+
+    for (;;) {
+
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept4");
+            }
+
+            return;
+
+        }
+
+        struct client *c = vcalloc(1, sizeof *c);
+
+        if (c == NULL) {
+
+            close(fd);
+            continue;
+
+        }
+
+        c->fd = fd;
+        c->location = -1;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+
+            close(fd);
+            vfree(c);
+            continue;
+
+        }
+
+        c->next = clients;
+        clients = c;
+
+    }
+
+}
+
+/*
+    Opens the daemon socket at path, taking over the path from a daemon
+    which did not clean up after itself.
+*/
+/*
+    Makes way for the socket at path. Only a stale socket of our own (one
+    nobody answers on any more) is removed: anything else there, or a
+    daemon which still answers, means we are not the one to listen on it.
+
+    Returns 0 if the path is free to bind, -1 otherwise.
+*/
+static int clear_socket(const struct sockaddr_un *addr)
+{
+
+    const char *path = addr->sun_path;
+    struct stat st;
+
+    if (lstat(path, &st) != 0) {
+
+        if (errno == ENOENT) {
+            return 0;
+        }
+
+        printf("Could not check %s: %s\n", path, strerror(errno));
+        return -1;
+
+    }
+
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+
+        printf("%s is not a socket of ours, not replacing it!\n", path);
+        return -1;
+
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+
+        perror("socket");
+        return -1;
+
+    }
+
+    int live = connect(fd, (const struct sockaddr *) addr, sizeof *addr) == 0;
+    int refused = !live && errno == ECONNREFUSED;
+    close(fd);
+
+    if (live) {
+
+        printf("Another daemon is already listening on %s!\n", path);
+        return -1;
+
+    }
+
+    if (!refused) {
+
+        printf("Could not check %s: %s\n", path, strerror(errno));
+        return -1;
+
+    }
+
+    if (unlink(path) != 0 && errno != ENOENT) {
+
+        printf("Could not remove the stale socket %s: %s\n", path, strerror(errno));
+        return -1;
+
+    }
+
+    return 0;
+
+}
+
+static int open_socket(const char *path)
+{
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+
+        printf("Socket path is too long: %s\n", path);
+        return -1;
+
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+
+        perror("socket");
+        return -1;
+
+    }
+
+    if (clear_socket(&addr) != 0) {
+
+        close(fd);
+        return -1;
+
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0) {
+
+        printf("Could not listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+
+        return -1;
+
+    }
+
+    return fd;
+
+}
+
+/*
+    Opens the TCP listener for metric scrapes on addr:port. It takes the
+    same lines as the daemon socket, but is there for GET /metrics.
+*/
+static int open_tcp(const char *addr, int port)
+{
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+
+        printf("Invalid metrics address %s\n", addr);
+        return -1;
+
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+
+        perror("socket");
+        return -1;
+
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    if (bind(fd, (struct sockaddr *) &sa, sizeof sa) != 0 || listen(fd, SOMAXCONN) != 0) {
+
+        printf("Could not listen on %s:%d: %s\n", addr, port, strerror(errno));
+        close(fd);
+
+        return -1;
+
+    }
+
+    return fd;
+
+}
+
+/*
+    Runs the hooks of the hooks file at their times and pushes the
+    state of locations to the clients subscribed on the daemon socket.
+
+    The next event of every hook, location boundary and the minute tick
+    (while anyone wants it) are kept in a min-heap, and a single
+    absolute timer (timerfd) wakes the daemon for the earliest of them,
+    so nothing runs between events. Commands are forked off and reaped
+    through a signalfd, which also takes SIGHUP (read the hooks file
+    again) and SIGTERM/SIGINT. All of it is one epoll loop.
+
+    Returns 0 after SIGTERM or SIGINT, and 1 if the daemon could not
+    start.
+*/
+int run_daemon(const struct daemon_options *opts)
+{
+
+    options = opts;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    timeheap_init(&heap);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+
+        perror("sigprocmask");
+        return 1;
+
+    }
+
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (sigfd < 0 || timerfd < 0 || epfd < 0) {
+
+        perror("Could not set up the daemon");
+        return 1;
+
+    }
+
+    if (opts->socket != NULL && (listenfd = open_socket(opts->socket)) < 0) {
+        return 1;
+    }
+
+    if (opts->metrics_port > 0 && (metricsfd = open_tcp(opts->metrics_addr, opts->metrics_port)) < 0) {
+        return 1;
+    }
+
+    if (load_hooks() != 0) {
+        return 1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &timer_marker;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &signal_marker;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+
+    if (listenfd >= 0) {
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &listen_marker;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+        log_time();
+        printf("Listening for subscriptions on %s\n", opts->socket);
+
+    }
+
+    if (metricsfd >= 0) {
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &metrics_marker;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, metricsfd, &ev);
+
+        log_time();
+        printf("Serving /metrics on %s:%d\n", opts->metrics_addr, opts->metrics_port);
+
+    }
+
+    struct epoll_event events[DAEMON_MAX_EVENTS];
+    int running = 1;
+
+    while (running) {
+
+        arm_timer();
+
+        int n = epoll_wait(epfd, events, DAEMON_MAX_EVENTS, -1);
+
+        if (n < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            int errcode = errno;
+            printf("Event loop failed!\n");
+            vactija_error(errcode);
+
+        }
+
+        for (int i = 0; i < n; i++) {
+
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &timer_marker) {
+
+                uint64_t expirations;
+
+                if (read(timerfd, &expirations, sizeof expirations) < 0 && errno == ECANCELED) {
+
+                    log_time();
+                    printf("The clock was set, working out the events again\n");
+
+                    schedule_all();
+
+                }
+
+                run_due();
+
+            } else if (ptr == &listen_marker) {
+
+                accept_clients(listenfd);
+
+            } else if (ptr == &metrics_marker) {
+
+                accept_clients(metricsfd);
+
+            } else if (ptr == &signal_marker) {
+
+                struct signalfd_siginfo info;
+
+                while (read(sigfd, &info, sizeof info) == sizeof info) {
+
+                    if (info.ssi_signo == SIGCHLD) {
+                        reap_children();
+                    } else if (info.ssi_signo == SIGHUP) {
+                        load_hooks();
+                    } else {
+                        running = 0;
+                    }
+
+                }
+
+            } else {
+
+                struct client *c = ptr;
+
+                if (!c->dead && (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN)) {
+                    close_client(c);
+                } else if (!c->dead) {
+                    client_read(c);
+                }
+
+            }
+
+        }
+
+        sweep_clients();
+
+    }
+
+    log_time();
+    printf("Stopping\n");
+
+    for (struct client *c = clients; c != NULL; c = c->next) {
+        close_client(c);
+    }
+
+    sweep_clients();
+
+    if (listenfd >= 0) {
+
+        close(listenfd);
+        unlink(opts->socket);
+
+    }
+
+    if (metricsfd >= 0) {
+        close(metricsfd);
+    }
+
+    hooks_free(hooks, nhooks);
+    vfree(due);
+    timeheap_free(&heap);
+
+    close(timerfd);
+    close(sigfd);
+    close(epfd);
+
+    return 0;
+
+}
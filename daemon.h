@@ -0,0 +1,76 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <time.h>
+
+#include "vactija.h"
+
+/*
+    Longest line of a hooks file.
+*/
+#define HOOK_LINE_MAX 1024
+
+/*
+    A command run at a time of a location's vaktija, e.g 5 minutes
+    before maghrib in Sarajevo. Hooks files hold one per line:
+
+        <location> <time> <offset> <command>
+
+    location is an ID or a name (with dashes for spaces, e.g banja-luka),
+    time a vakat (dawn ... isha, or fajr) or derived time (see
+    config.h), and offset [+-]N with an optional unit of s, m (the
+    default) or h. The command is the rest of the line, run by /bin/sh.
+    Empty lines and lines starting with # are skipped.
+*/
+struct hook {
+
+    int location;
+    int time;   /* vakat (0 - 5), or PRAYER_TIME_NUM + derived time */
+    int offset; /* seconds */
+
+    char *command;
+
+};
+
+/*
+    Loads the vaktija of a location for a date, returning NULL (rather
+    than exiting) if it is not available right now.
+*/
+typedef struct vaktija *(*daemon_load_fn)(int location, struct tm date);
+
+/*
+    Settings for the daemon mode, filled in by the CLI from config.h
+    and the command-line arguments.
+
+    Clients of the socket send "subscribe <location> [ticks]" and get
+    a line for every change after that instead of polling, e.g
+
+        vakat location=77 date=2027-03-01 current=Asr next=Maghrib at=17:19 left=2:30
+
+    with hello (right after subscribing), vakat, date (at midnight) or
+    tick (every minute, only with ticks) in front.
+*/
+struct daemon_options {
+
+    const char *hooks;  /* hooks file, read again on SIGHUP, or NULL */
+    const char *socket; /* path of the socket to subscribe on, or NULL */
+
+    const char *metrics_addr; /* address of the TCP listener for /metrics */
+    int metrics_port;         /* and its port, 0 for none */
+
+    int grace;         /* seconds an event may be late and still run */
+    int retry;         /* seconds to wait after a day failed to load */
+
+    daemon_load_fn load;
+
+};
+
+int hook_parse(const char *line, struct hook *hook, const char **err);
+struct hook *hooks_load(const char *path, int *count);
+void hooks_free(struct hook *hooks, int count);
+
+time_t hook_next(const struct hook *hook, time_t after, daemon_load_fn load);
+
+int run_daemon(const struct daemon_options *opts);
+
+#endif
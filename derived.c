@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "vactija.h"
+#include "derived.h"
+
+static const struct derived_time default_derived[] = {
+    { "midnight", "Midnight is on", derive_night, 1, 2 },
+    { "third", "Last third of the night is on", derive_night, 2, 3 }
+};
+
+static const struct derived_time *derived = default_derived;
+static int nderived = sizeof default_derived / sizeof default_derived[0];
+
+/*
+    The point splitting the night (from maghrib until the fajr of the
+    following day) in the ratio num/den, e.g 1/2 for the midnight.
+
+    If next is NULL, today's fajr stands in for tomorrow's, which is
+    off by the minute or two fajr moves a day.
+*/
+int derive_night(const struct vaktija *vaktija, const struct vaktija *next, int num, int den)
+{
+
+    int start = vaktija->times[4];
+    int end = (next != NULL ? next : vaktija)->times[0] + 86400;
+
+    return start + (end - start) * num / den;
+
+}
+
+/*
+    The time offset seconds away from the vakat with the given index,
+    e.g ishraq some minutes after sunrise.
+*/
+int derive_offset(const struct vaktija *vaktija, const struct vaktija *next, int vakat, int offset)
+{
+
+    (void) next;
+
+    return vaktija->times[vakat] + offset;
+
+}
+
+/*
+    Replaces the set of derived times. Only the first DERIVED_MAX
+    definitions are used. defs has to stay valid from then on.
+*/
+void derived_register(const struct derived_time *defs, int count)
+{
+
+    derived = defs;
+    nderived = (count > DERIVED_MAX) ? DERIVED_MAX : count;
+
+}
+
+int derived_count(void)
+{
+
+    return nderived;
+
+}
+
+const struct derived_time *derived_get(int idx)
+{
+
+    return &derived[idx];
+
+}
+
+/*
+    Returns the index of the derived time with the given name, or -1.
+*/
+int derived_find(const char *name)
+{
+
+    for (int i = 0; i < nderived; i++) {
+
+        if (strcmp(derived[i].name, name) == 0) {
+            return i;
+        }
+
+    }
+
+    return -1;
+
+}
+
+/*
+    Computes all derived times of the vaktija and stores them in it,
+    so reading them later is only a lookup. This is done when the data
+    is loaded, and done again once the following day is known (since
+    the night times depend on it).
+*/
+void derive_times(struct vaktija *vaktija, const struct vaktija *next)
+{
+
+    for (int i = 0; i < nderived; i++) {
+        vaktija->derived[i] = derived[i].derive(vaktija, next, derived[i].a, derived[i].b);
+    }
+
+    vaktija->derived_exact = (next != NULL);
+
+}
@@ -0,0 +1,41 @@
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#include "vactija.h"
+
+/*
+    Computes a derived time for the vaktija, in seconds since the 00:00
+    of its day (so times after midnight are past 86400). next is the
+    following day, which may be NULL. a and b are the arguments given
+    in the definition.
+*/
+typedef int (*derive_fn)(const struct vaktija *vaktija, const struct vaktija *next, int a, int b);
+
+/*
+    A time derived from the vakats, e.g the middle of the night.
+
+    The set of derived times is a table of these, so adding a new one
+    is a matter of adding an entry (see cfg_derived in config.h).
+*/
+struct derived_time {
+
+    const char *name;  /* short name, e.g "midnight" */
+    const char *label; /* printed in front of the time by print_vaktija */
+
+    derive_fn derive;
+    int a;
+    int b;
+
+};
+
+int derive_night(const struct vaktija *vaktija, const struct vaktija *next, int num, int den);
+int derive_offset(const struct vaktija *vaktija, const struct vaktija *next, int vakat, int offset);
+
+void derived_register(const struct derived_time *defs, int count);
+int derived_count(void);
+const struct derived_time *derived_get(int idx);
+int derived_find(const char *name);
+
+void derive_times(struct vaktija *vaktija, const struct vaktija *next);
+
+#endif
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vactija.h"
+#include "export.h"
+#include "derived.h"
+#include "locations.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+static const char *kind_names[] = { "csv", "jsonl", "ics" };
+
+static const char *prayer_names[PRAYER_TIME_NUM] = {
+    "dawn", "sunrise", "dhuhr", "asr", "maghrib", "isha"
+};
+
+/*
+    Returns the export kind called name (csv, jsonl or ics), or -1 if
+    there is none.
+*/
+int export_kind(const char *name)
+{
+
+    for (int i = 0; i < (int) (sizeof kind_names / sizeof kind_names[0]); i++) {
+
+        if (strcmp(name, kind_names[i]) == 0) {
+            return i;
+        }
+
+    }
+
+    return -1;
+
+}
+
+/*
+    Writes out the buffer. After a failed write nothing more is written,
+    which export_close reports.
+*/
+static void flush(struct export *ex)
+{
+
+    for (size_t done = 0; done < ex->len && !ex->failed; ) {
+
+        ssize_t n = write(ex->fd, ex->buf + done, ex->len - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            ex->failed = 1;
+        } else {
+            done += n;
+        }
+
+    }
+
+    ex->len = 0;
+
+}
+
+static void put(struct export *ex, const char *str, size_t n)
+{
+
+    if (ex->len + n > EXPORT_BUF_SIZE) {
+        flush(ex);
+    }
+
+    memcpy(ex->buf + ex->len, str, n);
+    ex->len += n;
+
+}
+
+static void put_str(struct export *ex, const char *str)
+{
+
+    put(ex, str, strlen(str));
+
+}
+
+static void put_char(struct export *ex, char c)
+{
+
+    if (ex->len == EXPORT_BUF_SIZE) {
+        flush(ex);
+    }
+
+    ex->buf[ex->len++] = c;
+
+}
+
+/*
+    Writes num (>= 0) with at least width digits, zero padded.
+*/
+static void put_num(struct export *ex, int num, int width)
+{
+
+    char digits[12];
+    int n = 0;
+
+    do {
+
+        digits[sizeof digits - ++n] = '0' + num % 10;
+        num /= 10;
+
+    } while (num > 0 || n < width);
+
+    put(ex, digits + sizeof digits - n, n);
+
+}
+
+/*
+    Writes the time of day secs (after midnight too) as HH:MM, or as
+    HHMM00 if ics.
+*/
+static void put_time(struct export *ex, int secs, int ics)
+{
+
+    secs %= 86400;
+
+    put_num(ex, secs / 3600, 2);
+
+    if (!ics) {
+        put_char(ex, ':');
+    }
+
+    put_num(ex, (secs / 60) % 60, 2);
+
+    if (ics) {
+        put(ex, "00", 2);
+    }
+
+}
+
+/*
+    Writes the date of the vaktija as yyyy-mm-dd, or as yyyymmdd if ics.
+*/
+static void put_date(struct export *ex, const struct vaktija *vaktija, int ics)
+{
+
+    put_num(ex, vaktija->year, 4);
+
+    if (!ics) {
+        put_char(ex, '-');
+    }
+
+    put_num(ex, vaktija->month, 2);
+
+    if (!ics) {
+        put_char(ex, '-');
+    }
+
+    put_num(ex, vaktija->day, 2);
+
+}
+
+/*
+    Writes text (cut at EXPORT_TEXT_MAX bytes) escaped for the kind of
+    export: quoted only if it has to be in csv, a JSON string in jsonl
+    and an iCalendar TEXT value in ics.
+*/
+static void put_text(struct export *ex, const char *text)
+{
+
+    size_t len = strnlen(text, EXPORT_TEXT_MAX);
+
+    if (ex->kind == EXPORT_CSV && strcspn(text, ",\"\r\n") >= len) {
+
+        put(ex, text, len);
+        return;
+
+    }
+
+    if (ex->kind != EXPORT_ICS) {
+        put_char(ex, '"');
+    }
+
+    for (size_t i = 0; i < len; i++) {
+
+        unsigned char c = text[i];
+
+        if (ex->kind == EXPORT_CSV) {
+
+            if (c == '"') {
+                put_char(ex, '"');
+            }
+
+            put_char(ex, c);
+
+        } else if (ex->kind == EXPORT_JSONL && (c == '"' || c == '\\')) {
+
+            put_char(ex, '\\');
+            put_char(ex, c);
+
+        } else if (ex->kind == EXPORT_JSONL && c < 0x20) {
+
+            put(ex, "\\u00", 4);
+            put_char(ex, "0123456789abcdef"[c >> 4]);
+            put_char(ex, "0123456789abcdef"[c & 0xF]);
+
+        } else if (ex->kind == EXPORT_ICS && (c == ',' || c == ';' || c == '\\')) {
+
+            put_char(ex, '\\');
+            put_char(ex, c);
+
+        } else if (ex->kind == EXPORT_ICS && c < 0x20) {
+
+            put(ex, "\\n", 2);
+
+        } else {
+
+            put_char(ex, c);
+
+        }
+
+    }
+
+    if (ex->kind != EXPORT_ICS) {
+        put_char(ex, '"');
+    }
+
+}
+
+/*
+    Starts an export to fd (which is left open), writing whatever comes
+    before the first day.
+*/
+struct export *export_open(int fd, enum export_kind kind)
+{
+
+    struct export *ex = vmalloc(sizeof *ex);
+
+    if (ex == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the export!\n");
+        vactija_error(errcode);
+
+    }
+
+    ex->fd = fd;
+    ex->kind = kind;
+    ex->failed = 0;
+    ex->len = 0;
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(ex->stamp, sizeof ex->stamp, "%Y%m%dT%H%M%SZ", &utc);
+
+    if (kind == EXPORT_CSV) {
+
+        put_str(ex, "id,location,date,hijri");
+
+        for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+            put_char(ex, ',');
+            put_str(ex, prayer_names[i]);
+
+        }
+
+        for (int i = 0; i < derived_count(); i++) {
+
+            put_char(ex, ',');
+            put_str(ex, derived_get(i)->name);
+
+        }
+
+        put_char(ex, '\n');
+
+    } else if (kind == EXPORT_ICS) {
+
+        put_str(ex, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//vactija//vaktija//BS\r\n"
+                "CALSCALE:GREGORIAN\r\nX-WR-CALNAME:Vaktija\r\n");
+
+    }
+
+    return ex;
+
+}
+
+static void export_ics(struct export *ex, int id, const char *name, const struct vaktija *vaktija)
+{
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+        put_str(ex, "BEGIN:VEVENT\r\nUID:");
+        put_date(ex, vaktija, 1);
+        put_char(ex, '-');
+        put_num(ex, id, 1);
+        put_char(ex, '-');
+        put_str(ex, prayer_names[i]);
+        put_str(ex, "@vactija\r\nDTSTAMP:");
+        put_str(ex, ex->stamp);
+
+        /* Floating time, shown as it is in whatever time zone the calendar is in */
+        put_str(ex, "\r\nDTSTART:");
+        put_date(ex, vaktija, 1);
+        put_char(ex, 'T');
+        put_time(ex, vaktija->times[i], 1);
+
+        put_str(ex, "\r\nSUMMARY:");
+        put_str(ex, vakat_name(i));
+        put_str(ex, "\r\nLOCATION:");
+        put_text(ex, name);
+        put_str(ex, "\r\nDESCRIPTION:");
+        put_text(ex, vaktija->dates[0]);
+        put_str(ex, "\r\nTRANSP:TRANSPARENT\r\nEND:VEVENT\r\n");
+
+    }
+
+}
+
+/*
+    Adds the vaktija of the location id (named from the location table,
+    or as the vaktija says if it is not in there) to the export.
+*/
+void export_day(struct export *ex, int id, const struct vaktija *vaktija)
+{
+
+    const char *name = location_name(id);
+
+    if (name == NULL) {
+        name = vaktija->location;
+    }
+
+    if (ex->kind == EXPORT_ICS) {
+
+        export_ics(ex, id, name, vaktija);
+        return;
+
+    }
+
+    int json = ex->kind == EXPORT_JSONL;
+
+    put_str(ex, json ? "{\"id\":" : "");
+    put_num(ex, id, 1);
+    put_str(ex, json ? ",\"location\":" : ",");
+    put_text(ex, name);
+    put_str(ex, json ? ",\"date\":\"" : ",");
+    put_date(ex, vaktija, 0);
+    put_str(ex, json ? "\",\"hijri\":" : ",");
+    put_text(ex, vaktija->dates[0]);
+
+    for (int i = 0; i < PRAYER_TIME_NUM + derived_count(); i++) {
+
+        put_char(ex, ',');
+
+        if (json) {
+
+            put_char(ex, '"');
+            put_str(ex, (i < PRAYER_TIME_NUM) ? prayer_names[i] : derived_get(i - PRAYER_TIME_NUM)->name);
+            put_str(ex, "\":\"");
+
+        }
+
+        put_time(ex, (i < PRAYER_TIME_NUM) ? vaktija->times[i] : vaktija->derived[i - PRAYER_TIME_NUM], 0);
+
+        if (json) {
+            put_char(ex, '"');
+        }
+
+    }
+
+    put_str(ex, json ? "}\n" : "\n");
+
+}
+
+/*
+    Finishes the export and writes out what is left of it.
+
+    Returns 0 on success and -1 if any of it could not be written.
+*/
+int export_close(struct export *ex)
+{
+
+    if (ex->kind == EXPORT_ICS) {
+        put_str(ex, "END:VCALENDAR\r\n");
+    }
+
+    flush(ex);
+
+    int failed = ex->failed;
+    vfree(ex);
+
+    return failed ? -1 : 0;
+
+}
@@ -0,0 +1,54 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+
+#include "vactija.h"
+
+/*
+    Bulk exports of many days (and locations) for other programs to
+    read, streamed one day at a time so memory does not grow with the
+    range:
+
+        csv     a header, then one row per day: id, location, date
+                (yyyy-mm-dd), hijri, the vakats and derived times (HH:MM)
+        jsonl   one JSON object per day with the same fields
+        ics     an iCalendar file with an event for every vakat, at the
+                local time of the location
+
+    Output is collected in a large buffer and written in blocks of
+    EXPORT_BUF_SIZE, so formatting a day is only a few copies.
+*/
+#define EXPORT_BUF_SIZE (256 * 1024)
+
+/* Longest text (location, hijri date) taken into an export */
+#define EXPORT_TEXT_MAX 128
+
+enum export_kind {
+
+    EXPORT_CSV,
+    EXPORT_JSONL,
+    EXPORT_ICS
+
+};
+
+struct export {
+
+    int fd;
+    enum export_kind kind;
+    int failed;
+
+    char stamp[20]; /* DTSTAMP of ics events */
+
+    size_t len;
+    char buf[EXPORT_BUF_SIZE];
+
+};
+
+int export_kind(const char *name);
+
+struct export *export_open(int fd, enum export_kind kind);
+void export_day(struct export *ex, int id, const struct vaktija *vaktija);
+int export_close(struct export *ex);
+
+#endif
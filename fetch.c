@@ -0,0 +1,544 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "fetch.h"
+#include "util/curlload.h"
+#include "util/cachefile.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/* 
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)          
+#endif 
+
+/*
+    Up to two requests run at once, the original and the hedged one.
+*/
+#define FETCH_TRANSFERS 2
+
+static struct fetch_policy policy = { 3000, 8000, 2, 250, 1500 };
+
+static enum fetch_mode fixture_mode = FETCH_LIVE;
+static const char *fixture_dir = NULL;
+
+struct mem_struct {
+    char *mem;
+    size_t size;
+};
+
+/*
+    One request of an attempt and what became of it.
+*/
+struct transfer {
+
+    CURL *curl;
+    struct mem_struct body;
+    char errbuf[CURL_ERROR_SIZE];
+
+    int done;
+    CURLcode result;
+    long status;
+
+};
+
+/*
+    Sets the policy used by every download after this call. Not meant
+    to be changed while downloads are running.
+*/
+void fetch_set_policy(const struct fetch_policy *p)
+{
+
+    policy = *p;
+
+}
+
+/*
+    Records downloads into (or replays them from) the fixture directory
+    dir, or turns that off again with FETCH_LIVE.
+*/
+void fetch_set_fixtures(enum fetch_mode mode, const char *dir)
+{
+
+    fixture_mode = (dir != NULL) ? mode : FETCH_LIVE;
+    fixture_dir = dir;
+
+}
+
+void fetch_fixtures_from_env(void)
+{
+
+    const char *dir = getenv("VACTIJA_FIXTURES");
+    const char *mode = getenv("VACTIJA_FIXTURE_MODE");
+
+    if (dir == NULL || dir[0] == '\0') {
+        return;
+    }
+
+    if (mode != NULL && strcmp(mode, "record") == 0) {
+        fetch_set_fixtures(FETCH_RECORD, dir);
+    } else {
+        fetch_set_fixtures(FETCH_REPLAY, dir);
+    }
+
+}
+
+/*
+    Builds the fixture file name for url into buf, which is the path
+    of the URL with every character other than letters, digits, - and .
+    replaced with _, e.g vaktija_v1_77_2022_2_19.json.
+
+    Returns 0 on success and -1 if it does not fit.
+*/
+int fixture_name(char *buf, size_t len, const char *url)
+{
+
+    const char *path = strstr(url, "://");
+    path = (path != NULL) ? strchr(path + 3, '/') : url;
+
+    if (path == NULL) {
+        path = "/";
+    }
+
+    while (*path == '/') {
+        path++;
+    }
+
+    size_t n = 0;
+
+    for (; *path != '\0' && *path != '?' && *path != '#'; path++) {
+
+        if (n + 1 >= len) {
+            return -1;
+        }
+
+        char ch = *path;
+        int keep = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+            (ch >= '0' && ch <= '9') || ch == '-' || ch == '.';
+
+        buf[n++] = keep ? ch : '_';
+
+    }
+
+    /* Trailing slashes do not make a different request */
+    while (n > 0 && buf[n - 1] == '_') {
+        n--;
+    }
+
+    if (n + sizeof ".json" > len) {
+        return -1;
+    }
+
+    memcpy(buf + n, ".json", sizeof ".json");
+
+    return 0;
+
+}
+
+static int fixture_path(char *buf, const char *url)
+{
+
+    char name[FETCH_FIXTURE_MAX];
+
+    if (fixture_name(name, sizeof name, url) != 0) {
+        return -1;
+    }
+
+    int n = snprintf(buf, CACHE_PATH_MAX, "%s/%s", fixture_dir, name);
+
+    return (n < 0 || n >= CACHE_PATH_MAX) ? -1 : 0;
+
+}
+
+static char *replay_fixture(const char *url)
+{
+
+    char path[CACHE_PATH_MAX];
+    size_t len;
+    char *body = NULL;
+
+    if (fixture_path(path, url) == 0) {
+        body = read_cache_data(path, &len);
+    }
+
+    if (body == NULL) {
+        printf("No fixture to replay for %s!\n", url);
+    }
+
+    return body;
+
+}
+
+static void record_fixture(const char *url, const char *body)
+{
+
+    char path[CACHE_PATH_MAX];
+
+    if (fixture_path(path, url) == 0) {
+
+        cache_prepare_dir(fixture_dir);
+
+        /* Downloads run in worker threads too, so a failed write only loses the fixture */
+        if (store_cache_data(path, body, strlen(body)) != 0) {
+            printf("Could not write the fixture %s: %s\n", path, strerror(errno));
+        }
+
+    }
+
+}
+
+static size_t write_callback(char *contents, size_t size, size_t nmemb, char *userp)
+{
+
+    size_t realsize = size * nmemb;
+    struct mem_struct *memory = (struct mem_struct *) userp;
+
+    char *ptr = vrealloc(memory->mem, memory->size + (realsize + 1));
+    if (ptr == NULL) {
+
+        /* Fails the transfer (CURLE_WRITE_ERROR) rather than the program */
+        printf("Could not allocate enough memory to store JSON data. Download aborted!\n");
+        return 0;
+
+    }
+
+    memory->mem = ptr;
+    memcpy(&(memory->mem[memory->size]), contents, realsize);
+    memory->size += realsize;
+    memory->mem[memory->size] = 0;
+
+    return realsize;
+
+}
+
+static long now_ms(void)
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+
+}
+
+static void sleep_ms(long ms)
+{
+
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        ;
+    }
+
+}
+
+/*
+    Adds a request for url to multi, which may take at most timeout_ms.
+*/
+static int start_transfer(const struct curl_api *lib, CURLM *multi,
+        struct transfer *t, const char *url, long timeout_ms)
+{
+
+    t->curl = lib->easy_init();
+
+    if (t->curl == NULL) {
+        return -1;
+    }
+
+    /* callback will reallocate enough memory */
+    t->body.mem = vmalloc(1);
+
+    if (t->body.mem == NULL) {
+
+        lib->easy_cleanup(t->curl);
+        return -1;
+
+    }
+
+    t->body.mem[0] = '\0';
+    t->body.size = 0;
+    t->errbuf[0] = '\0';
+    t->done = 0;
+    t->result = CURLE_OK;
+    t->status = 0;
+
+    lib->easy_setopt(t->curl, CURLOPT_URL, url);
+    lib->easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    lib->easy_setopt(t->curl, CURLOPT_WRITEDATA, &t->body);
+    lib->easy_setopt(t->curl, CURLOPT_FAILONERROR, 1L);
+    lib->easy_setopt(t->curl, CURLOPT_NOSIGNAL, 1L);
+    lib->easy_setopt(t->curl, CURLOPT_ERRORBUFFER, t->errbuf);
+    lib->easy_setopt(t->curl, CURLOPT_PRIVATE, (char *) t);
+
+    if (policy.connect_ms > 0) {
+        lib->easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT_MS, policy.connect_ms);
+    }
+
+    if (timeout_ms > 0) {
+        lib->easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    }
+
+    lib->multi_add_handle(multi, t->curl);
+
+    return 0;
+
+}
+
+/*
+    Makes one attempt at downloading url, hedging it with a second
+    request if the first one is slow.
+
+    Returns the index of the transfer which succeeded, or -1 if all of
+    them failed (and *failed is set to the last one to do so).
+*/
+static int fetch_attempt(const struct curl_api *lib, CURLM *multi,
+        struct transfer *transfers, int *started, const char *url, int *failed)
+{
+
+    long start = now_ms();
+
+    *started = 0;
+    *failed = -1;
+
+    if (start_transfer(lib, multi, &transfers[0], url, policy.timeout_ms) != 0) {
+        return -1;
+    }
+
+    *started = 1;
+
+    int ndone = 0;
+    int hedged = 0;
+
+    while (1) {
+
+        int running;
+        lib->multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int msgs;
+
+        while ((msg = lib->multi_info_read(multi, &msgs)) != NULL) {
+
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            struct transfer *t;
+            lib->easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+            lib->easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &t->status);
+
+            t->done = 1;
+            t->result = msg->data.result;
+            ndone++;
+
+            if (t->result == CURLE_OK) {
+                return t - transfers;
+            }
+
+            *failed = t - transfers;
+
+        }
+
+        if (ndone == *started) {
+            return -1;
+        }
+
+        long elapsed = now_ms() - start;
+        long wait = 1000;
+
+        if (policy.hedge_after_ms > 0 && !hedged) {
+
+            if (elapsed >= policy.hedge_after_ms) {
+
+                hedged = 1;
+
+                /* The hedged request only gets what is left of the timeout */
+                long left = (policy.timeout_ms > 0) ? policy.timeout_ms - elapsed : 0;
+
+                if (policy.timeout_ms <= 0 || left > 0) {
+
+                    if (start_transfer(lib, multi, &transfers[1], url, left) == 0) {
+                        *started = 2;
+                    }
+
+                }
+
+                continue;
+
+            }
+
+            if (policy.hedge_after_ms - elapsed < wait) {
+                wait = policy.hedge_after_ms - elapsed;
+            }
+
+        }
+
+        lib->multi_wait(multi, NULL, 0, (int) wait, NULL);
+
+    }
+
+}
+
+/*
+    Returns 1 if a failed transfer is worth retrying: timeouts, failed
+    connections and broken transfers, and HTTP errors other than the
+    server definitely saying no (4xx other than 408 and 429). Anything
+    else (a bad URL, an unknown host, certificate problems, running out
+    of memory) fails the same way every time, so it is not retried.
+*/
+static int retriable(const struct transfer *t)
+{
+
+    switch (t->result) {
+
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_GOT_NOTHING:
+        return 1;
+
+    case CURLE_HTTP_RETURNED_ERROR:
+        return t->status < 400 || t->status >= 500 || t->status == 408 || t->status == 429;
+
+    default:
+        return 0;
+
+    }
+
+}
+
+static void report_error(const struct curl_api *lib, const struct transfer *t)
+{
+
+    size_t errlen = strlen(t->errbuf);
+    printf("Encountered an error with libcurl!\n");
+    printf("libcurl error code: %d\n", t->result);
+
+    if (errlen) {
+
+        printf("libcurl error: %s%s", t->errbuf,
+                (t->errbuf[errlen - 1] != '\n' ? "\n" : ""));
+
+    } else {
+
+        printf("libcurl (generic) error: %s\n", lib->easy_strerror(t->result));
+
+    }
+
+}
+
+static void finish_transfers(const struct curl_api *lib, CURLM *multi,
+        struct transfer *transfers, int started, int keep)
+{
+
+    for (int i = 0; i < started; i++) {
+
+        lib->multi_remove_handle(multi, transfers[i].curl);
+        lib->easy_cleanup(transfers[i].curl);
+
+        if (i != keep) {
+            vfree(transfers[i].body.mem);
+        }
+
+    }
+
+}
+
+/*
+    Downloads url following the fetch policy (or replays it from the
+    fixture directory).
+
+    Returns the body, or NULL (after printing the reason) if every
+    attempt failed.
+*/
+char *fetch_url(const char *url)
+{
+
+    if (fixture_mode == FETCH_REPLAY) {
+        return replay_fixture(url);
+    }
+
+    const struct curl_api *lib = curl_api();
+
+    if (lib == NULL) {
+        return NULL;
+    }
+
+    CURLM *multi = lib->multi_init();
+
+    if (multi == NULL) {
+
+        printf("Could not initialise libcurl handle!\n");
+        return NULL;
+
+    }
+
+    unsigned int seed = (unsigned int) now_ms() ^ (unsigned int) (uintptr_t) &seed;
+
+    char *body = NULL;
+
+    for (int attempt = 0; attempt <= policy.retries; attempt++) {
+
+        struct transfer transfers[FETCH_TRANSFERS];
+        int started;
+        int failed;
+
+        int won = fetch_attempt(lib, multi, transfers, &started, url, &failed);
+
+        if (won >= 0) {
+
+            body = transfers[won].body.mem;
+            finish_transfers(lib, multi, transfers, started, won);
+
+            break;
+
+        }
+
+        if (started == 0) {
+
+            printf("Could not initialise libcurl handle!\n");
+            break;
+
+        }
+
+        int again = attempt < policy.retries && retriable(&transfers[failed]);
+
+        if (!again) {
+            report_error(lib, &transfers[failed]);
+        }
+
+        finish_transfers(lib, multi, transfers, started, -1);
+
+        if (!again) {
+            break;
+        }
+
+        /* Exponential backoff with jitter, so clients do not retry in step */
+        long delay = policy.backoff_ms << attempt;
+
+        if (delay > 0) {
+            sleep_ms(delay / 2 + rand_r(&seed) % (delay / 2 + 1));
+        }
+
+    }
+
+    lib->multi_cleanup(multi);
+
+    if (body != NULL && fixture_mode == FETCH_RECORD) {
+        record_fixture(url, body);
+    }
+
+    return body;
+
+}
@@ -0,0 +1,57 @@
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <stddef.h>
+
+/*
+    How downloads deal with a slow or failing network. All times are
+    in milliseconds, 0 turns the particular limit or feature off.
+
+    One attempt gives up after timeout_ms (connecting after connect_ms).
+    If hedge_after_ms passes without an answer, a second request for the
+    same URL is started next to the first and whichever answers first
+    wins. Failed attempts are retried up to retries times, waiting about
+    backoff_ms, then twice that and so on (with random jitter) in between.
+
+    A download therefore never takes longer than about
+    (retries + 1) * timeout_ms plus the backoffs.
+*/
+struct fetch_policy {
+
+    long connect_ms;
+    long timeout_ms;
+
+    int retries;
+    long backoff_ms;
+
+    long hedge_after_ms;
+
+};
+
+/*
+    Downloads can be recorded into and replayed from a fixture directory,
+    so that everything above them can be tested and benchmarked offline.
+    Each response is one file, named after the path of its URL (without
+    the scheme and host, so fixtures recorded against the real API replay
+    against any other host as well).
+
+    Set from VACTIJA_FIXTURES (the directory) and VACTIJA_FIXTURE_MODE
+    ("record" or "replay", the default) when fetch_fixtures_from_env is
+    called, or with fetch_set_fixtures.
+*/
+enum fetch_mode {
+    FETCH_LIVE,
+    FETCH_RECORD,
+    FETCH_REPLAY
+};
+
+#define FETCH_FIXTURE_MAX 512
+
+void fetch_set_policy(const struct fetch_policy *policy);
+void fetch_set_fixtures(enum fetch_mode mode, const char *dir);
+void fetch_fixtures_from_env(void);
+int fixture_name(char *buf, size_t len, const char *url);
+
+char *fetch_url(const char *url);
+
+#endif
@@ -0,0 +1,601 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "vactija.h"
+#include "format.h"
+#include "derived.h"
+#include "util/temporal.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define FORMAT_WIDTH_MAX 64
+
+enum op_kind {
+
+    OP_LITERAL,
+    OP_FIELD,
+    OP_COLOUR
+
+};
+
+enum field {
+
+    FIELD_TIME,
+    FIELD_LOCATION,
+    FIELD_TITLE,
+    FIELD_DATE,
+    FIELD_HIJRI,
+    FIELD_GDATE,
+    FIELD_PRAYER,      /* arg is the vakat */
+    FIELD_DERIVED,     /* arg is the derived time */
+    FIELD_SLOT_NAME,   /* arg is the slot */
+    FIELD_SLOT_TIME,
+    FIELD_COUNTDOWN
+
+};
+
+enum slot {
+
+    SLOT_VAKAT,
+    SLOT_NEXT,
+    SLOT_CURRENT
+
+};
+
+struct format_op {
+
+    enum op_kind kind;
+
+    const char *str; /* literal text or colour code */
+    size_t len;
+
+    enum field field;
+    int arg;
+    int width; /* negative for left aligned */
+
+};
+
+struct format {
+
+    int count;
+    int needs;
+
+    char *text; /* the literals, unescaped */
+    struct format_op ops[];
+
+};
+
+static const struct {
+
+    const char *name;
+    const char *code;
+
+} colours[] = {
+    { "cyan", "\x1b[36m" },
+    { "yellow", "\x1b[33m" },
+    { "green", "\x1b[32m" },
+    { "red", "\x1b[31m" },
+    { "bold", "\x1b[1m" },
+    { "reset", "\x1b[0m" }
+};
+
+static const char *prayer_names[PRAYER_TIME_NUM] = {
+    "dawn", "sunrise", "dhuhr", "asr", "maghrib", "isha"
+};
+
+/*
+    Fills op in for the field (or colour) called name.
+
+    Returns 0 on success and -1 if there is no such field.
+*/
+static int compile_field(struct format_op *op, const char *name, int *needs)
+{
+
+    static const struct {
+
+        const char *name;
+        enum field field;
+        int arg;
+
+    } fields[] = {
+        { "time", FIELD_TIME, 0 },
+        { "location", FIELD_LOCATION, 0 },
+        { "title", FIELD_TITLE, 0 },
+        { "date", FIELD_DATE, 0 },
+        { "hijri", FIELD_HIJRI, 0 },
+        { "gdate", FIELD_GDATE, 0 },
+        { "fajr", FIELD_PRAYER, 0 },
+        { "vakat.name", FIELD_SLOT_NAME, SLOT_VAKAT },
+        { "vakat.time", FIELD_SLOT_TIME, SLOT_VAKAT },
+        { "next.name", FIELD_SLOT_NAME, SLOT_NEXT },
+        { "next.time", FIELD_SLOT_TIME, SLOT_NEXT },
+        { "current.name", FIELD_SLOT_NAME, SLOT_CURRENT },
+        { "current.time", FIELD_SLOT_TIME, SLOT_CURRENT },
+        { "countdown", FIELD_COUNTDOWN, SLOT_NEXT }
+    };
+
+    for (size_t i = 0; i < sizeof colours / sizeof colours[0]; i++) {
+
+        if (strcmp(name, colours[i].name) == 0) {
+
+            op->kind = OP_COLOUR;
+            op->str = colours[i].code;
+            op->len = strlen(colours[i].code);
+
+            return 0;
+
+        }
+
+    }
+
+    op->kind = OP_FIELD;
+    op->arg = -1;
+
+    for (size_t i = 0; i < sizeof fields / sizeof fields[0]; i++) {
+
+        if (strcmp(name, fields[i].name) == 0) {
+
+            op->field = fields[i].field;
+            op->arg = fields[i].arg;
+
+        }
+
+    }
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+        if (strcmp(name, prayer_names[i]) == 0) {
+
+            op->field = FIELD_PRAYER;
+            op->arg = i;
+
+        }
+
+    }
+
+    if (op->arg == -1 && (op->arg = derived_find(name)) >= 0) {
+        op->field = FIELD_DERIVED;
+    }
+
+    if (op->arg == -1) {
+        return -1;
+    }
+
+    if (op->field == FIELD_SLOT_NAME || op->field == FIELD_SLOT_TIME || op->field == FIELD_COUNTDOWN) {
+
+        if (op->arg == SLOT_NEXT) {
+            *needs |= FORMAT_NEEDS_NEXT;
+        } else if (op->arg == SLOT_CURRENT) {
+            *needs |= FORMAT_NEEDS_CURRENT;
+        }
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Compiles the template (see format.h).
+
+    Returns the compiled template, or NULL (with the reason in err) if
+    it is not valid.
+*/
+struct format *format_compile(const char *template, char *err, size_t errlen)
+{
+
+    size_t tlen = strlen(template);
+
+    /* Every op takes at least one character of the template */
+    struct format *fmt = vmalloc(sizeof *fmt + sizeof fmt->ops[0] * (tlen + 1));
+    char *text = vmalloc(tlen + 1);
+
+    if (fmt == NULL || text == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to compile the format!\n");
+        vactija_error(errcode);
+
+    }
+
+    fmt->count = 0;
+    fmt->needs = 0;
+    fmt->text = text;
+
+    size_t textlen = 0;
+    struct format_op *lit = NULL;
+
+    for (const char *s = template; *s != '\0'; ) {
+
+        char c = *s;
+
+        if (c == '{' && s[1] != '{') {
+
+            const char *end = strchr(s, '}');
+
+            char name[64];
+            size_t namelen = (end != NULL) ? (size_t) (end - s - 1) : 0;
+
+            if (end == NULL || namelen == 0 || namelen >= sizeof name) {
+
+                snprintf(err, errlen, "Unterminated or empty field at \"%.16s\"", s);
+                format_free(fmt);
+                return NULL;
+
+            }
+
+            memcpy(name, s + 1, namelen);
+            name[namelen] = '\0';
+
+            /* {field:N} or {field:-N} */
+            int width = 0;
+            char *colon = strchr(name, ':');
+
+            if (colon != NULL) {
+
+                char *wend;
+                width = (int) strtol(colon + 1, &wend, 10);
+                *colon = '\0';
+
+                if (wend == colon + 1 || *wend != '\0' || width > FORMAT_WIDTH_MAX || width < -FORMAT_WIDTH_MAX) {
+
+                    snprintf(err, errlen, "Invalid width in {%s:%s}", name, colon + 1);
+                    format_free(fmt);
+                    return NULL;
+
+                }
+
+            }
+
+            struct format_op *op = &fmt->ops[fmt->count];
+            memset(op, 0, sizeof *op);
+            op->width = width;
+
+            if (compile_field(op, name, &fmt->needs) != 0) {
+
+                snprintf(err, errlen, "Unknown field {%s}", name);
+                format_free(fmt);
+                return NULL;
+
+            }
+
+            fmt->count++;
+            lit = NULL;
+            s = end + 1;
+
+            continue;
+
+        }
+
+        if ((c == '{' || c == '}') && s[1] == c) {
+
+            s += 2;
+
+        } else if (c == '}') {
+
+            snprintf(err, errlen, "Unmatched } (write }} for a literal one)");
+            format_free(fmt);
+            return NULL;
+
+        } else if (c == '\\' && (s[1] == 'n' || s[1] == 't' || s[1] == '\\')) {
+
+            c = (s[1] == 'n') ? '\n' : (s[1] == 't') ? '\t' : '\\';
+            s += 2;
+
+        } else {
+
+            s++;
+
+        }
+
+        /* Runs of literal text are one op */
+        if (lit == NULL) {
+
+            lit = &fmt->ops[fmt->count++];
+            memset(lit, 0, sizeof *lit);
+            lit->kind = OP_LITERAL;
+            lit->str = text + textlen;
+
+        }
+
+        text[textlen++] = c;
+        lit->len++;
+
+    }
+
+    return fmt;
+
+}
+
+void format_free(struct format *fmt)
+{
+
+    if (fmt == NULL) {
+        return;
+    }
+
+    vfree(fmt->text);
+    vfree(fmt);
+
+}
+
+/*
+    Returns whether the template uses the next (FORMAT_NEEDS_NEXT) or
+    current (FORMAT_NEEDS_CURRENT) vakat, which may take work to find.
+    No template (NULL) needs nothing.
+*/
+int format_needs(const struct format *fmt, int what)
+{
+
+    return fmt != NULL && (fmt->needs & what) != 0;
+
+}
+
+/*
+    Writes the value of a field into buf (of FORMAT_BUF_MAX), returning
+    its length. Missing values are empty.
+*/
+static size_t field_value(const struct format_op *op, const struct format_ctx *ctx, char *buf)
+{
+
+    const struct vaktija *day = ctx->day;
+    const struct format_vakat *slot = NULL;
+
+    if (op->field == FIELD_SLOT_NAME || op->field == FIELD_SLOT_TIME || op->field == FIELD_COUNTDOWN) {
+
+        slot = (op->arg == SLOT_NEXT) ? &ctx->next : (op->arg == SLOT_CURRENT) ? &ctx->current : &ctx->vakat;
+
+        if (slot->day == NULL) {
+            return 0;
+        }
+
+    }
+
+    int n = 0;
+
+    switch (op->field) {
+
+    case FIELD_TIME: {
+
+        struct tm now;
+        localtime_r(&ctx->now, &now);
+        n = strftime(buf, FORMAT_BUF_MAX, "%H:%M", &now);
+        break;
+
+    }
+
+    case FIELD_LOCATION:
+
+        if (ctx->location != NULL || day != NULL) {
+            n = snprintf(buf, FORMAT_BUF_MAX, "%s", (ctx->location != NULL) ? ctx->location : day->location);
+        }
+
+        break;
+
+    case FIELD_TITLE:
+        n = (ctx->title != NULL) ? snprintf(buf, FORMAT_BUF_MAX, "%s", ctx->title) : 0;
+        break;
+
+    case FIELD_DATE:
+        n = (day != NULL) ? snprintf(buf, FORMAT_BUF_MAX, "%s", day->dates[1]) : 0;
+        break;
+
+    case FIELD_HIJRI:
+        n = (day != NULL) ? snprintf(buf, FORMAT_BUF_MAX, "%s", day->dates[0]) : 0;
+        break;
+
+    case FIELD_GDATE:
+        n = (day != NULL) ? snprintf(buf, FORMAT_BUF_MAX, "%02d.%02d.%04d", day->day, day->month, day->year) : 0;
+        break;
+
+    case FIELD_PRAYER:
+        n = (day != NULL) ? snprintf(buf, FORMAT_BUF_MAX, "%s", day->prayers[op->arg]) : 0;
+        break;
+
+    case FIELD_DERIVED:
+
+        if (day != NULL && op->arg < derived_count()) {
+
+            format_seconds(day->derived[op->arg], buf, FORMAT_BUF_MAX);
+            n = strlen(buf);
+
+        }
+
+        break;
+
+    case FIELD_SLOT_NAME:
+        n = snprintf(buf, FORMAT_BUF_MAX, "%s", vakat_name(slot->vakat));
+        break;
+
+    case FIELD_SLOT_TIME:
+        n = snprintf(buf, FORMAT_BUF_MAX, "%s", slot->day->prayers[slot->vakat]);
+        break;
+
+    case FIELD_COUNTDOWN: {
+
+        /* Rounded up to the minute, like a countdown would show it */
+        long left = (long) (slot->at - ctx->now + 59) / 60;
+
+        if (left >= 0) {
+            n = snprintf(buf, FORMAT_BUF_MAX, "%ld:%02ld", left / 60, left % 60);
+        }
+
+        break;
+
+    }
+
+    }
+
+    return (n > 0 && n < FORMAT_BUF_MAX) ? (size_t) n : 0;
+
+}
+
+/*
+    Number of characters (not bytes) of the UTF-8 string, for padding.
+*/
+static int text_width(const char *str, size_t len)
+{
+
+    int width = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        width += ((unsigned char) str[i] & 0xC0) != 0x80;
+    }
+
+    return width;
+
+}
+
+static size_t append(char *buf, size_t pos, size_t len, const char *str, size_t n)
+{
+
+    if (pos + n >= len) {
+        n = (pos < len) ? len - pos - 1 : 0;
+    }
+
+    memcpy(buf + pos, str, n);
+
+    return pos + n;
+
+}
+
+static size_t pad(char *buf, size_t pos, size_t len, int count)
+{
+
+    while (count-- > 0 && pos + 1 < len) {
+        buf[pos++] = ' ';
+    }
+
+    return pos;
+
+}
+
+/*
+    Renders the template into buf (of len bytes, NUL terminated),
+    with colour codes only if colour is 1.
+
+    Returns the length of the output, which is cut short if buf is
+    too small.
+*/
+size_t format_render(const struct format *fmt, const struct format_ctx *ctx,
+        int colour, char *buf, size_t len)
+{
+
+    if (len == 0) {
+        return 0;
+    }
+
+    size_t pos = 0;
+    char value[FORMAT_BUF_MAX];
+
+    for (int i = 0; i < fmt->count; i++) {
+
+        const struct format_op *op = &fmt->ops[i];
+
+        if (op->kind == OP_LITERAL || (op->kind == OP_COLOUR && colour)) {
+
+            pos = append(buf, pos, len, op->str, op->len);
+
+        } else if (op->kind == OP_FIELD) {
+
+            size_t n = field_value(op, ctx, value);
+            int fill = abs(op->width) - text_width(value, n);
+
+            if (op->width > 0) {
+                pos = pad(buf, pos, len, fill);
+            }
+
+            pos = append(buf, pos, len, value, n);
+
+            if (op->width < 0) {
+                pos = pad(buf, pos, len, fill);
+            }
+
+        }
+
+    }
+
+    buf[pos] = '\0';
+
+    return pos;
+
+}
+
+/*
+    Renders the template and writes it to stdout in one go (after
+    whatever stdio still had buffered).
+
+    Returns 0 on success and -1 if the write failed.
+*/
+int format_print(const struct format *fmt, const struct format_ctx *ctx, int colour)
+{
+
+    char buf[FORMAT_BUF_MAX];
+    size_t len = format_render(fmt, ctx, colour, buf, sizeof buf);
+
+    fflush(stdout);
+
+    for (size_t done = 0; done < len; ) {
+
+        ssize_t n = write(STDOUT_FILENO, buf + done, len - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        done += n;
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Returns 1 if output should be coloured: only when built with
+    USE_ANSI_COLOR, stdout is a terminal, TERM is not "dumb" and
+    NO_COLOR (https://no-color.org) is not set.
+*/
+int format_colour(void)
+{
+
+    static int colour = -1;
+
+    if (colour == -1) {
+
+#ifdef USE_ANSI_COLOR
+
+        const char *nocolour = getenv("NO_COLOR");
+        const char *term = getenv("TERM");
+
+        colour = isatty(STDOUT_FILENO) && (nocolour == NULL || nocolour[0] == '\0') &&
+            (term == NULL || strcmp(term, "dumb") != 0);
+
+#else
+
+        colour = 0;
+
+#endif
+
+    }
+
+    return colour;
+
+}
@@ -0,0 +1,78 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "vactija.h"
+
+/*
+    Output templates, e.g "{next.name} in {countdown}\n". A template is
+    compiled once into a list of literal, field and colour ops, and
+    rendered into a stack buffer which goes out with a single write, so
+    rendering it again (on every tick of a long running mode) costs no
+    parsing and no stdio.
+
+    Fields:
+        {time}                  current time (HH:MM)
+        {location}              location name
+        {title}                 what a table is for, e.g its dates
+        {date} {hijri}          the dates as given by the API
+        {gdate}                 the date as dd.mm.yyyy
+        {dawn} ... {isha}       vakat times (also {fajr})
+        {midnight}, ...         derived times, by their name
+        {vakat.name}            the vakat an action is about (#, next
+        {vakat.time}            and current)
+        {next.name} {next.time} the next vakat
+        {current.name}          the current vakat
+        {current.time}
+        {countdown}             time left until the next vakat (H:MM)
+
+    Colours: {cyan} {yellow} {green} {red} {bold} {reset}, left out when
+    colour is off. Any field takes a width as {field:N} (right aligned)
+    or {field:-N} (left aligned). {{, }}, \n, \t and \\ are escapes.
+*/
+#define FORMAT_BUF_MAX 4096
+#define FORMAT_ERR_MAX 128
+
+/* What format_needs can be asked about */
+#define FORMAT_NEEDS_NEXT 0x1
+#define FORMAT_NEEDS_CURRENT 0x2
+
+/*
+    A vakat a template can refer to, or day NULL if there is none.
+*/
+struct format_vakat {
+
+    const struct vaktija *day;
+    int vakat;
+    time_t at;
+
+};
+
+struct format_ctx {
+
+    const struct vaktija *day;
+    const char *location; /* instead of the day's, if set */
+    const char *title;
+    time_t now;
+
+    struct format_vakat vakat;
+    struct format_vakat next;
+    struct format_vakat current;
+
+};
+
+struct format;
+
+struct format *format_compile(const char *template, char *err, size_t errlen);
+void format_free(struct format *fmt);
+int format_needs(const struct format *fmt, int what);
+
+size_t format_render(const struct format *fmt, const struct format_ctx *ctx,
+        int colour, char *buf, size_t len);
+int format_print(const struct format *fmt, const struct format_ctx *ctx, int colour);
+
+int format_colour(void);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "vactija.h"
+#include "locations.h"
+#include "util/textfold.h"
+
+/*
+    A k-d tree node, with the latitude as y and the longitude scaled by
+    LOCATION_LON_SCALE as x.
+*/
+struct location_node {
+
+    float y;
+    float x;
+    int16_t id;
+
+};
+
+#include "loctable.h"
+
+/* Length of a degree of latitude */
+#define KM_PER_DEGREE 111.2
+
+_Static_assert(LOCATION_COUNT == VAKTIJA_LOCATIONS, "locations.txt does not match VAKTIJA_LOCATIONS");
+
+/*
+    Returns the name of the location with the ID, or NULL if there is no
+    such location.
+*/
+const char *location_name(int id)
+{
+
+    return (id >= 0 && id < LOCATION_COUNT) ? location_names[id] : NULL;
+
+}
+
+/*
+    Stores the coordinates of the location in lat and lon.
+
+    Returns 0 on success and -1 if there is no such location.
+*/
+int location_coords(int id, double *lat, double *lon)
+{
+
+    if (location_name(id) == NULL) {
+        return -1;
+    }
+
+    *lat = location_coords_table[id][0];
+    *lon = location_coords_table[id][1];
+
+    return 0;
+
+}
+
+/*
+    Returns the distance in km between the location and the point, as
+    measured by location_nearest (flat, which is close enough within a
+    few hundred km).
+*/
+double location_distance(int id, double lat, double lon)
+{
+
+    double dy = location_coords_table[id][0] - lat;
+    double dx = (location_coords_table[id][1] - lon) * LOCATION_LON_SCALE;
+
+    return sqrt(dx * dx + dy * dy) * KM_PER_DEGREE;
+
+}
+
+struct nearest {
+
+    float x, y;
+
+    int best;
+    float dist; /* squared */
+
+};
+
+/*
+    Searches the subtree of [lo, hi) split on axis (0 for latitude).
+*/
+static void search_tree(struct nearest *n, int lo, int hi, int axis)
+{
+
+    if (lo >= hi) {
+        return;
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    const struct location_node *node = &location_tree[mid];
+
+    float dx = node->x - n->x;
+    float dy = node->y - n->y;
+    float dist = dx * dx + dy * dy;
+
+    if (dist < n->dist) {
+
+        n->dist = dist;
+        n->best = node->id;
+
+    }
+
+    float diff = (axis == 0) ? n->y - node->y : n->x - node->x;
+
+    /* The side the point is on first, the other only if it can be nearer */
+    if (diff < 0) {
+
+        search_tree(n, lo, mid, !axis);
+
+        if (diff * diff < n->dist) {
+            search_tree(n, mid + 1, hi, !axis);
+        }
+
+    } else {
+
+        search_tree(n, mid + 1, hi, !axis);
+
+        if (diff * diff < n->dist) {
+            search_tree(n, lo, mid, !axis);
+        }
+
+    }
+
+}
+
+/*
+    Returns the ID of the location nearest to the point, or -1 if the
+    coordinates are not valid.
+*/
+int location_nearest(double lat, double lon)
+{
+
+    if (!(lat >= -90 && lat <= 90 && lon >= -180 && lon <= 180)) {
+        return -1;
+    }
+
+    struct nearest n = { lon * LOCATION_LON_SCALE, lat, -1, INFINITY };
+    search_tree(&n, 0, LOCATION_COUNT, 0);
+
+    return n.best;
+
+}
+
+/*
+    Returns the location ID written in str (only digits), or -1 if str
+    is not a number or no location has that ID.
+*/
+int location_id(const char *str)
+{
+
+    int id = 0;
+
+    if (*str == '\0') {
+        return -1;
+    }
+
+    for (const char *s = str; *s != '\0'; s++) {
+
+        if (*s < '0' || *s > '9') {
+            return -1;
+        }
+
+        id = id * 10 + (*s - '0');
+
+        if (id >= LOCATION_COUNT) {
+            return -1;
+        }
+
+    }
+
+    return id;
+
+}
+
+/*
+    Returns the ID of the location called name, ignoring case, the
+    diacritics and dashes (so "banja luka" and "Kotor Varos" are found),
+    or -1 if there is none.
+*/
+int location_find(const char *name)
+{
+
+    char folded[LOCATION_NAME_MAX];
+
+    if (text_fold(folded, sizeof folded, name) == 0) {
+        return -1;
+    }
+
+    uint32_t disp = location_disp[text_hash(folded, 0) % LOCATION_BUCKETS];
+    int id = location_slots[text_hash(folded, disp) & (LOCATION_SLOTS - 1)];
+
+    return (id >= 0 && strcmp(location_folded[id], folded) == 0) ? id : -1;
+
+}
+
+/*
+    Returns the location given by either its ID or its name, or -1 if
+    str is neither.
+*/
+int location_parse(const char *str)
+{
+
+    int id = location_id(str);
+
+    return (id >= 0) ? id : location_find(str);
+
+}
@@ -0,0 +1,19 @@
+#ifndef LOCATIONS_H
+#define LOCATIONS_H
+
+/*
+    The locations of the vaktija API, built into the program from
+    locations.txt (see util/genlocations.c). Nothing here reads files.
+*/
+#define LOCATION_NAME_MAX 64
+
+const char *location_name(int id);
+int location_id(const char *str);
+int location_find(const char *name);
+int location_parse(const char *str);
+
+int location_coords(int id, double *lat, double *lon);
+double location_distance(int id, double lat, double lon);
+int location_nearest(double lat, double lon);
+
+#endif
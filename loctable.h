@@ -0,0 +1,516 @@
+/* Generated from locations.txt by genlocations, do not edit. */
+
+#define LOCATION_COUNT 118
+#define LOCATION_BUCKETS 60
+#define LOCATION_SLOTS 256
+#define LOCATION_LON_SCALE 0.71934
+
+static const char *const location_names[LOCATION_COUNT] = {
+    "Banovići",
+    "Banja Luka",
+    "Bihać",
+    "Bijeljina",
+    "Bileća",
+    "Bosanski Brod",
+    "Bosanska Dubica",
+    "Bosanska Gradiška",
+    "Bosansko Grahovo",
+    "Bosanska Krupa",
+    "Bosanski Novi",
+    "Bosanski Petrovac",
+    "Bosanski Šamac",
+    "Bratunac",
+    "Brčko",
+    "Breza",
+    "Bugojno",
+    "Busovača",
+    "Bužim",
+    "Cazin",
+    "Čajniče",
+    "Čapljina",
+    "Čelić",
+    "Čelinac",
+    "Čitluk",
+    "Derventa",
+    "Doboj",
+    "Donji Vakuf",
+    "Drvar",
+    "Foča",
+    "Fojnica",
+    "Gacko",
+    "Glamoč",
+    "Goražde",
+    "Gornji Vakuf",
+    "Gračanica",
+    "Gradačac",
+    "Grude",
+    "Hadžići",
+    "Han-Pijesak",
+    "Hlivno",
+    "Ilijaš",
+    "Jablanica",
+    "Jajce",
+    "Kakanj",
+    "Kalesija",
+    "Kalinovik",
+    "Kiseljak",
+    "Kladanj",
+    "Ključ",
+    "Konjic",
+    "Kotor-Varoš",
+    "Kreševo",
+    "Kupres",
+    "Laktaši",
+    "Lopare",
+    "Lukavac",
+    "Ljubinje",
+    "Ljubuški",
+    "Maglaj",
+    "Modriča",
+    "Mostar",
+    "Mrkonjić-Grad",
+    "Neum",
+    "Nevesinje",
+    "Novi Travnik",
+    "Odžak",
+    "Olovo",
+    "Orašje",
+    "Pale",
+    "Posušje",
+    "Prijedor",
+    "Prnjavor",
+    "Prozor",
+    "Rogatica",
+    "Rudo",
+    "Sanski Most",
+    "Sarajevo",
+    "Skender-Vakuf",
+    "Sokolac",
+    "Srbac",
+    "Srebrenica",
+    "Srebrenik",
+    "Stolac",
+    "Šekovići",
+    "Šipovo",
+    "Široki Brijeg",
+    "Teslić",
+    "Tešanj",
+    "Tomislav-Grad",
+    "Travnik",
+    "Trebinje",
+    "Trnovo",
+    "Tuzla",
+    "Ugljevik",
+    "Vareš",
+    "Velika Kladuša",
+    "Visoko",
+    "Višegrad",
+    "Vitez",
+    "Vlasenica",
+    "Zavidovići",
+    "Zenica",
+    "Zvornik",
+    "Žepa",
+    "Žepče",
+    "Živinice",
+    "Bijelo Polje",
+    "Gusinje",
+    "Nova Varoš",
+    "Novi Pazar",
+    "Plav",
+    "Pljevlja",
+    "Priboj",
+    "Prijepolje",
+    "Rožaje",
+    "Sjenica",
+    "Tutin",
+};
+
+static const char *const location_folded[LOCATION_COUNT] = {
+    "banovici",
+    "banja luka",
+    "bihac",
+    "bijeljina",
+    "bileca",
+    "bosanski brod",
+    "bosanska dubica",
+    "bosanska gradiska",
+    "bosansko grahovo",
+    "bosanska krupa",
+    "bosanski novi",
+    "bosanski petrovac",
+    "bosanski samac",
+    "bratunac",
+    "brcko",
+    "breza",
+    "bugojno",
+    "busovaca",
+    "buzim",
+    "cazin",
+    "cajnice",
+    "capljina",
+    "celic",
+    "celinac",
+    "citluk",
+    "derventa",
+    "doboj",
+    "donji vakuf",
+    "drvar",
+    "foca",
+    "fojnica",
+    "gacko",
+    "glamoc",
+    "gorazde",
+    "gornji vakuf",
+    "gracanica",
+    "gradacac",
+    "grude",
+    "hadzici",
+    "han pijesak",
+    "hlivno",
+    "ilijas",
+    "jablanica",
+    "jajce",
+    "kakanj",
+    "kalesija",
+    "kalinovik",
+    "kiseljak",
+    "kladanj",
+    "kljuc",
+    "konjic",
+    "kotor varos",
+    "kresevo",
+    "kupres",
+    "laktasi",
+    "lopare",
+    "lukavac",
+    "ljubinje",
+    "ljubuski",
+    "maglaj",
+    "modrica",
+    "mostar",
+    "mrkonjic grad",
+    "neum",
+    "nevesinje",
+    "novi travnik",
+    "odzak",
+    "olovo",
+    "orasje",
+    "pale",
+    "posusje",
+    "prijedor",
+    "prnjavor",
+    "prozor",
+    "rogatica",
+    "rudo",
+    "sanski most",
+    "sarajevo",
+    "skender vakuf",
+    "sokolac",
+    "srbac",
+    "srebrenica",
+    "srebrenik",
+    "stolac",
+    "sekovici",
+    "sipovo",
+    "siroki brijeg",
+    "teslic",
+    "tesanj",
+    "tomislav grad",
+    "travnik",
+    "trebinje",
+    "trnovo",
+    "tuzla",
+    "ugljevik",
+    "vares",
+    "velika kladusa",
+    "visoko",
+    "visegrad",
+    "vitez",
+    "vlasenica",
+    "zavidovici",
+    "zenica",
+    "zvornik",
+    "zepa",
+    "zepce",
+    "zivinice",
+    "bijelo polje",
+    "gusinje",
+    "nova varos",
+    "novi pazar",
+    "plav",
+    "pljevlja",
+    "priboj",
+    "prijepolje",
+    "rozaje",
+    "sjenica",
+    "tutin",
+};
+
+static const float location_coords_table[LOCATION_COUNT][2] = {
+    { 44.41000f, 18.53000f },
+    { 44.77000f, 17.19000f },
+    { 44.82000f, 15.87000f },
+    { 44.76000f, 19.21000f },
+    { 42.87000f, 18.43000f },
+    { 45.14000f, 17.99000f },
+    { 45.18000f, 16.81000f },
+    { 45.14000f, 17.25000f },
+    { 44.18000f, 16.36000f },
+    { 44.88000f, 16.15000f },
+    { 45.05000f, 16.38000f },
+    { 44.55000f, 16.37000f },
+    { 45.06000f, 18.47000f },
+    { 44.19000f, 19.33000f },
+    { 44.87000f, 18.81000f },
+    { 44.02000f, 18.26000f },
+    { 44.06000f, 17.45000f },
+    { 44.10000f, 17.88000f },
+    { 45.05000f, 16.03000f },
+    { 44.97000f, 15.94000f },
+    { 43.56000f, 19.07000f },
+    { 43.12000f, 17.68000f },
+    { 44.72000f, 18.82000f },
+    { 44.72000f, 17.33000f },
+    { 43.23000f, 17.70000f },
+    { 44.98000f, 17.91000f },
+    { 44.73000f, 18.09000f },
+    { 44.14000f, 17.40000f },
+    { 44.37000f, 16.38000f },
+    { 43.51000f, 18.78000f },
+    { 43.96000f, 17.90000f },
+    { 43.17000f, 18.54000f },
+    { 44.05000f, 16.85000f },
+    { 43.67000f, 18.98000f },
+    { 43.94000f, 17.59000f },
+    { 44.70000f, 18.31000f },
+    { 44.88000f, 18.43000f },
+    { 43.37000f, 17.41000f },
+    { 43.82000f, 18.20000f },
+    { 44.08000f, 18.95000f },
+    { 43.83000f, 17.01000f },
+    { 43.95000f, 18.27000f },
+    { 43.66000f, 17.76000f },
+    { 44.34000f, 17.27000f },
+    { 44.13000f, 18.12000f },
+    { 44.44000f, 18.87000f },
+    { 43.50000f, 18.45000f },
+    { 43.94000f, 18.08000f },
+    { 44.22000f, 18.69000f },
+    { 44.53000f, 16.78000f },
+    { 43.65000f, 17.96000f },
+    { 44.62000f, 17.37000f },
+    { 43.87000f, 18.05000f },
+    { 43.99000f, 17.28000f },
+    { 44.91000f, 17.30000f },
+    { 44.64000f, 18.85000f },
+    { 44.54000f, 18.53000f },
+    { 42.95000f, 18.09000f },
+    { 43.20000f, 17.55000f },
+    { 44.55000f, 18.10000f },
+    { 44.96000f, 18.30000f },
+    { 43.34000f, 17.81000f },
+    { 44.42000f, 17.08000f },
+    { 42.92000f, 17.62000f },
+    { 43.26000f, 18.11000f },
+    { 44.17000f, 17.66000f },
+    { 45.01000f, 18.33000f },
+    { 44.13000f, 18.58000f },
+    { 45.04000f, 18.69000f },
+    { 43.82000f, 18.57000f },
+    { 43.47000f, 17.33000f },
+    { 44.98000f, 16.71000f },
+    { 44.87000f, 17.66000f },
+    { 43.82000f, 17.61000f },
+    { 43.80000f, 19.00000f },
+    { 43.62000f, 19.37000f },
+    { 44.77000f, 16.67000f },
+    { 43.86000f, 18.41000f },
+    { 44.49000f, 17.38000f },
+    { 43.94000f, 18.80000f },
+    { 45.10000f, 17.52000f },
+    { 44.11000f, 19.30000f },
+    { 44.71000f, 18.49000f },
+    { 43.08000f, 17.96000f },
+    { 44.30000f, 18.86000f },
+    { 44.28000f, 17.09000f },
+    { 43.38000f, 17.59000f },
+    { 44.61000f, 17.86000f },
+    { 44.61000f, 17.99000f },
+    { 43.72000f, 17.23000f },
+    { 44.23000f, 17.67000f },
+    { 42.71000f, 18.34000f },
+    { 43.66000f, 18.45000f },
+    { 44.54000f, 18.67000f },
+    { 44.69000f, 18.99000f },
+    { 44.16000f, 18.33000f },
+    { 45.18000f, 15.81000f },
+    { 43.99000f, 18.18000f },
+    { 43.78000f, 19.29000f },
+    { 44.16000f, 17.79000f },
+    { 44.18000f, 18.94000f },
+    { 44.45000f, 18.15000f },
+    { 44.20000f, 17.91000f },
+    { 44.39000f, 19.10000f },
+    { 43.95000f, 19.12000f },
+    { 44.43000f, 18.04000f },
+    { 44.45000f, 18.65000f },
+    { 43.04000f, 19.75000f },
+    { 42.56000f, 19.83000f },
+    { 43.46000f, 19.81000f },
+    { 43.14000f, 20.52000f },
+    { 42.60000f, 19.94000f },
+    { 43.36000f, 19.36000f },
+    { 43.58000f, 19.53000f },
+    { 43.39000f, 19.65000f },
+    { 42.84000f, 20.17000f },
+    { 43.27000f, 20.00000f },
+    { 42.99000f, 20.34000f },
+};
+
+static const struct location_node location_tree[LOCATION_COUNT] = {
+    { 43.20000f, 12.62442f, 58 },
+    { 42.92000f, 12.67477f, 63 },
+    { 43.12000f, 12.71793f, 21 },
+    { 43.37000f, 12.52371f, 37 },
+    { 43.72000f, 12.39423f, 89 },
+    { 43.47000f, 12.46616f, 70 },
+    { 43.38000f, 12.65319f, 86 },
+    { 43.23000f, 12.73232f, 24 },
+    { 43.08000f, 12.91935f, 83 },
+    { 42.95000f, 13.01286f, 57 },
+    { 43.26000f, 13.02725f, 64 },
+    { 43.34000f, 12.81145f, 61 },
+    { 43.66000f, 12.77548f, 42 },
+    { 43.65000f, 12.91935f, 50 },
+    { 43.82000f, 12.66758f, 73 },
+    { 43.83000f, 12.23597f, 40 },
+    { 43.99000f, 12.43020f, 53 },
+    { 43.94000f, 12.65319f, 34 },
+    { 44.05000f, 12.12088f, 32 },
+    { 44.14000f, 12.51652f, 27 },
+    { 44.06000f, 12.55248f, 16 },
+    { 44.10000f, 12.86180f, 17 },
+    { 43.96000f, 12.87619f, 30 },
+    { 43.87000f, 12.98409f, 52 },
+    { 43.94000f, 13.00567f, 47 },
+    { 43.82000f, 13.09199f, 38 },
+    { 43.99000f, 13.07760f, 97 },
+    { 44.13000f, 13.03444f, 44 },
+    { 44.02000f, 13.13515f, 15 },
+    { 43.95000f, 13.14234f, 41 },
+    { 42.71000f, 13.19270f, 91 },
+    { 42.87000f, 13.25744f, 4 },
+    { 43.04000f, 14.20697f, 107 },
+    { 43.17000f, 13.33656f, 31 },
+    { 43.50000f, 13.27182f, 46 },
+    { 43.36000f, 13.92642f, 112 },
+    { 43.39000f, 14.13503f, 114 },
+    { 43.46000f, 14.25013f, 109 },
+    { 42.56000f, 14.26451f, 108 },
+    { 42.60000f, 14.34364f, 111 },
+    { 42.84000f, 14.50909f, 115 },
+    { 42.99000f, 14.63138f, 117 },
+    { 43.27000f, 14.38680f, 116 },
+    { 43.14000f, 14.76086f, 110 },
+    { 43.51000f, 13.50921f, 29 },
+    { 43.66000f, 13.27182f, 92 },
+    { 43.82000f, 13.35814f, 69 },
+    { 43.67000f, 13.65307f, 33 },
+    { 43.86000f, 13.24305f, 77 },
+    { 44.13000f, 13.36534f, 67 },
+    { 43.94000f, 13.52359f, 79 },
+    { 44.08000f, 13.63149f, 39 },
+    { 43.80000f, 13.66746f, 74 },
+    { 43.56000f, 13.71781f, 20 },
+    { 43.62000f, 13.93362f, 75 },
+    { 43.58000f, 14.04871f, 113 },
+    { 43.78000f, 13.87607f, 98 },
+    { 43.95000f, 13.75378f, 104 },
+    { 44.11000f, 13.88326f, 81 },
+    { 44.16000f, 13.18550f, 95 },
+    { 44.18000f, 11.76840f, 8 },
+    { 44.28000f, 12.29352f, 85 },
+    { 44.34000f, 12.42300f, 43 },
+    { 44.37000f, 11.78279f, 28 },
+    { 44.55000f, 11.77560f, 11 },
+    { 44.53000f, 12.07053f, 49 },
+    { 44.42000f, 12.28633f, 62 },
+    { 44.62000f, 12.49494f, 51 },
+    { 44.17000f, 12.70354f, 65 },
+    { 44.16000f, 12.79706f, 99 },
+    { 44.20000f, 12.88338f, 102 },
+    { 44.23000f, 12.71074f, 90 },
+    { 44.49000f, 12.50213f, 78 },
+    { 44.61000f, 12.84741f, 87 },
+    { 44.72000f, 12.46616f, 23 },
+    { 44.82000f, 11.41593f, 2 },
+    { 44.88000f, 11.61734f, 9 },
+    { 44.77000f, 11.99140f, 76 },
+    { 44.97000f, 11.46628f, 19 },
+    { 45.18000f, 11.37277f, 96 },
+    { 45.05000f, 11.53102f, 18 },
+    { 45.05000f, 11.78279f, 10 },
+    { 44.98000f, 12.02017f, 71 },
+    { 44.77000f, 12.36545f, 1 },
+    { 44.91000f, 12.44458f, 54 },
+    { 44.87000f, 12.70354f, 72 },
+    { 45.10000f, 12.60284f, 80 },
+    { 45.18000f, 12.09211f, 6 },
+    { 45.14000f, 12.40861f, 7 },
+    { 44.98000f, 12.88338f, 25 },
+    { 44.43000f, 12.97689f, 105 },
+    { 44.45000f, 13.05602f, 101 },
+    { 44.41000f, 13.32937f, 0 },
+    { 44.45000f, 13.41569f, 106 },
+    { 44.61000f, 12.94093f, 88 },
+    { 44.55000f, 13.02005f, 59 },
+    { 44.54000f, 13.32937f, 56 },
+    { 44.54000f, 13.43008f, 93 },
+    { 44.22000f, 13.44446f, 48 },
+    { 44.18000f, 13.62430f, 100 },
+    { 44.19000f, 13.90484f, 13 },
+    { 44.30000f, 13.56675f, 84 },
+    { 44.44000f, 13.57395f, 45 },
+    { 44.39000f, 13.73939f, 103 },
+    { 44.64000f, 13.55956f, 55 },
+    { 44.73000f, 13.01286f, 26 },
+    { 44.70000f, 13.17112f, 35 },
+    { 44.88000f, 13.25744f, 36 },
+    { 44.96000f, 13.16392f, 60 },
+    { 45.14000f, 12.94093f, 5 },
+    { 45.01000f, 13.18550f, 66 },
+    { 45.06000f, 13.28621f, 12 },
+    { 44.71000f, 13.30060f, 82 },
+    { 44.72000f, 13.53798f, 22 },
+    { 44.69000f, 13.66027f, 94 },
+    { 44.76000f, 13.81852f, 3 },
+    { 45.04000f, 13.44446f, 68 },
+    { 44.87000f, 13.53079f, 14 },
+};
+
+static const uint16_t location_disp[LOCATION_BUCKETS] = {
+    1, 2, 2, 1, 1, 1, 1, 2, 1, 1, 1, 2, 2, 0, 1, 0,
+    4, 1, 3, 1, 1, 1, 2, 1, 0, 1, 2, 4, 2, 1, 0, 2,
+    1, 2, 1, 1, 2, 1, 0, 1, 1, 1, 1, 0, 2, 2, 3, 1,
+    2, 1, 2, 6, 2, 2, 2, 2, 2, 1, 3, 1
+};
+
+static const int16_t location_slots[LOCATION_SLOTS] = {
+    -1, -1, 29, 26, -1, 21, -1, -1, 79, 108, -1, -1, 52, 19, -1, 25,
+    -1, -1, 45, -1, 105, 68, -1, -1, -1, -1, 82, -1, -1, 98, -1, -1,
+    -1, -1, 114, -1, 93, 103, 76, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    10, -1, -1, -1, -1, -1, -1, -1, 86, -1, -1, -1, 16, 55, 106, -1,
+    81, -1, 89, 23, -1, -1, 41, 110, 96, -1, 11, -1, -1, 65, -1, -1,
+    -1, 56, -1, -1, 51, 74, 72, 78, 37, -1, -1, 33, 39, 71, -1, -1,
+    -1, -1, -1, 13, 20, -1, -1, -1, -1, 84, -1, 87, -1, 117, -1, -1,
+    44, 88, 101, 116, -1, 109, 95, -1, 91, 14, 43, -1, 2, 54, -1, 18,
+    75, -1, 100, 99, 12, -1, -1, -1, 31, -1, -1, -1, 35, -1, -1, -1,
+    24, 32, 90, -1, -1, -1, -1, -1, 6, -1, 30, -1, -1, -1, 60, 73,
+    -1, 46, 80, 85, 69, -1, -1, 5, -1, 8, -1, -1, -1, -1, 67, 58,
+    36, 92, -1, 64, 40, 53, 22, 1, 113, 112, -1, -1, 47, -1, -1, -1,
+    9, -1, 115, -1, 4, -1, 42, 61, 102, 50, -1, -1, -1, 15, 77, 48,
+    -1, -1, 27, -1, -1, 107, -1, -1, 59, -1, 57, -1, -1, 3, -1, -1,
+    -1, 34, 83, -1, -1, 63, 38, -1, 94, 49, 104, 66, -1, -1, 70, -1,
+    -1, 97, -1, -1, 111, -1, 28, 17, -1, -1, -1, 0, -1, 62, -1, 7
+};
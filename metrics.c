@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define METRICS_TEXT_MAX 8192
+
+/*
+    What one thread recorded. The last shard is shared by the threads
+    there are no shards left for, and only they have to add atomically.
+*/
+struct shard {
+
+    int64_t values[METRIC_NUM];
+
+    int64_t buckets[HISTOGRAM_NUM][METRICS_BUCKETS + 1]; /* last is +Inf */
+    int64_t sum_ns[HISTOGRAM_NUM];
+
+} __attribute__((aligned(64)));
+
+struct metric_info {
+
+    const char *name;
+    const char *help;
+    int gauge;
+
+};
+
+static const struct metric_info metric_info[METRIC_NUM] = {
+
+    { "vactija_requests", "HTTP requests handled", 0 },
+    { "vactija_cache_hits", "Vaktije answered from memory", 0 },
+    { "vactija_cache_misses", "Vaktije which had to be loaded", 0 },
+    { "vactija_disk_hits", "Misses found in the cache directory", 0 },
+    { "vactija_cache_evictions", "Entries dropped from memory to make room", 0 },
+    { "vactija_upstream_requests", "Requests to the vaktija API", 0 },
+    { "vactija_upstream_errors", "Requests to the vaktija API which failed", 0 },
+    { "vactija_hooks_run", "Hook commands started", 0 },
+    { "vactija_hooks_failed", "Hook commands which exited with an error", 0 },
+    { "vactija_connections", "Open connections", 1 },
+    { "vactija_subscriptions", "Clients subscribed to a location", 1 },
+    { "vactija_queue_depth", "Misses waiting for a fetch worker", 1 }
+
+};
+
+static const struct metric_info histogram_info[HISTOGRAM_NUM] = {
+
+    { "vactija_upstream_latency_seconds", "Latency of requests to the vaktija API", 0 },
+    { "vactija_refresh_duration_seconds", "Time a miss took to load from any source", 0 }
+
+};
+
+static const uint64_t bucket_ns[METRICS_BUCKETS] = {
+
+    500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000, 2500000000, 5000000000,
+    10000000000
+
+};
+
+static const char *bucket_le[METRICS_BUCKETS] = {
+
+    "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05",
+    "0.1", "0.25", "0.5", "1.0", "2.5", "5.0", "10.0"
+
+};
+
+static struct shard shards[METRICS_MAX_SHARDS];
+static int shards_taken = 0;
+
+static __thread struct shard *mine = NULL;
+
+static struct shard *my_shard(void)
+{
+
+    if (mine == NULL) {
+
+        int i = __atomic_fetch_add(&shards_taken, 1, __ATOMIC_RELAXED);
+        mine = &shards[(i < METRICS_MAX_SHARDS - 1) ? i : METRICS_MAX_SHARDS - 1];
+
+    }
+
+    return mine;
+
+}
+
+/*
+    Adds n to a value of the shard. Nobody else writes to it unless it is
+    the shared one, so a load and a store do; the atomics only keep the
+    scrape from reading a torn value.
+*/
+static void shard_add(struct shard *s, int64_t *v, int64_t n)
+{
+
+    if (s == &shards[METRICS_MAX_SHARDS - 1]) {
+
+        __atomic_fetch_add(v, n, __ATOMIC_RELAXED);
+
+    } else {
+
+        __atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+
+    }
+
+}
+
+/*
+    Adds n to a counter (n > 0) or gauge (either way).
+*/
+void metric_add(enum metric metric, int64_t n)
+{
+
+    struct shard *s = my_shard();
+
+    shard_add(s, &s->values[metric], n);
+
+}
+
+/*
+    Records a sample of ns nanoseconds in the histogram.
+*/
+void metric_observe(enum histogram histogram, uint64_t ns)
+{
+
+    struct shard *s = my_shard();
+
+    int b = 0;
+    while (b < METRICS_BUCKETS && ns > bucket_ns[b]) {
+        b++;
+    }
+
+    shard_add(s, &s->buckets[histogram][b], 1);
+    shard_add(s, &s->sum_ns[histogram], ns);
+
+}
+
+/*
+    Returns a monotonic time in nanoseconds, to take samples with.
+*/
+uint64_t metrics_clock(void)
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+}
+
+static int64_t sum(const int64_t *first)
+{
+
+    size_t offset = (const char *) first - (const char *) &shards[0];
+    int64_t total = 0;
+
+    for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+        total += __atomic_load_n((const int64_t *) ((const char *) &shards[i] + offset), __ATOMIC_RELAXED);
+    }
+
+    return total;
+
+}
+
+/*
+    Returns the value of the metric over all threads.
+*/
+int64_t metric_value(enum metric metric)
+{
+
+    return sum(&shards[0].values[metric]);
+
+}
+
+static void append(char *buf, size_t *len, const char *fmt, ...)
+{
+
+    va_list args;
+    va_start(args, fmt);
+
+    int n = vsnprintf(buf + *len, METRICS_TEXT_MAX - *len, fmt, args);
+
+    va_end(args);
+
+    if (n > 0) {
+        *len = (*len + n < METRICS_TEXT_MAX) ? *len + n : METRICS_TEXT_MAX - 1;
+    }
+
+}
+
+/*
+    Returns every metric in the OpenMetrics text format, to be freed by
+    the caller with vfree.
+*/
+char *metrics_render(void)
+{
+
+    char *buf = vmalloc(METRICS_TEXT_MAX);
+
+    if (buf == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the metrics!\n");
+        vactija_error(errcode);
+
+    }
+
+    size_t len = 0;
+    buf[0] = '\0';
+
+    for (int m = 0; m < METRIC_NUM; m++) {
+
+        const struct metric_info *info = &metric_info[m];
+
+        append(buf, &len, "# TYPE %s %s\n# HELP %s %s.\n%s%s %lld\n",
+                info->name, info->gauge ? "gauge" : "counter", info->name, info->help,
+                info->name, info->gauge ? "" : "_total", (long long) metric_value(m));
+
+    }
+
+    for (int h = 0; h < HISTOGRAM_NUM; h++) {
+
+        const struct metric_info *info = &histogram_info[h];
+
+        append(buf, &len, "# TYPE %s histogram\n# HELP %s %s.\n", info->name, info->name, info->help);
+
+        int64_t count = 0;
+
+        for (int b = 0; b <= METRICS_BUCKETS; b++) {
+
+            count += sum(&shards[0].buckets[h][b]);
+
+            append(buf, &len, "%s_bucket{le=\"%s\"} %lld\n", info->name,
+                    (b < METRICS_BUCKETS) ? bucket_le[b] : "+Inf", (long long) count);
+
+        }
+
+        int64_t ns = sum(&shards[0].sum_ns[h]);
+
+        append(buf, &len, "%s_sum %lld.%09lld\n%s_count %lld\n", info->name,
+                (long long) (ns / 1000000000), (long long) (ns % 1000000000),
+                info->name, (long long) count);
+
+    }
+
+    append(buf, &len, "# EOF\n");
+
+    return buf;
+
+}
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Counters, gauges and latency histograms of the long running modes,
+    exposed as OpenMetrics text on /metrics.
+
+    Every thread records into its own shard, which only it writes to,
+    so a sample is a couple of plain (relaxed atomic) stores with no
+    lock and no shared cache line. A scrape adds the shards up. Gauges
+    are kept the same way, as the sum of what every thread added to
+    them.
+
+    Histogram buckets are fixed (METRICS_BUCKETS below, in seconds),
+    and samples are taken in nanoseconds from metrics_clock.
+*/
+#define METRICS_MAX_SHARDS 64
+#define METRICS_BUCKETS 14
+
+enum metric {
+
+    METRIC_REQUESTS,          /* HTTP requests handled */
+    METRIC_CACHE_HITS,        /* answered from memory */
+    METRIC_CACHE_MISSES,      /* had to be loaded */
+    METRIC_DISK_HITS,         /* misses found in the cache directory */
+    METRIC_CACHE_EVICTIONS,   /* entries dropped to make room in memory */
+    METRIC_UPSTREAM_REQUESTS, /* requests to the vaktija API */
+    METRIC_UPSTREAM_ERRORS,   /* of which failed */
+    METRIC_HOOKS_RUN,
+    METRIC_HOOKS_FAILED,
+
+    /* Gauges */
+    METRIC_CONNECTIONS,
+    METRIC_SUBSCRIPTIONS,
+    METRIC_QUEUE_DEPTH,       /* misses waiting for a worker */
+
+    METRIC_NUM
+
+};
+
+enum histogram {
+
+    HISTOGRAM_UPSTREAM, /* latency of a request to the vaktija API */
+    HISTOGRAM_REFRESH,  /* time a miss took to load, from any source */
+
+    HISTOGRAM_NUM
+
+};
+
+void metric_add(enum metric metric, int64_t n);
+void metric_observe(enum histogram histogram, uint64_t ns);
+
+uint64_t metrics_clock(void);
+
+int64_t metric_value(enum metric metric);
+char *metrics_render(void);
+
+#endif
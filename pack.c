@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vactija.h"
+#include "pack.h"
+#include "record.h"
+#include "util/cachefile.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define PACK_HEADER 16
+
+struct pack_index {
+
+    char key[PACK_KEY_MAX];
+
+    uint32_t record_off;
+    uint32_t record_len;
+
+    uint32_t json_off;
+    uint32_t json_len;
+    uint32_t json_sum;
+
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+
+    const struct pack_entry *x = a;
+    const struct pack_entry *y = b;
+
+    return strncmp(x->key, y->key, PACK_KEY_MAX);
+
+}
+
+/*
+    Writes the entries (sorted by key in place) into a new pack at path,
+    replacing any previous one atomically.
+
+    Returns 0 on success and -1 if the pack would be too large or a key
+    appears twice.
+*/
+int pack_write(const char *path, struct pack_entry *entries, size_t count)
+{
+
+    qsort(entries, count, sizeof *entries, compare_entries);
+
+    size_t size = PACK_HEADER + count * sizeof(struct pack_index);
+
+    for (size_t i = 0; i < count; i++) {
+
+        if (i > 0 && compare_entries(&entries[i - 1], &entries[i]) == 0) {
+            return -1;
+        }
+
+        size += entries[i].record_len + entries[i].json_len;
+
+    }
+
+    if (size > UINT32_MAX) {
+        return -1;
+    }
+
+    unsigned char *buf = vcalloc(1, size);
+
+    if (buf == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to write the cache pack!\n");
+        vactija_error(errcode);
+
+    }
+
+    struct pack_index *index = (struct pack_index *) (buf + PACK_HEADER);
+    size_t off = PACK_HEADER + count * sizeof *index;
+
+    for (size_t i = 0; i < count; i++) {
+
+        memcpy(index[i].key, entries[i].key, PACK_KEY_MAX);
+
+        index[i].record_off = off;
+        index[i].record_len = entries[i].record_len;
+        memcpy(buf + off, entries[i].record, entries[i].record_len);
+        off += entries[i].record_len;
+
+        index[i].json_off = off;
+        index[i].json_len = entries[i].json_len;
+        index[i].json_sum = record_checksum(entries[i].json, entries[i].json_len);
+        memcpy(buf + off, entries[i].json, entries[i].json_len);
+        off += entries[i].json_len;
+
+    }
+
+    uint16_t version = PACK_VERSION;
+    uint32_t count32 = count;
+    uint32_t checksum = record_checksum((const char *) index, count * sizeof *index);
+
+    memcpy(buf, PACK_MAGIC, 4);
+    memcpy(buf + 4, &version, 2);
+    memcpy(buf + 8, &count32, 4);
+    memcpy(buf + 12, &checksum, 4);
+
+    write_cache_data(path, buf, size);
+
+    vfree(buf);
+
+    return 0;
+
+}
+
+static const struct pack_index *pack_index(const struct pack *pack)
+{
+
+    return (const struct pack_index *) (pack->map + PACK_HEADER);
+
+}
+
+/*
+    Maps the pack at path into memory, after checking its index.
+
+    Returns NULL if there is no pack at path or it is not valid.
+*/
+struct pack *pack_open(const char *path)
+{
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < PACK_HEADER) {
+
+        close(fd);
+        return NULL;
+
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct pack *pack = vmalloc(sizeof *pack);
+
+    if (pack == NULL) {
+
+        munmap(map, st.st_size);
+        return NULL;
+
+    }
+
+    pack->map = map;
+    pack->size = st.st_size;
+
+    uint16_t version;
+    uint32_t checksum;
+    memcpy(&version, pack->map + 4, 2);
+    memcpy(&pack->count, pack->map + 8, 4);
+    memcpy(&checksum, pack->map + 12, 4);
+
+    int valid = memcmp(pack->map, PACK_MAGIC, 4) == 0 && version == PACK_VERSION &&
+        pack->count <= (pack->size - PACK_HEADER) / sizeof(struct pack_index) &&
+        record_checksum((const char *) pack_index(pack), pack->count * sizeof(struct pack_index)) == checksum;
+
+    for (uint32_t i = 0; valid && i < pack->count; i++) {
+
+        const struct pack_index *e = &pack_index(pack)[i];
+
+        valid = (size_t) e->record_off + e->record_len <= pack->size &&
+            (size_t) e->json_off + e->json_len <= pack->size &&
+            e->key[PACK_KEY_MAX - 1] == '\0';
+
+    }
+
+    if (!valid) {
+
+        pack_close(pack);
+        return NULL;
+
+    }
+
+    return pack;
+
+}
+
+void pack_close(struct pack *pack)
+{
+
+    if (pack == NULL) {
+        return;
+    }
+
+    munmap((void *) pack->map, pack->size);
+    vfree(pack);
+
+}
+
+/*
+    Returns the index of the entry with the key, or -1 if the pack
+    does not have it.
+*/
+int pack_find(const struct pack *pack, const char *key)
+{
+
+    const struct pack_index *index = pack_index(pack);
+
+    size_t lo = 0;
+    size_t hi = pack->count;
+
+    while (lo < hi) {
+
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(index[mid].key, key, PACK_KEY_MAX);
+
+        if (cmp == 0) {
+            return (int) mid;
+        }
+
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+
+    }
+
+    return -1;
+
+}
+
+const char *pack_key(const struct pack *pack, int idx)
+{
+
+    return pack_index(pack)[idx].key;
+
+}
+
+/*
+    Returns how many bytes the record and JSON of the entry at idx take.
+*/
+size_t pack_entry_size(const struct pack *pack, int idx)
+{
+
+    const struct pack_index *e = &pack_index(pack)[idx];
+
+    return sizeof *e + e->record_len + e->json_len;
+
+}
+
+/*
+    Returns a copy of the serialised record of the entry at idx (and
+    its length in len), or NULL if it has none.
+*/
+char *pack_record_data(const struct pack *pack, int idx, size_t *len)
+{
+
+    const struct pack_index *e = &pack_index(pack)[idx];
+
+    if (e->record_len == 0) {
+        return NULL;
+    }
+
+    char *buf = vmalloc(e->record_len);
+
+    if (buf != NULL) {
+
+        memcpy(buf, pack->map + e->record_off, e->record_len);
+        *len = e->record_len;
+
+    }
+
+    return buf;
+
+}
+
+/*
+    Returns the parsed day stored under key, or NULL if the pack does
+    not have it (or the record is damaged).
+*/
+struct vaktija *pack_record(const struct pack *pack, const char *key)
+{
+
+    int idx = pack_find(pack, key);
+
+    if (idx < 0) {
+        return NULL;
+    }
+
+    const struct pack_index *e = &pack_index(pack)[idx];
+
+    if (e->record_len == 0) {
+        return NULL;
+    }
+
+    return deserialize_record((const char *) pack->map + e->record_off, e->record_len);
+
+}
+
+/*
+    Returns a copy of the raw JSON stored under key, or NULL if the
+    pack does not have it (or it is damaged).
+*/
+char *pack_json(const struct pack *pack, const char *key)
+{
+
+    int idx = pack_find(pack, key);
+
+    if (idx < 0) {
+        return NULL;
+    }
+
+    const struct pack_index *e = &pack_index(pack)[idx];
+    const char *json = (const char *) pack->map + e->json_off;
+
+    if (e->json_len == 0 || record_checksum(json, e->json_len) != e->json_sum) {
+        return NULL;
+    }
+
+    char *copy = vmalloc(e->json_len + 1);
+
+    if (copy == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store JSON data!\n");
+        vactija_error(errcode);
+
+    }
+
+    memcpy(copy, json, e->json_len);
+    copy[e->json_len] = '\0';
+
+    return copy;
+
+}
@@ -0,0 +1,65 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vactija.h"
+
+/*
+    The cache pack merges the per-day cache files (the record and the
+    raw JSON of each (location, date) key) into one file, so that a large
+    cache is a single mmap instead of thousands of small files:
+
+        "VKTP", u16 version, u16 reserved, u32 entries, u32 checksum
+        (FNV-1a of the index), then the index sorted by key:
+        char key[32], u32 record offset, u32 record length,
+        u32 JSON offset, u32 JSON length, u32 JSON checksum
+        followed by the records and JSON themselves.
+
+    Records carry their own checksum. Like records, packs are in native
+    byte order since the cache is never shared between machines.
+*/
+#define PACK_MAGIC "VKTP"
+#define PACK_VERSION 1
+#define PACK_NAME "cache.pack"
+
+#define PACK_KEY_MAX 32
+
+struct pack {
+
+    const unsigned char *map;
+    size_t size;
+
+    uint32_t count;
+
+};
+
+/*
+    One entry to write, either part may be missing (NULL).
+*/
+struct pack_entry {
+
+    char key[PACK_KEY_MAX];
+
+    char *record;
+    size_t record_len;
+
+    char *json;
+    size_t json_len;
+
+};
+
+int pack_write(const char *path, struct pack_entry *entries, size_t count);
+
+struct pack *pack_open(const char *path);
+void pack_close(struct pack *pack);
+
+int pack_find(const struct pack *pack, const char *key);
+const char *pack_key(const struct pack *pack, int idx);
+size_t pack_entry_size(const struct pack *pack, int idx);
+char *pack_record_data(const struct pack *pack, int idx, size_t *len);
+struct vaktija *pack_record(const struct pack *pack, const char *key);
+char *pack_json(const struct pack *pack, const char *key);
+
+#endif
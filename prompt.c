@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "vactija.h"
+#include "prompt.h"
+#include "record.h"
+#include "pack.h"
+#include "format.h"
+#include "timeline.h"
+#include "locations.h"
+#include "util/cachefile.h"
+#include "util/temporal.h"
+#include "util/alloc.h"
+
+static const char *action_names[PROMPT_ACTION_NUM] = { "next", "current", "countdown" };
+
+/* The same as vactija <action> -r prints */
+static const char *action_templates[PROMPT_ACTION_NUM] = { "{vakat.time}", "{vakat.time}", "{countdown}" };
+
+/*
+    Returns the action called name, or -1 if there is none.
+*/
+int prompt_action(const char *name)
+{
+
+    for (int i = 0; i < PROMPT_ACTION_NUM; i++) {
+
+        if (strcmp(name, action_names[i]) == 0) {
+            return i;
+        }
+
+    }
+
+    return -1;
+
+}
+
+/*
+    Returns the template an action is answered with unless another one
+    is given.
+*/
+const char *prompt_template(enum prompt_action action)
+{
+
+    return action_templates[action];
+
+}
+
+void prompt_init(struct prompt *p)
+{
+
+    memset(p, 0, sizeof *p);
+
+}
+
+static void forget(struct prompt_day *d)
+{
+
+    if (d->vaktija != NULL) {
+        delete_vaktija(d->vaktija);
+    }
+
+    d->vaktija = NULL;
+    d->key[0] = '\0';
+    d->source[0] = '\0';
+
+}
+
+void prompt_free(struct prompt *p)
+{
+
+    for (int i = 0; i < PROMPT_DAYS; i++) {
+        forget(&p->days[i]);
+    }
+
+}
+
+static int same_file(const struct stat *a, const struct stat *b)
+{
+
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+        a->st_mtime == b->st_mtime;
+
+}
+
+/*
+    Stats path into st, which is zeroed if there is nothing there, so
+    that something still missing compares the same as before.
+*/
+static void stat_or_zero(const char *path, struct stat *st)
+{
+
+    if (stat(path, st) != 0) {
+        memset(st, 0, sizeof *st);
+    }
+
+}
+
+/*
+    Whether a day which was not cached when d was loaded still can not
+    be: nothing was written to the directory (the cache writes files by
+    renaming them into place) and the pack is the same.
+*/
+static int still_missing(const struct prompt_day *d, const char *directory)
+{
+
+    char path[CACHE_PATH_MAX];
+    struct stat st;
+
+    /* A change later in the second it was looked in would not show in st_mtime */
+    if (d->dir_st.st_mtime >= d->looked) {
+        return 0;
+    }
+
+    stat_or_zero(directory, &st);
+
+    if (!same_file(&st, &d->dir_st) || cache_path(path, sizeof path, directory, "cache", "pack") <= 0) {
+        return 0;
+    }
+
+    stat_or_zero(path, &st);
+
+    return same_file(&st, &d->pack_st);
+
+}
+
+/*
+    Whether d still holds what the cache has under key (the path of the
+    record): the file it was read from has not changed since, and if
+    that was not the record, no record has turned up, which would be
+    read first. A day which was not cached is fresh while still_missing.
+*/
+static int fresh(const struct prompt_day *d, const char *directory, const char *key)
+{
+
+    struct stat st;
+
+    if (strcmp(d->key, key) != 0) {
+        return 0;
+    }
+
+    if (d->source[0] == '\0') {
+        return still_missing(d, directory);
+    }
+
+    if (stat(d->source, &st) != 0 || !same_file(&st, &d->st)) {
+        return 0;
+    }
+
+    return strcmp(d->source, key) == 0 || stat(key, &st) != 0;
+
+}
+
+/*
+    Parses a day of JSON, or returns NULL if it is not valid (where
+    parse_data would exit).
+*/
+static struct vaktija *parse_json(char *json)
+{
+
+    struct vaktija *v = (json != NULL && valid_vaktija(json)) ? parse_data(json) : NULL;
+
+    vfree(json);
+
+    return v;
+
+}
+
+/*
+    Reads the day of the location into d the way the CLI looks for it in
+    the directory: its record, the compacted pack, then its JSON. d is
+    left without a vaktija if none of them has it.
+*/
+static void load(struct prompt *p, struct prompt_day *d, const char *directory,
+        const char *location, struct tm date, const char *key)
+{
+
+    forget(d);
+    snprintf(d->key, sizeof d->key, "%s", key);
+
+    p->loads++;
+
+    int year = date.tm_year + 1900;
+    int mon = date.tm_mon + 1;
+
+    char name[CACHE_KEY_MAX];
+    char path[CACHE_PATH_MAX];
+    char packpath[CACHE_PATH_MAX];
+    struct stat st;
+
+    /* Stat before reading, so a file replaced in between is read again next time */
+    d->looked = time(NULL);
+    stat_or_zero(directory, &d->dir_st);
+    memset(&d->pack_st, 0, sizeof d->pack_st);
+
+    int packed = cache_path(packpath, sizeof packpath, directory, "cache", "pack") > 0 &&
+        stat(packpath, &d->pack_st) == 0;
+
+    if (stat(key, &st) == 0 && (d->vaktija = read_record(key)) != NULL) {
+        snprintf(path, sizeof path, "%s", key);
+    }
+
+    if (d->vaktija == NULL && cache_key(name, sizeof name, location, year, mon, date.tm_mday) <= 0) {
+        return;
+    }
+
+    if (d->vaktija == NULL && packed) {
+
+        struct pack *pack = pack_open(packpath);
+
+        if (pack != NULL) {
+
+            if ((d->vaktija = pack_record(pack, name)) == NULL) {
+                d->vaktija = parse_json(pack_json(pack, name));
+            }
+
+            pack_close(pack);
+
+            snprintf(path, sizeof path, "%s", packpath);
+            st = d->pack_st;
+
+        }
+
+    }
+
+    if (d->vaktija == NULL && cache_path(path, sizeof path, directory, name, "json") > 0 &&
+        stat(path, &st) == 0) {
+
+        size_t len;
+        d->vaktija = parse_json(read_cache_data(path, &len));
+
+    }
+
+    if (d->vaktija == NULL) {
+        return;
+    }
+
+    if (d->vaktija->year == 0) {
+
+        d->vaktija->year = year;
+        d->vaktija->month = mon;
+        d->vaktija->day = date.tm_mday;
+
+    }
+
+    snprintf(d->source, sizeof d->source, "%s", path);
+    d->st = st;
+
+}
+
+/*
+    Returns the day offset days from today (-1, 0 or 1) which is on the
+    given date, reading it only if it is not kept already, or NULL if it
+    is not cached.
+*/
+static struct vaktija *cached_day(struct prompt *p, int offset, const char *directory,
+        int location, struct tm date)
+{
+
+    char loc[16];
+    char name[CACHE_KEY_MAX];
+    char key[CACHE_PATH_MAX];
+
+    snprintf(loc, sizeof loc, "%d", location);
+
+    if (cache_key(name, sizeof name, loc, date.tm_year + 1900, date.tm_mon + 1, date.tm_mday) <= 0 ||
+        cache_path(key, sizeof key, directory, name, RECORD_EXT) <= 0) {
+        return NULL;
+    }
+
+    struct prompt_day *d = &p->days[offset + 1];
+
+    /* After midnight, yesterday's tomorrow is today and its today yesterday */
+    for (int i = 0; i < PROMPT_DAYS && strcmp(d->key, key) != 0; i++) {
+
+        if (strcmp(p->days[i].key, key) == 0) {
+
+            struct prompt_day swap = *d;
+            *d = p->days[i];
+            p->days[i] = swap;
+
+        }
+
+    }
+
+    if (!fresh(d, directory, key)) {
+        load(p, d, directory, loc, date, key);
+    }
+
+    return d->vaktija;
+
+}
+
+/*
+    Renders the answer to the action for the location at now into buf
+    (of len bytes) with the template (no colours), from the days cached
+    in the directory.
+
+    Returns the length of the answer, or -1 if the days it needs are
+    not cached (yesterday for current before fajr, tomorrow for next
+    after isha).
+*/
+int prompt_answer(struct prompt *p, const char *directory, int location, enum prompt_action action,
+        const struct format *fmt, time_t now, char *buf, size_t len)
+{
+
+    struct tm today;
+    localtime_r(&now, &today);
+
+    struct vaktija *v = cached_day(p, 0, directory, location, today);
+
+    if (v == NULL) {
+        return -1;
+    }
+
+    struct timeline tl;
+    timeline_init(&tl);
+    timeline_add_day(&tl, v);
+
+    int needs_current = action == PROMPT_CURRENT || format_needs(fmt, FORMAT_NEEDS_CURRENT);
+
+    /* Before fajr the current vakat is yesterday's isha */
+    if (needs_current && timeline_current(&tl, now) == -1) {
+
+        struct tm yesterday = today;
+        add_days(&yesterday, -1);
+
+        struct vaktija *prev = cached_day(p, -1, directory, location, yesterday);
+
+        if (prev != NULL) {
+
+            timeline_init(&tl);
+            timeline_add_day(&tl, prev);
+            timeline_add_day(&tl, v);
+
+        }
+
+    }
+
+    struct format_ctx ctx = { 0 };
+    ctx.day = v;
+    ctx.location = location_name(location);
+    ctx.now = now;
+
+    if (action != PROMPT_CURRENT || format_needs(fmt, FORMAT_NEEDS_NEXT)) {
+
+        int idx = timeline_next(&tl, now);
+
+        /* After isha the next vakat is tomorrow's fajr */
+        if (idx == -1) {
+
+            struct tm tomorrow = today;
+            add_days(&tomorrow, 1);
+
+            struct vaktija *next = cached_day(p, 1, directory, location, tomorrow);
+
+            if (next != NULL && timeline_add_day(&tl, next) == 0) {
+                idx = timeline_next(&tl, now);
+            }
+
+        }
+
+        if (idx == -1 && action != PROMPT_CURRENT) {
+            return -1;
+        }
+
+        if (idx >= 0) {
+            ctx.next = (struct format_vakat) { timeline_day(&tl, idx), timeline_vakat(&tl, idx), tl.times[idx] };
+        }
+
+    }
+
+    if (needs_current) {
+
+        int idx = timeline_current(&tl, now);
+
+        if (idx == -1 && action == PROMPT_CURRENT) {
+            return -1;
+        }
+
+        if (idx >= 0) {
+            ctx.current = (struct format_vakat) { timeline_day(&tl, idx), timeline_vakat(&tl, idx), tl.times[idx] };
+        }
+
+    }
+
+    ctx.vakat = (action == PROMPT_CURRENT) ? ctx.current : ctx.next;
+
+    return (int) format_render(fmt, &ctx, 0, buf, len);
+
+}
@@ -0,0 +1,77 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "vactija.h"
+#include "format.h"
+#include "util/cachefile.h"
+
+/*
+    Answers for a shell prompt (next, current and countdown) from the
+    cache alone. Nothing here downloads, forks or exits, so it can run
+    inside the shell itself (see builtin/vactija_builtin.c).
+
+    Parsed days are kept between calls. A day is only read again when
+    the date, location or directory changes, or when its cache file
+    does. A day which is not cached is looked for again only once the
+    directory or its pack changes.
+*/
+enum prompt_action {
+
+    PROMPT_NEXT,
+    PROMPT_CURRENT,
+    PROMPT_COUNTDOWN,
+
+    PROMPT_ACTION_NUM
+
+};
+
+/*
+    Yesterday, today and tomorrow: current needs yesterday's isha before
+    fajr, next needs tomorrow's fajr after isha.
+*/
+#define PROMPT_DAYS 3
+
+/*
+    A cached day and the file it was read from, as it was then.
+*/
+struct prompt_day {
+
+    struct vaktija *vaktija; /* NULL if it is not in the cache */
+
+    char key[CACHE_PATH_MAX]; /* path of its record, which names the directory, location and date */
+    char source[CACHE_PATH_MAX];
+    struct stat st;
+
+    /*
+        The directory and its pack as they were when the day was looked
+        for, so a day which is not cached is only looked for again once
+        something was written there.
+    */
+    struct stat dir_st;
+    struct stat pack_st;
+    time_t looked;
+
+};
+
+struct prompt {
+
+    struct prompt_day days[PROMPT_DAYS]; /* by date, today in the middle */
+
+    int loads; /* times a day was read from the cache */
+
+};
+
+int prompt_action(const char *name);
+const char *prompt_template(enum prompt_action action);
+
+void prompt_init(struct prompt *p);
+void prompt_free(struct prompt *p);
+
+int prompt_answer(struct prompt *p, const char *directory, int location, enum prompt_action action,
+        const struct format *fmt, time_t now, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vactija.h"
+#include "derived.h"
+#include "record.h"
+#include "util/cachefile.h"
+#include "util/jsmnutil.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define RECORD_HEADER 16
+
+/*
+    FNV-1a over the payload, which is plenty to catch truncated or
+    otherwise damaged files.
+*/
+uint32_t record_checksum(const char *data, size_t len)
+{
+
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+
+        h ^= (unsigned char) data[i];
+        h *= 16777619u;
+
+    }
+
+    return h;
+
+}
+
+/*
+    Identifies the set of derived times, so records written with a
+    different set are recomputed instead of read with the wrong meaning.
+*/
+static uint32_t derived_signature(void)
+{
+
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < derived_count(); i++) {
+
+        const struct derived_time *d = derived_get(i);
+
+        char buf[128];
+        int len = snprintf(buf, sizeof buf, "%s/%d/%d;", d->name, d->a, d->b);
+
+        h ^= record_checksum(buf, len);
+        h *= 16777619u;
+
+    }
+
+    return h;
+
+}
+
+struct writer {
+
+    char *buf;
+    size_t len;
+    size_t cap;
+
+};
+
+static void put(struct writer *w, const void *data, size_t len)
+{
+
+    if (w->len + len > w->cap) {
+
+        size_t cap = (w->cap > 0) ? w->cap * 2 : 256;
+        while (cap < w->len + len) {
+            cap *= 2;
+        }
+
+        char *buf = vrealloc(w->buf, cap);
+
+        if (buf == NULL) {
+
+            int errcode = errno;
+            printf("Could not allocate enough memory to serialise record!\n");
+            vactija_error(errcode);
+
+        }
+
+        w->buf = buf;
+        w->cap = cap;
+
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+
+}
+
+static void put_i32(struct writer *w, int32_t val)
+{
+
+    put(w, &val, sizeof val);
+
+}
+
+static void put_str(struct writer *w, const char *str)
+{
+
+    size_t len = strlen(str);
+    uint16_t len16 = (len > UINT16_MAX) ? UINT16_MAX : (uint16_t) len;
+
+    put(w, &len16, sizeof len16);
+    put(w, str, len16);
+
+}
+
+/*
+    Serialises the vaktija into a newly allocated buffer (including the
+    header) and stores its size in len.
+*/
+char *serialize_record(const struct vaktija *vaktija, size_t *len)
+{
+
+    struct writer w = { NULL, 0, 0 };
+
+    /* Header, filled in once the payload is known */
+    char header[RECORD_HEADER] = { 0 };
+    put(&w, header, sizeof header);
+
+    put_i32(&w, vaktija->year);
+    put_i32(&w, vaktija->month);
+    put_i32(&w, vaktija->day);
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+        put_i32(&w, vaktija->times[i]);
+    }
+
+    put_i32(&w, (int32_t) derived_signature());
+    put_i32(&w, derived_count());
+
+    for (int i = 0; i < derived_count(); i++) {
+        put_i32(&w, vaktija->derived[i]);
+    }
+
+    put_str(&w, vaktija->location);
+
+    for (int i = 0; i < DATUM_NUM; i++) {
+        put_str(&w, vaktija->dates[i]);
+    }
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+        put_str(&w, vaktija->prayers[i]);
+    }
+
+    uint16_t version = RECORD_VERSION;
+    uint16_t flags = vaktija->derived_exact ? RECORD_EXACT : 0;
+    uint32_t payload = w.len - RECORD_HEADER;
+    uint32_t checksum = record_checksum(w.buf + RECORD_HEADER, payload);
+
+    memcpy(w.buf, RECORD_MAGIC, 4);
+    memcpy(w.buf + 4, &version, 2);
+    memcpy(w.buf + 6, &flags, 2);
+    memcpy(w.buf + 8, &checksum, 4);
+    memcpy(w.buf + 12, &payload, 4);
+
+    *len = w.len;
+
+    return w.buf;
+
+}
+
+struct reader {
+
+    const char *buf;
+    size_t len;
+    size_t off;
+
+    int failed;
+
+};
+
+static int32_t get_i32(struct reader *r)
+{
+
+    int32_t val = 0;
+
+    if (r->off + sizeof val > r->len) {
+
+        r->failed = 1;
+        return 0;
+
+    }
+
+    memcpy(&val, r->buf + r->off, sizeof val);
+    r->off += sizeof val;
+
+    return val;
+
+}
+
+static char *get_str(struct reader *r)
+{
+
+    uint16_t len;
+
+    if (r->failed || r->off + sizeof len > r->len) {
+
+        r->failed = 1;
+        return NULL;
+
+    }
+
+    memcpy(&len, r->buf + r->off, sizeof len);
+    r->off += sizeof len;
+
+    if (r->off + len > r->len) {
+
+        r->failed = 1;
+        return NULL;
+
+    }
+
+    char *str = vmalloc(len + 1);
+
+    if (str == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to read record!\n");
+        vactija_error(errcode);
+
+    }
+
+    memcpy(str, r->buf + r->off, len);
+    str[len] = '\0';
+    r->off += len;
+
+    return str;
+
+}
+
+static char **get_str_array(struct reader *r, int count)
+{
+
+    char **arr = vcalloc(count, sizeof *arr);
+
+    if (arr == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to read record!\n");
+        vactija_error(errcode);
+
+    }
+
+    for (int i = 0; i < count; i++) {
+        arr[i] = get_str(r);
+    }
+
+    return arr;
+
+}
+
+/*
+    Turns a serialised record back into a vaktija.
+
+    Returns NULL if the buffer does not hold a valid record of this
+    version, in which case the caller falls back to the JSON.
+*/
+struct vaktija *deserialize_record(const char *buf, size_t len)
+{
+
+    if (len < RECORD_HEADER || memcmp(buf, RECORD_MAGIC, 4) != 0) {
+        return NULL;
+    }
+
+    uint16_t version;
+    uint16_t flags;
+    uint32_t checksum;
+    uint32_t payload;
+
+    memcpy(&version, buf + 4, 2);
+    memcpy(&flags, buf + 6, 2);
+    memcpy(&checksum, buf + 8, 4);
+    memcpy(&payload, buf + 12, 4);
+
+    if (version != RECORD_VERSION || payload != len - RECORD_HEADER ||
+        checksum != record_checksum(buf + RECORD_HEADER, payload)) {
+
+        return NULL;
+
+    }
+
+    struct reader r = { buf + RECORD_HEADER, payload, 0, 0 };
+
+    struct vaktija *v = create_vaktija();
+    v->year = get_i32(&r);
+    v->month = get_i32(&r);
+    v->day = get_i32(&r);
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+        v->times[i] = get_i32(&r);
+    }
+
+    uint32_t signature = (uint32_t) get_i32(&r);
+    int nderived = get_i32(&r);
+
+    for (int i = 0; i < nderived && !r.failed; i++) {
+
+        int32_t val = get_i32(&r);
+
+        if (i < DERIVED_MAX) {
+            v->derived[i] = val;
+        }
+
+    }
+
+    v->location = get_str(&r);
+    v->dates = get_str_array(&r, DATUM_NUM);
+    v->prayers = get_str_array(&r, PRAYER_TIME_NUM);
+
+    if (r.failed) {
+
+        /* Checksum matched, so only a bug could get us here */
+        vfree(v->location);
+        free_array(v->dates, DATUM_NUM);
+        free_array(v->prayers, PRAYER_TIME_NUM);
+        vfree(v);
+
+        return NULL;
+
+    }
+
+    v->derived_exact = (flags & RECORD_EXACT) != 0;
+
+    if (signature != derived_signature() || nderived != derived_count()) {
+        derive_times(v, NULL);
+    }
+
+    return v;
+
+}
+
+/*
+    Writes the vaktija as a binary record to the cache file at path.
+
+    Returns 0 on success, or -1 with errno set if it could not be
+    written (see store_cache_data), which is safe in worker threads.
+*/
+int write_record(const char *path, const struct vaktija *vaktija)
+{
+
+    size_t len;
+    char *buf = serialize_record(vaktija, &len);
+
+    int result = store_cache_data(path, buf, len);
+    int errcode = errno;
+
+    vfree(buf);
+    errno = errcode;
+
+    return result;
+
+}
+
+/*
+    Reads the binary record cached at path, or returns NULL if there is
+    none (or it is damaged or from another version).
+*/
+struct vaktija *read_record(const char *path)
+{
+
+    size_t len;
+    char *buf = read_cache_data(path, &len);
+
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    struct vaktija *v = deserialize_record(buf, len);
+
+    vfree(buf);
+
+    return v;
+
+}
@@ -0,0 +1,33 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vactija.h"
+
+/*
+    Parsed vaktija records are cached in a small binary format next to
+    the raw JSON, so a cache hit never has to tokenise JSON again:
+
+        "VKTR", u16 version, u16 flags, u32 checksum, u32 payload length
+
+    followed by the payload (date, times, derived times and the strings,
+    each as u16 length and bytes). Everything is in native byte order,
+    since the cache is never shared between machines.
+*/
+#define RECORD_MAGIC "VKTR"
+#define RECORD_VERSION 1
+#define RECORD_EXT "rec"
+
+#define RECORD_EXACT 0x1 /* derived times were computed with the next day */
+
+char *serialize_record(const struct vaktija *vaktija, size_t *len);
+struct vaktija *deserialize_record(const char *buf, size_t len);
+
+int write_record(const char *path, const struct vaktija *vaktija);
+struct vaktija *read_record(const char *path);
+
+uint32_t record_checksum(const char *data, size_t len);
+
+#endif
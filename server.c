@@ -0,0 +1,1500 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "vactija.h"
+#include "server.h"
+#include "pack.h"
+#include "locations.h"
+#include "metrics.h"
+#include "util/temporal.h"
+#include "util/cachefile.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+#define SERVE_MAX_EVENTS 256
+#define SERVE_CONN_BUF 4096
+
+/*
+    Size of the in-memory response table (must be a power of two).
+    Each entry is one (location, date) key, so this comfortably holds
+    every location for weeks worth of days. Past three quarters full,
+    every new entry evicts an old one (see table_evict).
+*/
+#define SERVE_TABLE_SIZE 16384
+#define SERVE_TABLE_LOAD (SERVE_TABLE_SIZE / 4 * 3)
+
+#define SERVE_FLIGHT_BUCKETS 1024
+
+/*
+    Location IDs are small numbers, so the locations asked for so far
+    (which get prefetched before midnight) are tracked in a flag array.
+*/
+#define SERVE_MAX_LOCATION 1000
+
+/*
+    Responses are stored fully serialised (status line, headers and body)
+    and shared by every connection sending them, so a cache hit is a
+    single table lookup followed by write().
+*/
+struct response {
+
+    int refs;
+    size_t len;
+    char data[];
+
+};
+
+struct entry {
+
+    char key[CACHE_KEY_MAX];
+    struct response *resp;
+
+    time_t expires; /* 0 if the entry never expires */
+    int referenced; /* hit since the eviction hand last passed it */
+
+};
+
+struct conn {
+
+    int fd;
+
+    char in[SERVE_CONN_BUF];
+    size_t inlen;
+
+    struct response *out;
+    size_t outoff;
+
+    int close_after; /* close once the current response is sent */
+    int eof;         /* peer finished sending, close once idle */
+    int waiting;     /* waiting for an upstream fetch to complete */
+    int dead;        /* closed, free once no fetch refers to us */
+
+    struct conn *next_dead;
+    struct conn *next_waiter;
+
+};
+
+/*
+    A cache miss handed to the worker threads. The body is filled
+    in by the worker (NULL if the fetch failed).
+
+    Only one job exists per key at a time: it is registered in the
+    flight table until it completes, and every connection asking for
+    the key in the meantime joins its list of waiters instead of
+    starting another fetch (single-flight). At midnight rollover this
+    keeps upstream requests at one per distinct key, no matter how
+    many clients ask for it.
+*/
+struct job {
+
+    char key[CACHE_KEY_MAX];
+    char loc[16];
+    char datepath[VAKTIJA_DATE_PATH_MAX];
+    int month; /* the key is a whole month rather than a day */
+
+    char *body;
+
+    struct conn *waiters;
+
+    struct job *next;
+    struct job *next_flight;
+
+};
+
+struct job_queue {
+
+    struct job *head;
+    struct job *tail;
+
+};
+
+static const struct serve_options *options;
+static struct pack *packed; /* the compacted cache, if there is one */
+
+static int epfd = -1;
+static int listenfd = -1;
+static int notifyfd = -1;
+static int timerfd = -1;
+
+/* Markers used as epoll data for the non-connection descriptors */
+static char listen_marker;
+static char notify_marker;
+static char timer_marker;
+
+static struct entry table[SERVE_TABLE_SIZE];
+static int table_used = 0;
+static uint32_t table_hand = 0;
+
+static struct job *flights[SERVE_FLIGHT_BUCKETS];
+
+static unsigned char seen_locations[SERVE_MAX_LOCATION];
+static time_t prefetch_at = 0;
+
+static char api_path[256];
+static size_t api_pathlen = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct job_queue pending = { NULL, NULL };
+static struct job_queue finished = { NULL, NULL };
+
+/*
+    Closed connections are only freed once the current batch of events
+    has been handled, since a later event in it may still refer to them.
+*/
+static struct conn *graveyard = NULL;
+
+static struct response *resp_bad_request;
+static struct response *resp_not_found;
+static struct response *resp_bad_method;
+static struct response *resp_bad_gateway;
+
+static void conn_process(struct conn *c);
+static void conn_read(struct conn *c);
+static void arm_prefetch(void);
+
+static void queue_push(struct job_queue *q, struct job *j)
+{
+
+    j->next = NULL;
+
+    if (q->tail != NULL) {
+        q->tail->next = j;
+    } else {
+        q->head = j;
+    }
+
+    q->tail = j;
+
+}
+
+static struct job *queue_pop(struct job_queue *q)
+{
+
+    struct job *j = q->head;
+
+    if (j != NULL) {
+
+        q->head = j->next;
+
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+
+    }
+
+    return j;
+
+}
+
+static struct response *make_response(const char *status, const char *type, const char *body)
+{
+
+    size_t bodylen = strlen(body);
+
+    char head[256];
+    int headlen = snprintf(head, sizeof head,
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "\r\n", status, type, bodylen);
+
+    struct response *r = vmalloc(sizeof *r + headlen + bodylen);
+
+    if (r == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store a response!\n");
+        vactija_error(errcode);
+
+    }
+
+    r->refs = 1;
+    r->len = headlen + bodylen;
+    memcpy(r->data, head, headlen);
+    memcpy(r->data + headlen, body, bodylen);
+
+    return r;
+
+}
+
+static void release_response(struct response *r)
+{
+
+    if (--r->refs == 0) {
+        vfree(r);
+    }
+
+}
+
+/*
+    FNV-1a, which is plenty for short keys like "77-2022-02-19".
+*/
+static uint32_t hash_key(const char *key)
+{
+
+    uint32_t h = 2166136261u;
+
+    for (; *key != '\0'; key++) {
+
+        h ^= (unsigned char) *key;
+        h *= 16777619u;
+
+    }
+
+    return h;
+
+}
+
+static struct entry *table_find(const char *key)
+{
+
+    uint32_t i = hash_key(key) & (SERVE_TABLE_SIZE - 1);
+
+    while (table[i].resp != NULL) {
+
+        if (strcmp(table[i].key, key) == 0) {
+            return &table[i];
+        }
+
+        i = (i + 1) & (SERVE_TABLE_SIZE - 1);
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Empties the slot of e, moving the entries probed past it back so
+    that every entry can still be found without tombstones.
+*/
+static void table_remove(struct entry *e)
+{
+
+    uint32_t i = e - table;
+    uint32_t j = i;
+
+    release_response(e->resp);
+
+    for (;;) {
+
+        j = (j + 1) & (SERVE_TABLE_SIZE - 1);
+
+        if (table[j].resp == NULL) {
+            break;
+        }
+
+        /* The entry at j may fill the hole unless its home slot lies after the hole */
+        uint32_t home = hash_key(table[j].key) & (SERVE_TABLE_SIZE - 1);
+
+        if (((j - home) & (SERVE_TABLE_SIZE - 1)) >= ((j - i) & (SERVE_TABLE_SIZE - 1))) {
+
+            table[i] = table[j];
+            i = j;
+
+        }
+
+    }
+
+    memset(&table[i], 0, sizeof table[i]);
+    table_used--;
+
+}
+
+/*
+    Drops one entry to make room, going round the table like a clock:
+    the first entry which has expired, or has not been hit since the
+    hand last passed it, goes. Hit entries get another round, so the
+    days being asked for stay while stale negative entries and days
+    nobody asks for any more are reclaimed.
+*/
+static void table_evict(void)
+{
+
+    time_t now = time(NULL);
+
+    for (;;) {
+
+        struct entry *e = &table[table_hand];
+        table_hand = (table_hand + 1) & (SERVE_TABLE_SIZE - 1);
+
+        if (e->resp == NULL) {
+            continue;
+        }
+
+        if ((e->expires != 0 && e->expires <= now) || !e->referenced) {
+
+            table_remove(e);
+            metric_add(METRIC_CACHE_EVICTIONS, 1);
+            return;
+
+        }
+
+        e->referenced = 0;
+
+    }
+
+}
+
+/*
+    Stores the response under key, evicting another entry first if the
+    table is full. If ttl is above 0, the entry expires after that many
+    seconds, otherwise it is kept until evicted.
+*/
+static void table_insert(const char *key, struct response *resp, int ttl)
+{
+
+    struct entry *e = table_find(key);
+
+    if (e == NULL) {
+
+        if (table_used >= SERVE_TABLE_LOAD) {
+            table_evict();
+        }
+
+        uint32_t i = hash_key(key) & (SERVE_TABLE_SIZE - 1);
+        while (table[i].resp != NULL) {
+            i = (i + 1) & (SERVE_TABLE_SIZE - 1);
+        }
+
+        e = &table[i];
+        strcpy(e->key, key);
+        table_used++;
+
+    } else {
+
+        release_response(e->resp);
+
+    }
+
+    resp->refs++;
+    e->resp = resp;
+    e->expires = (ttl > 0) ? time(NULL) + ttl : 0;
+    e->referenced = 1;
+
+}
+
+static struct job *flight_find(const char *key)
+{
+
+    struct job *j = flights[hash_key(key) & (SERVE_FLIGHT_BUCKETS - 1)];
+
+    while (j != NULL && strcmp(j->key, key) != 0) {
+        j = j->next_flight;
+    }
+
+    return j;
+
+}
+
+static void flight_add(struct job *j)
+{
+
+    struct job **bucket = &flights[hash_key(j->key) & (SERVE_FLIGHT_BUCKETS - 1)];
+
+    j->next_flight = *bucket;
+    *bucket = j;
+
+}
+
+static void flight_remove(struct job *j)
+{
+
+    struct job **p = &flights[hash_key(j->key) & (SERVE_FLIGHT_BUCKETS - 1)];
+
+    while (*p != j) {
+        p = &(*p)->next_flight;
+    }
+
+    *p = j->next_flight;
+
+}
+
+/*
+    Checks that the body is a vaktija for the job's key (a single day or
+    a whole month) before it is cached and handed out, without exiting
+    like the parsers would.
+*/
+static int valid_body(const struct job *j, const char *body)
+{
+
+    return j->month ? valid_month(body) : valid_vaktija(body);
+
+}
+
+/*
+    Worker thread: takes cache misses off the queue and resolves them
+    from the keyed cache directory or, failing that, the upstream API.
+*/
+static void *fetch_worker(void *arg)
+{
+
+    (void) arg;
+
+    for (;;) {
+
+        pthread_mutex_lock(&queue_lock);
+
+        while (pending.head == NULL) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+
+        struct job *j = queue_pop(&pending);
+
+        pthread_mutex_unlock(&queue_lock);
+
+        metric_add(METRIC_QUEUE_DEPTH, -1);
+        uint64_t start = metrics_clock();
+
+        char path[CACHE_PATH_MAX];
+        int cached = options->cachedir != NULL &&
+            cache_path(path, sizeof path, options->cachedir, j->key, "json") > 0;
+
+        size_t len;
+
+        /* Nothing here may exit: a broken disk or upstream only fails this request */
+        if (cached && cache_exists(path) && (j->body = read_cache_data(path, &len)) == NULL) {
+            printf("Could not read the cache file %s, asking upstream!\n", path);
+        }
+
+        if (j->body == NULL && cached && packed != NULL) {
+            j->body = pack_json(packed, j->key); /* compacted by "vactija cache compact" */
+        }
+
+        if (j->body != NULL && !valid_body(j, j->body)) {
+
+            printf("Cached data for %s is invalid, asking upstream!\n", j->key);
+            vfree(j->body);
+            j->body = NULL;
+
+        }
+
+        if (j->body != NULL) {
+
+            metric_add(METRIC_DISK_HITS, 1);
+
+        } else {
+
+            j->body = fetch_vaktija(j->loc, j->datepath);
+
+            if (j->body != NULL && !valid_body(j, j->body)) {
+
+                printf("Upstream returned invalid data for %s!\n", j->key);
+                metric_add(METRIC_UPSTREAM_ERRORS, 1);
+                vfree(j->body);
+                j->body = NULL;
+
+            }
+
+            /* Still served if it cannot be kept, it is only fetched again next time */
+            if (j->body != NULL && cached && store_cache_data(path, j->body, strlen(j->body)) != 0) {
+                printf("Could not write the cache file %s: %s\n", path, strerror(errno));
+            }
+
+        }
+
+        metric_observe(HISTOGRAM_REFRESH, metrics_clock() - start);
+
+        pthread_mutex_lock(&queue_lock);
+        queue_push(&finished, j);
+        pthread_mutex_unlock(&queue_lock);
+
+        uint64_t one = 1;
+        if (write(notifyfd, &one, sizeof one) < 0) {
+            perror("write");
+        }
+
+    }
+
+    return NULL;
+
+}
+
+static void conn_bury(struct conn *c)
+{
+
+    c->next_dead = graveyard;
+    graveyard = c;
+
+}
+
+static void free_graveyard(void)
+{
+
+    while (graveyard != NULL) {
+
+        struct conn *c = graveyard;
+        graveyard = c->next_dead;
+
+        if (c->out != NULL) {
+            release_response(c->out);
+        }
+
+        vfree(c);
+
+    }
+
+}
+
+static void conn_close(struct conn *c)
+{
+
+    if (c->fd >= 0) {
+
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+
+        metric_add(METRIC_CONNECTIONS, -1);
+
+    }
+
+    c->dead = 1;
+
+    if (!c->waiting) {
+        conn_bury(c); /* otherwise the fetch still refers to us */
+    }
+
+}
+
+/*
+    Writes as much of the pending response as the socket takes.
+
+    Returns 0 once the response is fully sent (or the connection was
+    closed), and 1 if it has to wait for the socket to become writable.
+*/
+static int conn_flush(struct conn *c)
+{
+
+    while (c->outoff < c->out->len) {
+
+        ssize_t n = send(c->fd, c->out->data + c->outoff, c->out->len - c->outoff, MSG_NOSIGNAL);
+
+        if (n < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+
+            conn_close(c);
+            return 0;
+
+        }
+
+        c->outoff += n;
+
+    }
+
+    release_response(c->out);
+    c->out = NULL;
+    c->outoff = 0;
+
+    if (c->close_after) {
+
+        conn_close(c);
+        return 0;
+
+    }
+
+    return 0;
+
+}
+
+static void conn_send(struct conn *c, struct response *resp)
+{
+
+    resp->refs++;
+    c->out = resp;
+    c->outoff = 0;
+
+    conn_flush(c);
+
+}
+
+/*
+    Maps a request path onto the cache key and the date path used for the
+    upstream request. Dates are filled in the same way the CLI does it, so
+    "/vaktija/v1/77" is served from today's entry for location 77, while
+    "/vaktija/v1/77/2022/2" is the entry for the whole month.
+
+    Returns 1 on success, 0 if the path is not a vaktija path.
+*/
+static int resolve_path(const char *path, struct job *j)
+{
+
+    if (strncmp(path, api_path, api_pathlen) != 0) {
+        return 0;
+    }
+
+    const char *rest = path + api_pathlen;
+
+    size_t loclen = 0;
+    while (isdigit((unsigned char) rest[loclen])) {
+        loclen++;
+    }
+
+    if (loclen == 0 || loclen >= sizeof j->loc) {
+        return 0;
+    }
+
+    memcpy(j->loc, rest, loclen);
+    j->loc[loclen] = '\0';
+    rest += loclen;
+
+    /* Unknown locations are never asked for upstream */
+    if (location_id(j->loc) < 0) {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    struct tm today;
+    localtime_r(&now, &today);
+
+    struct tm date = today;
+    int parts = 0;
+
+    if (*rest == '/' && rest[1] != '\0') {
+
+        char datestr[16];
+        size_t datelen = strlen(rest + 1);
+
+        if (datelen >= sizeof datestr) {
+            return 0;
+        }
+
+        memcpy(datestr, rest + 1, datelen + 1);
+
+        if (datestr[datelen - 1] == '/') {
+            datestr[datelen - 1] = '\0';
+        }
+
+        parts = parse_datestr(datestr, &today, &date);
+
+        if (parts == 0) {
+            return 0;
+        }
+
+    } else if (*rest != '\0' && strcmp(rest, "/") != 0) {
+
+        return 0;
+
+    }
+
+    int year = date.tm_year + 1900;
+    int mon = date.tm_mon + 1;
+
+    if (parts == 2) {
+
+        j->month = 1;
+        snprintf(j->datepath, sizeof j->datepath, "%d/%d", year, mon);
+
+        return cache_key(j->key, sizeof j->key, j->loc, year, mon, 0) > 0;
+
+    }
+
+    snprintf(j->datepath, sizeof j->datepath, "%d/%d/%d", year, mon, date.tm_mday);
+
+    return cache_key(j->key, sizeof j->key, j->loc, year, mon, date.tm_mday) > 0;
+
+}
+
+/*
+    Registers the job in the flight table and hands it to the workers.
+*/
+static void start_fetch(struct job *j)
+{
+
+    flight_add(j);
+    metric_add(METRIC_QUEUE_DEPTH, 1);
+
+    pthread_mutex_lock(&queue_lock);
+    queue_push(&pending, j);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+}
+
+/*
+    Starts fetches (without anyone waiting on them) for the days after
+    today at the location, unless they are cached or already on the way.
+*/
+static void prefetch_location(int loc, const struct tm *today)
+{
+
+    for (int d = 1; d <= options->prefetch_days; d++) {
+
+        struct tm date = *today;
+        add_days(&date, d);
+
+        int year = date.tm_year + 1900;
+        int mon = date.tm_mon + 1;
+
+        struct job *j = vcalloc(1, sizeof *j);
+
+        if (j == NULL) {
+            return;
+        }
+
+        snprintf(j->loc, sizeof j->loc, "%d", loc);
+        snprintf(j->datepath, sizeof j->datepath, "%d/%d/%d", year, mon, date.tm_mday);
+        cache_key(j->key, sizeof j->key, j->loc, year, mon, date.tm_mday);
+
+        struct entry *e = table_find(j->key);
+
+        if ((e != NULL && e->resp != resp_bad_gateway && (e->expires == 0 || e->expires > time(NULL))) ||
+            flight_find(j->key) != NULL) {
+
+            vfree(j);
+            continue;
+
+        }
+
+        start_fetch(j);
+
+    }
+
+}
+
+/*
+    Runs when the prefetch timer fires, some time before midnight, and
+    prefetches the following days for every location asked for so far.
+    This way the date changing is a switch to entries which are already
+    in the table, rather than a wave of misses.
+*/
+static void prefetch(void)
+{
+
+    uint64_t expirations;
+    if (read(timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN) {
+        perror("read");
+    }
+
+    time_t now = time(NULL);
+    struct tm today;
+    localtime_r(&now, &today);
+
+    int count = 0;
+    for (int loc = 0; loc < SERVE_MAX_LOCATION; loc++) {
+
+        if (seen_locations[loc]) {
+
+            prefetch_location(loc, &today);
+            count++;
+
+        }
+
+    }
+
+    printf("Prefetching %d day(s) ahead for %d location(s)\n", options->prefetch_days, count);
+
+    arm_prefetch();
+
+}
+
+/*
+    Arms the prefetch timer for the next time it is due, i.e
+    prefetch_before seconds before the coming midnight (or the
+    one after, if that point has passed today).
+*/
+static void arm_prefetch(void)
+{
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    tm.tm_mday += 1;
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+
+    time_t at = mktime(&tm) - options->prefetch_before;
+
+    if (at <= now) {
+
+        tm.tm_mday += 1;
+        tm.tm_isdst = -1;
+        at = mktime(&tm) - options->prefetch_before;
+
+    }
+
+    prefetch_at = at;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof its);
+    its.it_value.tv_sec = at;
+
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        perror("timerfd_settime");
+    }
+
+}
+
+/*
+    Answers a scrape with the metrics of every thread, rendered afresh.
+*/
+static void send_metrics(struct conn *c)
+{
+
+    char *text = metrics_render();
+    struct response *resp = make_response("200 OK",
+            "application/openmetrics-text; version=1.0.0; charset=utf-8", text);
+
+    vfree(text);
+
+    conn_send(c, resp);
+    release_response(resp);
+
+}
+
+/*
+    Remembers that the location was asked for. A location showing up
+    for the first time after today's prefetch already ran is prefetched
+    right away.
+*/
+static void remember_location(const char *loc)
+{
+
+    int id = atoi(loc);
+
+    if (options->prefetch_days <= 0 || id < 0 || id >= SERVE_MAX_LOCATION || seen_locations[id]) {
+        return;
+    }
+
+    seen_locations[id] = 1;
+
+    time_t now = time(NULL);
+
+    if (prefetch_at - now > 86400 - options->prefetch_before) {
+
+        struct tm today;
+        localtime_r(&now, &today);
+
+        prefetch_location(id, &today);
+
+    }
+
+}
+
+static void handle_request(struct conn *c, const char *method, const char *path)
+{
+
+    metric_add(METRIC_REQUESTS, 1);
+
+    if (strcmp(method, "GET") != 0) {
+
+        c->close_after = 1;
+        conn_send(c, resp_bad_method);
+        return;
+
+    }
+
+    if (strcmp(path, "/metrics") == 0) {
+
+        send_metrics(c);
+        return;
+
+    }
+
+    struct job *j = vcalloc(1, sizeof *j);
+
+    if (j == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to queue a fetch!\n");
+        vactija_error(errcode);
+
+    }
+
+    if (!resolve_path(path, j)) {
+
+        vfree(j);
+        conn_send(c, resp_not_found);
+        return;
+
+    }
+
+    remember_location(j->loc);
+
+    struct entry *e = table_find(j->key);
+
+    if (e != NULL && (e->expires == 0 || e->expires > time(NULL))) {
+
+        metric_add(METRIC_CACHE_HITS, 1);
+        e->referenced = 1;
+
+        vfree(j);
+        conn_send(c, e->resp);
+        return;
+
+    }
+
+    metric_add(METRIC_CACHE_MISSES, 1);
+    c->waiting = 1;
+
+    struct job *flight = flight_find(j->key);
+
+    if (flight != NULL) {
+
+        /* Someone already fetches this key, wait for their result */
+        vfree(j);
+        c->next_waiter = flight->waiters;
+        flight->waiters = c;
+        return;
+
+    }
+
+    c->next_waiter = NULL;
+    j->waiters = c;
+
+    start_fetch(j);
+
+}
+
+/*
+    Handles every complete request in the input buffer, one at a time,
+    until the connection has to wait on a write or an upstream fetch.
+*/
+static void conn_process(struct conn *c)
+{
+
+    while (c->fd >= 0 && c->out == NULL && !c->waiting) {
+
+        char *end = NULL;
+        if (c->inlen >= 4) {
+            c->in[c->inlen] = '\0';
+            end = strstr(c->in, "\r\n\r\n");
+        }
+
+        if (end == NULL) {
+
+            if (c->inlen >= SERVE_CONN_BUF - 1) {
+
+                c->inlen = 0;
+                c->close_after = 1;
+                conn_send(c, resp_bad_request);
+
+            }
+
+            return;
+
+        }
+
+        size_t reqlen = (end - c->in) + 4;
+        *end = '\0';
+
+        char method[8];
+        char path[256];
+        char version[16];
+
+        if (sscanf(c->in, "%7s %255s %15s", method, path, version) != 3) {
+
+            c->inlen = 0;
+            c->close_after = 1;
+            conn_send(c, resp_bad_request);
+            return;
+
+        }
+
+        /* HTTP/1.1 keeps connections alive unless told otherwise, 1.0 the opposite */
+        int keepalive = strcmp(version, "HTTP/1.1") == 0;
+
+        for (char *line = strstr(c->in, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+
+            if (strncasecmp(line + 2, "Connection:", 11) == 0) {
+
+                const char *val = line + 13;
+                while (*val == ' ') {
+                    val++;
+                }
+
+                if (strncasecmp(val, "close", 5) == 0) {
+                    keepalive = 0;
+                } else if (strncasecmp(val, "keep-alive", 10) == 0) {
+                    keepalive = 1;
+                }
+
+            }
+
+        }
+
+        char *query = strchr(path, '?');
+        if (query != NULL) {
+            *query = '\0';
+        }
+
+        memmove(c->in, c->in + reqlen, c->inlen - reqlen);
+        c->inlen -= reqlen;
+        c->close_after = !keepalive;
+
+        handle_request(c, method, path);
+
+    }
+
+}
+
+/*
+    Reads whatever is available (connections are edge-triggered, so
+    this has to drain the socket) and processes the requests. This is
+    also how a connection resumes after a response or fetch completes.
+*/
+static void conn_read(struct conn *c)
+{
+
+    for (;;) {
+
+        int drained = c->eof;
+
+        while (!drained && c->fd >= 0 && c->inlen < SERVE_CONN_BUF - 1) {
+
+            ssize_t n = recv(c->fd, c->in + c->inlen, SERVE_CONN_BUF - 1 - c->inlen, 0);
+
+            if (n > 0) {
+
+                c->inlen += n;
+
+            } else if (n == 0) {
+
+                c->eof = drained = 1;
+
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+
+                drained = 1;
+
+            } else if (errno != EINTR) {
+
+                conn_close(c);
+
+            }
+
+        }
+
+        if (c->fd < 0) {
+            return;
+        }
+
+        size_t before = c->inlen;
+        conn_process(c);
+
+        if (c->fd < 0) {
+            return;
+        }
+
+        if (c->out != NULL || c->waiting) {
+            return;
+        }
+
+        if (c->eof) {
+
+            conn_close(c); /* nothing left to answer */
+            return;
+
+        }
+
+        if (drained || c->inlen == before) {
+            return;
+        }
+
+    }
+
+}
+
+static void accept_conns(void)
+{
+
+    for (;;) {
+
+        int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+
+            return;
+
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+        struct conn *c = vcalloc(1, sizeof *c);
+
+        if (c == NULL) {
+
+            close(fd);
+            continue;
+
+        }
+
+        c->fd = fd;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+
+            perror("epoll_ctl");
+            close(fd);
+            vfree(c);
+            continue;
+
+        }
+
+        metric_add(METRIC_CONNECTIONS, 1);
+
+    }
+
+}
+
+/*
+    Takes the finished fetches from the workers, stores successful
+    responses in the table and answers the waiting connections.
+*/
+static void complete_jobs(void)
+{
+
+    uint64_t count;
+    if (read(notifyfd, &count, sizeof count) < 0 && errno != EAGAIN) {
+        perror("read");
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    struct job_queue done = finished;
+    finished.head = finished.tail = NULL;
+    pthread_mutex_unlock(&queue_lock);
+
+    struct job *j;
+    while ((j = queue_pop(&done)) != NULL) {
+
+        flight_remove(j);
+
+        struct response *resp;
+
+        if (j->body != NULL) {
+
+            resp = make_response("200 OK", "application/json; charset=utf-8", j->body);
+            table_insert(j->key, resp, options->ttl);
+            vfree(j->body);
+
+        } else {
+
+            /*
+                Failures are cached for a short while as well, so a
+                failing upstream is not hammered by every client.
+            */
+            resp = resp_bad_gateway;
+            resp->refs++;
+            table_insert(j->key, resp, options->negative_ttl);
+
+        }
+
+        struct conn *c = j->waiters;
+        while (c != NULL) {
+
+            struct conn *next = c->next_waiter;
+            c->waiting = 0;
+
+            if (c->dead) {
+
+                conn_bury(c);
+
+            } else {
+
+                conn_send(c, resp);
+
+                if (c->fd >= 0 && c->out == NULL) {
+                    conn_read(c);
+                }
+
+            }
+
+            c = next;
+
+        }
+
+        release_response(resp);
+        vfree(j);
+
+    }
+
+}
+
+static int open_listener(const char *addr, int port)
+{
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+
+        int errcode = errno;
+        printf("Could not create the listening socket!\n");
+        vactija_error(errcode);
+
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+
+        printf("Invalid listen address: %s\n", addr);
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (bind(fd, (struct sockaddr *) &sa, sizeof sa) != 0 || listen(fd, SOMAXCONN) != 0) {
+
+        int errcode = errno;
+        printf("Could not listen on %s:%d!\n", addr, port);
+        vactija_error(errcode);
+
+    }
+
+    return fd;
+
+}
+
+/*
+    The proxy serves the same paths as the upstream API, so the path
+    prefix is taken from VAKTIJA_API_URL (e.g "/vaktija/v1/").
+*/
+static void init_api_path(void)
+{
+
+    const char *url = VAKTIJA_API_URL;
+    const char *p = strstr(url, "://");
+    p = (p != NULL) ? strchr(p + 3, '/') : NULL;
+
+    snprintf(api_path, sizeof api_path, "%s", (p != NULL) ? p : "/");
+    api_pathlen = strlen(api_path);
+
+}
+
+/*
+    Connections are cheap for us, but the default descriptor limit
+    (often 1024) is not enough for thousands of keep-alive clients.
+*/
+static void raise_fd_limit(void)
+{
+
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+
+    }
+
+}
+
+/*
+    Runs the caching proxy for the vaktija API: an epoll loop accepting
+    HTTP/1.1 keep-alive connections, answering from the in-memory table
+    of serialised responses and handing misses to worker threads, which
+    look in the keyed cache directory before going upstream.
+
+    Only returns on fatal errors.
+*/
+int serve_http(const struct serve_options *opts)
+{
+
+    options = opts;
+
+    setvbuf(stdout, NULL, _IOLBF, 0); /* workers log from other threads */
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+    init_api_path();
+
+    if (opts->cachedir != NULL) {
+
+        cache_prepare_dir(opts->cachedir);
+
+        char path[CACHE_PATH_MAX];
+        if (cache_path(path, sizeof path, opts->cachedir, "cache", "pack") > 0) {
+            packed = pack_open(path);
+        }
+
+    }
+
+    resp_bad_request = make_response("400 Bad Request", "text/plain", "Bad Request\n");
+    resp_not_found = make_response("404 Not Found", "text/plain", "Not Found\n");
+    resp_bad_method = make_response("405 Method Not Allowed", "text/plain", "Method Not Allowed\n");
+    resp_bad_gateway = make_response("502 Bad Gateway", "text/plain", "Bad Gateway\n");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    notifyfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    listenfd = open_listener(opts->addr, opts->port);
+
+    if (epfd < 0 || notifyfd < 0) {
+
+        int errcode = errno;
+        printf("Could not set up the event loop!\n");
+        vactija_error(errcode);
+
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_marker;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &notify_marker;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, notifyfd, &ev);
+
+    if (opts->prefetch_days > 0) {
+
+        timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (timerfd < 0) {
+
+            int errcode = errno;
+            printf("Could not create the prefetch timer!\n");
+            vactija_error(errcode);
+
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &timer_marker;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+
+        arm_prefetch();
+
+    }
+
+    int workers = (opts->workers > 0) ? opts->workers : 1;
+    for (int i = 0; i < workers; i++) {
+
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, fetch_worker, NULL) != 0) {
+
+            printf("Could not start fetch worker!\n");
+            exit(EXIT_FAILURE);
+
+        }
+
+        pthread_detach(tid);
+
+    }
+
+    printf("Serving %s on %s:%d\n", api_path, opts->addr, opts->port);
+    fflush(stdout);
+
+    struct epoll_event events[SERVE_MAX_EVENTS];
+
+    for (;;) {
+
+        int n = epoll_wait(epfd, events, SERVE_MAX_EVENTS, -1);
+
+        if (n < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            int errcode = errno;
+            printf("Event loop failed!\n");
+            vactija_error(errcode);
+
+        }
+
+        for (int i = 0; i < n; i++) {
+
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &listen_marker) {
+
+                accept_conns();
+
+            } else if (ptr == &notify_marker) {
+
+                complete_jobs();
+
+            } else if (ptr == &timer_marker) {
+
+                prefetch();
+
+            } else {
+
+                struct conn *c = ptr;
+
+                if (c->dead) {
+                    continue;
+                }
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+
+                    conn_close(c);
+
+                } else if ((events[i].events & EPOLLOUT) && c->out != NULL) {
+
+                    if (conn_flush(c) == 0 && c->fd >= 0) {
+                        conn_read(c);
+                    }
+
+                } else if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+
+                    conn_read(c);
+
+                }
+
+            }
+
+        }
+
+        free_graveyard();
+
+    }
+
+    return 0;
+
+}
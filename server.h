@@ -0,0 +1,26 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+    Settings for the serve mode, filled in by the CLI from config.h
+    and the command-line flags.
+*/
+struct serve_options {
+
+    const char *addr;     /* address the HTTP listener binds to */
+    int port;             /* port of the HTTP listener */
+
+    int workers;          /* number of threads fetching cache misses */
+    int ttl;              /* seconds a fetched entry is served from memory, 0 for good */
+    int negative_ttl;     /* seconds a failed fetch is remembered for */
+
+    int prefetch_days;    /* days after today to prefetch, 0 to disable */
+    int prefetch_before;  /* seconds before midnight to prefetch at */
+
+    const char *cachedir; /* keyed cache directory, NULL for memory only */
+
+};
+
+int serve_http(const struct serve_options *opts);
+
+#endif
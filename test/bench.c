@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/*
+    Cold-start benchmark of the CLI on a cache hit, which is what nearly
+    every invocation is.
+
+    Runs the release binary against a prepared cache, reports how long
+    a start takes and what it allocates, and fails if it takes longer than the budget or if
+    libcurl gets loaded at all. For comparison it also measures what
+    loading libcurl alone costs.
+
+    Usage: vactija-bench <vactija binary> [runs]
+    The budget (in ms, for the median) can be set in VACTIJA_BENCH_BUDGET_MS.
+*/
+
+#define DUMMY_CACHE_FILE "testrel/dummycache"
+#define BENCH_KEY "77-2022-02-19"
+#define BENCH_DATE "2022/02/19"
+#define DEFAULT_RUNS 200
+#define DEFAULT_BUDGET_MS 10.0
+
+static double now_ms(void)
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+
+}
+
+static int compare_double(const void *a, const void *b)
+{
+
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+
+}
+
+static int copy_file(const char *from, const char *to)
+{
+
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+
+    if (in == NULL || out == NULL) {
+        return -1;
+    }
+
+    char buf[4096];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof buf, in)) > 0) {
+        fwrite(buf, 1, n, out);
+    }
+
+    fclose(in);
+
+    return fclose(out);
+
+}
+
+/*
+    Runs the binary once on the cached day with stdout discarded and
+    returns how long it took in ms, or -1 if it failed.
+*/
+static double run_once(const char *binary, const char *cachedir, char **envp)
+{
+
+    double start = now_ms();
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+
+        char *argv[] = {
+            (char *) binary, "-d", (char *) cachedir, "-l", "77",
+            "-y", BENCH_DATE, "print", NULL
+        };
+
+        execve(binary, argv, envp);
+        _exit(127);
+
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    return now_ms() - start;
+
+}
+
+/*
+    Returns 1 if the dynamic loader reports loading libcurl for one run
+    of the binary, 0 if not, and -1 if that could not be found out.
+*/
+static int loads_curl(const char *binary, const char *cachedir)
+{
+
+    char prefix[256];
+    snprintf(prefix, sizeof prefix, "%s/ld", cachedir);
+
+    char debug_output[300];
+    snprintf(debug_output, sizeof debug_output, "LD_DEBUG_OUTPUT=%s", prefix);
+
+    char *envp[] = { "LD_DEBUG=files", debug_output, NULL };
+
+    if (run_once(binary, cachedir, envp) < 0) {
+        return -1;
+    }
+
+    /* The loader writes to <prefix>.<pid> */
+    char cmd[600];
+    snprintf(cmd, sizeof cmd, "cat %s.* 2>/dev/null", prefix);
+
+    FILE *debug = popen(cmd, "r");
+
+    if (debug == NULL) {
+        return -1;
+    }
+
+    char out[300];
+    int found = 0;
+    int any = 0;
+
+    while (fgets(out, sizeof out, debug) != NULL) {
+
+        any = 1;
+
+        if (strstr(out, "libcurl") != NULL) {
+            found = 1;
+        }
+
+    }
+
+    pclose(debug);
+
+    snprintf(cmd, sizeof cmd, "rm -f %s.*", prefix);
+    system(cmd);
+
+    return any ? found : -1;
+
+}
+
+/*
+    Prints what one run allocates through the library, as counted by
+    the binary itself with VACTIJA_ALLOC_STATS set.
+*/
+static void alloc_stats(const char *binary, const char *cachedir)
+{
+
+    char cmd[1200];
+    snprintf(cmd, sizeof cmd, "VACTIJA_API_URL=http://127.0.0.1:9/ VACTIJA_ALLOC_STATS=1 "
+            "'%s' -d '%s' -l 77 -y %s print 2>&1 >/dev/null", binary, cachedir, BENCH_DATE);
+
+    FILE *out = popen(cmd, "r");
+
+    if (out == NULL) {
+        return;
+    }
+
+    char line[200];
+
+    while (fgets(line, sizeof line, out) != NULL) {
+
+        if (strncmp(line, "allocations:", 12) == 0) {
+            printf("cache hit %s", line);
+        }
+
+    }
+
+    pclose(out);
+
+}
+
+/*
+    Returns how long loading and initialising libcurl takes in ms,
+    measured in a fresh child process, or -1 if it is not available.
+*/
+static double curl_load_ms(void)
+{
+
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        double start = now_ms();
+
+        void *lib = dlopen("libcurl.so.4", RTLD_NOW | RTLD_LOCAL);
+        int (*global_init)(long) = NULL;
+
+        if (lib != NULL) {
+            *(void **) &global_init = dlsym(lib, "curl_global_init");
+        }
+
+        double elapsed = -1;
+
+        if (global_init != NULL) {
+
+            global_init(3); /* CURL_GLOBAL_DEFAULT */
+            elapsed = now_ms() - start;
+
+        }
+
+        write(fds[1], &elapsed, sizeof elapsed);
+        _exit(0);
+
+    }
+
+    close(fds[1]);
+
+    double elapsed = -1;
+
+    if (read(fds[0], &elapsed, sizeof elapsed) != sizeof elapsed) {
+        elapsed = -1;
+    }
+
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    return elapsed;
+
+}
+
+int main(int argc, char **argv)
+{
+
+    if (argc < 2) {
+
+        printf("Usage: %s <vactija binary> [runs]\n", argv[0]);
+        return EXIT_FAILURE;
+
+    }
+
+    const char *binary = argv[1];
+    int runs = (argc > 2) ? atoi(argv[2]) : DEFAULT_RUNS;
+
+    if (runs <= 0) {
+        runs = DEFAULT_RUNS;
+    }
+
+    const char *budget_env = getenv("VACTIJA_BENCH_BUDGET_MS");
+    double budget = (budget_env != NULL) ? atof(budget_env) : DEFAULT_BUDGET_MS;
+
+    char cachedir[] = "/tmp/vactija-bench.XXXXXX";
+
+    if (mkdtemp(cachedir) == NULL) {
+
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+
+    }
+
+    char path[512];
+    snprintf(path, sizeof path, "%s/%s.json", cachedir, BENCH_KEY);
+
+    if (copy_file(DUMMY_CACHE_FILE, path) != 0) {
+
+        printf("Could not prepare the cache from %s!\n", DUMMY_CACHE_FILE);
+        return EXIT_FAILURE;
+
+    }
+
+    /* Keep the binary off the network whatever happens */
+    char *envp[] = { "VACTIJA_API_URL=http://127.0.0.1:9/", NULL };
+
+    /* The first run also writes the parsed record */
+    if (run_once(binary, cachedir, envp) < 0) {
+
+        printf("%s failed on a cache hit!\n", binary);
+        return EXIT_FAILURE;
+
+    }
+
+    double *times = malloc(sizeof *times * runs);
+    double total = 0;
+
+    for (int i = 0; i < runs; i++) {
+
+        times[i] = run_once(binary, cachedir, envp);
+
+        if (times[i] < 0) {
+
+            printf("%s failed on a cache hit!\n", binary);
+            return EXIT_FAILURE;
+
+        }
+
+        total += times[i];
+
+    }
+
+    qsort(times, runs, sizeof *times, compare_double);
+
+    double median = times[runs / 2];
+    double p99 = times[(runs * 99) / 100 < runs ? (runs * 99) / 100 : runs - 1];
+
+    printf("cache hit cold start (%d runs): mean %.3f ms, median %.3f ms, p99 %.3f ms\n",
+            runs, total / runs, median, p99);
+
+    alloc_stats(binary, cachedir);
+
+    double curl_ms = curl_load_ms();
+
+    if (curl_ms >= 0) {
+        printf("loading libcurl alone: %.3f ms\n", curl_ms);
+    }
+
+    int failed = 0;
+    int curl = loads_curl(binary, cachedir);
+
+    if (curl == 1) {
+
+        printf("FAIL: libcurl is loaded on a cache hit\n");
+        failed = 1;
+
+    } else if (curl == -1) {
+
+        printf("could not check whether libcurl is loaded (no LD_DEBUG support)\n");
+
+    }
+
+    if (median > budget) {
+
+        printf("FAIL: median cold start %.3f ms is over the budget of %.3f ms\n", median, budget);
+        failed = 1;
+
+    }
+
+    snprintf(path, sizeof path, "rm -rf %s", cachedir);
+    system(path);
+
+    free(times);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}
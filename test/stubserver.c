@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+    A stand-in for the vaktija API, for testing and benchmarking the
+    download, retry, bulk and proxy code offline.
+
+    It answers the same URL layout as the API
+
+        /vaktija/v1/<location>[/<year>[/<month>[/<day>]]]
+
+    with made-up (but well formed) vaktija data, optionally after some
+    latency, with a share of the requests failing and with the body
+    padded to a given size. Point VACTIJA_API_URL at
+    http://127.0.0.1:<port>/vaktija/v1/ to use it.
+
+    For tests, the first requests can fail (-f) and the very first one
+    stall (-t) instead, so how often a client tried is known exactly.
+    GET /count answers how many requests came before it, and with port
+    0 the port the kernel picked is the one printed.
+
+    Usage: vactija-stub [-p port] [-l latency ms] [-j jitter ms]
+                        [-e error %] [-s error status] [-b body bytes]
+                        [-f failing first requests] [-t first stall ms]
+*/
+
+#define STUB_PREFIX "/vaktija/v1/"
+#define STUB_REQ_MAX 4096
+#define STUB_BODY_MAX (1 << 20)
+
+struct stub_options {
+
+    int port;
+    int latency_ms;
+    int jitter_ms;
+    int error_pct;
+    int error_status;
+    int body_size;
+
+    int fail_first;
+    int stall_first_ms;
+
+};
+
+static struct stub_options opts = { 8088, 0, 0, 0, 503, 0, 0, 0 };
+
+static unsigned long requests = 0;
+static pthread_mutex_t requests_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *days[] = {
+    "nedjelja", "ponedjeljak", "utorak", "srijeda", "četvrtak", "petak", "subota"
+};
+
+static const char *months[] = {
+    "januar", "februar", "mart", "april", "maj", "juni",
+    "juli", "august", "septembar", "oktobar", "novembar", "decembar"
+};
+
+static void sleep_ms(int ms)
+{
+
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        ;
+    }
+
+}
+
+/*
+    Appends the "datum" and "vakat" members for a day to buf. The times
+    drift a little over the year, like the real ones.
+*/
+static int day_json(char *buf, size_t len, int year, int mon, int mday)
+{
+
+    struct tm tm = { 0 };
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = mday;
+    tm.tm_hour = 12;
+    mktime(&tm);
+
+    int drift = (tm.tm_yday < 183) ? tm.tm_yday / 3 : (365 - tm.tm_yday) / 3;
+
+    int fajr = 5 * 60 + 20 - drift;
+    int sunrise = fajr + 95;
+    int dhuhr = 12 * 60 + 1;
+    int asr = 14 * 60 + 30 + drift;
+    int maghrib = 17 * 60 + drift;
+    int isha = maghrib + 85;
+
+    return snprintf(buf, len,
+            "\"datum\":[\"%d. redžeb 1443\",\"%s, %d. %s %d\"],"
+            "\"vakat\":[\"%d:%02d\",\"%d:%02d\",\"%d:%02d\",\"%d:%02d\",\"%d:%02d\",\"%d:%02d\"]",
+            (tm.tm_yday % 30) + 1, days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], year,
+            fajr / 60, fajr % 60, sunrise / 60, sunrise % 60, dhuhr / 60, dhuhr % 60,
+            asr / 60, asr % 60, maghrib / 60, maghrib % 60, isha / 60, isha % 60);
+
+}
+
+/*
+    Builds the body for an API path into buf, returning its length or
+    -1 if the path is not one the API knows.
+*/
+static int make_body(char *buf, size_t len, const char *path)
+{
+
+    if (strncmp(path, STUB_PREFIX, strlen(STUB_PREFIX)) != 0) {
+        return -1;
+    }
+
+    int loc = 0, year = 0, mon = 0, mday = 0;
+    int parts = sscanf(path + strlen(STUB_PREFIX), "%d/%d/%d/%d", &loc, &year, &mon, &mday);
+
+    time_t now = time(NULL);
+    struct tm today = *localtime(&now);
+
+    if (parts < 1 || loc < 0 || loc > 999) {
+        return -1;
+    }
+
+    if (parts < 2) {
+        year = today.tm_year + 1900;
+    }
+
+    if (parts < 3) {
+        mon = today.tm_mon + 1;
+    }
+
+    if (mon < 1 || mon > 12 || mday < 0 || mday > 31) {
+        return -1;
+    }
+
+    size_t n = snprintf(buf, len, "{\"id\":%d,\"lokacija\":\"Lokacija %d\",\"godina\":%d,\"mjesec\":%d,",
+            loc, loc, year, mon);
+
+    if (parts == 3) {
+
+        /* A whole month */
+        static const int mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        int count = mdays[mon - 1] + (mon == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+
+        n += snprintf(buf + n, len - n, "\"dan\":[");
+
+        for (int d = 1; d <= count && n < len; d++) {
+
+            n += snprintf(buf + n, len - n, "%s{", d > 1 ? "," : "");
+            n += day_json(buf + n, len - n, year, mon, d);
+            n += snprintf(buf + n, len - n, "}");
+
+        }
+
+        n += snprintf(buf + n, len - n, "]}");
+
+    } else {
+
+        if (parts < 4) {
+            mday = today.tm_mday;
+        }
+
+        n += snprintf(buf + n, len - n, "\"dan\":%d,", mday);
+        n += day_json(buf + n, len - n, year, mon, mday);
+        n += snprintf(buf + n, len - n, "}");
+
+    }
+
+    if (n >= len) {
+        return -1;
+    }
+
+    /* Whitespace after the JSON, to test bigger bodies */
+    while (n < (size_t) opts.body_size && n + 1 < len) {
+        buf[n++] = ' ';
+    }
+
+    buf[n] = '\0';
+
+    return n;
+
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+
+    while (len > 0) {
+
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        data += n;
+        len -= n;
+
+    }
+
+    return 0;
+
+}
+
+static int respond(int fd, const char *status, const char *body, size_t len)
+{
+
+    char head[256];
+    int n = snprintf(head, sizeof head,
+            "HTTP/1.1 %s\r\nContent-Type: application/json\r\n"
+            "Content-Length: %zu\r\nConnection: keep-alive\r\n\r\n", status, len);
+
+    if (send_all(fd, head, n) != 0) {
+        return -1;
+    }
+
+    return send_all(fd, body, len);
+
+}
+
+static void handle(int fd, const char *path, unsigned int *seed)
+{
+
+    pthread_mutex_lock(&requests_lock);
+    requests++;
+    unsigned long seen = requests;
+    pthread_mutex_unlock(&requests_lock);
+
+    if (strcmp(path, "/count") == 0) {
+
+        char body[32];
+        int n = snprintf(body, sizeof body, "%lu\n", seen - 1);
+
+        respond(fd, "200 OK", body, n);
+        return;
+
+    }
+
+    int delay = (seen == 1 && opts.stall_first_ms > 0) ? opts.stall_first_ms : opts.latency_ms;
+
+    if (opts.jitter_ms > 0) {
+        delay += rand_r(seed) % (opts.jitter_ms + 1);
+    }
+
+    if (delay > 0) {
+        sleep_ms(delay);
+    }
+
+    if (seen <= (unsigned long) opts.fail_first ||
+        (opts.error_pct > 0 && (int) (rand_r(seed) % 100) < opts.error_pct)) {
+
+        char status[32];
+        snprintf(status, sizeof status, "%d Stub Error", opts.error_status);
+
+        respond(fd, status, "", 0);
+        return;
+
+    }
+
+    static __thread char body[STUB_BODY_MAX];
+    int n = make_body(body, sizeof body, path);
+
+    if (n < 0) {
+        respond(fd, "404 Not Found", "", 0);
+    } else {
+        respond(fd, "200 OK", body, n);
+    }
+
+}
+
+/*
+    Serves one connection, request after request, until the client
+    closes it.
+*/
+static void *serve_conn(void *arg)
+{
+
+    int fd = (int) (long) arg;
+    unsigned int seed = (unsigned int) time(NULL) ^ (unsigned int) fd;
+
+    char req[STUB_REQ_MAX];
+    size_t have = 0;
+
+    while (1) {
+
+        char *end = NULL;
+
+        while ((end = memmem(req, have, "\r\n\r\n", 4)) == NULL) {
+
+            if (have == sizeof req) {
+                goto out;
+            }
+
+            ssize_t n = recv(fd, req + have, sizeof req - have, 0);
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n <= 0) {
+                goto out;
+            }
+
+            have += n;
+
+        }
+
+        char path[1024];
+
+        if (sscanf(req, "GET %1023s", path) != 1) {
+
+            respond(fd, "400 Bad Request", "", 0);
+            goto out;
+
+        }
+
+        handle(fd, path, &seed);
+
+        size_t used = end + 4 - req;
+        memmove(req, req + used, have - used);
+        have -= used;
+
+    }
+
+out:
+    close(fd);
+
+    return NULL;
+
+}
+
+static void usage(const char *pname)
+{
+
+    printf("Usage: %s [-p port] [-l latency ms] [-j jitter ms]\n", pname);
+    printf("          [-e error %%] [-s error status] [-b body bytes]\n");
+    printf("          [-f failing first requests] [-t first stall ms]\n");
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char **argv)
+{
+
+    int c;
+    while ((c = getopt(argc, argv, "p:l:j:e:s:b:f:t:")) != -1) {
+
+        switch (c) {
+
+        case 'p':
+            opts.port = atoi(optarg);
+            break;
+
+        case 'l':
+            opts.latency_ms = atoi(optarg);
+            break;
+
+        case 'j':
+            opts.jitter_ms = atoi(optarg);
+            break;
+
+        case 'e':
+            opts.error_pct = atoi(optarg);
+            break;
+
+        case 's':
+            opts.error_status = atoi(optarg);
+            break;
+
+        case 'b':
+            opts.body_size = atoi(optarg);
+            break;
+
+        case 'f':
+            opts.fail_first = atoi(optarg);
+            break;
+
+        case 't':
+            opts.stall_first_ms = atoi(optarg);
+            break;
+
+        default:
+            usage(argv[0]);
+
+        }
+
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    struct sockaddr_in sa = { 0 };
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(opts.port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(lfd, (struct sockaddr *) &sa, sizeof sa) != 0 || listen(lfd, 1024) != 0) {
+
+        perror("vactija-stub");
+        return EXIT_FAILURE;
+
+    }
+
+    socklen_t salen = sizeof sa;
+    getsockname(lfd, (struct sockaddr *) &sa, &salen);
+    opts.port = ntohs(sa.sin_port);
+
+    printf("Stub API on http://127.0.0.1:%d%s\n", opts.port, STUB_PREFIX);
+    fflush(stdout);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (1) {
+
+        int fd = accept(lfd, NULL, NULL);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, &attr, serve_conn, (void *) (long) fd) != 0) {
+            close(fd);
+        }
+
+    }
+
+}
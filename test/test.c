@@ -1,14 +1,54 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "test.h"
 
 #include "../util/temporal.h"
 #include "../util/jsmnutil.h"
 #include "../util/cachefile.h"
+#include "../util/curlload.h"
+#include "../util/timeheap.h"
+#include "../util/clocksource.h"
+#include "../util/hijri.h"
+#include "../util/alloc.h"
+#include "../fetch.h"
 #include "../vactija.h"
+#include "../timeline.h"
+#include "../derived.h"
+#include "../record.h"
+#include "../bundle.h"
+#include "../pack.h"
+#include "../locations.h"
+#include "../format.h"
+#include "../export.h"
+#include "../daemon.h"
+#include "../upcoming.h"
+#include "../metrics.h"
+#include "../prompt.h"
+#include "../cachectl.h"
+#include "../server.h"
 
 #define DUMMY_CACHE_FILE "testrel/dummycache"
+#define DUMMY_MONTH_FILE "testrel/dummymonth"
+#define PRINT_FILE "testrel/print.out"
+#define FIXTURE_DIR "testrel/fixtures"
+#define BUNDLE_FILE "testrel/test.bundle"
+#define PACK_FILE "testrel/test.pack"
+#define EXPORT_FILE "testrel/test.export"
+#define PROMPT_DIR "testrel/prompt"
+#define GC_DIR "testrel/gc"
+#define STUB_BIN "testrel/vactija-stub"
 
 static int passed_test = 0;
 static int failed_test = 0;
@@ -21,6 +61,33 @@ static int jsonparse_test(void);
 static int jsonsearch_test(void);
 static int nextvakat_test(void);
 static int currentvakat_test(void);
+static int monthparse_test(void);
+static int timeline_test(void);
+static int midnight_test(void);
+static int record_test(void);
+static int derived_test(void);
+static int replay_test(void);
+static int bundle_test(void);
+static int pack_test(void);
+static int location_test(void);
+static int format_test(void);
+static int export_test(void);
+static int timeheap_test(void);
+static int hook_test(void);
+static int upcoming_test(void);
+static int hijri_test(void);
+static int alloc_test(void);
+static int prompt_test(void);
+static int cachegc_test(void);
+static int metrics_test(void);
+static int clock_test(void);
+static int simulation_test(void);
+static int lazycurl_test(void);
+static int fetch_test(void);
+static int proxy_test(void);
+
+static int quiet(void);
+static void unquiet(int out);
 
 static void test(int (*testf)(void), char *name)
 {
@@ -339,6 +406,1800 @@ static int currentvakat_test(void)
 
 }
 
+static int monthparse_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+    char *day = read_cache(DUMMY_CACHE_FILE);
+
+    check(valid_month(json) == 1);
+    check(valid_month(day) == 0);
+    check(valid_month("not json") == 0);
+    check(valid_month("{\"lokacija\":\"Sarajevo\",\"godina\":2022,\"mjesec\":2,"
+                "\"dan\":[{\"datum\":[\"a\",\"b\"],\"vakat\":[\"5:17\"]}]}") == 0);
+    check(valid_month("{\"lokacija\":\"Sarajevo\",\"godina\":2022,\"mjesec\":2,\"dan\":[]}") == 0);
+
+    free(day);
+
+    /* Bad months are reported rather than exiting, bundle workers parse them */
+    int count = -1;
+    int out = quiet();
+    struct vaktija **bad = parse_month("{\"lokacija\":\"Sarajevo\",\"godina\":2022,\"mjesec\":2,"
+            "\"dan\":[{\"datum\":[\"a\",\"b\"]}]}", &count);
+    struct vaktija **broken = parse_month("{\"dan\":[", &count);
+    unquiet(out);
+
+    check(bad == NULL && broken == NULL && count == -1);
+
+    struct vaktija **days = parse_month(json, &count);
+
+    check(count == 28);
+
+    check(strcmp(days[0]->location, "Sarajevo") == 0);
+    check(days[0]->year == 2022 && days[0]->month == 2 && days[0]->day == 1);
+    check(strcmp(days[0]->prayers[0], "5:17") == 0);
+
+    /* Same day as in the dummycache file */
+    struct vaktija *v = days[18];
+    check(v->day == 19);
+    check(strcmp(v->dates[0], "18. redžeb 1443") == 0);
+    check(strcmp(v->dates[1], "subota, 19. februar 2022") == 0);
+    check(strcmp(v->prayers[0], "4:59") == 0);
+    check(strcmp(v->prayers[5], "18:51") == 0);
+
+    check(days[27]->day == 28);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static time_t local_epoch(int year, int mon, int mday, int hour, int min)
+{
+
+    struct tm tm = { 0 };
+    tm.tm_year = year - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = mday;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+
+}
+
+static int timeline_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    struct timeline tl;
+    timeline_init(&tl);
+
+    check(timeline_add_day(&tl, days[18]) == 0);
+    check(timeline_add_day(&tl, days[19]) == 0);
+
+    /* Days have to follow each other */
+    check(timeline_add_day(&tl, days[5]) == -1);
+
+    /* Before isha on the 19th */
+    int idx = timeline_next(&tl, local_epoch(2022, 2, 19, 18, 0));
+    check(timeline_day(&tl, idx) == days[18] && timeline_vakat(&tl, idx) == 5);
+
+    /* After isha, the next one is fajr on the 20th rather than the 19th */
+    idx = timeline_next(&tl, local_epoch(2022, 2, 19, 20, 20));
+    check(timeline_day(&tl, idx) == days[19] && timeline_vakat(&tl, idx) == 0);
+    check(tl.times[idx] == local_epoch(2022, 2, 20, 4, 58));
+
+    /* Still isha of the 19th after midnight */
+    idx = timeline_current(&tl, local_epoch(2022, 2, 20, 0, 30));
+    check(timeline_day(&tl, idx) == days[18] && timeline_vakat(&tl, idx) == 5);
+
+    /* Exactly at a vakat, it is current */
+    idx = timeline_current(&tl, local_epoch(2022, 2, 20, 4, 58));
+    check(timeline_day(&tl, idx) == days[19] && timeline_vakat(&tl, idx) == 0);
+
+    /* Nothing before the first and after the last vakat */
+    check(timeline_current(&tl, local_epoch(2022, 2, 19, 1, 0)) == -1);
+    check(timeline_next(&tl, local_epoch(2022, 2, 20, 23, 0)) == -1);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int midnight_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    /* Maghrib 17:27 on the 19th, fajr 4:58 on the 20th */
+    struct tm midnight;
+    calculate_midnight(days[18], days[19], &midnight);
+    check(midnight.tm_hour == 23 && midnight.tm_min == 12 && midnight.tm_sec == 30);
+
+    struct tm third;
+    calculate_third(days[18], days[19], &third);
+    check(third.tm_hour == 1 && third.tm_min == 7 && third.tm_sec == 40);
+
+    /* Without the next day, the same day's fajr (4:59) is used */
+    calculate_midnight(days[18], NULL, &midnight);
+    check(midnight.tm_hour == 23 && midnight.tm_min == 13);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int record_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    size_t len;
+    char *buf = serialize_record(days[18], &len);
+
+    struct vaktija *v = deserialize_record(buf, len);
+    check(v != NULL);
+    check(v->year == 2022 && v->month == 2 && v->day == 19);
+    check(strcmp(v->location, "Sarajevo") == 0);
+    check(strcmp(v->dates[0], "18. redžeb 1443") == 0);
+    check(strcmp(v->prayers[5], "18:51") == 0);
+    check(memcmp(v->times, days[18]->times, sizeof v->times) == 0);
+    check(v->derived_exact == 1);
+    check(v->derived[derived_find("midnight")] == days[18]->derived[derived_find("midnight")]);
+    delete_vaktija(v);
+
+    /* Damaged or truncated records are rejected */
+    buf[len - 1] ^= 0x20;
+    check(deserialize_record(buf, len) == NULL);
+    buf[len - 1] ^= 0x20;
+    check(deserialize_record(buf, len - 1) == NULL);
+
+    /* So are records of other versions */
+    buf[4]++;
+    check(deserialize_record(buf, len) == NULL);
+
+    free(buf);
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int derived_test(void)
+{
+
+    char *json = read_cache(DUMMY_CACHE_FILE);
+    struct vaktija *v = parse_data(json);
+
+    check(v->times[0] == 4 * 3600 + 59 * 60);
+    check(v->times[5] == 18 * 3600 + 51 * 60);
+
+    /* Without the next day, computed from the same day's fajr */
+    int midnight = derived_find("midnight");
+    check(midnight >= 0);
+    check(v->derived_exact == 0);
+    check(v->derived[midnight] == 23 * 3600 + 13 * 60);
+
+    free(json);
+
+    /* Within a month every day but the last knows the following one */
+    json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    check(days[18]->derived_exact == 1);
+    check(days[18]->derived[midnight] == 23 * 3600 + 12 * 60 + 30);
+    check(days[18]->derived[derived_find("third")] == 86400 + 1 * 3600 + 7 * 60 + 40);
+    check(days[27]->derived_exact == 0);
+
+    /* The set of derived times is pluggable */
+    static const struct derived_time defs[] = {
+        { "ishraq", "Ishraq is on", derive_offset, 1, 15 * 60 }
+    };
+    const struct derived_time *saved = derived_get(0);
+    int nsaved = derived_count();
+
+    derived_register(defs, 1);
+    derive_times(days[18], days[19]);
+
+    int ndefs = derived_count();
+    int found = derived_find("midnight");
+
+    /* Put the set back before checking, the tests after this one rely on it */
+    derived_register(saved, nsaved);
+
+    check(ndefs == 1 && found == -1);
+    check(days[18]->derived[0] == 6 * 3600 + 50 * 60);
+    check(derived_count() == nsaved && derived_find("midnight") == midnight);
+
+    delete_month(days, count);
+    delete_vaktija(v);
+    free(json);
+
+    done();
+
+}
+
+static int replay_test(void)
+{
+
+    char name[FETCH_FIXTURE_MAX];
+    check(fixture_name(name, sizeof name, "https://api.vaktija.ba/vaktija/v1/77/2022/2/19") == 0);
+    check(strcmp(name, "vaktija_v1_77_2022_2_19.json") == 0);
+    check(fixture_name(name, sizeof name, "http://127.0.0.1:8080/vaktija/v1/77/") == 0);
+    check(strcmp(name, "vaktija_v1_77.json") == 0);
+
+    fetch_set_fixtures(FETCH_REPLAY, FIXTURE_DIR);
+
+    char *json = fetch_vaktija("77", "2022/2/19");
+    check(json != NULL);
+
+    struct vaktija *v = parse_data(json);
+    check(v->year == 2022 && v->month == 2 && v->day == 19);
+    check(strcmp(v->prayers[4], "17:16") == 0);
+
+    /* Replaying never goes to the network, not even on a miss */
+    check(fetch_vaktija("77", "2022/2/20") == NULL);
+
+    fetch_set_fixtures(FETCH_LIVE, NULL);
+
+    delete_vaktija(v);
+    free(json);
+
+    done();
+
+}
+
+static int bundle_test(void)
+{
+
+    static uint16_t times[2][365][PRAYER_TIME_NUM];
+    static struct bundle_hijri dates[365];
+
+    /* Drifting a minute or two a day, with an hour jump at both DST changes */
+    for (int l = 0; l < 2; l++) {
+
+        for (int d = 0; d < 365; d++) {
+
+            int dst = (d >= 86 && d < 303) ? 60 : 0;
+            int drift = (d < 182) ? d : 364 - d;
+
+            for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+                times[l][d][i] = 4 * 60 + i * 150 + (i % 2 ? drift / 2 : -drift / 3) + dst + l * 3;
+            }
+
+        }
+
+    }
+
+    for (int d = 0; d < 365; d++) {
+
+        dates[d].day = d % 30 + 1;
+        dates[d].month = 7;
+        dates[d].year = 1443;
+
+    }
+
+    struct bundle_location locations[] = {
+        { 77, "Sarajevo", times[1] },
+        { 1, "Banja Luka", times[0] }
+    };
+
+    check(bundle_write(BUNDLE_FILE, 2022, 365, locations, 2, dates) == 0);
+
+    struct bundle *bundle = bundle_open(BUNDLE_FILE);
+    check(bundle != NULL);
+    check(bundle->year == 2022 && bundle->ndays == 365 && bundle->nlocations == 2);
+
+    int sarajevo = bundle_find(bundle, 77);
+    check(sarajevo == 1 && bundle_find(bundle, 1) == 0 && bundle_find(bundle, 5) == -1);
+
+    static uint16_t year[365][PRAYER_TIME_NUM];
+    check(bundle_year_times(bundle, sarajevo, year) == 0);
+    check(memcmp(year, times[1], sizeof year) == 0);
+
+    for (int d = 0; d < 365; d++) {
+
+        int minutes[PRAYER_TIME_NUM];
+        check(bundle_day_times(bundle, sarajevo, d, minutes) == 0);
+
+        for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+            check(minutes[i] == times[1][d][i]);
+        }
+
+    }
+
+    struct vaktija *v = bundle_day(bundle, sarajevo, 2, 19);
+    check(v != NULL);
+    check(strcmp(v->location, "Sarajevo") == 0);
+    check(strcmp(v->dates[0], "20. redžeb 1443") == 0);
+    check(strcmp(v->dates[1], "subota, 19. februar 2022") == 0);
+    check(v->year == 2022 && v->month == 2 && v->day == 19);
+    check(v->times[0] == times[1][49][0] * 60);
+    delete_vaktija(v);
+
+    check(bundle_day(bundle, sarajevo, 2, 29) == NULL);
+
+    bundle_close(bundle);
+
+    /* A damaged bundle is not used */
+    size_t len;
+    char *buf = read_cache_data(BUNDLE_FILE, &len);
+    buf[len / 2] ^= 1;
+    write_cache_data(BUNDLE_FILE, buf, len);
+    free(buf);
+
+    check(bundle_open(BUNDLE_FILE) == NULL);
+
+    done();
+
+}
+
+static int pack_test(void)
+{
+
+    char *json = read_cache(DUMMY_CACHE_FILE);
+    check(valid_vaktija(json) == 1);
+    check(valid_vaktija("{\"lokacija\":\"Sarajevo\"}") == 0);
+    check(valid_vaktija("not json") == 0);
+
+    struct vaktija *v = parse_data(json);
+
+    struct pack_entry entries[3] = {
+        { "77-2022-02-19", NULL, 0, json, strlen(json) },
+        { "1-2022-02-19", NULL, 0, NULL, 0 },
+        { "77-2022-02-18", NULL, 0, NULL, 0 }
+    };
+
+    for (int i = 0; i < 3; i++) {
+        entries[i].record = serialize_record(v, &entries[i].record_len);
+    }
+
+    check(pack_write(PACK_FILE, entries, 3) == 0);
+
+    struct pack *pack = pack_open(PACK_FILE);
+    check(pack != NULL && pack->count == 3);
+
+    /* Sorted by key, so found by binary search */
+    check(strcmp(pack_key(pack, 0), "1-2022-02-19") == 0);
+    check(pack_find(pack, "77-2022-02-19") == 2);
+    check(pack_find(pack, "77-2022-02-20") == -1);
+
+    struct vaktija *packed = pack_record(pack, "77-2022-02-19");
+    check(packed != NULL);
+    check(memcmp(packed->times, v->times, sizeof v->times) == 0);
+    check(strcmp(packed->location, v->location) == 0);
+    delete_vaktija(packed);
+
+    char *copy = pack_json(pack, "77-2022-02-19");
+    check(copy != NULL && strcmp(copy, json) == 0);
+    check(pack_json(pack, "77-2022-02-18") == NULL);
+    free(copy);
+
+    pack_close(pack);
+
+    /* Keys are unique */
+    check(pack_write(PACK_FILE ".dup", (struct pack_entry[]) { entries[0], entries[0] }, 2) == -1);
+
+    /* A damaged index is not used */
+    size_t len;
+    char *buf = read_cache_data(PACK_FILE, &len);
+    buf[20] ^= 1;
+    write_cache_data(PACK_FILE, buf, len);
+    free(buf);
+
+    check(pack_open(PACK_FILE) == NULL);
+
+    for (int i = 0; i < 3; i++) {
+        free(entries[i].record);
+    }
+
+    delete_vaktija(v);
+    free(json);
+
+    done();
+
+}
+
+static int location_test(void)
+{
+
+    check(location_find("Sarajevo") == 77);
+    check(location_find("sarajevo") == 77);
+    check(location_find("BANJA  LUKA") == 1);
+    check(location_find("Bosanski Šamac") == 12);
+    check(location_find("bosanski samac") == 12);
+    check(location_find("Kotor Varos") == 51);
+    check(location_find("Bosanska Krupa") == 9);
+    check(location_find("Sarajevo2") == -1);
+    check(location_find("") == -1);
+
+    /* Every name finds its own ID */
+    for (int id = 0; id < VAKTIJA_LOCATIONS; id++) {
+        check(location_find(location_name(id)) == id);
+    }
+
+    check(location_id("0") == 0);
+    check(location_id("117") == 117);
+    check(location_id("118") == -1);
+    check(location_id("7a") == -1);
+    check(location_id("") == -1);
+    check(location_name(118) == NULL && location_name(-1) == NULL);
+
+    check(location_parse("77") == 77);
+    check(location_parse("Tuzla") == location_find("tuzla"));
+
+    /* The k-d tree agrees with looking at every location */
+    for (double lat = 42.0; lat <= 46.0; lat += 0.13) {
+
+        for (double lon = 15.0; lon <= 21.0; lon += 0.17) {
+
+            int nearest = location_nearest(lat, lon);
+            check(nearest >= 0);
+
+            for (int id = 0; id < VAKTIJA_LOCATIONS; id++) {
+                check(location_distance(nearest, lat, lon) <= location_distance(id, lat, lon) + 1e-3);
+            }
+
+        }
+
+    }
+
+    double lat, lon;
+    check(location_coords(77, &lat, &lon) == 0);
+    check(location_nearest(lat, lon) == 77);
+    check(location_nearest(43.85, 18.39) == 77);
+    check(location_nearest(44.54, 18.68) == location_find("Tuzla"));
+    check(location_nearest(91, 0) == -1);
+    check(location_coords(118, &lat, &lon) == -1);
+
+    /* Rejected before anything is fetched (replaying would otherwise miss) */
+    fetch_set_fixtures(FETCH_REPLAY, FIXTURE_DIR);
+    check(fetch_vaktija("999", NULL) == NULL);
+    fetch_set_fixtures(FETCH_LIVE, NULL);
+
+    done();
+
+}
+
+/*
+    Everything above only works with cached data, so none of it should
+    have loaded libcurl.
+*/
+/*
+    Returns what print_vaktija prints for the day, or NULL.
+*/
+static char *print_to_file(const struct vaktija *v)
+{
+
+    fflush(stdout);
+
+    int out = dup(STDOUT_FILENO);
+    int fd = open(PRINT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+
+        close(out);
+        return NULL;
+
+    }
+
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    print_vaktija(v);
+
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+
+    char *text = read_cache(PRINT_FILE);
+    unlink(PRINT_FILE);
+
+    return text;
+
+}
+
+static int format_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    char err[FORMAT_ERR_MAX];
+    char buf[FORMAT_BUF_MAX];
+
+    struct format_ctx ctx = { 0 };
+    ctx.day = days[18];
+    ctx.title = "Šamac";
+    ctx.now = local_epoch(2022, 2, 19, 16, 0);
+    ctx.next = (struct format_vakat) { days[18], 5, local_epoch(2022, 2, 19, 18, 1) };
+
+    struct format *fmt = format_compile("{next.name} in {countdown}\\n", err, sizeof err);
+    check(fmt != NULL);
+    check(format_needs(fmt, FORMAT_NEEDS_NEXT) && !format_needs(fmt, FORMAT_NEEDS_CURRENT));
+    format_render(fmt, &ctx, 0, buf, sizeof buf);
+    check(strcmp(buf, "Isha in 2:01\n") == 0);
+    format_free(fmt);
+
+    /* Widths count characters, not bytes */
+    fmt = format_compile("{title:-7}|{title:6}|{{x}}\\t", err, sizeof err);
+    check(fmt != NULL);
+    format_render(fmt, &ctx, 0, buf, sizeof buf);
+    check(strcmp(buf, "Šamac  | Šamac|{x}\t") == 0);
+    format_free(fmt);
+
+    /* Colours only when asked for, nothing for a missing vakat */
+    fmt = format_compile("{red}{isha}{reset}{current.name}", err, sizeof err);
+    check(fmt != NULL);
+    format_render(fmt, &ctx, 0, buf, sizeof buf);
+    check(strcmp(buf, days[18]->prayers[5]) == 0);
+    format_render(fmt, &ctx, 1, buf, sizeof buf);
+    check(strncmp(buf, "\x1b[31m", 5) == 0 && strstr(buf, "\x1b[0m") != NULL);
+    format_free(fmt);
+
+    check(format_compile("{bogus}", err, sizeof err) == NULL && strstr(err, "bogus") != NULL);
+    check(format_compile("{isha", err, sizeof err) == NULL);
+    check(format_compile("isha}", err, sizeof err) == NULL);
+    check(format_compile("{isha:x}", err, sizeof err) == NULL);
+
+    /* Labels of derived times come out as they are, whatever is in them */
+    static const struct derived_time odd[] = {
+        { "ishraq", "Odd {label} \\ }", derive_offset, 1, 15 * 60 }
+    };
+
+    const struct derived_time *saved = derived_get(0);
+    int nsaved = derived_count();
+
+    derived_register(odd, 1);
+    derive_times(days[18], days[19]);
+    char *printed = print_to_file(days[18]);
+
+    derived_register(saved, nsaved);
+    derive_times(days[18], days[19]);
+    char *again = print_to_file(days[18]);
+
+    check(printed != NULL && strstr(printed, "Odd {label} \\ }") != NULL && strstr(printed, "06:50") != NULL);
+    check(again != NULL && strstr(again, "Odd") == NULL && strstr(again, "Midnight is on") != NULL);
+
+    free(printed);
+    free(again);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+/*
+    Exports the days of the dummy month as kind, returning what was
+    written (to be freed).
+*/
+static char *export_month(struct vaktija **days, int count, enum export_kind kind)
+{
+
+    int fd = open(EXPORT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct export *ex = export_open(fd, kind);
+
+    for (int i = 0; i < count; i++) {
+        export_day(ex, 77, days[i]);
+    }
+
+    int res = export_close(ex);
+    close(fd);
+
+    return (res == 0) ? read_cache(EXPORT_FILE) : NULL;
+
+}
+
+static int export_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    /* Quotes only where csv needs them */
+    free(days[1]->dates[0]);
+    days[1]->dates[0] = strdup("2. \"redžeb\", 1443");
+
+    check(export_kind("jsonl") == EXPORT_JSONL && export_kind("xml") == -1);
+
+    char *csv = export_month(days, count, EXPORT_CSV);
+    check(csv != NULL);
+    check(strncmp(csv, "id,location,date,hijri,dawn,sunrise,dhuhr,asr,maghrib,isha", 58) == 0);
+    check(strstr(csv, "\n77,Sarajevo,2022-02-19,") != NULL);
+    check(strstr(csv, ",\"2. \"\"redžeb\"\", 1443\",") != NULL);
+
+    int lines = 0;
+    for (char *c = csv; *c != '\0'; c++) {
+        lines += *c == '\n';
+    }
+
+    check(lines == count + 1);
+    free(csv);
+
+    char *jsonl = export_month(days, count, EXPORT_JSONL);
+    check(jsonl != NULL);
+    check(strncmp(jsonl, "{\"id\":77,\"location\":\"Sarajevo\",\"date\":\"2022-02-01\"", 50) == 0);
+    check(strstr(jsonl, "\"hijri\":\"2. \\\"redžeb\\\", 1443\"") != NULL);
+    free(jsonl);
+
+    char time[32];
+    snprintf(time, sizeof time, "%02d%02d00", days[18]->times[5] / 3600, days[18]->times[5] / 60 % 60);
+
+    char *ics = export_month(days, count, EXPORT_ICS);
+    check(ics != NULL);
+    check(strncmp(ics, "BEGIN:VCALENDAR\r\n", 17) == 0);
+    check(strstr(ics, "UID:20220219-77-isha@vactija\r\n") != NULL);
+    check(strstr(ics, "DTSTART:20220219T") != NULL && strstr(ics, time) != NULL);
+    check(strstr(ics, "DESCRIPTION:2. \"redžeb\"\\, 1443\r\n") != NULL);
+    check(strcmp(ics + strlen(ics) - 15, "END:VCALENDAR\r\n") == 0);
+    free(ics);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int timeheap_test(void)
+{
+
+    struct timeheap heap;
+    timeheap_init(&heap);
+
+    /* Pseudo-random times, some of them equal */
+    for (int i = 0; i < 1000; i++) {
+        timeheap_push(&heap, (i * 7919) % 313, i);
+    }
+
+    struct timeheap_entry prev = { -1, -1 };
+    struct timeheap_entry e;
+    int count = 0;
+
+    check(timeheap_peek(&heap, &e) == 0 && e.at == 0);
+
+    while (timeheap_pop(&heap, &e) == 0) {
+
+        check(e.at > prev.at || (e.at == prev.at && e.id > prev.id));
+        prev = e;
+        count++;
+
+    }
+
+    check(count == 1000);
+    check(timeheap_peek(&heap, &e) == -1);
+
+    timeheap_free(&heap);
+
+    done();
+
+}
+
+static struct vaktija **hook_days;
+
+/* Only has the days of the dummy month up to the 20th */
+static struct vaktija *hook_load(int location, struct tm date)
+{
+
+    (void) location;
+
+    if (date.tm_year != 122 || date.tm_mon != 1 || date.tm_mday > 20) {
+        return NULL;
+    }
+
+    size_t len;
+    char *buf = serialize_record(hook_days[date.tm_mday - 1], &len);
+    struct vaktija *v = deserialize_record(buf, len);
+    free(buf);
+
+    return v;
+
+}
+
+static int hook_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    hook_days = parse_month(json, &count);
+
+    struct hook hook;
+    const char *err = NULL;
+
+    check(hook_parse("  # comment", &hook, &err) == 1);
+    check(hook_parse("", &hook, &err) == 1);
+    check(hook_parse("Sarajevo isha", &hook, &err) == -1 && err != NULL);
+    check(hook_parse("Atlantis isha +0 true", &hook, &err) == -1);
+    check(hook_parse("77 zuhr +0 true", &hook, &err) == -1);
+    check(hook_parse("77 isha 10 true", &hook, &err) == -1);
+    check(hook_parse("77 isha +13h true", &hook, &err) == -1);
+
+    check(hook_parse("banja-luka midnight +90s echo a b\n", &hook, &err) == 0);
+    check(hook.location == 1 && hook.time == PRAYER_TIME_NUM + derived_find("midnight"));
+    check(hook.offset == 90 && strcmp(hook.command, "echo a b") == 0);
+    vfree(hook.command);
+
+    check(hook_parse("Sarajevo isha -10 mpc pause", &hook, &err) == 0);
+    check(hook.location == 77 && hook.time == 5 && hook.offset == -600);
+
+    /* Isha on the 19th is at 18:51 */
+    check(hook_next(&hook, local_epoch(2022, 2, 19, 12, 0), hook_load) == local_epoch(2022, 2, 19, 18, 41));
+
+    /* Once it passed, the next one is the following day's */
+    time_t at = hook_next(&hook, local_epoch(2022, 2, 19, 18, 41), hook_load);
+    check(at == local_epoch(2022, 2, 20, 4, 0) + hook_days[19]->times[5] - 4 * 3600 - 600);
+
+    /* Days which can not be loaded leave it unscheduled */
+    check(hook_next(&hook, local_epoch(2022, 2, 20, 23, 0), hook_load) == -1);
+
+    vfree(hook.command);
+    delete_month(hook_days, count);
+    free(json);
+
+    done();
+
+}
+
+static int upcoming_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    hook_days = parse_month(json, &count);
+
+    /* From 18:00 on the 19th: its isha, then the 20th, then nothing (see hook_load) */
+    int one[] = { 77 };
+    struct upcoming it;
+    struct upcoming_event ev;
+
+    upcoming_init(&it, one, 1, local_epoch(2022, 2, 19, 18, 0), hook_load);
+
+    check(upcoming_next(&it, &ev) == 0);
+    check(ev.at == local_epoch(2022, 2, 19, 18, 51) && ev.vakat == 5 && ev.location == 77 && ev.day->day == 19);
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+        check(upcoming_next(&it, &ev) == 0);
+        check(ev.vakat == i && ev.day->day == 20 && ev.at == vakat_epoch(hook_days[19], i));
+
+    }
+
+    check(upcoming_next(&it, &ev) == -1);
+    upcoming_free(&it);
+
+    /* Merged, same times come in the order the locations were given */
+    int three[] = { 77, 1, 3 };
+    upcoming_init(&it, three, 3, local_epoch(2022, 2, 18, 23, 0), hook_load);
+
+    time_t prev = 0;
+    int events = 0;
+
+    while (upcoming_next(&it, &ev) == 0) {
+
+        check(ev.at >= prev);
+        check(ev.location == three[events % 3]);
+        check(ev.vakat == (events / 3) % PRAYER_TIME_NUM);
+
+        prev = ev.at;
+        events++;
+
+    }
+
+    check(events == 3 * 2 * PRAYER_TIME_NUM);
+    upcoming_free(&it);
+
+    delete_month(hook_days, count);
+    free(json);
+
+    done();
+
+}
+
+static int hijri_test(void)
+{
+
+    struct hijri_date h;
+
+    hijri_from_gregorian(2022, 2, 19, &h);
+    check(h.year == 1443 && h.month == 7 && h.day == 18);
+
+    /* The tabular calendar has džumadel-uhra 1443 a day later than the API */
+    hijri_from_gregorian(2022, 2, 1, &h);
+    check(h.month == 6 && h.day == 29);
+
+    struct hijri_adjustment bad = { 1443, 6, -3 };
+    check(hijri_set_adjustments(&bad, 1) == -1);
+
+    struct hijri_adjustment adjust = { 1443, 6, -1 };
+    check(hijri_set_adjustments(&adjust, 1) == 0);
+    check(hijri_month_days(1443, 5) == 29 && hijri_month_days(1443, 6) == 30);
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    /* With the adjustment, every day of the month is as the API has it */
+    for (int i = 0; i < count; i++) {
+
+        char buf[64];
+        hijri_from_gregorian(days[i]->year, days[i]->month, days[i]->day, &h);
+        hijri_format(buf, sizeof buf, &h);
+
+        check(strcmp(buf, days[i]->dates[0]) == 0);
+
+    }
+
+    /* Both ways agree, and months are 29 or 30 days, for two centuries */
+    struct tm date = { 0 };
+    date.tm_year = 1950 - 1900;
+    date.tm_mday = 1;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+    mktime(&date);
+
+    struct hijri_date prev = { 0, 0, 0 };
+
+    for (int i = 0; i < 365 * 150; i++, add_days(&date, 1)) {
+
+        hijri_from_gregorian(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday, &h);
+
+        int year, mon, mday;
+        hijri_to_gregorian(&h, &year, &mon, &mday);
+
+        check(year == date.tm_year + 1900 && mon == date.tm_mon + 1 && mday == date.tm_mday);
+        check(h.day >= 1 && h.day <= hijri_month_days(h.year, h.month));
+        check(hijri_month_days(h.year, h.month) == 29 || hijri_month_days(h.year, h.month) == 30);
+        check(i == 0 || h.day == prev.day + 1 || (h.day == 1 && prev.day == hijri_month_days(prev.year, prev.month)));
+
+        prev = h;
+
+    }
+
+    check(hijri_parse("18. redžeb 1443", &h) == 1 && h.day == 18 && h.month == 7 && h.year == 1443);
+    check(hijri_parse("ramazan 1448", &h) == 1 && h.day == 0 && h.month == 9);
+    check(hijri_parse("Dzumadel ula 1448", &h) == 1 && h.day == 0 && h.month == 5 && h.year == 1448);
+    check(hijri_parse("3. zul ka'de  1447 ", &h) == 1 && h.day == 3 && h.month == 11 && h.year == 1447);
+    check(hijri_parse("ramazan", &h) == 0 && hijri_parse("1448", &h) == 0 && hijri_parse("ramazan1448", &h) == 0);
+    check(hijri_parse("ramazan 1448 x", &h) == 0);
+    check(hijri_parse("dzumadel-ula 1448", &h) == 1 && h.month == 5);
+    check(hijri_parse("saban 1447", &h) == 1 && h.month == 8);
+    check(hijri_parse("ramadan 1448", &h) == 0);
+    check(hijri_parse("31. ramazan 1448", &h) == 0);
+
+    hijri_set_adjustments(NULL, 0);
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int alloc_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+    int count;
+
+    /* Everything parsing takes is given back */
+    struct alloc_counter counter;
+    alloc_counter_init(&counter, NULL);
+    alloc_set_thread(&counter.allocator);
+
+    struct vaktija **days = parse_month(json, &count);
+    check(count == 28);
+    check(counter.allocs > 0 && counter.bytes > 0);
+
+    delete_month(days, count);
+    check(counter.frees == counter.allocs);
+
+    /* The same month out of an arena, then thrown away at once */
+    struct alloc_arena arena;
+    alloc_arena_init(&arena, 4096);
+    alloc_set_thread(&arena.allocator);
+
+    days = parse_month(json, &count);
+    check(count == 28 && days[18]->times[5] == 18 * 3600 + 51 * 60);
+    check(strcmp(days[18]->dates[0], "18. redžeb 1443") == 0);
+    check(alloc_arena_used(&arena) > 0);
+
+    delete_month(days, count);
+    alloc_arena_reset(&arena);
+    check(alloc_arena_used(&arena) == 0);
+
+    /* The latest allocation grows in place, anything else is copied */
+    char *a = vmalloc(8);
+    strcpy(a, "vakat");
+    check(vrealloc(a, 64) == a);
+
+    char *b = vstrdup("sabah");
+    char *c = vrealloc(a, 200);
+    check(c != a && strcmp(c, "vakat") == 0 && strcmp(b, "sabah") == 0);
+
+    int *zeros = vcalloc(100, sizeof *zeros);
+    check(zeros[0] == 0 && zeros[99] == 0);
+
+    /* Larger than a block */
+    char *big = vmalloc(10000);
+    memset(big, 1, 10000);
+    check(alloc_arena_used(&arena) >= 10000);
+
+    alloc_set_thread(NULL);
+    check(alloc_current() != &arena.allocator);
+
+    alloc_arena_free(&arena);
+    free(json);
+
+    done();
+
+}
+
+static int prompt_test(void)
+{
+
+    char *json = read_cache(DUMMY_CACHE_FILE);
+    char *month = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(month, &count);
+
+    cache_prepare_dir(PROMPT_DIR);
+    unlink(PROMPT_DIR "/77-2022-02-18.rec");
+    unlink(PROMPT_DIR "/77-2022-02-19.rec");
+    unlink(PROMPT_DIR "/77-2022-02-20.rec");
+    write_cache_data(PROMPT_DIR "/77-2022-02-19.json", json, strlen(json));
+
+    char err[FORMAT_ERR_MAX];
+    struct format *fmts[PROMPT_ACTION_NUM];
+
+    for (int i = 0; i < PROMPT_ACTION_NUM; i++) {
+        fmts[i] = format_compile(prompt_template(i), err, sizeof err);
+    }
+
+    check(prompt_action("countdown") == PROMPT_COUNTDOWN && prompt_action("print") == -1);
+
+    struct prompt p;
+    prompt_init(&p);
+
+    char buf[64];
+    time_t evening = local_epoch(2022, 2, 19, 18, 0);
+
+    /* Read once, then answered from memory */
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_NEXT, fmts[PROMPT_NEXT], evening, buf, sizeof buf) > 0);
+    check(strcmp(buf, "18:51") == 0);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_COUNTDOWN, fmts[PROMPT_COUNTDOWN], evening, buf, sizeof buf) > 0);
+    check(strcmp(buf, "0:51") == 0);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], evening, buf, sizeof buf) > 0);
+    check(strcmp(buf, "17:27") == 0);
+    check(p.loads == 1);
+
+    /* After isha without tomorrow in the cache there is no answer, and nothing exits */
+    time_t night = local_epoch(2022, 2, 19, 22, 0);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_NEXT, fmts[PROMPT_NEXT], night, buf, sizeof buf) == -1);
+
+    write_record(PROMPT_DIR "/77-2022-02-20.rec", days[19]);
+
+    int loads = p.loads;
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_NEXT, fmts[PROMPT_NEXT], night, buf, sizeof buf) > 0);
+    check(strcmp(buf, "4:58") == 0);
+    check(p.loads == loads + 1);
+
+    /* A record showing up for today is what the cache has now */
+    write_record(PROMPT_DIR "/77-2022-02-19.rec", days[18]);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], night, buf, sizeof buf) > 0);
+    check(strcmp(buf, "18:51") == 0 && p.loads == loads + 2);
+
+    /* Tomorrow becomes today after midnight without being read again */
+    time_t dawn = local_epoch(2022, 2, 20, 3, 0);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_NEXT, fmts[PROMPT_NEXT], dawn, buf, sizeof buf) > 0);
+    check(p.loads == loads + 2);
+
+    /* Before fajr it is still yesterday's isha, and today became yesterday */
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], dawn, buf, sizeof buf) > 0);
+    check(strcmp(buf, "18:51") == 0 && p.loads == loads + 2);
+
+    /* Without yesterday in the cache there is no answer rather than today's isha */
+    time_t early = local_epoch(2022, 2, 19, 3, 0);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], early, buf, sizeof buf) == -1);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_NEXT, fmts[PROMPT_NEXT], early, buf, sizeof buf) > 0);
+    check(strcmp(buf, "4:59") == 0);
+
+    /* A day which is not cached is only looked for again once the directory changes */
+    struct utimbuf past = { time(NULL) - 60, time(NULL) - 60 };
+    check(utime(PROMPT_DIR, &past) == 0);
+
+    loads = p.loads;
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], early, buf, sizeof buf) == -1);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], early, buf, sizeof buf) == -1);
+    check(p.loads == loads + 1);
+
+    write_record(PROMPT_DIR "/77-2022-02-18.rec", days[17]);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, fmts[PROMPT_CURRENT], early, buf, sizeof buf) > 0);
+    check(strcmp(buf, days[17]->prayers[5]) == 0 && p.loads == loads + 2);
+
+    struct format *named = format_compile("{next.name} in {countdown}", err, sizeof err);
+    check(prompt_answer(&p, PROMPT_DIR, 77, PROMPT_CURRENT, named, evening + 600, buf, sizeof buf) > 0);
+    check(strcmp(buf, "Isha in 0:41") == 0);
+
+    prompt_free(&p);
+    format_free(named);
+
+    for (int i = 0; i < PROMPT_ACTION_NUM; i++) {
+        format_free(fmts[i]);
+    }
+
+    delete_month(days, count);
+    free(month);
+    free(json);
+
+    done();
+
+}
+
+static void *metrics_thread(void *arg)
+{
+
+    (void) arg;
+
+    for (int i = 0; i < 1000; i++) {
+        metric_add(METRIC_HOOKS_RUN, 1);
+    }
+
+    return NULL;
+
+}
+
+/*
+    Sends stdout to /dev/null until unquiet is given what this returned,
+    for code which reports what it does there.
+*/
+static int quiet(void)
+{
+
+    fflush(stdout);
+
+    int out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    return out;
+
+}
+
+static void unquiet(int out)
+{
+
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+
+}
+
+static int cachegc_test(void)
+{
+
+    /* Left by writes which never finished, and files of someone else's */
+    const char *stale[] = { "77-2022-02-19.json.1234.tmp", "77-2022-02-19.rec.99.tmp", "cache.pack.7.tmp" };
+    const char *foreign[] = { "notes.tmp", "report.json.1.tmp", "77-2022-02-19.json.x1.tmp", "draft.12.tmp" };
+
+    size_t nstale = sizeof stale / sizeof stale[0];
+    size_t nforeign = sizeof foreign / sizeof foreign[0];
+
+    char path[CACHE_PATH_MAX];
+    struct utimbuf old = { time(NULL) - 2 * 86400, time(NULL) - 2 * 86400 };
+
+    cache_prepare_dir(GC_DIR);
+
+    for (size_t i = 0; i < nstale + nforeign; i++) {
+
+        const char *name = (i < nstale) ? stale[i] : foreign[i - nstale];
+
+        snprintf(path, sizeof path, "%s/%s", GC_DIR, name);
+        write_cache_data(path, "{}", 2);
+        check(utime(path, &old) == 0);
+
+    }
+
+    /* gc reports what it removed on stdout */
+    int out = quiet();
+    int res = cache_gc(GC_DIR, 1, 0, 0);
+    unquiet(out);
+
+    check(res == 0);
+
+    for (size_t i = 0; i < nstale + nforeign; i++) {
+
+        const char *name = (i < nstale) ? stale[i] : foreign[i - nstale];
+
+        snprintf(path, sizeof path, "%s/%s", GC_DIR, name);
+        check(access(path, F_OK) == ((i < nstale) ? -1 : 0));
+        unlink(path);
+
+    }
+
+    done();
+
+}
+
+static int metrics_test(void)
+{
+
+    int64_t before = metric_value(METRIC_HOOKS_RUN);
+
+    pthread_t tid;
+    check(pthread_create(&tid, NULL, metrics_thread, NULL) == 0);
+
+    for (int i = 0; i < 1000; i++) {
+        metric_add(METRIC_HOOKS_RUN, 1);
+    }
+
+    pthread_join(tid, NULL);
+    check(metric_value(METRIC_HOOKS_RUN) - before == 2000);
+
+    metric_add(METRIC_SUBSCRIPTIONS, 2);
+    metric_add(METRIC_SUBSCRIPTIONS, -1);
+    check(metric_value(METRIC_SUBSCRIPTIONS) == 1);
+
+    metric_observe(HISTOGRAM_REFRESH, 200000);
+    metric_observe(HISTOGRAM_REFRESH, 3000000);
+    metric_observe(HISTOGRAM_REFRESH, 20000000000);
+
+    char *text = metrics_render();
+    size_t len = strlen(text);
+
+    check(strstr(text, "# TYPE vactija_subscriptions gauge\n") != NULL);
+    check(strstr(text, "\nvactija_subscriptions 1\n") != NULL);
+    check(strstr(text, "\nvactija_hooks_run_total ") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_bucket{le=\"0.0005\"} 1\n") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_bucket{le=\"0.005\"} 2\n") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_bucket{le=\"10.0\"} 2\n") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_bucket{le=\"+Inf\"} 3\n") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_sum 20.003200000\n") != NULL);
+    check(strstr(text, "vactija_refresh_duration_seconds_count 3\n") != NULL);
+    check(len > 6 && strcmp(text + len - 6, "# EOF\n") == 0);
+
+    vfree(text);
+
+    done();
+
+}
+
+static int clock_test(void)
+{
+
+    time_t at = local_epoch(2022, 2, 19, 18, 50);
+
+    check(clock_kind() == CLOCK_SOURCE_REAL);
+
+    clock_set_fixed(at);
+    check(clock_now() == at);
+
+    struct tm tm;
+    clock_localtime(&tm);
+    check(tm.tm_mday == 19 && tm.tm_hour == 18 && tm.tm_min == 50);
+
+    /* A year a second, which has surely moved it along by the check */
+    clock_set_accelerated(at, 31536000);
+    check(clock_now() >= at && clock_now() < at + 2 * 31536000);
+
+    setenv("VACTIJA_NOW", "2022-02-19 18:50", 1);
+    check(clock_from_env() == 0 && clock_kind() == CLOCK_SOURCE_FIXED && clock_now() == at);
+
+    setenv("VACTIJA_CLOCK_SPEED", "60", 1);
+    check(clock_from_env() == 0 && clock_kind() == CLOCK_SOURCE_ACCELERATED);
+
+    setenv("VACTIJA_CLOCK_SPEED", "fast", 1);
+    check(clock_from_env() == -1);
+
+    setenv("VACTIJA_NOW", "2022-13-19 18:50", 1);
+    check(clock_from_env() == -1);
+
+    unsetenv("VACTIJA_NOW");
+    unsetenv("VACTIJA_CLOCK_SPEED");
+    clock_set_real();
+
+    done();
+
+}
+
+/*
+    Sweeps a fixed clock over every minute of 2022, asking next_vakat,
+    current_vakat and the timeline at each one and checking that they
+    agree with each other and with the times. The days are the dummy
+    month's, repeated with the dates of the year.
+*/
+static int simulation_test(void)
+{
+
+    char *json = read_cache(DUMMY_MONTH_FILE);
+
+    int count;
+    struct vaktija **days = parse_month(json, &count);
+
+    /* The day before and after the year too, for the timelines */
+    static struct vaktija year[367];
+    struct tm date = { 0 };
+    date.tm_year = 2021 - 1900;
+    date.tm_mon = 11;
+    date.tm_mday = 31;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+
+    for (int i = 0; i < 367; i++) {
+
+        year[i] = *days[i % count];
+        year[i].year = date.tm_year + 1900;
+        year[i].month = date.tm_mon + 1;
+        year[i].day = date.tm_mday;
+
+        add_days(&date, 1);
+
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    time_t first = local_epoch(2022, 1, 1, 0, 0);
+    time_t last = local_epoch(2023, 1, 1, 0, 0);
+
+    struct timeline tl;
+    int day = -1;
+    int minutes = 0;
+
+    for (time_t t = first; t < last; t += 60) {
+
+        clock_set_fixed(t);
+
+        time_t now = clock_now();
+        struct tm tm;
+        clock_localtime(&tm);
+
+        if (tm.tm_yday != day) {
+
+            day = tm.tm_yday;
+
+            timeline_init(&tl);
+            timeline_add_day(&tl, &year[day]);
+            timeline_add_day(&tl, &year[day + 1]);
+            timeline_add_day(&tl, &year[day + 2]);
+
+        }
+
+        const struct vaktija *v = &year[day + 1];
+        int next = next_vakat(v, tm);
+        int current = current_vakat(v, tm);
+
+        check(next >= 0 && current == (next + PRAYER_TIME_NUM - 1) % PRAYER_TIME_NUM);
+
+        int idx = timeline_next(&tl, now);
+        int cur = timeline_current(&tl, now);
+
+        check(idx > cur && cur >= 0);
+        check(tl.times[cur] <= now && now < tl.times[idx]);
+        check(timeline_vakat(&tl, idx) == next && timeline_vakat(&tl, cur) == current);
+
+        /* Before fajr the next vakat is today's, after isha tomorrow's */
+        check(timeline_day(&tl, idx) == ((next == 0 && now >= tl.times[PRAYER_TIME_NUM]) ? &year[day + 2] : v));
+
+        minutes++;
+
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_set_real();
+
+    check(minutes == 525600);
+    check(secs < 1.0);
+
+    delete_month(days, count);
+    free(json);
+
+    done();
+
+}
+
+static int lazycurl_test(void)
+{
+
+    check(curl_loaded() == 0);
+    check(dlopen("libcurl.so.4", RTLD_NOW | RTLD_NOLOAD) == NULL);
+
+    check(curl_api() != NULL);
+    check(curl_loaded() == 1);
+
+    done();
+
+}
+
+/*
+    Starts the stub API with args (NULL terminated) on a port of its own,
+    which is stored in port. Returns its pid, or -1 if it did not start.
+*/
+static pid_t stub_start(const char *const *args, int *port)
+{
+
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        char *argv[16] = { STUB_BIN, "-p", "0" };
+        int argc = 3;
+
+        while (argc < 15 && args[argc - 3] != NULL) {
+
+            argv[argc] = (char *) args[argc - 3];
+            argc++;
+
+        }
+
+        argv[argc] = NULL;
+
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        execv(argv[0], argv);
+        _exit(127);
+
+    }
+
+    close(fds[1]);
+
+    /* It prints where it listens once it does */
+    FILE *out = fdopen(fds[0], "r");
+    char line[256];
+
+    if (pid > 0 && (fgets(line, sizeof line, out) == NULL ||
+        sscanf(line, "Stub API on http://127.0.0.1:%d", port) != 1)) {
+
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        pid = -1;
+
+    }
+
+    fclose(out);
+
+    return pid;
+
+}
+
+static void stub_stop(pid_t pid)
+{
+
+    if (pid > 0) {
+
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+
+    }
+
+}
+
+/*
+    Returns how many requests the stub on port has had, or -1.
+*/
+static long stub_requests(int port)
+{
+
+    char url[64];
+    snprintf(url, sizeof url, "http://127.0.0.1:%d/count", port);
+
+    char *body = fetch_url(url);
+    long count = (body != NULL) ? atol(body) : -1;
+
+    vfree(body);
+
+    return count;
+
+}
+
+static long elapsed_ms(const struct timespec *start)
+{
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+
+}
+
+/*
+    Fetches a day from a stub started with args under the policy, and
+    stores how many requests it took and how long in requests and ms.
+
+    Returns 1 if the data came back.
+*/
+static int stub_fetch(const char *const *args, const struct fetch_policy *policy, long *requests, long *ms)
+{
+
+    int port;
+    pid_t pid = stub_start(args, &port);
+
+    *requests = -1;
+    *ms = -1;
+
+    if (pid < 0) {
+        return 0;
+    }
+
+    char url[64];
+    snprintf(url, sizeof url, "http://127.0.0.1:%d/vaktija/v1/77/2022/2/19", port);
+
+    fetch_set_policy(policy);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Failed attempts are reported on stdout */
+    int out = quiet();
+    char *body = fetch_url(url);
+    unquiet(out);
+
+    *ms = elapsed_ms(&start);
+
+    struct fetch_policy once = { 1000, 2000, 0, 0, 0 };
+    fetch_set_policy(&once);
+
+    *requests = stub_requests(port);
+
+    stub_stop(pid);
+
+    int ok = body != NULL && strstr(body, "\"vakat\"") != NULL;
+    vfree(body);
+
+    return ok;
+
+}
+
+/*
+    Fetches a URL which is meant to fail under the policy.
+
+    Returns how long it took to fail in ms, or -1 if it did not.
+*/
+static long failed_fetch(const char *url, const struct fetch_policy *policy)
+{
+
+    fetch_set_policy(policy);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int out = quiet();
+    char *body = fetch_url(url);
+    unquiet(out);
+
+    long ms = elapsed_ms(&start);
+
+    struct fetch_policy once = { 1000, 2000, 0, 0, 0 };
+    fetch_set_policy(&once);
+
+    if (body != NULL) {
+
+        vfree(body);
+        return -1;
+
+    }
+
+    return ms;
+
+}
+
+static int fetch_test(void)
+{
+
+    long requests, ms;
+
+    /* 5xx twice, then the data, after backoffs of 20 and 40 ms with up to half off */
+    struct fetch_policy retry = { 1000, 2000, 3, 20, 0 };
+    check(stub_fetch((const char *[]) { "-f", "2", "-s", "503", NULL }, &retry, &requests, &ms));
+    check(requests == 3);
+    check(ms >= 30);
+
+    /* The server saying no is final, except for 408 and 429 */
+    check(!stub_fetch((const char *[]) { "-f", "5", "-s", "404", NULL }, &retry, &requests, &ms));
+    check(requests == 1);
+
+    check(stub_fetch((const char *[]) { "-f", "1", "-s", "429", NULL }, &retry, &requests, &ms));
+    check(requests == 2);
+
+    /* Every attempt failing gives up after the retries */
+    check(!stub_fetch((const char *[]) { "-f", "10", "-s", "500", NULL }, &retry, &requests, &ms));
+    check(requests == 4);
+
+    /* An attempt which times out is retried */
+    struct fetch_policy timeout = { 1000, 200, 1, 0, 0 };
+    check(stub_fetch((const char *[]) { "-t", "1500", NULL }, &timeout, &requests, &ms));
+    check(requests == 2);
+    check(ms >= 200 && ms < 1500);
+
+    /* A slow request is hedged with a second one instead of waited out */
+    struct fetch_policy hedge = { 1000, 5000, 0, 0, 100 };
+    check(stub_fetch((const char *[]) { "-t", "1500", NULL }, &hedge, &requests, &ms));
+    check(requests == 2);
+    check(ms >= 100 && ms < 1500);
+
+    /* Errors which come out the same every time are not retried, a refused connection is */
+    struct fetch_policy backoff = { 1000, 2000, 1, 400, 0 };
+    long failed = failed_fetch("nosuch://127.0.0.1/vaktija/v1/77", &backoff);
+    check(failed >= 0 && failed < 200);
+    check(failed_fetch("http://127.0.0.1:1/vaktija/v1/77", &backoff) >= 200);
+
+    /* Without hedging the same request is waited out */
+    struct fetch_policy wait = { 1000, 5000, 0, 0, 0 };
+    check(stub_fetch((const char *[]) { "-t", "300", NULL }, &wait, &requests, &ms));
+    check(requests == 1);
+    check(ms >= 300);
+
+    done();
+
+}
+
+/*
+    Returns a port nobody listens on right now, or -1.
+*/
+static int free_port(void)
+{
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { 0 };
+    socklen_t len = sizeof sa;
+
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int port = (bind(fd, (struct sockaddr *) &sa, sizeof sa) == 0 &&
+        getsockname(fd, (struct sockaddr *) &sa, &len) == 0) ? ntohs(sa.sin_port) : -1;
+
+    close(fd);
+
+    return port;
+
+}
+
+/*
+    Sends an HTTP/1.0 GET for path to port on the loopback and reads the
+    response into buf. Returns its status, or -1 if there was none.
+*/
+static int http_get(int port, const char *path, char *buf, size_t len)
+{
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { 0 };
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    char req[256];
+    int n = snprintf(req, sizeof req, "GET %s HTTP/1.0\r\n\r\n", path);
+    size_t have = 0;
+
+    if (connect(fd, (struct sockaddr *) &sa, sizeof sa) == 0 && send(fd, req, n, MSG_NOSIGNAL) == n) {
+
+        ssize_t got;
+
+        while (have + 1 < len && (got = recv(fd, buf + have, len - 1 - have, 0)) > 0) {
+            have += got;
+        }
+
+    }
+
+    close(fd);
+    buf[have] = '\0';
+
+    int status;
+
+    return (sscanf(buf, "HTTP/1.1 %d", &status) == 1) ? status : -1;
+
+}
+
+/*
+    Returns vactija_upstream_requests_total as the proxy on port exports
+    it, or -1.
+*/
+static long proxy_upstream_requests(int port)
+{
+
+    char buf[8192];
+
+    if (http_get(port, "/metrics", buf, sizeof buf) != 200) {
+        return -1;
+    }
+
+    char *line = strstr(buf, "\nvactija_upstream_requests_total ");
+
+    return (line != NULL) ? atol(line + strlen("\nvactija_upstream_requests_total ")) : -1;
+
+}
+
+struct proxy_client {
+
+    int port;
+    const char *path;
+    pthread_barrier_t *start;
+
+    int status;
+
+};
+
+static void *proxy_client(void *arg)
+{
+
+    struct proxy_client *c = arg;
+    char buf[4096];
+
+    pthread_barrier_wait(c->start);
+    c->status = http_get(c->port, c->path, buf, sizeof buf);
+
+    return NULL;
+
+}
+
+/*
+    Asks the proxy on port for path from count clients at once. Returns
+    how many of them got the status.
+*/
+static int proxy_burst(int port, const char *path, int count, int status)
+{
+
+    struct proxy_client clients[32];
+    pthread_t tids[32];
+    pthread_barrier_t start;
+    int got = 0;
+
+    pthread_barrier_init(&start, NULL, count);
+
+    for (int i = 0; i < count; i++) {
+
+        clients[i] = (struct proxy_client) { port, path, &start, -1 };
+        pthread_create(&tids[i], NULL, proxy_client, &clients[i]);
+
+    }
+
+    for (int i = 0; i < count; i++) {
+
+        pthread_join(tids[i], NULL);
+        got += clients[i].status == status;
+
+    }
+
+    pthread_barrier_destroy(&start);
+
+    return got;
+
+}
+
+static int proxy_test(void)
+{
+
+    /* Slow enough for every client to ask before the first fetch is done, and failing it */
+    int stubport;
+    pid_t stub = stub_start((const char *[]) { "-l", "300", "-f", "1", NULL }, &stubport);
+    check(stub > 0);
+
+    char api[64];
+    snprintf(api, sizeof api, "http://127.0.0.1:%d/vaktija/v1/", stubport);
+
+    int port = free_port();
+
+    /* The child flushes stdout too, which must not print our output again */
+    fflush(stdout);
+    pid_t proxy = fork();
+
+    if (proxy == 0) {
+
+        struct serve_options opts = { "127.0.0.1", port, 4, 0, 1, 0, 0, NULL };
+
+        setenv("VACTIJA_API_URL", api, 1);
+        quiet();
+        serve_http(&opts);
+        _exit(1);
+
+    }
+
+    char buf[4096];
+    int up = -1;
+
+    for (int i = 0; i < 100 && up == -1; i++) {
+
+        usleep(20 * 1000);
+        up = http_get(port, "/metrics", buf, sizeof buf);
+
+    }
+
+    /* It starts out with what this process counted already */
+    long before = proxy_upstream_requests(port);
+
+    /* 20 misses on one key are one upstream request, which failed for all of them */
+    int failed = proxy_burst(port, "/vaktija/v1/77/2022/2/19", 20, 502);
+    long after_burst = proxy_upstream_requests(port) - before;
+
+    /* The failure is remembered for the negative TTL, then asked for again */
+    int cached = http_get(port, "/vaktija/v1/77/2022/2/19", buf, sizeof buf);
+    long while_negative = proxy_upstream_requests(port) - before;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int retried = 502;
+
+    while (retried == 502 && elapsed_ms(&start) < 3000) {
+
+        usleep(100 * 1000);
+        retried = http_get(port, "/vaktija/v1/77/2022/2/19", buf, sizeof buf);
+
+    }
+
+    long after_expiry = proxy_upstream_requests(port) - before;
+
+    /* And once it is there, from memory */
+    int served = proxy_burst(port, "/vaktija/v1/77/2022/2/20", 20, 200);
+    int hit = http_get(port, "/vaktija/v1/77/2022/2/19", buf, sizeof buf);
+    long total = proxy_upstream_requests(port) - before;
+
+    kill(proxy, SIGTERM);
+    waitpid(proxy, NULL, 0);
+
+    long stubbed = stub_requests(stubport);
+    stub_stop(stub);
+
+    check(up == 200 && before >= 0);
+    check(failed == 20 && after_burst == 1);
+    check(cached == 502 && while_negative == 1);
+    check(retried == 200 && after_expiry == 2);
+    check(served == 20 && hit == 200 && total == 3);
+    check(stubbed == 3);
+
+    done();
+
+}
+
 int main(void) {
 
     test(timestr_parsing, "parsing timestrings");
@@ -349,6 +2210,30 @@ int main(void) {
     test(jsonparse_test, "parsing cache json");
     test(nextvakat_test, "getting next vakat");
     test(currentvakat_test, "getting current vakat");
+    test(monthparse_test, "parsing monthly json");
+    test(timeline_test, "timeline across midnight");
+    test(midnight_test, "night times from next day");
+    test(record_test, "binary record roundtrip");
+    test(derived_test, "derived times on load");
+    test(replay_test, "replaying recorded downloads");
+    test(bundle_test, "yearly bundle roundtrip");
+    test(pack_test, "cache pack roundtrip");
+    test(location_test, "location lookup");
+    test(format_test, "output format templates");
+    test(export_test, "csv, jsonl and ics exports");
+    test(timeheap_test, "timer heap order");
+    test(hook_test, "daemon hooks and their times");
+    test(upcoming_test, "upcoming vakats across days");
+    test(hijri_test, "hijri calendar");
+    test(alloc_test, "arena and counting allocators");
+    test(prompt_test, "prompt answers from the cache");
+    test(cachegc_test, "cache gc of stale temporary files");
+    test(metrics_test, "per-thread metrics");
+    test(clock_test, "fixed and accelerated clocks");
+    test(simulation_test, "every minute of a year");
+    test(lazycurl_test, "libcurl loaded lazily");
+    test(fetch_test, "retries, timeouts and hedging");
+    test(proxy_test, "proxy single-flight and negative cache");
 
     printf("Ran %d tests. Failed %d.\n", (passed_test + failed_test), failed_test);
 
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "vactija.h"
+#include "timeline.h"
+#include "util/temporal.h"
+
+/*
+    Returns the point in time (in local time) at which the vakat with
+    the given index (0 - 5) happens on the day of the vaktija.
+
+    The vaktija has to know its date, and -1 is returned otherwise.
+*/
+time_t vakat_epoch(const struct vaktija *vaktija, int vakat)
+{
+
+    if (vaktija->year == 0) {
+        return -1;
+    }
+
+    struct tm tm = { 0 };
+    tm.tm_hour = vaktija->times[vakat] / 3600;
+    tm.tm_min = (vaktija->times[vakat] / 60) % 60;
+    tm.tm_year = vaktija->year - 1900;
+    tm.tm_mon = vaktija->month - 1;
+    tm.tm_mday = vaktija->day;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+
+}
+
+void timeline_init(struct timeline *tl)
+{
+
+    tl->count = 0;
+    tl->ndays = 0;
+
+}
+
+/*
+    Appends the vakats of a day to the timeline. Days have to be added
+    in chronological order, each one following the previous.
+
+    Returns 0 on success and -1 if the day could not be added (the
+    timeline is full, the vaktija does not know its date or the day
+    does not follow the previous one).
+*/
+int timeline_add_day(struct timeline *tl, const struct vaktija *vaktija)
+{
+
+    if (tl->ndays == TIMELINE_MAX_DAYS) {
+        return -1;
+    }
+
+    time_t times[PRAYER_TIME_NUM];
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+        times[i] = vakat_epoch(vaktija, i);
+
+        if (times[i] == -1) {
+            return -1;
+        }
+
+    }
+
+    if (tl->count > 0 && times[0] <= tl->times[tl->count - 1]) {
+        return -1;
+    }
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+        tl->times[tl->count + i] = times[i];
+    }
+
+    tl->days[tl->ndays++] = vaktija;
+    tl->count += PRAYER_TIME_NUM;
+
+    return 0;
+
+}
+
+/*
+    Returns the index (into the timeline) of the first vakat after now,
+    or -1 if the timeline ends before that.
+*/
+int timeline_next(const struct timeline *tl, time_t now)
+{
+
+    int lo = 0;
+    int hi = tl->count;
+
+    while (lo < hi) {
+
+        int mid = lo + (hi - lo) / 2;
+
+        if (tl->times[mid] > now) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+
+    }
+
+    return (lo < tl->count) ? lo : -1;
+
+}
+
+/*
+    Returns the index (into the timeline) of the vakat which is in
+    progress at now, or -1 if the timeline starts after that.
+*/
+int timeline_current(const struct timeline *tl, time_t now)
+{
+
+    int next = timeline_next(tl, now);
+
+    if (next == -1) {
+        return tl->count - 1;
+    }
+
+    return next - 1;
+
+}
+
+/*
+    Returns the day the vakat at the timeline index belongs to.
+*/
+const struct vaktija *timeline_day(const struct timeline *tl, int idx)
+{
+
+    return tl->days[idx / PRAYER_TIME_NUM];
+
+}
+
+/*
+    Returns the vakat index (0 - 5) of the vakat at the timeline index,
+    or -1 if there is no such index in the timeline.
+*/
+int timeline_vakat(const struct timeline *tl, int idx)
+{
+
+    return (idx >= 0 && idx < tl->count) ? idx % PRAYER_TIME_NUM : -1;
+
+}
@@ -0,0 +1,40 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <time.h>
+
+#include "vactija.h"
+
+/*
+    Enough for yesterday, today and tomorrow.
+*/
+#define TIMELINE_MAX_DAYS 3
+
+/*
+    A continuous, sorted run of vakat times across consecutive days,
+    so that "next" and "current" keep working across midnight instead
+    of wrapping around to today's data.
+*/
+struct timeline {
+
+    int count;
+
+    time_t times[TIMELINE_MAX_DAYS * PRAYER_TIME_NUM];
+    const struct vaktija *days[TIMELINE_MAX_DAYS];
+
+    int ndays;
+
+};
+
+time_t vakat_epoch(const struct vaktija *vaktija, int vakat);
+
+void timeline_init(struct timeline *tl);
+int timeline_add_day(struct timeline *tl, const struct vaktija *vaktija);
+
+int timeline_next(const struct timeline *tl, time_t now);
+int timeline_current(const struct timeline *tl, time_t now);
+
+const struct vaktija *timeline_day(const struct timeline *tl, int idx);
+int timeline_vakat(const struct timeline *tl, int idx);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vactija.h"
+#include "upcoming.h"
+#include "timeline.h"
+#include "util/temporal.h"
+#include "util/alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+/*
+    Moves the cursor on to the day after its current one, keeping the
+    current one as prev. Returns 0 on success and -1 if the day can not
+    be loaded.
+*/
+static int next_day(struct upcoming *it, struct upcoming_cursor *c)
+{
+
+    struct tm date = { 0 };
+    date.tm_year = c->day->year - 1900;
+    date.tm_mon = c->day->month - 1;
+    date.tm_mday = c->day->day;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+
+    add_days(&date, 1);
+
+    struct vaktija *v = it->load(c->location, date);
+
+    if (v == NULL) {
+        return -1;
+    }
+
+    if (c->prev != NULL) {
+        delete_vaktija(c->prev);
+    }
+
+    c->prev = c->day;
+    c->day = v;
+    c->vakat = 0;
+
+    return 0;
+
+}
+
+/*
+    Puts the first vakat of the cursor after the given time into the
+    heap, going to the following day when the current one is over. A
+    cursor whose next day can not be loaded (or which does not know
+    its date) stays out of the heap, which ends that location.
+*/
+static void advance(struct upcoming *it, int i, time_t after)
+{
+
+    struct upcoming_cursor *c = &it->cursors[i];
+
+    /* Two days are always enough, the second only has to be reached */
+    for (int tries = 0; c->day != NULL && c->day->year != 0 && tries < 3; tries++) {
+
+        for (; c->vakat < PRAYER_TIME_NUM; c->vakat++) {
+
+            time_t at = vakat_epoch(c->day, c->vakat);
+
+            if (at > after) {
+
+                timeheap_push(&it->heap, at, i);
+
+                return;
+
+            }
+
+        }
+
+        if (next_day(it, c) != 0) {
+            return;
+        }
+
+    }
+
+}
+
+/*
+    Starts iterating over the vakats of the locations after from. Each
+    location starts on the day from is on, loaded through load.
+*/
+void upcoming_init(struct upcoming *it, const int *locations, int count, time_t from, upcoming_load_fn load)
+{
+
+    it->cursors = vcalloc(count > 0 ? count : 1, sizeof *it->cursors);
+
+    if (it->cursors == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory for the locations!\n");
+        vactija_error(errcode);
+
+    }
+
+    it->count = count;
+    it->load = load;
+    timeheap_init(&it->heap);
+
+    struct tm today;
+    localtime_r(&from, &today);
+
+    for (int i = 0; i < count; i++) {
+
+        struct upcoming_cursor *c = &it->cursors[i];
+        c->location = locations[i];
+        c->day = load(c->location, today);
+
+        advance(it, i, from);
+
+    }
+
+}
+
+/*
+    Takes the next event, the earliest of any location (or of the first
+    location given, if several are at the same time).
+
+    Returns 0 on success and -1 once no location has any more events.
+*/
+int upcoming_next(struct upcoming *it, struct upcoming_event *ev)
+{
+
+    struct timeheap_entry top;
+
+    if (timeheap_pop(&it->heap, &top) != 0) {
+        return -1;
+    }
+
+    struct upcoming_cursor *c = &it->cursors[top.id];
+
+    ev->at = top.at;
+    ev->vakat = c->vakat;
+    ev->location = c->location;
+    ev->day = c->day;
+
+    /* If it goes on to the next day, the event's day is kept as prev */
+    c->vakat++;
+    advance(it, top.id, top.at);
+
+    return 0;
+
+}
+
+void upcoming_free(struct upcoming *it)
+{
+
+    for (int i = 0; i < it->count; i++) {
+
+        if (it->cursors[i].day != NULL) {
+            delete_vaktija(it->cursors[i].day);
+        }
+
+        if (it->cursors[i].prev != NULL) {
+            delete_vaktija(it->cursors[i].prev);
+        }
+
+    }
+
+    vfree(it->cursors);
+    timeheap_free(&it->heap);
+
+}
@@ -0,0 +1,64 @@
+#ifndef UPCOMING_H
+#define UPCOMING_H
+
+#include <time.h>
+
+#include "vactija.h"
+#include "util/timeheap.h"
+
+/*
+    Loads the vaktija of a location for a date, returning NULL if it is
+    not available.
+*/
+typedef struct vaktija *(*upcoming_load_fn)(int location, struct tm date);
+
+/*
+    A vakat of a location at a point in time. day is the vaktija it is
+    on, which stays valid until the next call to upcoming_next.
+*/
+struct upcoming_event {
+
+    time_t at;
+    int vakat;
+    int location;
+
+    const struct vaktija *day;
+
+};
+
+/*
+    Where a location is at: the day it is on (and the one before, which
+    the last event may still be on) and the vakat it is at in the heap.
+*/
+struct upcoming_cursor {
+
+    int location;
+
+    struct vaktija *day;
+    struct vaktija *prev;
+
+    int vakat;
+
+};
+
+/*
+    The vakats of one or more locations from some point in time on, in
+    order and across midnight. Days are loaded only when a location
+    gets to them. Every location has its next event in a min-heap, so
+    merging k of them costs O(log k) an event.
+*/
+struct upcoming {
+
+    struct upcoming_cursor *cursors;
+    int count;
+
+    struct timeheap heap;
+    upcoming_load_fn load;
+
+};
+
+void upcoming_init(struct upcoming *it, const int *locations, int count, time_t from, upcoming_load_fn load);
+int upcoming_next(struct upcoming *it, struct upcoming_event *ev);
+void upcoming_free(struct upcoming *it);
+
+#endif
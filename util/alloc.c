@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+#define ARENA_ALIGN 16
+
+/* In front of every arena allocation, so it can be grown */
+#define ARENA_HEADER ARENA_ALIGN
+
+struct arena_block {
+
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+
+};
+
+static void *system_alloc(void *ctx, size_t size)
+{
+
+    (void) ctx;
+    return malloc(size);
+
+}
+
+static void *system_realloc(void *ctx, void *ptr, size_t size)
+{
+
+    (void) ctx;
+    return realloc(ptr, size);
+
+}
+
+static void system_free(void *ctx, void *ptr)
+{
+
+    (void) ctx;
+    free(ptr);
+
+}
+
+static const struct allocator system_allocator = {
+    system_alloc, system_realloc, system_free, NULL
+};
+
+static const struct allocator *process = &system_allocator;
+static __thread const struct allocator *thread = NULL;
+
+/*
+    Sets the allocator of the process, or goes back to malloc if it is
+    NULL. The allocator has to stay around for as long as it is set.
+*/
+void alloc_set(const struct allocator *allocator)
+{
+
+    process = (allocator != NULL) ? allocator : &system_allocator;
+
+}
+
+/*
+    Sets the allocator of the calling thread, or goes back to the one of
+    the process if it is NULL.
+*/
+void alloc_set_thread(const struct allocator *allocator)
+{
+
+    thread = allocator;
+
+}
+
+const struct allocator *alloc_current(void)
+{
+
+    return (thread != NULL) ? thread : process;
+
+}
+
+void *vmalloc(size_t size)
+{
+
+    const struct allocator *a = alloc_current();
+
+    return a->alloc(a->ctx, size);
+
+}
+
+void *vcalloc(size_t count, size_t size)
+{
+
+    const struct allocator *a = alloc_current();
+
+    if (a == &system_allocator) {
+        return calloc(count, size);
+    }
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = a->alloc(a->ctx, count * size);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+
+}
+
+void *vrealloc(void *ptr, size_t size)
+{
+
+    const struct allocator *a = alloc_current();
+
+    return a->realloc(a->ctx, ptr, size);
+
+}
+
+void vfree(void *ptr)
+{
+
+    const struct allocator *a = alloc_current();
+
+    a->free(a->ctx, ptr);
+
+}
+
+char *vstrndup(const char *str, size_t len)
+{
+
+    len = strnlen(str, len);
+
+    char *copy = vmalloc(len + 1);
+
+    if (copy != NULL) {
+
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+
+    }
+
+    return copy;
+
+}
+
+char *vstrdup(const char *str)
+{
+
+    return vstrndup(str, strlen(str));
+
+}
+
+static size_t *arena_size_of(void *ptr)
+{
+
+    return (size_t *) ((unsigned char *) ptr - ARENA_HEADER);
+
+}
+
+static size_t arena_round(size_t size)
+{
+
+    return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+}
+
+static void *arena_alloc(void *ctx, size_t size)
+{
+
+    struct alloc_arena *arena = ctx;
+
+    if (size > SIZE_MAX / 2) {
+        return NULL;
+    }
+
+    size_t need = ARENA_HEADER + arena_round(size);
+    struct arena_block *b = arena->blocks;
+
+    if (b == NULL || b->size - b->used < need) {
+
+        size_t bsize = (need > arena->block_size) ? need : arena->block_size;
+
+        if ((b = malloc(sizeof *b + bsize)) == NULL) {
+            return NULL;
+        }
+
+        b->next = arena->blocks;
+        b->size = bsize;
+        b->used = 0;
+        arena->blocks = b;
+
+    }
+
+    void *ptr = b->data + b->used + ARENA_HEADER;
+    *arena_size_of(ptr) = size;
+    b->used += need;
+
+    arena->last = ptr;
+
+    return ptr;
+
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t size)
+{
+
+    struct alloc_arena *arena = ctx;
+
+    if (ptr == NULL) {
+        return arena_alloc(ctx, size);
+    }
+
+    size_t old = *arena_size_of(ptr);
+
+    if (ptr == arena->last && size <= SIZE_MAX / 2) {
+
+        struct arena_block *b = arena->blocks;
+        size_t start = (unsigned char *) ptr - b->data;
+
+        if (b->size - start >= arena_round(size)) {
+
+            b->used = start + arena_round(size);
+            *arena_size_of(ptr) = size;
+
+            return ptr;
+
+        }
+
+    }
+
+    void *res = arena_alloc(ctx, size);
+
+    if (res != NULL) {
+        memcpy(res, ptr, (old < size) ? old : size);
+    }
+
+    return res;
+
+}
+
+static void arena_free_one(void *ctx, void *ptr)
+{
+
+    struct alloc_arena *arena = ctx;
+
+    if (ptr != NULL && ptr == arena->last) {
+
+        arena->blocks->used = (unsigned char *) ptr - ARENA_HEADER - arena->blocks->data;
+        arena->last = NULL;
+
+    }
+
+}
+
+/*
+    Starts an empty arena which takes memory from malloc block_size bytes
+    at a time (or more, for allocations that would not fit).
+*/
+void alloc_arena_init(struct alloc_arena *arena, size_t block_size)
+{
+
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.realloc = arena_realloc;
+    arena->allocator.free = arena_free_one;
+    arena->allocator.ctx = arena;
+
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->last = NULL;
+
+}
+
+/*
+    Gives back everything allocated from the arena at once. The current
+    block is kept for what comes next.
+*/
+void alloc_arena_reset(struct alloc_arena *arena)
+{
+
+    if (arena->blocks == NULL) {
+        return;
+    }
+
+    struct arena_block *b = arena->blocks->next;
+
+    while (b != NULL) {
+
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+
+    }
+
+    arena->blocks->next = NULL;
+    arena->blocks->used = 0;
+    arena->last = NULL;
+
+}
+
+void alloc_arena_free(struct alloc_arena *arena)
+{
+
+    alloc_arena_reset(arena);
+
+    free(arena->blocks);
+    arena->blocks = NULL;
+
+}
+
+/*
+    Returns how many bytes of the arena are taken, headers included.
+*/
+size_t alloc_arena_used(const struct alloc_arena *arena)
+{
+
+    size_t used = 0;
+
+    for (const struct arena_block *b = arena->blocks; b != NULL; b = b->next) {
+        used += b->used;
+    }
+
+    return used;
+
+}
+
+static void *counter_alloc(void *ctx, size_t size)
+{
+
+    struct alloc_counter *c = ctx;
+
+    __atomic_fetch_add(&c->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytes, size, __ATOMIC_RELAXED);
+
+    return c->parent->alloc(c->parent->ctx, size);
+
+}
+
+static void *counter_realloc(void *ctx, void *ptr, size_t size)
+{
+
+    struct alloc_counter *c = ctx;
+
+    __atomic_fetch_add(&c->reallocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytes, size, __ATOMIC_RELAXED);
+
+    return c->parent->realloc(c->parent->ctx, ptr, size);
+
+}
+
+static void counter_free(void *ctx, void *ptr)
+{
+
+    struct alloc_counter *c = ctx;
+
+    if (ptr != NULL) {
+        __atomic_fetch_add(&c->frees, 1, __ATOMIC_RELAXED);
+    }
+
+    c->parent->free(c->parent->ctx, ptr);
+
+}
+
+/*
+    Starts a counter passing everything on to parent, or to malloc if it
+    is NULL.
+*/
+void alloc_counter_init(struct alloc_counter *counter, const struct allocator *parent)
+{
+
+    counter->allocator.alloc = counter_alloc;
+    counter->allocator.realloc = counter_realloc;
+    counter->allocator.free = counter_free;
+    counter->allocator.ctx = counter;
+
+    counter->parent = (parent != NULL) ? parent : &system_allocator;
+
+    counter->allocs = 0;
+    counter->reallocs = 0;
+    counter->frees = 0;
+    counter->bytes = 0;
+
+}
@@ -0,0 +1,89 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Where the library's memory comes from: the vaktije, the JSON bodies
+    and cache files read or fetched, and everything built from them,
+    including the proxy's and the daemon's connections, responses and
+    hooks, and the rendered metrics. All of it is allocated with vmalloc/vcalloc/vrealloc/vstrdup and has to
+    be given back with vfree (delete_vaktija and free_array do), which
+    call whatever allocator is set:
+
+        alloc_set         for the whole process, before any threads start
+        alloc_set_thread  for the calling thread only, over the process one
+
+    Without either it is the system malloc, which the command-line
+    front end (vactija-cli.c) also uses directly for its own option
+    strings and work arrays. Memory has to be freed with
+    the allocator it was taken from, so switching allocators while some
+    of their memory is still around is up to the caller to get right.
+
+    Two allocators come with it. An arena hands out memory from large
+    blocks and gives all of it back at once, so whatever one request
+    (or one run) needs costs a few pointer bumps. A counter passes
+    everything on to another allocator and counts it, for benchmarks.
+*/
+struct allocator {
+
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+
+    void *ctx;
+
+};
+
+void alloc_set(const struct allocator *allocator);
+void alloc_set_thread(const struct allocator *allocator);
+const struct allocator *alloc_current(void);
+
+void *vmalloc(size_t size);
+void *vcalloc(size_t count, size_t size);
+void *vrealloc(void *ptr, size_t size);
+void vfree(void *ptr);
+char *vstrdup(const char *str);
+char *vstrndup(const char *str, size_t len);
+
+/*
+    Freeing the latest allocation gives its memory back, and so does
+    growing it in place; anything else is only given back by
+    alloc_arena_reset. Not to be shared between threads.
+*/
+struct alloc_arena {
+
+    struct allocator allocator;
+
+    struct arena_block *blocks; /* the current one first */
+    size_t block_size;
+    void *last;                 /* latest allocation, or NULL */
+
+};
+
+void alloc_arena_init(struct alloc_arena *arena, size_t block_size);
+void alloc_arena_reset(struct alloc_arena *arena);
+void alloc_arena_free(struct alloc_arena *arena);
+size_t alloc_arena_used(const struct alloc_arena *arena);
+
+/*
+    Counts are kept with atomic adds, so a counter can be shared by
+    threads if the allocator under it can.
+*/
+struct alloc_counter {
+
+    struct allocator allocator;
+
+    const struct allocator *parent;
+
+    int64_t allocs;   /* vmalloc, vcalloc and vstrdup */
+    int64_t reallocs;
+    int64_t frees;    /* of non-NULL pointers */
+    int64_t bytes;    /* asked for by allocs and reallocs */
+
+};
+
+void alloc_counter_init(struct alloc_counter *counter, const struct allocator *parent);
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "temporal.h"
 #include "cachefile.h"
+#include "alloc.h"
 
 #ifndef vactija_error
 /* 
@@ -83,27 +84,85 @@ int cache_outdated(const char *path)
 
 }
 
+/*
+    Writes the JSON data to the cache file.
+*/
 void write_cache(const char *path, const char *json)
 {
 
-    FILE *cache = fopen(path, "w");
+    write_cache_data(path, json, strlen(json));
 
-    if (cache) {
+}
 
-        int res = fprintf(cache, "%s", json);
+/*
+    Writes len bytes of data to the cache file.
 
-        if (res < 0) {
-            printf("An error has occurred while writing to the cache file. Aborting!\n");
-            fclose(cache);
-            exit(EXIT_FAILURE);
-        }
+    The data is first written to a temporary file next to it which is
+    then renamed over the cache file, so concurrent readers (other
+    invocations or the serve mode) never observe a partial file.
 
-        fclose(cache);
+    Returns 0 on success, or -1 with errno set (and no temporary file
+    left behind) if the data could not be written, e.g on a full disk.
+*/
+int store_cache_data(const char *path, const void *data, size_t len)
+{
+
+    char tmp[CACHE_PATH_MAX];
+    if (snprintf(tmp, sizeof tmp, "%s.%ld.tmp", path, (long) getpid()) >= (int) sizeof tmp) {
+
+        errno = ENAMETOOLONG;
+        return -1;
+
+    }
+
+    FILE *cache = fopen(tmp, "w");
+
+    if (cache == NULL) {
+        return -1;
+    }
+
+    /* A full disk may only show up once the buffer is flushed by fclose */
+    errno = 0;
+    int failed = fwrite(data, 1, len, cache) != len;
+    int errcode = errno;
+
+    if (fclose(cache) != 0 && !failed) {
+
+        failed = 1;
+        errcode = errno;
+
+    }
+
+    if (!failed && rename(tmp, path) != 0) {
+
+        failed = 1;
+        errcode = errno;
+
+    }
+
+    if (failed) {
+
+        unlink(tmp);
+        errno = (errcode != 0) ? errcode : EIO;
+        return -1;
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Same as store_cache_data, except that any failure terminates the
+    program.
+*/
+void write_cache_data(const char *path, const void *data, size_t len)
+{
+
+    if (store_cache_data(path, data, len) != 0) {
 
-    } else {
-    
         int errcode = errno;
-        printf("Encountered an error while opening cache file!\n");
+        printf("Encountered an error while writing the cache file %s!\n", path);
         vactija_error(errcode);
 
     }
@@ -114,7 +173,8 @@ void write_cache(const char *path, const char *json)
     Reads the data from the cache file into a string.
 
     The returned string will be null-terminated and dynamically
-    allocated, therefore it has to be freed once it's no longer used.
+    allocated (see alloc.h), therefore it has to be freed with vfree
+    once it's no longer used.
 */
 char *read_cache(const char *path)
 {
@@ -139,7 +199,7 @@ char *read_cache(const char *path)
         unsigned long file_size = ftell(cache);
         rewind(cache);
 
-        char *json_prayer_buf = malloc(sizeof *json_prayer_buf * (file_size + 1));
+        char *json_prayer_buf = vmalloc(sizeof *json_prayer_buf * (file_size + 1));
 
         if (json_prayer_buf == NULL) {
 
@@ -150,16 +210,18 @@ char *read_cache(const char *path)
 
         }
 
-        int read = fread(json_prayer_buf, sizeof(char), file_size, cache);
+        size_t read = fread(json_prayer_buf, sizeof(char), file_size, cache);
 
         if (read != file_size) {
             
             printf("Could not read the entire file.\n");
-            printf("Filesize: %lu bytes.\n Read: %d bytes.\n", file_size, read);
+            printf("Filesize: %lu bytes.\n Read: %zu bytes.\n", file_size, read);
 
             exit(EXIT_FAILURE);
         }
 
+        fclose(cache);
+
         json_prayer_buf[file_size] = '\0';
 
         return json_prayer_buf;
@@ -173,3 +235,100 @@ char *read_cache(const char *path)
     }
 
 }
+
+/*
+    Reads the entire cache file into a newly allocated buffer and stores
+    its size in len. Unlike read_cache, a missing or unreadable file is
+    not an error: NULL is returned, so the caller can fall back to
+    another source.
+
+    The buffer has to be freed with vfree once it's no longer used.
+*/
+void *read_cache_data(const char *path, size_t *len)
+{
+
+    FILE *cache = fopen(path, "rb");
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    fseek(cache, 0, SEEK_END);
+    long file_size = ftell(cache);
+    rewind(cache);
+
+    char *buf = (file_size >= 0) ? vmalloc(file_size + 1) : NULL;
+
+    if (buf == NULL || fread(buf, 1, file_size, cache) != (size_t) file_size) {
+
+        vfree(buf);
+        fclose(cache);
+        return NULL;
+
+    }
+
+    fclose(cache);
+
+    buf[file_size] = '\0'; /* so text can be used as a string right away */
+    *len = file_size;
+
+    return buf;
+
+}
+
+/*
+    Builds the key under which vaktija data is cached, e.g "77-2022-02-19"
+    for a single day or "77-2022-02" for a whole month (if mday is 0).
+
+    year is the full year and mon is in range 1 - 12.
+
+    Returns the length of the key, or -1 if it did not fit into buf.
+*/
+int cache_key(char *buf, size_t buflen, const char *loc, int year, int mon, int mday)
+{
+
+    int len;
+    if (mday > 0) {
+        len = snprintf(buf, buflen, "%s-%04d-%02d-%02d", loc, year, mon, mday);
+    } else {
+        len = snprintf(buf, buflen, "%s-%04d-%02d", loc, year, mon);
+    }
+
+    return (len < 0 || (size_t) len >= buflen) ? -1 : len;
+
+}
+
+/*
+    Builds the path of the cache entry for key inside the cache
+    directory dir, with ext appended as the file extension.
+
+    Returns the length of the path, or -1 if it did not fit into buf.
+*/
+int cache_path(char *buf, size_t buflen, const char *dir, const char *key, const char *ext)
+{
+
+    size_t dirlen = strlen(dir);
+    const char *sep = (dirlen > 0 && dir[dirlen - 1] == '/') ? "" : "/";
+
+    int len = snprintf(buf, buflen, "%s%s%s.%s", dir, sep, key, ext);
+
+    return (len < 0 || (size_t) len >= buflen) ? -1 : len;
+
+}
+
+/*
+    Makes sure the cache directory exists, creating it (but not its
+    parents) if necessary.
+*/
+void cache_prepare_dir(const char *dir)
+{
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+
+        int errcode = errno;
+        printf("Could not create cache directory: %s\n", dir);
+        vactija_error(errcode);
+
+    }
+
+}
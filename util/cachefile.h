@@ -1,10 +1,25 @@
 #ifndef CACHEFILE_H
 #define CACHEFILE_H
 
+#include <stddef.h>
+
+/*
+    Enough for any cache directory path we expect plus the key.
+*/
+#define CACHE_PATH_MAX 4096
+#define CACHE_KEY_MAX 64
+
 int cache_exists(const char *path);
 int cache_outdated(const char *path);
 
 void write_cache(const char *path, const char *json);
+void write_cache_data(const char *path, const void *data, size_t len);
+int store_cache_data(const char *path, const void *data, size_t len);
 char *read_cache(const char *path);
+void *read_cache_data(const char *path, size_t *len);
+
+int cache_key(char *buf, size_t buflen, const char *loc, int year, int mon, int mday);
+int cache_path(char *buf, size_t buflen, const char *dir, const char *key, const char *ext);
+void cache_prepare_dir(const char *dir);
 
-#endif
\ No newline at end of file
+#endif
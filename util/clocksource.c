@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clocksource.h"
+
+static enum clock_kind kind = CLOCK_SOURCE_REAL;
+
+static time_t base = 0;    /* the fixed moment, or where acceleration started from */
+static time_t started = 0; /* system time acceleration started at */
+static int speed = 1;
+
+void clock_set_real(void)
+{
+
+    kind = CLOCK_SOURCE_REAL;
+
+}
+
+void clock_set_fixed(time_t at)
+{
+
+    kind = CLOCK_SOURCE_FIXED;
+    base = at;
+
+}
+
+void clock_set_accelerated(time_t from, int factor)
+{
+
+    kind = CLOCK_SOURCE_ACCELERATED;
+    base = from;
+    started = time(NULL);
+    speed = factor;
+
+}
+
+/*
+    Sets the clock from VACTIJA_NOW ("yyyy-mm-dd HH:MM[:SS]", local time)
+    and VACTIJA_CLOCK_SPEED: fixed at that moment, or running from it
+    that many times faster if the speed is set. Without VACTIJA_NOW the
+    clock stays real.
+
+    Returns 0 on success and -1 if either is invalid.
+*/
+int clock_from_env(void)
+{
+
+    const char *now = getenv("VACTIJA_NOW");
+    const char *factor = getenv("VACTIJA_CLOCK_SPEED");
+
+    if (now == NULL || now[0] == '\0') {
+        return 0;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+
+    int n = sscanf(now, "%d-%d-%d%*1[ T]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+            &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+
+    if (n < 5 || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31 ||
+            tm.tm_hour > 23 || tm.tm_min > 59) {
+        return -1;
+    }
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+
+    time_t at = mktime(&tm);
+
+    if (factor == NULL || factor[0] == '\0') {
+
+        clock_set_fixed(at);
+        return 0;
+
+    }
+
+    char *end;
+    long x = strtol(factor, &end, 10);
+
+    if (*end != '\0' || x < 1 || x > 1000000) {
+        return -1;
+    }
+
+    clock_set_accelerated(at, (int) x);
+
+    return 0;
+
+}
+
+enum clock_kind clock_kind(void)
+{
+
+    return kind;
+
+}
+
+/*
+    Returns the current time as the clock source sees it.
+*/
+time_t clock_now(void)
+{
+
+    if (kind == CLOCK_SOURCE_FIXED) {
+        return base;
+    }
+
+    time_t real = time(NULL);
+
+    if (kind == CLOCK_SOURCE_ACCELERATED) {
+        return base + (real - started) * speed;
+    }
+
+    return real;
+
+}
+
+/*
+    Breaks clock_now down into local time.
+*/
+void clock_localtime(struct tm *res)
+{
+
+    time_t now = clock_now();
+    localtime_r(&now, res);
+
+}
@@ -0,0 +1,36 @@
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include <time.h>
+
+/*
+    Where "now" comes from for everything that depends on the time of
+    day, so it can be tested at any moment rather than only the current
+    one:
+
+        real         the system clock (the default)
+        fixed        always the same moment, moved only by clock_set_fixed
+        accelerated  starts at a given moment and runs factor times faster
+                     than the system clock
+
+    The long running modes which arm kernel timers (serve and daemon)
+    stay on the system clock.
+*/
+enum clock_kind {
+
+    CLOCK_SOURCE_REAL,
+    CLOCK_SOURCE_FIXED,
+    CLOCK_SOURCE_ACCELERATED
+
+};
+
+void clock_set_real(void);
+void clock_set_fixed(time_t at);
+void clock_set_accelerated(time_t from, int factor);
+int clock_from_env(void);
+
+enum clock_kind clock_kind(void);
+time_t clock_now(void);
+void clock_localtime(struct tm *res);
+
+#endif
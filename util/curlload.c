@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "curlload.h"
+
+/*
+    Sonames to try, in order. The plain libcurl.so is usually only
+    there with the development package.
+*/
+static const char *curl_sonames[] = {
+    "libcurl.so.4",
+    "libcurl-gnutls.so.4",
+    "libcurl-nss.so.4",
+    "libcurl.so"
+};
+
+static struct curl_api api;
+static int api_loaded = 0;
+static pthread_once_t api_once = PTHREAD_ONCE_INIT;
+
+static void *load_symbol(void *lib, const char *name)
+{
+
+    void *sym = dlsym(lib, name);
+
+    if (sym == NULL) {
+        printf("Could not find %s in libcurl: %s\n", name, dlerror());
+    }
+
+    return sym;
+
+}
+
+/*
+    Gives up on a library which could not be used, so nothing is left
+    pointing into it.
+*/
+static void unload_curl(void *lib)
+{
+
+    dlclose(lib);
+    memset(&api, 0, sizeof api);
+
+}
+
+static void load_curl(void)
+{
+
+    void *lib = NULL;
+    size_t nsonames = sizeof curl_sonames / sizeof curl_sonames[0];
+
+    for (size_t i = 0; i < nsonames && lib == NULL; i++) {
+        lib = dlopen(curl_sonames[i], RTLD_NOW | RTLD_LOCAL);
+    }
+
+    if (lib == NULL) {
+
+        printf("Could not load libcurl: %s\n", dlerror());
+        return;
+
+    }
+
+    /* Function pointers can not be assigned from void * in ISO C */
+    *(void **) &api.global_init = load_symbol(lib, "curl_global_init");
+    *(void **) &api.easy_init = load_symbol(lib, "curl_easy_init");
+    *(void **) &api.easy_setopt = load_symbol(lib, "curl_easy_setopt");
+    *(void **) &api.easy_perform = load_symbol(lib, "curl_easy_perform");
+    *(void **) &api.easy_cleanup = load_symbol(lib, "curl_easy_cleanup");
+    *(void **) &api.easy_strerror = load_symbol(lib, "curl_easy_strerror");
+    *(void **) &api.easy_getinfo = load_symbol(lib, "curl_easy_getinfo");
+    *(void **) &api.multi_init = load_symbol(lib, "curl_multi_init");
+    *(void **) &api.multi_add_handle = load_symbol(lib, "curl_multi_add_handle");
+    *(void **) &api.multi_remove_handle = load_symbol(lib, "curl_multi_remove_handle");
+    *(void **) &api.multi_perform = load_symbol(lib, "curl_multi_perform");
+    *(void **) &api.multi_wait = load_symbol(lib, "curl_multi_wait");
+    *(void **) &api.multi_info_read = load_symbol(lib, "curl_multi_info_read");
+    *(void **) &api.multi_cleanup = load_symbol(lib, "curl_multi_cleanup");
+
+    if (api.global_init == NULL || api.easy_init == NULL ||
+        api.easy_setopt == NULL || api.easy_perform == NULL ||
+        api.easy_cleanup == NULL || api.easy_strerror == NULL ||
+        api.easy_getinfo == NULL || api.multi_init == NULL ||
+        api.multi_add_handle == NULL || api.multi_remove_handle == NULL ||
+        api.multi_perform == NULL || api.multi_wait == NULL ||
+        api.multi_info_read == NULL || api.multi_cleanup == NULL) {
+
+        unload_curl(lib);
+        return;
+
+    }
+
+    /*
+        curl_global_init is not thread safe, doing it here (under the
+        pthread_once) covers the worker threads of serve mode as well.
+    */
+    if (api.global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+
+        printf("Could not initialise libcurl!\n");
+        unload_curl(lib);
+        return;
+
+    }
+
+    api_loaded = 1;
+
+}
+
+/*
+    Returns the libcurl functions, loading the library on the first call.
+
+    Safe to call from multiple threads. Returns NULL (after printing the
+    reason) if libcurl could not be loaded.
+*/
+const struct curl_api *curl_api(void)
+{
+
+    pthread_once(&api_once, load_curl);
+
+    return api_loaded ? &api : NULL;
+
+}
+
+/*
+    Returns 1 iff libcurl has been loaded by curl_api.
+*/
+int curl_loaded(void)
+{
+
+    return api_loaded;
+
+}
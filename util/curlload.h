@@ -0,0 +1,38 @@
+#ifndef CURLLOAD_H
+#define CURLLOAD_H
+
+#include <curl/curl.h>
+
+/*
+    libcurl is not linked into the binary, it is only loaded with dlopen
+    the first time something has to be downloaded. Cache hits therefore
+    never pay for loading and relocating libcurl and its TLS stack.
+
+    Only the headers of libcurl are needed at build time.
+*/
+struct curl_api {
+
+    CURLcode (*global_init)(long flags);
+
+    CURL *(*easy_init)(void);
+    CURLcode (*easy_setopt)(CURL *curl, CURLoption option, ...);
+    CURLcode (*easy_perform)(CURL *curl);
+    void (*easy_cleanup)(CURL *curl);
+    const char *(*easy_strerror)(CURLcode code);
+    CURLcode (*easy_getinfo)(CURL *curl, CURLINFO info, ...);
+
+    CURLM *(*multi_init)(void);
+    CURLMcode (*multi_add_handle)(CURLM *multi, CURL *curl);
+    CURLMcode (*multi_remove_handle)(CURLM *multi, CURL *curl);
+    CURLMcode (*multi_perform)(CURLM *multi, int *running);
+    CURLMcode (*multi_wait)(CURLM *multi, struct curl_waitfd *fds,
+            unsigned int nfds, int timeout_ms, int *numfds);
+    CURLMsg *(*multi_info_read)(CURLM *multi, int *msgs);
+    CURLMcode (*multi_cleanup)(CURLM *multi);
+
+};
+
+const struct curl_api *curl_api(void);
+int curl_loaded(void);
+
+#endif
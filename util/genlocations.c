@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "textfold.h"
+
+/*
+    Turns locations.txt into loctable.h, the table of locations the
+    program is built with. Run by make, never at runtime:
+
+        genlocations locations.txt > loctable.h
+
+    Every line of locations.txt is an ID, a name, the latitude and the
+    longitude. IDs have to go from 0 up without gaps or duplicates, and
+    no two names may fold (see textfold.h) to the same string, otherwise
+    nothing is generated.
+
+    Names are found through a perfect hash: a folded name picks a bucket
+    with text_hash(name, 0), and the bucket's displacement d picks its
+    slot with text_hash(name, d). The displacements are searched for
+    here, so that every name gets a slot of its own and a lookup is
+    always two hashes and one string comparison.
+
+    The coordinates are put into a k-d tree, stored implicitly as an
+    array: the node of the range [lo, hi) is at (lo + hi) / 2, splitting
+    on latitude at even depths and longitude at odd ones, with the
+    smaller half before it. Longitudes are scaled by GEN_LON_SCALE so
+    that a degree either way is roughly the same distance.
+*/
+
+#define GEN_LOCATIONS_MAX 1024
+#define GEN_NAME_MAX 64
+#define GEN_DISP_MAX 65535
+
+/* cos(44°), the middle of the covered area */
+#define GEN_LON_SCALE 0.71934
+
+struct location {
+
+    int id;
+    char name[GEN_NAME_MAX];
+    char folded[GEN_NAME_MAX];
+
+    double lat;
+    double lon;
+
+};
+
+static struct location locations[GEN_LOCATIONS_MAX];
+static int count = 0;
+
+static void fail(const char *file, int line, const char *msg)
+{
+
+    fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+    exit(EXIT_FAILURE);
+
+}
+
+static void read_locations(const char *file)
+{
+
+    FILE *fp = fopen(file, "r");
+
+    if (fp == NULL) {
+
+        perror(file);
+        exit(EXIT_FAILURE);
+
+    }
+
+    char buf[256];
+    int line = 0;
+
+    while (fgets(buf, sizeof buf, fp) != NULL) {
+
+        line++;
+
+        size_t len = strlen(buf);
+        while (len > 0 && isspace((unsigned char) buf[len - 1])) {
+            buf[--len] = '\0';
+        }
+
+        if (len == 0) {
+            continue;
+        }
+
+        /* The coordinates are the last two columns, the name is before them */
+        char *lonstr = strrchr(buf, ' ');
+        char *latstr = NULL;
+
+        if (lonstr != NULL) {
+
+            char *end = lonstr;
+            while (end > buf && end[-1] == ' ') {
+                end--;
+            }
+
+            *end = '\0';
+            latstr = strrchr(buf, ' ');
+
+        }
+
+        struct location *l = &locations[count];
+        char *end1, *end2;
+
+        if (latstr == NULL ||
+            (l->lat = strtod(latstr + 1, &end1), *end1 != '\0') ||
+            (l->lon = strtod(lonstr + 1, &end2), *end2 != '\0') ||
+            l->lat < -90 || l->lat > 90 || l->lon < -180 || l->lon > 180) {
+            fail(file, line, "expected the latitude and longitude at the end");
+        }
+
+        while (latstr > buf && latstr[-1] == ' ') {
+            latstr--;
+        }
+
+        *latstr = '\0';
+
+        int id, n = 0;
+
+        if (sscanf(buf, "%d %n", &id, &n) != 1 || buf[n] == '\0') {
+            fail(file, line, "expected an ID and a name");
+        }
+
+        if (id != count) {
+            fail(file, line, (id < count) ? "duplicate ID" : "IDs have to follow each other");
+        }
+
+        if (count == GEN_LOCATIONS_MAX) {
+            fail(file, line, "too many locations");
+        }
+
+        l->id = id;
+
+        if (snprintf(l->name, sizeof l->name, "%s", buf + n) >= (int) sizeof l->name) {
+            fail(file, line, "name is too long");
+        }
+
+        if (text_fold(l->folded, sizeof l->folded, l->name) == 0) {
+            fail(file, line, "name can not be folded");
+        }
+
+        for (int i = 0; i < count; i++) {
+
+            if (strcmp(locations[i].folded, l->folded) == 0) {
+                fail(file, line, "name is the same as an earlier one");
+            }
+
+        }
+
+        count++;
+
+    }
+
+    fclose(fp);
+
+    if (count == 0) {
+        fail(file, line, "no locations");
+    }
+
+}
+
+/*
+    Bucket order for the search, largest first (an insertion sort, so
+    the order of equally large buckets does not depend on qsort).
+*/
+static void sort_buckets(int *order, int nbuckets, const int *sizes)
+{
+
+    for (int i = 0; i < nbuckets; i++) {
+        order[i] = i;
+    }
+
+    for (int i = 1; i < nbuckets; i++) {
+
+        int b = order[i];
+        int j = i;
+
+        while (j > 0 && sizes[order[j - 1]] < sizes[b]) {
+
+            order[j] = order[j - 1];
+            j--;
+
+        }
+
+        order[j] = b;
+
+    }
+
+}
+
+static int tree_axis = 0;
+
+static double coordinate(const struct location *l, int axis)
+{
+
+    return (axis == 0) ? l->lat : l->lon * GEN_LON_SCALE;
+
+}
+
+static int compare_axis(const void *a, const void *b)
+{
+
+    double x = coordinate(a, tree_axis);
+    double y = coordinate(b, tree_axis);
+
+    return (x > y) - (x < y);
+
+}
+
+/*
+    Orders tree[lo, hi) into the implicit k-d tree described above.
+*/
+static void build_tree(struct location *tree, int lo, int hi, int depth)
+{
+
+    if (hi - lo <= 1) {
+        return;
+    }
+
+    tree_axis = depth % 2;
+    qsort(tree + lo, hi - lo, sizeof *tree, compare_axis);
+
+    int mid = lo + (hi - lo) / 2;
+
+    build_tree(tree, lo, mid, depth + 1);
+    build_tree(tree, mid + 1, hi, depth + 1);
+
+}
+
+int main(int argc, char **argv)
+{
+
+    if (argc != 2) {
+
+        fprintf(stderr, "Usage: %s locations.txt\n", argv[0]);
+        return EXIT_FAILURE;
+
+    }
+
+    read_locations(argv[1]);
+
+    int nslots = 1;
+    while (nslots < 2 * count) {
+        nslots *= 2;
+    }
+
+    int nbuckets = count / 2 + 1;
+
+    int *bucket = malloc(sizeof *bucket * count);
+    int *sizes = calloc(nbuckets, sizeof *sizes);
+    int *order = malloc(sizeof *order * nbuckets);
+    int *disp = calloc(nbuckets, sizeof *disp);
+    int *slots = malloc(sizeof *slots * nslots);
+
+    if (bucket == NULL || sizes == NULL || order == NULL || disp == NULL || slots == NULL) {
+
+        perror(argv[0]);
+        return EXIT_FAILURE;
+
+    }
+
+    for (int i = 0; i < count; i++) {
+
+        bucket[i] = text_hash(locations[i].folded, 0) % nbuckets;
+        sizes[bucket[i]]++;
+
+    }
+
+    for (int i = 0; i < nslots; i++) {
+        slots[i] = -1;
+    }
+
+    sort_buckets(order, nbuckets, sizes);
+
+    for (int o = 0; o < nbuckets && sizes[order[o]] > 0; o++) {
+
+        int b = order[o];
+        int members[GEN_LOCATIONS_MAX];
+        int nmembers = 0;
+
+        for (int i = 0; i < count; i++) {
+
+            if (bucket[i] == b) {
+                members[nmembers++] = i;
+            }
+
+        }
+
+        for (int d = 1; disp[b] == 0; d++) {
+
+            if (d > GEN_DISP_MAX) {
+
+                fprintf(stderr, "%s: no perfect hash found\n", argv[0]);
+                return EXIT_FAILURE;
+
+            }
+
+            int slot[GEN_LOCATIONS_MAX];
+            int free_slots = 1;
+
+            for (int m = 0; m < nmembers && free_slots; m++) {
+
+                slot[m] = text_hash(locations[members[m]].folded, d) & (nslots - 1);
+                free_slots = slots[slot[m]] == -1;
+
+                for (int k = 0; k < m && free_slots; k++) {
+                    free_slots = slot[k] != slot[m];
+                }
+
+            }
+
+            if (!free_slots) {
+                continue;
+            }
+
+            for (int m = 0; m < nmembers; m++) {
+                slots[slot[m]] = locations[members[m]].id;
+            }
+
+            disp[b] = d;
+
+        }
+
+    }
+
+    printf("/* Generated from locations.txt by genlocations, do not edit. */\n\n");
+    printf("#define LOCATION_COUNT %d\n", count);
+    printf("#define LOCATION_BUCKETS %d\n", nbuckets);
+    printf("#define LOCATION_SLOTS %d\n", nslots);
+    printf("#define LOCATION_LON_SCALE %.5f\n\n", GEN_LON_SCALE);
+
+    printf("static const char *const location_names[LOCATION_COUNT] = {\n");
+    for (int i = 0; i < count; i++) {
+        printf("    \"%s\",\n", locations[i].name);
+    }
+    printf("};\n\n");
+
+    printf("static const char *const location_folded[LOCATION_COUNT] = {\n");
+    for (int i = 0; i < count; i++) {
+        printf("    \"%s\",\n", locations[i].folded);
+    }
+    printf("};\n\n");
+
+    printf("static const float location_coords_table[LOCATION_COUNT][2] = {\n");
+    for (int i = 0; i < count; i++) {
+        printf("    { %.5ff, %.5ff },\n", locations[i].lat, locations[i].lon);
+    }
+    printf("};\n\n");
+
+    static struct location tree[GEN_LOCATIONS_MAX];
+    memcpy(tree, locations, sizeof *tree * count);
+    build_tree(tree, 0, count, 0);
+
+    printf("static const struct location_node location_tree[LOCATION_COUNT] = {\n");
+    for (int i = 0; i < count; i++) {
+        printf("    { %.5ff, %.5ff, %d },\n", coordinate(&tree[i], 0), coordinate(&tree[i], 1), tree[i].id);
+    }
+    printf("};\n\n");
+
+    printf("static const uint16_t location_disp[LOCATION_BUCKETS] = {");
+    for (int i = 0; i < nbuckets; i++) {
+        printf("%s%d", (i % 16 == 0) ? "\n    " : " ", disp[i]);
+        printf("%s", (i + 1 < nbuckets) ? "," : "\n");
+    }
+    printf("};\n\n");
+
+    printf("static const int16_t location_slots[LOCATION_SLOTS] = {");
+    for (int i = 0; i < nslots; i++) {
+        printf("%s%d", (i % 16 == 0) ? "\n    " : " ", slots[i]);
+        printf("%s", (i + 1 < nslots) ? "," : "\n");
+    }
+    printf("};\n");
+
+    free(bucket);
+    free(sizes);
+    free(order);
+    free(disp);
+    free(slots);
+
+    return EXIT_SUCCESS;
+
+}
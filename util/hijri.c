@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hijri.h"
+#include "textfold.h"
+
+/* Julian day number of 1 muharrem 1 in the civil reckoning */
+#define HIJRI_EPOCH 1948439L
+
+/* Open addressed by month number, so a lookup is a probe or two */
+#define ADJUST_SLOTS (HIJRI_MAX_ADJUSTMENTS * 2)
+
+/*
+    Names as the API writes them in dates.
+*/
+static const char *month_names[] = {
+    "muharrem", "safer", "rebiul-evvel", "rebiul-ahir", "džumadel-ula", "džumadel-uhra",
+    "redžeb", "ša'ban", "ramazan", "ševval", "zul-ka'de", "zul-hidždže"
+};
+
+struct adjust_slot {
+
+    long month; /* months since the epoch, 0 if the slot is free */
+    int shift;
+
+};
+
+static struct adjust_slot adjust[ADJUST_SLOTS];
+static int nadjust = 0;
+
+static long month_number(int year, int month)
+{
+
+    return (long) (year - 1) * 12 + month;
+
+}
+
+static int month_shift(long number)
+{
+
+    if (nadjust == 0) {
+        return 0;
+    }
+
+    for (unsigned long i = (unsigned long) number % ADJUST_SLOTS; adjust[i].month != 0; i = (i + 1) % ADJUST_SLOTS) {
+
+        if (adjust[i].month == number) {
+            return adjust[i].shift;
+        }
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Sets the months which do not start when the tabular calendar says
+    (replacing any set before).
+
+    Returns 0 on success and -1 if there are too many or one is invalid.
+*/
+int hijri_set_adjustments(const struct hijri_adjustment *table, int count)
+{
+
+    memset(adjust, 0, sizeof adjust);
+    nadjust = 0;
+
+    if (count > HIJRI_MAX_ADJUSTMENTS) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+
+        const struct hijri_adjustment *a = &table[i];
+
+        if (a->year < 1 || a->month < 1 || a->month > 12 || a->shift < -2 || a->shift > 2) {
+
+            memset(adjust, 0, sizeof adjust);
+            nadjust = 0;
+
+            return -1;
+
+        }
+
+        long number = month_number(a->year, a->month);
+        unsigned long slot = (unsigned long) number % ADJUST_SLOTS;
+
+        while (adjust[slot].month != 0 && adjust[slot].month != number) {
+            slot = (slot + 1) % ADJUST_SLOTS;
+        }
+
+        adjust[slot].month = number;
+        adjust[slot].shift = a->shift;
+        nadjust++;
+
+    }
+
+    return 0;
+
+}
+
+static long gregorian_jdn(int year, int month, int day)
+{
+
+    long a = (14 - month) / 12;
+    long y = year + 4800 - a;
+    long m = month + 12 * a - 3;
+
+    return day + (153 * m + 2) / 5 + 365 * y + y / 4 - y / 100 + y / 400 - 32045;
+
+}
+
+static void jdn_gregorian(long jdn, int *year, int *month, int *day)
+{
+
+    long a = jdn + 32044;
+    long b = (4 * a + 3) / 146097;
+    long c = a - 146097 * b / 4;
+    long d = (4 * c + 3) / 1461;
+    long e = c - 1461 * d / 4;
+    long m = (5 * e + 2) / 153;
+
+    *day = (int) (e - (153 * m + 2) / 5 + 1);
+    *month = (int) (m + 3 - 12 * (m / 10));
+    *year = (int) (100 * b + d - 4800 + m / 10);
+
+}
+
+/*
+    Julian day number of the first of the month in the tabular calendar,
+    i.e 354 days a year, 11 leap days every 30 years and months of 29.5
+    days on average, starting with a 30 day one.
+*/
+static long tabular_start(int year, int month)
+{
+
+    return HIJRI_EPOCH + (long) (year - 1) * 354 + (3 + 11L * year) / 30 + (295L * (month - 1) + 9) / 10;
+
+}
+
+/*
+    Julian day number of the first of the month, adjusted.
+*/
+static long month_start(int year, int month)
+{
+
+    return tabular_start(year, month) + month_shift(month_number(year, month));
+
+}
+
+/*
+    Returns the Hijri date of the Gregorian one (month 1 - 12).
+*/
+void hijri_from_gregorian(int year, int month, int day, struct hijri_date *res)
+{
+
+    long jdn = gregorian_jdn(year, month, day);
+
+    int hyear = (int) ((30 * (jdn - HIJRI_EPOCH) + 10646) / 10631);
+    int hmonth = (int) ((10 * (jdn - tabular_start(hyear, 1)) + 5) / 295) + 1;
+
+    if (hmonth > 12) {
+        hmonth = 12;
+    }
+
+    /* The tabular month, moved by its own or the next month's adjustment */
+    long start = month_start(hyear, hmonth);
+
+    if (jdn < start) {
+
+        hyear -= (hmonth == 1);
+        hmonth = (hmonth == 1) ? 12 : hmonth - 1;
+        start = month_start(hyear, hmonth);
+
+    } else {
+
+        int nyear = hyear + (hmonth == 12);
+        int nmonth = (hmonth == 12) ? 1 : hmonth + 1;
+        long next = month_start(nyear, nmonth);
+
+        if (jdn >= next) {
+
+            hyear = nyear;
+            hmonth = nmonth;
+            start = next;
+
+        }
+
+    }
+
+    res->year = hyear;
+    res->month = hmonth;
+    res->day = (int) (jdn - start) + 1;
+
+}
+
+/*
+    Returns the Gregorian date (month 1 - 12) of the Hijri one.
+*/
+void hijri_to_gregorian(const struct hijri_date *date, int *year, int *month, int *day)
+{
+
+    jdn_gregorian(month_start(date->year, date->month) + date->day - 1, year, month, day);
+
+}
+
+/*
+    Returns the number of days (29 or 30) in the Hijri month.
+*/
+int hijri_month_days(int year, int month)
+{
+
+    long next = (month == 12) ? month_start(year + 1, 1) : month_start(year, month + 1);
+
+    return (int) (next - month_start(year, month));
+
+}
+
+const char *hijri_month_name(int month)
+{
+
+    return month_names[month - 1];
+
+}
+
+/*
+    Returns the month (1 - 12) with the name, as the API writes it or
+    folded (e.g "dzumadel ula", "saban"), or -1 if there is none.
+*/
+int hijri_month_find(const char *name)
+{
+
+    char plain[64];
+    char folded[64];
+    size_t n = 0;
+
+    /* Apostrophes do not fold, and are easy to leave out anyway */
+    for (const char *s = name; *s != '\0' && n + 1 < sizeof plain; s++) {
+
+        if (*s != '\'') {
+            plain[n++] = *s;
+        }
+
+    }
+
+    plain[n] = '\0';
+
+    if (text_fold(folded, sizeof folded, plain) == 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < 12; i++) {
+
+        char known[64];
+        char knownfold[64];
+        size_t k = 0;
+
+        for (const char *s = month_names[i]; *s != '\0'; s++) {
+
+            if (*s != '\'') {
+                known[k++] = *s;
+            }
+
+        }
+
+        known[k] = '\0';
+
+        if (text_fold(knownfold, sizeof knownfold, known) > 0 && strcmp(folded, knownfold) == 0) {
+            return i + 1;
+        }
+
+    }
+
+    return -1;
+
+}
+
+/*
+    Parses a Hijri date the way the API writes it, e.g "18. redžeb 1443",
+    or just a month, e.g "ramazan 1448" (which leaves day 0). The name
+    runs up to the year, so it may be written in words ("dzumadel ula").
+    Days up to 30 are taken in any month, as sighting may have made it
+    that long.
+
+    Returns 1 on success and 0 if it is not one.
+*/
+int hijri_parse(const char *str, struct hijri_date *res)
+{
+
+    int day = 0;
+    int start = 0;
+
+    if (sscanf(str, "%d. %n", &day, &start) != 1 || start == 0) {
+
+        day = 0;
+        start = 0;
+
+    }
+
+    /* The year is the last word, the name everything before it */
+    const char *end = str + strlen(str);
+
+    while (end > str + start && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    const char *digits = end;
+
+    while (digits > str + start && digits[-1] >= '0' && digits[-1] <= '9') {
+        digits--;
+    }
+
+    if (digits == end || end - digits > 4 || digits == str + start
+            || (digits[-1] != ' ' && digits[-1] != '\t')) {
+        return 0;
+    }
+
+    int year = atoi(digits);
+    char name[32];
+    size_t n = (size_t) (digits - (str + start));
+
+    if (n >= sizeof name) {
+        return 0;
+    }
+
+    memcpy(name, str + start, n);
+    name[n] = '\0';
+
+    int month = hijri_month_find(name);
+
+    if (month < 0 || year < 1 || year > 9999 || day < 0 || day > 30) {
+        return 0;
+    }
+
+    res->year = year;
+    res->month = month;
+    res->day = day;
+
+    return 1;
+
+}
+
+/*
+    Writes the date the way the API does, e.g "18. redžeb 1443".
+*/
+size_t hijri_format(char *buf, size_t len, const struct hijri_date *date)
+{
+
+    int n = snprintf(buf, len, "%d. %s %d", date->day, month_names[date->month - 1], date->year);
+
+    return (n > 0) ? (size_t) n : 0;
+
+}
@@ -0,0 +1,48 @@
+#ifndef HIJRI_H
+#define HIJRI_H
+
+#include <stddef.h>
+
+/*
+    Hijri dates computed locally rather than taken from the API, with
+    the tabular (arithmetic) calendar: 30 year cycles of 354 and 355 day
+    years, months of 30 and 29 days in turn, counted from the civil
+    epoch (16 July 622). That is how the API's dates run too, except for
+    months which were started by sighting a day off, which go into the
+    adjustment table. Every conversion takes the same few operations,
+    whatever the date.
+*/
+#define HIJRI_MAX_ADJUSTMENTS 32
+
+struct hijri_date {
+
+    int year;
+    int month; /* 1 - 12 */
+    int day;   /* 1 - 30 */
+
+};
+
+/*
+    A month which started shift days later (earlier if negative) than
+    the tabular calendar has it. At most 2 either way.
+*/
+struct hijri_adjustment {
+
+    int year;
+    int month;
+    int shift;
+
+};
+
+int hijri_set_adjustments(const struct hijri_adjustment *table, int count);
+
+void hijri_from_gregorian(int year, int month, int day, struct hijri_date *res);
+void hijri_to_gregorian(const struct hijri_date *date, int *year, int *month, int *day);
+int hijri_month_days(int year, int month);
+
+const char *hijri_month_name(int month);
+int hijri_month_find(const char *name);
+int hijri_parse(const char *str, struct hijri_date *res);
+size_t hijri_format(char *buf, size_t len, const struct hijri_date *date);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "jsmnutil.h"
+#include "alloc.h"
 
 int jsmn_compare(const char *js, jsmntok_t *token, const char *str)
 {
@@ -30,7 +31,7 @@ int jsmn_compare(const char *js, jsmntok_t *token, const char *str)
 jsmntok_t *find_by_key(const char *js, const char *key, jsmntok_t tokens[], size_t toklen)
 {
 
-    for (int i = 0; i < toklen; i++) {
+    for (size_t i = 0; i < toklen; i++) {
 
         if (jsmn_compare(js, &tokens[i], key) == 0) {
 
@@ -53,11 +54,11 @@ jsmntok_t *find_by_key(const char *js, const char *key, jsmntok_t tokens[], size
 int find_idx_by_key(const char *js, const char *key, jsmntok_t tokens[], size_t toklen)
 {
 
-    for (int i = 0; i < toklen; i++) {
+    for (size_t i = 0; i < toklen; i++) {
 
         if (jsmn_compare(js, &tokens[i], key) == 0) {
 
-            return (i + 1);
+            return (int) (i + 1);
 
         }
 
@@ -72,13 +73,13 @@ int find_idx_by_key(const char *js, const char *key, jsmntok_t tokens[], size_t
     the string value which the token represents into the newly
     allocated string.
 
-    The string has to be freed manually once it is no longer useful.
+    The string has to be freed with vfree once it is no longer useful.
 */
 char *get_simple(const char *js, jsmntok_t *token)
 {
 
     int len = token->end - token->start;
-    char *str = malloc(sizeof *str * (len + 1));
+    char *str = vmalloc(sizeof *str * (len + 1));
 
     if (str == NULL) {
 
@@ -99,6 +100,32 @@ char *get_simple(const char *js, jsmntok_t *token)
 
 }
 
+/*
+    Returns the integer value of a (primitive or string) token, or 0 if
+    the token is NULL or does not hold a number.
+*/
+int get_number(const char *js, jsmntok_t *token)
+{
+
+    if (token == NULL) {
+        return 0;
+    }
+
+    int val = 0;
+    for (int i = token->start; i < token->end; i++) {
+
+        if (js[i] < '0' || js[i] > '9') {
+            return 0;
+        }
+
+        val = val * 10 + (js[i] - '0');
+
+    }
+
+    return val;
+
+}
+
 /*
     Allocates an array of strings onto the heap and then copies all
     string values from the JSON array into the newly allocated array.
@@ -106,12 +133,12 @@ char *get_simple(const char *js, jsmntok_t *token)
     Essentially works the same as get_simple, except it treats each
     new string as the column of a 2D array.
 
-    The array has to be freed manually once it is no longer useful.
+    The array has to be freed with free_array once it is no longer useful.
 */
 char **get_array(const char *js, int idx, jsmntok_t tokens[], size_t arrlen)
 {
 
-    char **arr = malloc(arrlen * sizeof(*arr));
+    char **arr = vmalloc(arrlen * sizeof(*arr));
 
     /*
         i represents the offset (idx + 1; since idx points to '['
@@ -119,12 +146,12 @@ char **get_array(const char *js, int idx, jsmntok_t tokens[], size_t arrlen)
 
         j is the index of each row
     */
-    for (int i = idx + 1, j = 0; j < arrlen; i++, j++) {
+    for (size_t i = idx + 1, j = 0; j < arrlen; i++, j++) {
 
         jsmntok_t curr = tokens[i];
         int len = curr.end - curr.start;
 
-        arr[j] = malloc(sizeof(arr[0]) * (len + 1));
+        arr[j] = vmalloc(sizeof(arr[0]) * (len + 1));
 
         if (arr[j] == NULL) {
 
@@ -147,15 +174,34 @@ char **get_array(const char *js, int idx, jsmntok_t tokens[], size_t arrlen)
 
 }
 
+/*
+    Returns the index of the first token after the token at idx and
+    everything nested inside it (e.g all elements of an array), which
+    is the index of its next sibling.
+*/
+int skip_token(jsmntok_t tokens[], int idx, size_t toklen)
+{
+
+    int end = tokens[idx].end;
+    int i = idx + 1;
+
+    while ((size_t) i < toklen && tokens[i].start < end) {
+        i++;
+    }
+
+    return i;
+
+}
+
 void free_array(char **arr, size_t arrlen)
 {
 	
-	for (int i = 0; i < arrlen; i++) {
+	for (size_t i = 0; i < arrlen; i++) {
 
-		free(arr[i]);
+		vfree(arr[i]);
 
 	}
 
-	free(arr);
+	vfree(arr);
 
 }
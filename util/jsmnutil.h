@@ -9,6 +9,9 @@ jsmntok_t *find_by_key(const char *js, const char *key, jsmntok_t tokens[], size
 int find_idx_by_key(const char *js, const char *key, jsmntok_t tokens[], size_t toklen);
 
 char *get_simple(const char *js, jsmntok_t *token);
+int get_number(const char *js, jsmntok_t *token);
 char **get_array(const char *js, int idx, jsmntok_t tokens[], size_t arrlen);
 
+int skip_token(jsmntok_t tokens[], int idx, size_t toklen);
+
 void free_array(char **arr, size_t arrlen);
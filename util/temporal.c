@@ -224,3 +224,107 @@ void parse_timestr(const char *str, struct tm *res)
     res->tm_isdst = -1; /* = unspecified, per Linux manual */
 
 }
+
+/*
+   Formats a time given in seconds since 00:00 as HH:MM. Times past
+   the end of the day wrap around (e.g a midnight after 00:00).
+*/
+void format_seconds(int secs, char *buf, size_t len)
+{
+
+    secs %= 86400;
+
+    snprintf(buf, len, "%02d:%02d", secs / 3600, (secs / 60) % 60);
+
+}
+
+/*
+   Parses a date string of the format <yyyy>[/mm[/dd]] into a struct tm.
+
+   Components which are left off take their values from today, so
+   "2022" means this month and day of 2022. Only tm_year, tm_mon
+   and tm_mday are meaningful in res afterwards.
+
+   Returns the number of components present in the string (1 - 3),
+   or 0 if the string is not a valid date.
+*/
+int parse_datestr(const char *str, const struct tm *today, struct tm *res)
+{
+
+    int parts[3] = { 0, 0, 0 };
+    int count = 0;
+
+    const char *p = str;
+    for (;;) {
+
+        char *end;
+        long val = strtol(p, &end, 10);
+
+        if (end == p || val < 0) {
+            return 0;
+        }
+
+        parts[count++] = (int) val;
+
+        if (*end == '\0') {
+            break;
+        }
+
+        if (*end != '/' || count == 3) {
+            return 0;
+        }
+
+        p = end + 1;
+
+    }
+
+    memset(res, 0, sizeof *res);
+    res->tm_year = parts[0] - 1900;
+    res->tm_mon = (count > 1) ? parts[1] - 1 : today->tm_mon;
+    res->tm_mday = (count > 2) ? parts[2] : today->tm_mday;
+    res->tm_hour = 12; /* keeps mktime normalisation clear of DST edges */
+    res->tm_isdst = -1;
+
+    if (res->tm_mon < 0 || res->tm_mon > 11 || res->tm_mday < 1 ||
+        res->tm_mday > days_in_month(res->tm_year + 1900, res->tm_mon + 1)) {
+        return 0;
+    }
+
+    mktime(res); /* fills in tm_wday and tm_yday */
+
+    return count;
+
+}
+
+/*
+   Returns the number of days in the given month (1 - 12) of the year.
+*/
+int days_in_month(int year, int month)
+{
+
+    static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0)) {
+        return 29;
+    }
+
+    return days[month - 1];
+
+}
+
+/*
+   Moves the date of the provided tm by the given number of days
+   (which may be negative) and normalises it.
+*/
+void add_days(struct tm *date, int days)
+{
+
+    date->tm_mday += days;
+    date->tm_hour = 12;
+    date->tm_min = 0;
+    date->tm_sec = 0;
+    date->tm_isdst = -1;
+
+    mktime(date);
+
+}
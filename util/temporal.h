@@ -11,5 +11,10 @@ void subtract_time(struct tm first, struct tm second, struct tm *res);
 void divide_time(struct tm first, int divisor, struct tm *res);
 
 void parse_timestr(const char *str, struct tm *res);
+void format_seconds(int secs, char *buf, size_t len);
+
+int parse_datestr(const char *str, const struct tm *today, struct tm *res);
+int days_in_month(int year, int month);
+void add_days(struct tm *date, int days);
 
 #endif
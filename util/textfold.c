@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "textfold.h"
+
+/*
+    Returns the plain letter of the two byte UTF-8 sequence at str, or 0
+    if it is not one of the Bosnian letters with diacritics.
+*/
+static char fold_letter(const unsigned char *str)
+{
+
+    if (str[0] == 0xC4) {
+
+        switch (str[1]) {
+        case 0x8C: case 0x8D: /* Č č */
+        case 0x86: case 0x87: /* Ć ć */
+            return 'c';
+        case 0x90: case 0x91: /* Đ đ */
+            return 'd';
+        }
+
+    } else if (str[0] == 0xC5) {
+
+        switch (str[1]) {
+        case 0xA0: case 0xA1: /* Š š */
+            return 's';
+        case 0xBD: case 0xBE: /* Ž ž */
+            return 'z';
+        }
+
+    }
+
+    return 0;
+
+}
+
+/*
+    Writes the folded str into buf.
+
+    Returns the length of the folded string, or 0 if it was empty, held
+    something other than letters, digits and separators, or did not fit.
+*/
+size_t text_fold(char *buf, size_t buflen, const char *str)
+{
+
+    const unsigned char *s = (const unsigned char *) str;
+    size_t len = 0;
+    int sep = 0;
+
+    while (*s != '\0') {
+
+        char c;
+
+        if (*s == ' ' || *s == '-' || *s == '_' || *s == '.' || *s == '\t') {
+
+            sep = 1;
+            s++;
+            continue;
+
+        }
+
+        if ((*s >= 'a' && *s <= 'z') || (*s >= '0' && *s <= '9')) {
+            c = *s++;
+        } else if (*s >= 'A' && *s <= 'Z') {
+            c = *s++ - 'A' + 'a';
+        } else if ((c = fold_letter(s)) != 0) {
+            s += 2;
+        } else {
+            return 0;
+        }
+
+        if (sep && len > 0) {
+
+            if (len + 1 >= buflen) {
+                return 0;
+            }
+
+            buf[len++] = ' ';
+
+        }
+
+        sep = 0;
+
+        if (len + 1 >= buflen) {
+            return 0;
+        }
+
+        buf[len++] = c;
+
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    buf[len] = '\0';
+
+    return len;
+
+}
+
+/*
+    FNV-1a of str, started from a state mixed with seed so the same
+    string hashes differently for every seed.
+*/
+uint32_t text_hash(const char *str, uint32_t seed)
+{
+
+    uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+
+    for (const unsigned char *s = (const unsigned char *) str; *s != '\0'; s++) {
+
+        hash ^= *s;
+        hash *= 16777619u;
+
+    }
+
+    /* Spread the low bits, the table is indexed with them */
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+
+    return hash;
+
+}
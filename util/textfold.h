@@ -0,0 +1,16 @@
+#ifndef TEXTFOLD_H
+#define TEXTFOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Folds a name for comparison: lowercase ASCII, the Bosnian letters
+    with diacritics (č, ć, đ, š, ž) as their plain letters and any run of
+    spaces, dashes, underscores or dots as a single space. "Kotor-Varoš"
+    and "kotor varos" fold to the same string.
+*/
+size_t text_fold(char *buf, size_t buflen, const char *str);
+uint32_t text_hash(const char *str, uint32_t seed);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "timeheap.h"
+#include "alloc.h"
+
+#ifndef vactija_error
+/*
+    Errcode needs to be equal to whetever errno value
+    the error is supposed to display.
+*/
+#define vactija_error(errcode)                                        \
+    char *errstr = strerror(errcode);                                 \
+    printf("Err: %s\n", errstr);                                      \
+    exit(EXIT_FAILURE)
+#endif
+
+void timeheap_init(struct timeheap *heap)
+{
+
+    heap->entries = NULL;
+    heap->count = 0;
+    heap->cap = 0;
+
+}
+
+void timeheap_free(struct timeheap *heap)
+{
+
+    vfree(heap->entries);
+    timeheap_init(heap);
+
+}
+
+/*
+    Empties the heap, keeping its memory for the next pushes.
+*/
+void timeheap_clear(struct timeheap *heap)
+{
+
+    heap->count = 0;
+
+}
+
+static int before(const struct timeheap_entry *a, const struct timeheap_entry *b)
+{
+
+    return a->at < b->at || (a->at == b->at && a->id < b->id);
+
+}
+
+void timeheap_push(struct timeheap *heap, time_t at, int id)
+{
+
+    if (heap->count == heap->cap) {
+
+        int cap = (heap->cap > 0) ? heap->cap * 2 : 64;
+        struct timeheap_entry *entries = vrealloc(heap->entries, sizeof *entries * cap);
+
+        if (entries == NULL) {
+
+            int errcode = errno;
+            printf("Could not allocate enough memory for the timer heap!\n");
+            vactija_error(errcode);
+
+        }
+
+        heap->entries = entries;
+        heap->cap = cap;
+
+    }
+
+    struct timeheap_entry e = { at, id };
+    int i = heap->count++;
+
+    /* Sift up */
+    while (i > 0 && before(&e, &heap->entries[(i - 1) / 2])) {
+
+        heap->entries[i] = heap->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+
+    }
+
+    heap->entries[i] = e;
+
+}
+
+/*
+    Stores the earliest entry in top, leaving it in the heap.
+
+    Returns 0 on success and -1 if the heap is empty.
+*/
+int timeheap_peek(const struct timeheap *heap, struct timeheap_entry *top)
+{
+
+    if (heap->count == 0) {
+        return -1;
+    }
+
+    *top = heap->entries[0];
+
+    return 0;
+
+}
+
+/*
+    Removes the earliest entry from the heap and stores it in top.
+
+    Returns 0 on success and -1 if the heap is empty.
+*/
+int timeheap_pop(struct timeheap *heap, struct timeheap_entry *top)
+{
+
+    if (heap->count == 0) {
+        return -1;
+    }
+
+    *top = heap->entries[0];
+
+    struct timeheap_entry last = heap->entries[--heap->count];
+    int i = 0;
+
+    /* Sift the last entry down from the root */
+    for (;;) {
+
+        int child = 2 * i + 1;
+
+        if (child >= heap->count) {
+            break;
+        }
+
+        if (child + 1 < heap->count && before(&heap->entries[child + 1], &heap->entries[child])) {
+            child++;
+        }
+
+        if (!before(&heap->entries[child], &last)) {
+            break;
+        }
+
+        heap->entries[i] = heap->entries[child];
+        i = child;
+
+    }
+
+    if (heap->count > 0) {
+        heap->entries[i] = last;
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,34 @@
+#ifndef TIMEHEAP_H
+#define TIMEHEAP_H
+
+#include <time.h>
+
+/*
+    A binary min-heap of (time, id) pairs, ordered by time and then by
+    id, so that events at the same second come out in a fixed order.
+    What an id stands for is up to the user.
+*/
+struct timeheap_entry {
+
+    time_t at;
+    int id;
+
+};
+
+struct timeheap {
+
+    struct timeheap_entry *entries;
+    int count;
+    int cap;
+
+};
+
+void timeheap_init(struct timeheap *heap);
+void timeheap_free(struct timeheap *heap);
+void timeheap_clear(struct timeheap *heap);
+
+void timeheap_push(struct timeheap *heap, time_t at, int id);
+int timeheap_peek(const struct timeheap *heap, struct timeheap_entry *top);
+int timeheap_pop(struct timeheap *heap, struct timeheap_entry *top);
+
+#endif
@@ -4,11 +4,41 @@
 #include <string.h>
 #include <getopt.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 
 #include "util/cachefile.h"
+#include "util/temporal.h"
+#include "util/clocksource.h"
+#include "util/hijri.h"
+#include "util/alloc.h"
 #include "vactija.h"
+#include "derived.h"
+#include "fetch.h"
+#include "export.h"
+#include "format.h"
+#include "record.h"
+#include "bundle.h"
+#include "pack.h"
+#include "cachectl.h"
+#include "locations.h"
+#include "timeline.h"
+#include "server.h"
+#include "daemon.h"
+#include "upcoming.h"
 #include "config.h"
 
+/*
+    Longest date range the print action takes, about ten years.
+*/
+#define RANGE_MAX_DAYS 3660
+
 static char *pname = "vactija";
 static char *pname_full = "Vactija";
 
@@ -19,17 +49,55 @@ static char *website = "https://github.com/Salihbasic/vactija";
 static struct option longopts[] = {
 
     {"help", no_argument, NULL, 'h'},
-    {"update", no_argument, NULL, 'h'},
+    {"update", no_argument, NULL, 'u'},
     {"directory", required_argument, NULL, 'd'},
     {"location", required_argument, NULL, 'l'},
+    {"coords", required_argument, NULL, 'c'},
     {"date", required_argument, NULL, 'y'},
-    {"raw", no_argument, NULL, 'r'}
+    {"raw", no_argument, NULL, 'r'},
+    {"format", required_argument, NULL, 'f'},
+    {"http", optional_argument, NULL, 'H'},
+    {"count", required_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}
 
 };
 
 static void usage(int status);
-static void print_raw_data(void);
+static int nearest_location(const char *coords);
 static int validate_date(const char *date);
+static void serve(const char *directory, const char *http);
+static char *load_data(const char *directory, const char *location, 
+        int year, int mon, int mday, int update);
+static void month(const char *directory, const char *location, 
+        const char *date, int update, int raw);
+static struct vaktija *load_day(const char *directory, const char *location,
+        struct tm date, int offset, int fetch, int update);
+static int day_path(char *buf, const char *directory, const char *location,
+        int year, int mon, int mday, const char *ext);
+static struct vaktija *fetch_day(const char *directory, const char *location,
+        struct tm date, int update);
+static struct vaktija *load_fallback(const char *directory, const char *location,
+        struct tm date);
+static int parse_range(const char *span, struct tm *start, struct tm *end);
+static int is_hijri(const char *str);
+static char *hijri_span(const char *span);
+static void range(const char *directory, const char *location, const char *span, int update,
+        struct export *out);
+static void export_action(const char *directory, const char *location, const char *span,
+        char **args, int update);
+static void build_bundle(const char *directory, const char *yearstr, const char *path, int update);
+static struct vaktija *bundle_lookup(const char *directory, const char *location, struct tm date);
+static int day_cached(const char *directory, const char *location, struct tm date);
+static struct pack *cache_pack(const char *directory);
+static void cache_action(const char *directory, char **args);
+static void prefetch(const char *directory, const char *location, struct tm today);
+static void daemon_action(const char *directory, const char *hooks);
+static void subscribe(int location, const char *ticks);
+static void upcoming_action(const char *directory, int location, const char *countstr,
+        char **args, const struct format *fmt, int colour);
+static void print_alloc_stats(void);
+
+static struct alloc_counter alloc_stats;
 
 int main(int argc, char **argv) {
 
@@ -38,14 +106,53 @@ int main(int argc, char **argv) {
         usage(EXIT_FAILURE);
     }
 
+    /* Counts what the run allocates, for the benchmarks */
+    if (getenv("VACTIJA_ALLOC_STATS") != NULL) {
+
+        alloc_counter_init(&alloc_stats, NULL);
+        alloc_set(&alloc_stats.allocator);
+        atexit(print_alloc_stats);
+
+    }
+
+    derived_register(cfg_derived, sizeof cfg_derived / sizeof cfg_derived[0]);
+
+    struct fetch_policy policy = {
+        cfg_fetch_connect_timeout, cfg_fetch_timeout,
+        cfg_fetch_retries, cfg_fetch_backoff, cfg_fetch_hedge_after
+    };
+    fetch_set_policy(&policy);
+    fetch_fixtures_from_env();
+
+    if (hijri_set_adjustments(cfg_hijri_adjustments,
+                sizeof cfg_hijri_adjustments / sizeof cfg_hijri_adjustments[0]) != 0) {
+
+        printf("Invalid cfg_hijri_adjustments in config.h!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (clock_from_env() != 0) {
+
+        printf("Invalid VACTIJA_NOW or VACTIJA_CLOCK_SPEED!\n");
+        printf("Expected: VACTIJA_NOW=\"yyyy-mm-dd HH:MM\" and VACTIJA_CLOCK_SPEED=<factor>\n");
+        exit(EXIT_FAILURE);
+
+    }
+
     int update_flag = 0;
     int raw_flag = 0;
     char *dir_path = NULL;
     char *loc = NULL;
+    char *coords = NULL;
     char *date = NULL;
+    const char *template = NULL;
+    char *http = NULL;
+    int http_flag = 0;
+    char *count = NULL;
 
     int c; 
-    while((c = getopt_long(argc, argv, "hurd:l:y:", longopts, NULL)) != -1) {
+    while((c = getopt_long(argc, argv, "hurd:l:c:y:f:n:", longopts, NULL)) != -1) {
 
         switch (c) {
         
@@ -59,23 +166,37 @@ int main(int argc, char **argv) {
 
         case 'd':
             dir_path = strndup(optarg, strlen(optarg));
-            update_flag = 1;
             break;
 
         case 'l':
             loc = strndup(optarg, strlen(optarg));
-            update_flag = 1;
+            break;
+
+        case 'c':
+            coords = strndup(optarg, strlen(optarg));
             break;
         
         case 'y':
             date = strndup(optarg, strlen(optarg));
-            update_flag = 1;
             break;
         
         case 'r':
             raw_flag = 1;
             break;
 
+        case 'f':
+            template = strndup(optarg, strlen(optarg));
+            break;
+
+        case 'H':
+            http_flag = 1;
+            http = (optarg != NULL) ? strndup(optarg, strlen(optarg)) : NULL;
+            break;
+
+        case 'n':
+            count = strndup(optarg, strlen(optarg));
+            break;
+
         }
 
     }
@@ -90,32 +211,150 @@ int main(int argc, char **argv) {
     }
 
     const char *location = (loc == NULL) ? cfg_loc : loc;
+    char locid[16];
     const char *directory = (dir_path == NULL) ? cfg_cachedir : dir_path;
 
-    char *vdata;
-    if (cfg_nocache) {
+    char *action = argv[optind];
 
-        vdata = download_vaktija(location, date);
+    if (count != NULL && strcmp(action, "upcoming") != 0) {
 
-    } else {
-    
-        if (update_flag || cache_exists(directory) != 1 || cache_outdated(directory) == 1) {
-            
-            vdata = download_vaktija(location, date);
-            write_cache(directory, vdata);
+        printf("Only upcoming takes --count!\n");
+        exit(EXIT_FAILURE);
 
-        } else {
+    }
 
-            vdata = read_cache(directory);
+    if (strcmp(action, "serve") == 0) {
+
+        if (!http_flag) {
+
+            printf("No listener specified for serve!\n");
+            usage(EXIT_FAILURE);
 
         }
 
+        serve(directory, http);
+
     }
-    struct vaktija *v = parse_data(vdata);
+
+    if (strcmp(action, "bundle") == 0) {
+
+        if (argv[optind + 1] == NULL || strcmp(argv[optind + 1], "build") != 0) {
+
+            printf("Unknown bundle action! Expected: bundle build [yyyy [file]]\n");
+            exit(EXIT_FAILURE);
+
+        }
+
+        const char *yearstr = argv[optind + 2];
+        build_bundle(directory, yearstr, (yearstr != NULL) ? argv[optind + 3] : NULL, update_flag);
+
+    }
+
+    if (strcmp(action, "cache") == 0) {
+        cache_action(directory, argv + optind + 1);
+    }
+
+    if (strcmp(action, "daemon") == 0) {
+        daemon_action(directory, argv[optind + 1]);
+    }
+
+    if (coords != NULL && loc != NULL) {
+
+        printf("Only one of --location and --coords can be given!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    /* Names are looked up in the built-in table, so only valid IDs go further */
+    int id = (coords != NULL) ? nearest_location(coords) : location_parse(location);
+
+    if (id < 0) {
+
+        printf("Unknown location: %s\n", location);
+        printf("Location is an ID or name from locations.txt, e.g. 77 or Sarajevo.\n");
+
+        exit(EXIT_FAILURE);
+
+    }
+
+    snprintf(locid, sizeof locid, "%d", id);
+    location = locid;
+
+    /* countdown and upcoming are built-in formats, the other actions have their own printers */
+    if (template == NULL && strcmp(action, "countdown") == 0) {
+        template = raw_flag ? "{countdown}" : "{next.name} in {countdown}\n";
+    }
+
+    if (template == NULL && strcmp(action, "upcoming") == 0) {
+
+        /* Several locations are told apart by name */
+        int several = argc - optind > 2;
+
+        template = several ? "{gdate} {yellow}{vakat.time:5}{reset} {cyan}{vakat.name:-7}{reset} {location}\n"
+            : "{gdate} {yellow}{vakat.time:5}{reset} {cyan}{vakat.name}{reset}\n";
+
+    }
+
+    struct format *fmt = NULL;
+
+    if (template != NULL) {
+
+        char err[FORMAT_ERR_MAX];
+
+        if ((fmt = format_compile(template, err, sizeof err)) == NULL) {
+
+            printf("Invalid format: %s\n", err);
+            exit(EXIT_FAILURE);
+
+        }
+
+    }
+
+    if (strcmp(action, "subscribe") == 0) {
+        subscribe(id, argv[optind + 1]);
+    }
+
+    if (strcmp(action, "upcoming") == 0) {
+        upcoming_action(directory, id, count, argv + optind + 1, fmt, format_colour() && !raw_flag);
+    }
+
+    if (strcmp(action, "export") == 0) {
+        export_action(directory, location, date, argv + optind + 1, update_flag);
+    }
+
+    if (strcmp(action, "month") == 0) {
+
+        const char *monthstr = (argv[optind + 1] != NULL) ? argv[optind + 1] : date;
+        month(directory, location, monthstr, update_flag, raw_flag);
+
+    }
+
+    /* A Hijri day is that Gregorian day, and a Hijri month the range of its days */
+    if (date != NULL && strstr(date, "..") == NULL && is_hijri(date)) {
+        date = hijri_span(date);
+    }
+
+    if (date != NULL && strstr(date, "..") != NULL) {
+
+        if (strcmp(action, "print") != 0 || raw_flag) {
+
+            printf("Date ranges only work with the print and export actions!\n");
+            exit(EXIT_FAILURE);
+
+        }
+
+        range(directory, location, date, update_flag, NULL);
+
+    }
+
+    time_t curr = clock_now();
+    struct tm today;
+    localtime_r(&curr, &today);
+    struct tm day = today;
 
     if (date != NULL) {
 
-        if (validate_date(date) == 0) {
+        if (validate_date(date) == 0 || parse_datestr(date, &today, &day) == 0) {
 
             printf("Invalid date provided!\n");
             printf("Date format: <yyyy>[/mm[/dd]]\n");
@@ -126,23 +365,71 @@ int main(int argc, char **argv) {
 
     }
 
-    char *action = argv[optind];
+    /* The raw JSON is only needed for print -r, everything else uses records */
+    if (strcmp(action, "print") == 0 && raw_flag && fmt == NULL) {
 
-    if (strcmp(action, "print") == 0) {
+        char *vdata = load_data(directory, location, 
+                day.tm_year + 1900, day.tm_mon + 1, day.tm_mday, update_flag);
 
-        if (raw_flag) {
-                
-            printf("%s", vdata);
+        if (vdata == NULL) {
+            exit(EXIT_FAILURE);
+        }
 
-        } else {
+        printf("%s", vdata);
+        vfree(vdata);
 
-            print_vaktija(v);
-                
+        exit(EXIT_SUCCESS);
+
+    }
+
+    struct vaktija *v = load_day(directory, location, day, 0, 1, update_flag);
+
+    /*
+        Neighbouring days are only taken from the cache here, tomorrow
+        is downloaded further down if it turns out to be needed.
+    */
+    struct vaktija *prev = load_day(directory, location, day, -1, 0, 0);
+    struct vaktija *next = load_day(directory, location, day, 1, 0, 0);
+
+    if (next != NULL && !v->derived_exact) {
+
+        derive_times(v, next);
+
+        /* Once is enough, so store the exact times with the record (unless it is a fallback), if it can be */
+        char recpath[CACHE_PATH_MAX];
+        if (!cfg_nocache && day_path(recpath, directory, location, v->year, v->month, v->day, RECORD_EXT) &&
+            cache_exists(recpath) == 1) {
+            write_record(recpath, v);
         }
 
     }
 
-    if ((strlen(action) == 1) && isdigit(action[0])) {
+    struct timeline tl;
+    timeline_init(&tl);
+
+    if (prev != NULL) {
+        timeline_add_day(&tl, prev);
+    }
+
+    timeline_add_day(&tl, v);
+
+    if (next != NULL) {
+        timeline_add_day(&tl, next);
+    }
+
+    int is_today = compare_date(day, today) == 0;
+    struct tm current = today;
+
+    struct format_ctx ctx = { 0 };
+    ctx.day = v;
+    ctx.location = location_name(id);
+    ctx.now = curr;
+
+    int is_vakat = (strlen(action) == 1) && isdigit(action[0]);
+    int is_next = strcmp(action, "next") == 0 || strcmp(action, "countdown") == 0;
+    int is_current = strcmp(action, "current") == 0;
+
+    if (is_vakat) {
 
         int num = action[0] - '0'; /* should be safe? */
 
@@ -153,32 +440,104 @@ int main(int argc, char **argv) {
         
         }
 
-        print_vakat(v, num, raw_flag);
+        ctx.vakat = (struct format_vakat) { v, num, vakat_epoch(v, num) };
+
+    }
+
+    /* Only looked for if the action or the format needs them */
+    if ((is_next || format_needs(fmt, FORMAT_NEEDS_NEXT)) && is_today) {
+
+        int idx = timeline_next(&tl, curr);
+
+        /* After isha the next vakat is tomorrow's fajr */
+        if (idx == -1 && next == NULL) {
+
+            next = load_day(directory, location, day, 1, 1, 0);
+
+            if (timeline_add_day(&tl, next) == 0) {
+                idx = timeline_next(&tl, curr);
+            }
+
+        }
+
+        if (idx == -1 && is_next) {
+
+            printf("Could not find the next vakat!\n");
+            exit(EXIT_FAILURE);
+
+        }
+
+        if (idx >= 0) {
+            ctx.next = (struct format_vakat) { timeline_day(&tl, idx), timeline_vakat(&tl, idx), tl.times[idx] };
+        }
+
+    } else if (is_next || format_needs(fmt, FORMAT_NEEDS_NEXT)) {
+
+        /* For other days there is only the time of day to go by */
+        int vakat = next_vakat(v, current);
+        ctx.next = (struct format_vakat) { v, vakat, vakat_epoch(v, vakat) };
+
+    }
+
+    if (is_current || format_needs(fmt, FORMAT_NEEDS_CURRENT)) {
+
+        int idx = is_today ? timeline_current(&tl, curr) : -1;
+
+        if (idx >= 0) {
+
+            ctx.current = (struct format_vakat) { timeline_day(&tl, idx), timeline_vakat(&tl, idx), tl.times[idx] };
+
+        } else {
+
+            int vakat = current_vakat(v, current);
+            ctx.current = (struct format_vakat) { v, vakat, vakat_epoch(v, vakat) };
+
+        }
 
     }
 
-    if (strcmp(action, "next") == 0) {
+    if (is_next) {
+        ctx.vakat = ctx.next;
+    } else if (is_current) {
+        ctx.vakat = ctx.current;
+    }
 
-        time_t curr;
-        time(&curr);
-        struct tm current = *localtime(&curr);
+    if (strcmp(action, "print") != 0 && !is_vakat && !is_next && !is_current) {
 
-        print_vakat(v, next_vakat(v, current), raw_flag); 
+        printf("Unknown action: %s\n", action);
+        usage(EXIT_FAILURE);
 
     }
 
-    if (strcmp(action, "current") == 0) {
+    if (fmt != NULL) {
+
+        /* -r leaves the colours out of a format, like any other output */
+        format_print(fmt, &ctx, format_colour() && !raw_flag);
+
+    } else if (strcmp(action, "print") == 0) {
+
+        print_vaktija(v);
+
+    } else {
+
+        print_vakat(ctx.vakat.day, ctx.vakat.vakat, raw_flag);
+
+    }
 
-        time_t curr;
-        time(&curr);
-        struct tm current = *localtime(&curr);
+    if (is_today && curr >= vakat_epoch(v, PRAYER_TIME_NUM - 1)) {
+        prefetch(directory, location, today);
+    }
 
-        print_vakat(v, current_vakat(v, current), raw_flag); 
+    if (prev != NULL) {
+        delete_vaktija(prev);
+    }
 
+    if (next != NULL) {
+        delete_vaktija(next);
     }
 
     delete_vaktija(v);
-    free(vdata);
+    format_free(fmt);
 
     exit(EXIT_SUCCESS);
 
@@ -206,17 +565,34 @@ static void usage(int status)
 
     printf(" -r, --raw            outputs raw data\n");
 
-    printf(" -d, --directory      sets the directory used to download/search\n");
-    printf("                      the vaktija data.\n");
+    printf(" -f, --format         prints print, #, next, current and countdown with a\n");
+    printf("                      template instead, e.g \"{next.name} in {countdown}\".\n");
+    printf("                      Fields: {time} {location} {date} {hijri} {gdate},\n");
+    printf("                      {dawn} ... {isha}, derived times by name, {vakat.name}\n");
+    printf("                      {vakat.time} {next.name} {next.time} {current.name}\n");
+    printf("                      {current.time} {countdown}, colours {cyan} {yellow}\n");
+    printf("                      {green} {red} {bold} {reset} and widths {field:N}.\n");
+
+    printf(" -d, --directory      sets the cache directory used to store/search\n");
+    printf("                      the vaktija data (one file per location and date).\n");
 
-    printf(" -l, --location       sets the location ID (found in locations.txt)\n");
-    printf("                      for vaktija data from the API. This will redownload\n");
-    printf("                      data regardless of caching.\n");
+    printf(" -l, --location       sets the location ID or name (found in locations.txt)\n");
+    printf("                      for vaktija data from the API.\n");
+
+    printf(" -c, --coords         picks the location nearest to <lat>,<lon> instead,\n");
+    printf("                      e.g. 43.85,18.39.\n");
 
     printf(" -y, --date           sets the date for vaktija data, the required date format\n");
-    printf("                      is <yyyy>[/mm[/dd]]. This will redownload data regardless\n");
-    printf("                      of caching.\n");
+    printf("                      is <yyyy>[/mm[/dd]]. print and export also take a range\n");
+    printf("                      of dates as <date>..<date>, e.g 2027/03/01..2027/04/15.\n");
+    printf("                      Hijri dates work too, as [dd. ]<month> <yyyy>, and a\n");
+    printf("                      Hijri month is all of its days, e.g \"ramazan 1448\".\n");
+
+    printf(" -n, --count          sets how many vakats upcoming prints.\n");
 
+    printf("     --http[=[addr:]port]\n");
+    printf("                      serves the vaktija API over HTTP from the cache\n");
+    printf("                      (used with the serve action).\n");
 
 
     printf("%s actions:\n", pname_full);
@@ -224,12 +600,42 @@ static void usage(int status)
     printf(" #                     prints the specified vakat [# = (0 - 5)]\n");
     printf(" next                  prints the next vakat\n");
     printf(" current               prints the current vakat\n");
+    printf(" countdown             prints the time left until the next vakat\n");
+    printf(" month [yyyy/mm]       prints the vaktija for every day of the month\n");
+    printf(" upcoming [location ...]\n");
+    printf("                       prints the next -n vakats (%d by default) across\n", cfg_upcoming_count);
+    printf("                       days, of several locations merged in time order\n");
+    printf(" export <csv|jsonl|ics> [all]\n");
+    printf("                       writes the days of -y (a date or range, this\n");
+    printf("                       month by default) for other programs, for every\n");
+    printf("                       location with all (from the cache and bundles)\n");
+    printf(" bundle build [yyyy [file]]\n");
+    printf("                       puts the whole year of every location into one\n");
+    printf("                       file, used for days missing from the cache\n");
+    printf(" cache compact         merges the cached days into one indexed file\n");
+    printf(" cache stats           prints what the cache holds\n");
+    printf(" cache gc [days [KB]]  removes cached days older than days, then the\n");
+    printf("                       oldest ones until the cache fits into KB\n");
+    printf(" daemon [file]         runs the commands of the hooks file at vakat times\n");
+    printf("                       (see daemon.h), SIGHUP reads the file again, and\n");
+    printf("                       pushes changes of vakat to subscribers\n");
+    printf(" subscribe [ticks]     prints a line from the daemon at every change of\n");
+    printf("                       vakat and date (and every minute with ticks)\n");
+    printf(" serve                 runs a caching proxy for the vaktija API, point\n");
+    printf("                       VACTIJA_API_URL of other machines at it\n");
 
     printf("\n");
 
     printf("Examples:\n");
     printf("  %s -r -d /home/user/altcache -y 2020/04/01 -l 82 print\n", pname);
     printf("  %s -u 3\n", pname);
+    printf("  %s -l \"Banja Luka\" next\n", pname);
+    printf("  %s -c 44.54,18.68 print\n", pname);
+    printf("  %s -l 77 -y 2027/03/01..2027/04/15 print\n", pname);
+    printf("  %s -y 2027 export ics all > vaktija-2027.ics\n", pname);
+    printf("  %s -l 77 -y \"ramazan 1448\" export csv > ramazan.csv\n", pname);
+    printf("  %s -f \"{location}: {next.name} at {next.time}\\n\" next\n", pname);
+    printf("  %s -d /var/cache/vactija serve --http=0.0.0.0:8080\n", pname);
 
     printf("\n");
 
@@ -240,43 +646,1800 @@ static void usage(int status)
 
 }
 
-static int validate_date(const char *date)
+/*
+    Returns the ID of the location nearest to coords (<lat>,<lon> in
+    degrees), warning when even that one is far away. Exits if coords
+    can not be parsed.
+*/
+static int nearest_location(const char *coords)
 {
 
-    /* date format <yyyy>[/mm[/dd]] */
+    char *end;
+    double lat = strtod(coords, &end);
+    double lon = 0;
 
-    int len = strlen(date);
+    if (end == coords || *end != ',') {
+        end = NULL;
+    } else {
 
-    if (len == 4 || len == 7 || len == 10) {
+        const char *lonstr = end + 1;
+        lon = strtod(lonstr, &end);
+        end = (end == lonstr || *end != '\0') ? NULL : end;
 
-        for (int i = 0; date[i] != '\0'; i++) {
+    }
 
-            if (i == 4 || i == 7) {
-                
-                if (date[i] != '/') {
+    int id = (end != NULL) ? location_nearest(lat, lon) : -1;
 
-                    return 0;
+    if (id < 0) {
 
-                }
+        printf("Invalid coordinates: %s\n", coords);
+        printf("Coordinates format: <lat>,<lon> in degrees, e.g. 43.85,18.39\n");
 
-            } else {
+        exit(EXIT_FAILURE);
 
-                if (!isdigit(date[i])) {
+    }
 
-                    return 0;
+    double km = location_distance(id, lat, lon);
 
-                }
+    if (km > cfg_coords_max_km) {
 
-            }
+        fflush(stdout);
+        fprintf(stderr, "The nearest location, %s, is %.0f km away.\n", location_name(id), km);
+
+    }
+
+    return id;
+
+}
+
+/*
+    Returns the vaktija JSON data for the location on the given date
+    (or the whole month if mday is 0), downloading it only if the cache
+    does not have it yet or an update is forced.
+
+    If the download fails, a forced update keeps using the cached data,
+    otherwise NULL is returned.
+
+    The cache holds one file per (location, date), so a different
+    location or date is simply a different entry and the date
+    changing at midnight switches to a new entry on its own.
+*/
+static char *load_data(const char *directory, const char *location, 
+        int year, int mon, int mday, int update)
+{
+
+    char datepath[VAKTIJA_DATE_PATH_MAX];
+    if (mday > 0) {
+        snprintf(datepath, sizeof datepath, "%d/%d/%d", year, mon, mday);
+    } else {
+        snprintf(datepath, sizeof datepath, "%d/%d", year, mon);
+    }
+
+    if (cfg_nocache) {
+        return fetch_vaktija(location, datepath);
+    }
+
+    char key[CACHE_KEY_MAX];
+    char path[CACHE_PATH_MAX];
+
+    if (cache_key(key, sizeof key, location, year, mon, mday) < 0 ||
+        cache_path(path, sizeof path, directory, key, "json") < 0) {
+
+        printf("Cache path is too long!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    int exists = cache_exists(path) == 1;
+
+    /* Compacted days are only in the pack */
+    struct pack *pack = exists ? NULL : cache_pack(directory);
+    char *packed = (pack != NULL) ? pack_json(pack, key) : NULL;
+
+    if (packed != NULL && !update) {
+        return packed;
+    }
+
+    if (update || !exists) {
+
+        char *vdata = fetch_vaktija(location, datepath);
+
+        /* A broken body is not cached over data which may still be good */
+        if (vdata != NULL && !(mday > 0 ? valid_vaktija(vdata) : valid_month(vdata))) {
+
+            printf("The vaktija API returned invalid data for %s!\n", key);
+            vfree(vdata);
+            vdata = NULL;
+
+        }
+
+        if (vdata == NULL) {
+            return exists ? read_cache(path) : packed;
+        }
+
+        vfree(packed);
+
+        cache_prepare_dir(directory);
+
+        /* Still used if it cannot be kept, this may run in a range worker */
+        if (store_cache_data(path, vdata, strlen(vdata)) != 0) {
+            printf("Could not write the cache file %s: %s\n", path, strerror(errno));
+        }
+
+        return vdata;
+
+    }
+
+    return read_cache(path);
+
+}
+
+/*
+    Runs the month action, which shows the whole month from a single
+    API request (and a single cache entry) for it.
+
+    Never returns.
+*/
+static void month(const char *directory, const char *location, 
+        const char *date, int update, int raw)
+{
+
+    struct tm today;
+    clock_localtime(&today);
+    struct tm day = today;
+
+    if (date != NULL) {
+
+        if (validate_date(date) == 0 || parse_datestr(date, &today, &day) == 0) {
+
+            printf("Invalid month provided!\n");
+            printf("Month format: <yyyy>[/mm]\n");
+
+            exit(EXIT_FAILURE);
 
         }
 
+    }
+
+    char *vdata = load_data(directory, location, day.tm_year + 1900, day.tm_mon + 1, 0, update);
+
+    if (vdata == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (raw) {
+
+        printf("%s", vdata);
+
     } else {
 
-        return 0;
+        int count;
+        struct vaktija **days = parse_month(vdata, &count);
+
+        if (days == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        print_month(days, count);
+
+        delete_month(days, count);
 
     }
 
-    return 1;
+    vfree(vdata);
+
+    exit(EXIT_SUCCESS);
+
+}
+
+/*
+    Shared between the range action and the threads filling in the
+    days missing from the cache.
+*/
+struct range_fill {
+
+    const char *directory;
+    const char *location;
+    struct tm start;
+    int update;
+
+    struct vaktija **days;
+    char *ready;
+    char *cached;   /* ready, but to be loaded from the cache */
+
+    int *missing;   /* day indexes to download, in date order */
+    int nmissing;
+    int next;       /* next entry of missing to start on */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+};
+
+static void *range_worker(void *arg)
+{
+
+    struct range_fill *fill = arg;
+
+    while (1) {
+
+        pthread_mutex_lock(&fill->lock);
+
+        if (fill->next == fill->nmissing) {
+
+            pthread_mutex_unlock(&fill->lock);
+            break;
+
+        }
+
+        int idx = fill->missing[fill->next++];
+
+        pthread_mutex_unlock(&fill->lock);
+
+        struct tm date = fill->start;
+        add_days(&date, idx);
+
+        struct vaktija *v = fetch_day(fill->directory, fill->location, date, fill->update);
+
+        pthread_mutex_lock(&fill->lock);
+        fill->days[idx] = v;
+        fill->ready[idx] = 1;
+        pthread_cond_broadcast(&fill->cond);
+        pthread_mutex_unlock(&fill->lock);
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Returns 1 if the date is a Hijri one, e.g "ramazan 1448" or
+    "1. ševval 1448", rather than <yyyy>[/mm[/dd]].
+*/
+static int is_hijri(const char *str)
+{
+
+    return str[strspn(str, "0123456789/")] != '\0';
+
+}
+
+/*
+    Parses a Hijri date into the Gregorian day it is on. A month without
+    a day is its first day, or its last one if end.
+
+    Returns 0 if the date is not valid.
+*/
+static int parse_hijri_date(const char *str, int end, struct tm *res)
+{
+
+    struct hijri_date hijri;
+
+    if (!hijri_parse(str, &hijri)) {
+        return 0;
+    }
+
+    if (hijri.day == 0) {
+        hijri.day = end ? hijri_month_days(hijri.year, hijri.month) : 1;
+    }
+
+    int year, mon, mday;
+    hijri_to_gregorian(&hijri, &year, &mon, &mday);
+
+    memset(res, 0, sizeof *res);
+    res->tm_year = year - 1900;
+    res->tm_mon = mon - 1;
+    res->tm_mday = mday;
+    res->tm_hour = 12;
+    res->tm_isdst = -1;
+
+    mktime(res);
+
+    return 1;
+
+}
+
+/*
+    Turns a Hijri day into its Gregorian date (yyyy/mm/dd) and a Hijri
+    month into the range of its days, for -y.
+
+    Exits if it is not valid.
+*/
+static char *hijri_span(const char *span)
+{
+
+    struct tm start, end;
+
+    if (!parse_hijri_date(span, 0, &start) || !parse_hijri_date(span, 1, &end)) {
+
+        printf("Invalid Hijri date provided!\n");
+        printf("Hijri date format: [<dd>. ]<month> <yyyy>, e.g \"ramazan 1448\"\n");
+
+        exit(EXIT_FAILURE);
+
+    }
+
+    char buf[32];
+    int n = snprintf(buf, sizeof buf, "%d/%02d/%02d", start.tm_year + 1900, start.tm_mon + 1, start.tm_mday);
+
+    if (compare_date(start, end) != 0) {
+        snprintf(buf + n, sizeof buf - n, "..%d/%02d/%02d", end.tm_year + 1900, end.tm_mon + 1, end.tm_mday);
+    }
+
+    return strdup(buf);
+
+}
+
+/*
+    Parses one end of a date range. Components which are left off
+    stretch the range as far as they can, so "2027/03..2027/04" is
+    all of March and April. Hijri months stretch the same way, so
+    "ramazan 1448" is the whole month.
+
+    Returns 0 if the date is not valid.
+*/
+static int parse_range_date(const char *str, int end, struct tm *res)
+{
+
+    if (is_hijri(str)) {
+        return parse_hijri_date(str, end, res);
+    }
+
+    struct tm jan1 = { 0 };
+    jan1.tm_mday = 1;
+
+    if (validate_date(str) == 0) {
+        return 0;
+    }
+
+    int count = parse_datestr(str, &jan1, res);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (end && count < 2) {
+        res->tm_mon = 11;
+    }
+
+    if (end && count < 3) {
+        res->tm_mday = days_in_month(res->tm_year + 1900, res->tm_mon + 1);
+    }
+
+    mktime(res);
+
+    return 1;
+
+}
+
+/*
+    Parses a range of days, <date>..<date> or a single <date> (so "2027"
+    is the whole year), into its first and last day.
+
+    Returns the number of days in it. Exits if it is not valid.
+*/
+static int parse_range(const char *span, struct tm *start, struct tm *end)
+{
+
+    const char *dots = strstr(span, "..");
+
+    char first[48];
+    const char *last = (dots != NULL) ? dots + 2 : span;
+    size_t firstlen = (dots != NULL) ? (size_t) (dots - span) : strlen(span);
+
+    if (firstlen >= sizeof first) {
+        last = NULL;
+    } else {
+        snprintf(first, sizeof first, "%.*s", (int) firstlen, span);
+    }
+
+    if (last == NULL || parse_range_date(first, 0, start) == 0 ||
+        parse_range_date(last, 1, end) == 0) {
+
+        printf("Invalid date range provided!\n");
+        printf("Date range format: <yyyy>[/mm[/dd]]..<yyyy>[/mm[/dd]], either end may be\n");
+        printf("a Hijri date or month, e.g \"ramazan 1448\"\n");
+
+        exit(EXIT_FAILURE);
+
+    }
+
+    /* Both are at noon, so DST changes in between round away */
+    int ndays = (int) ((difftime(mktime(end), mktime(start)) + 43200) / 86400) + 1;
+
+    if (ndays < 1 || ndays > RANGE_MAX_DAYS) {
+
+        printf("Date ranges have to go forward and span at most %d days!\n", RANGE_MAX_DAYS);
+        exit(EXIT_FAILURE);
+
+    }
+
+    return ndays;
+
+}
+
+/*
+    Runs the print action over a range of days (<date>..<date>), as a
+    table with one row per day, or adds the days to out instead if it
+    is not NULL.
+
+    Days missing from the cache are downloaded by cfg_range_workers
+    threads at once, earliest first. Rows are printed as soon as every
+    day before them is there, and only the days still waiting for that
+    are held in memory.
+
+    Never returns.
+*/
+static void range(const char *directory, const char *location, const char *span, int update,
+        struct export *out)
+{
+
+    struct tm start, end;
+    int ndays = parse_range(span, &start, &end);
+
+    struct range_fill fill;
+    fill.directory = directory;
+    fill.location = location;
+    fill.start = start;
+    fill.update = update;
+    fill.days = calloc(ndays, sizeof *fill.days);
+    fill.ready = calloc(ndays, 1);
+    fill.cached = calloc(ndays, 1);
+    fill.missing = malloc(ndays * sizeof *fill.missing);
+    fill.nmissing = 0;
+    fill.next = 0;
+    pthread_mutex_init(&fill.lock, NULL);
+    pthread_cond_init(&fill.cond, NULL);
+
+    if (fill.days == NULL || fill.ready == NULL || fill.cached == NULL || fill.missing == NULL) {
+
+        printf("Could not allocate enough memory for the date range!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    struct tm date = start;
+
+    /* Cached days are only looked for here, and loaded once their turn comes */
+    for (int i = 0; i < ndays; i++, add_days(&date, 1)) {
+
+        if (!update && day_cached(directory, location, date)) {
+
+            fill.ready[i] = 1;
+            fill.cached[i] = 1;
+
+        } else {
+
+            fill.missing[fill.nmissing++] = i;
+
+        }
+
+    }
+
+    int nworkers = (fill.nmissing < cfg_range_workers) ? fill.nmissing : cfg_range_workers;
+    pthread_t workers[nworkers > 0 ? nworkers : 1];
+
+    for (int i = 0; i < nworkers; i++) {
+
+        if (pthread_create(&workers[i], NULL, range_worker, &fill) != 0) {
+            nworkers = i;
+        }
+
+    }
+
+    /* If no thread could be started, the days are downloaded right here */
+    if (nworkers == 0) {
+        range_worker(&fill);
+    }
+
+    int failed = 0;
+    date = start;
+
+    for (int i = 0; i < ndays; i++, add_days(&date, 1)) {
+
+        pthread_mutex_lock(&fill.lock);
+
+        while (!fill.ready[i]) {
+            pthread_cond_wait(&fill.cond, &fill.lock);
+        }
+
+        pthread_mutex_unlock(&fill.lock);
+
+        struct vaktija *v = fill.cached[i] ? load_day(directory, location, date, 0, 0, 0) : fill.days[i];
+
+        /* A cache file which turned out to be damaged is downloaded after all */
+        if (v == NULL && fill.cached[i]) {
+            v = fetch_day(directory, location, date, 0);
+        }
+
+        if (out != NULL) {
+
+            if (v != NULL) {
+
+                export_day(out, atoi(location), v);
+                delete_vaktija(v);
+
+            } else {
+
+                printf("%02d.%02d.%04d  Could not download vaktija data!\n",
+                        date.tm_mday, date.tm_mon + 1, date.tm_year + 1900);
+                failed = 1;
+
+            }
+
+            continue;
+
+        }
+
+        if (i == 0) {
+
+            char title[80];
+            snprintf(title, sizeof title, "%02d.%02d.%04d - %02d.%02d.%04d",
+                    start.tm_mday, start.tm_mon + 1, start.tm_year + 1900,
+                    end.tm_mday, end.tm_mon + 1, end.tm_year + 1900);
+
+            print_table_header((v != NULL) ? v->location : location, title);
+
+        }
+
+        if (v != NULL) {
+
+            print_table_row(v);
+            delete_vaktija(v);
+
+        } else {
+
+            printf("%02d.%02d.%04d  Could not download vaktija data!\n",
+                    date.tm_mday, date.tm_mon + 1, date.tm_year + 1900);
+            failed = 1;
+
+        }
+
+        /* Whoever reads the other end gets every complete row right away */
+        fflush(stdout);
+
+    }
+
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(fill.days);
+    free(fill.ready);
+    free(fill.cached);
+    free(fill.missing);
+
+    if (out != NULL && export_close(out) != 0) {
+
+        printf("Could not write the export!\n");
+        failed = 1;
+
+    }
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+
+}
+
+/*
+    Runs the export action, export <csv|jsonl|ics> [all], which writes
+    the days of span (a range or a single date, this month if NULL) to
+    stdout for other programs. Messages go to stderr meanwhile, so they
+    never end up in the export.
+
+    A single location is downloaded where the cache is missing days, like
+    print over a range. With all, every location is exported one after
+    the other from the cache, its pack and the bundles only, so a whole
+    year of the country needs that year's bundle but no network.
+
+    Never returns.
+*/
+static void export_action(const char *directory, const char *location, const char *span,
+        char **args, int update)
+{
+
+    int kind = (args[0] != NULL) ? export_kind(args[0]) : -1;
+    int all = kind >= 0 && args[1] != NULL && strcmp(args[1], "all") == 0;
+
+    if (kind < 0 || (args[1] != NULL && !all)) {
+
+        printf("Unknown export! Expected: export <csv|jsonl|ics> [all]\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    char thismonth[VAKTIJA_DATE_PATH_MAX];
+
+    if (span == NULL) {
+
+        struct tm today;
+        clock_localtime(&today);
+
+        snprintf(thismonth, sizeof thismonth, "%d/%d", today.tm_year + 1900, today.tm_mon + 1);
+        span = thismonth;
+
+    }
+
+    struct tm start, end;
+    int ndays = parse_range(span, &start, &end);
+
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+
+        printf("Could not set up the export!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    struct export *out = export_open(fd, kind);
+
+    if (!all) {
+        range(directory, location, span, update, out);
+    }
+
+    int missing = 0;
+
+    for (int id = 0; id < VAKTIJA_LOCATIONS; id++) {
+
+        char idstr[16];
+        snprintf(idstr, sizeof idstr, "%d", id);
+
+        struct tm date = start;
+
+        for (int i = 0; i < ndays; i++, add_days(&date, 1)) {
+
+            struct vaktija *v = load_day(directory, idstr, date, 0, 0, 0);
+
+            if (v == NULL) {
+
+                missing++;
+                continue;
+
+            }
+
+            export_day(out, id, v);
+            delete_vaktija(v);
+
+        }
+
+    }
+
+    int failed = export_close(out) != 0;
+
+    if (failed) {
+        printf("Could not write the export!\n");
+    }
+
+    if (missing > 0) {
+        printf("%d days are neither cached nor in a bundle and were left out.\n", missing);
+    }
+
+    exit((failed || missing > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+}
+
+/*
+    Loads the vaktija for the day offset days away from date. If fetch
+    is 0, it is only taken from the cache and NULL is returned if the
+    cache does not have it.
+*/
+static struct vaktija *load_day(const char *directory, const char *location,
+        struct tm date, int offset, int fetch, int update)
+{
+
+    add_days(&date, offset);
+
+    int year = date.tm_year + 1900;
+    int mon = date.tm_mon + 1;
+
+    char recpath[CACHE_PATH_MAX];
+    char jsonpath[CACHE_PATH_MAX];
+    int cached = !cfg_nocache &&
+        day_path(recpath, directory, location, year, mon, date.tm_mday, RECORD_EXT) &&
+        day_path(jsonpath, directory, location, year, mon, date.tm_mday, "json");
+
+    if (cached && !update) {
+
+        /* Usual case, already parsed when it was downloaded */
+        struct vaktija *v = read_record(recpath);
+
+        if (v != NULL) {
+            return v;
+        }
+
+        char key[CACHE_KEY_MAX] = "";
+        struct pack *pack = cache_pack(directory);
+
+        if (pack != NULL && cache_key(key, sizeof key, location, year, mon, date.tm_mday) > 0 &&
+            (v = pack_record(pack, key)) != NULL) {
+            return v;
+        }
+
+        if (cache_exists(jsonpath) != 1 && (pack == NULL || pack_find(pack, key) < 0)) {
+
+            /* Machines without network access get their data from a bundle */
+            v = bundle_lookup(directory, location, date);
+
+            if (v != NULL || !fetch) {
+                return v;
+            }
+
+        }
+
+    } else if (!fetch) {
+
+        return NULL;
+
+    }
+
+    struct vaktija *v = fetch_day(directory, location, date, update);
+
+    return (v != NULL) ? v : load_fallback(directory, location, date);
+
+}
+
+/*
+    Downloads the day (unless it is cached and no update is forced) and
+    stores its record in the cache.
+
+    Returns NULL if the download failed or the data is not a valid
+    vaktija. Safe to call from several threads at once.
+*/
+static struct vaktija *fetch_day(const char *directory, const char *location,
+        struct tm date, int update)
+{
+
+    int year = date.tm_year + 1900;
+    int mon = date.tm_mon + 1;
+
+    char *vdata = load_data(directory, location, year, mon, date.tm_mday, update);
+
+    if (vdata != NULL && !valid_vaktija(vdata)) {
+
+        printf("Invalid vaktija data for %s on %d/%02d/%02d!\n", location, year, mon, date.tm_mday);
+        vfree(vdata);
+        vdata = NULL;
+
+    }
+
+    if (vdata == NULL) {
+        return NULL;
+    }
+
+    struct vaktija *v = parse_data(vdata);
+    vfree(vdata);
+
+    if (v->year == 0) {
+
+        v->year = year;
+        v->month = mon;
+        v->day = date.tm_mday;
+
+    }
+
+    char recpath[CACHE_PATH_MAX];
+    if (!cfg_nocache && day_path(recpath, directory, location, year, mon, date.tm_mday, RECORD_EXT) &&
+        write_record(recpath, v) != 0) {
+        printf("Could not write the cache file %s: %s\n", recpath, strerror(errno));
+    }
+
+    return v;
+
+}
+
+/*
+    Stands in for a day which could not be downloaded with the most
+    recent cached day before it (at most cfg_fallback_days back), moved
+    to the requested date. It is never written back to the cache.
+
+    Exits if there is nothing to fall back on.
+*/
+static struct vaktija *load_fallback(const char *directory, const char *location,
+        struct tm date)
+{
+
+    for (int back = 0; back <= cfg_fallback_days && !cfg_nocache; back++) {
+
+        struct tm prev = date;
+        add_days(&prev, -back);
+
+        int year = prev.tm_year + 1900;
+        int mon = prev.tm_mon + 1;
+
+        char path[CACHE_PATH_MAX];
+        struct vaktija *v = NULL;
+
+        if (day_path(path, directory, location, year, mon, prev.tm_mday, RECORD_EXT)) {
+            v = read_record(path);
+        }
+
+        if (v == NULL && day_path(path, directory, location, year, mon, prev.tm_mday, "json") &&
+            cache_exists(path) == 1) {
+
+            char *vdata = read_cache(path);
+            v = valid_vaktija(vdata) ? parse_data(vdata) : NULL;
+            vfree(vdata);
+
+        }
+
+        if (v == NULL) {
+            continue;
+        }
+
+        fflush(stdout);
+        fprintf(stderr, "Could not download vaktija data, using the cached data for %d/%02d/%02d.\n",
+                year, mon, prev.tm_mday);
+
+        v->year = date.tm_year + 1900;
+        v->month = date.tm_mon + 1;
+        v->day = date.tm_mday;
+
+        /* The Hijri date at least is the right one */
+        compute_hijri(v);
+
+        return v;
+
+    }
+
+    printf("No cached vaktija data to fall back on!\n");
+    exit(EXIT_FAILURE);
+
+}
+
+/*
+    Builds the path of the bundle for the year, which lives in the
+    cache directory as vaktija-<yyyy>.bundle.
+*/
+static int bundle_path(char *buf, const char *directory, int year)
+{
+
+    int n = snprintf(buf, CACHE_PATH_MAX, "%s/vaktija-%04d.%s", directory, year, BUNDLE_EXT);
+
+    return n > 0 && n < CACHE_PATH_MAX;
+
+}
+
+/*
+    Returns the day from the bundle of its year, or NULL if there is no
+    such bundle or it does not have the location. The bundle stays
+    mapped for later days of the same year.
+*/
+static struct bundle *year_bundle(const char *directory, int year)
+{
+
+    static struct bundle *bundle = NULL;
+    static int bundle_year = -1;
+
+    if (year != bundle_year) {
+
+        if (bundle != NULL) {
+            bundle_close(bundle);
+        }
+
+        char path[CACHE_PATH_MAX];
+        bundle = bundle_path(path, directory, year) ? bundle_open(path) : NULL;
+        bundle_year = year;
+
+    }
+
+    return bundle;
+
+}
+
+static struct vaktija *bundle_lookup(const char *directory, const char *location, struct tm date)
+{
+
+    struct bundle *bundle = year_bundle(directory, date.tm_year + 1900);
+
+    char *end;
+    long id = strtol(location, &end, 10);
+
+    if (bundle == NULL || end == location || *end != '\0') {
+        return NULL;
+    }
+
+    return bundle_day(bundle, bundle_find(bundle, (int) id), date.tm_mon + 1, date.tm_mday);
+
+}
+
+/*
+    Whether load_day would find the day without downloading it, going
+    by which files have it rather than reading them: its record or JSON,
+    the pack, or the bundle of its year.
+*/
+static int day_cached(const char *directory, const char *location, struct tm date)
+{
+
+    int year = date.tm_year + 1900;
+    int mon = date.tm_mon + 1;
+
+    char path[CACHE_PATH_MAX];
+    char key[CACHE_KEY_MAX];
+
+    if (cfg_nocache) {
+        return 0;
+    }
+
+    if ((day_path(path, directory, location, year, mon, date.tm_mday, RECORD_EXT) && cache_exists(path)) ||
+        (day_path(path, directory, location, year, mon, date.tm_mday, "json") && cache_exists(path))) {
+        return 1;
+    }
+
+    struct pack *pack = cache_pack(directory);
+
+    if (pack != NULL && cache_key(key, sizeof key, location, year, mon, date.tm_mday) > 0 &&
+        pack_find(pack, key) >= 0) {
+        return 1;
+    }
+
+    struct bundle *bundle = year_bundle(directory, year);
+    int minutes[PRAYER_TIME_NUM];
+
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+    mktime(&date);
+
+    return bundle != NULL && bundle_day_times(bundle, bundle_find(bundle, atoi(location)), date.tm_yday, minutes) == 0;
+
+}
+
+/*
+    Returns the pack of the cache directory (see cache compact), or NULL
+    if it has none. It is opened on first use and stays mapped.
+*/
+static struct pack *cache_pack(const char *directory)
+{
+
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static struct pack *pack = NULL;
+    static int opened = 0;
+
+    pthread_mutex_lock(&lock);
+
+    if (!opened) {
+
+        char path[CACHE_PATH_MAX];
+
+        if (cache_path(path, sizeof path, directory, "cache", "pack") > 0) {
+            pack = pack_open(path);
+        }
+
+        opened = 1;
+
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return pack;
+
+}
+
+/*
+    Runs the cache action: cache compact, cache stats or cache gc [days
+    [size in KB]], with the limits of gc defaulting to the config.
+
+    Never returns.
+*/
+static void cache_action(const char *directory, char **args)
+{
+
+    const char *sub = args[0];
+    int status = -1;
+
+    if (sub != NULL && strcmp(sub, "compact") == 0) {
+
+        status = cache_compact(directory, cfg_cache_workers);
+
+    } else if (sub != NULL && strcmp(sub, "stats") == 0) {
+
+        status = cache_stats(directory, cfg_cache_workers);
+
+    } else if (sub != NULL && strcmp(sub, "gc") == 0) {
+
+        int max_age = cfg_cache_max_age;
+        long long max_size = cfg_cache_max_size;
+        char *end;
+
+        if (args[1] != NULL) {
+
+            max_age = (int) strtol(args[1], &end, 10);
+
+            if (end == args[1] || *end != '\0' || max_age < 0) {
+
+                printf("Invalid number of days: %s\n", args[1]);
+                exit(EXIT_FAILURE);
+
+            }
+
+            if (args[2] != NULL) {
+
+                max_size = strtoll(args[2], &end, 10) * 1024;
+
+                if (end == args[2] || *end != '\0' || max_size < 0) {
+
+                    printf("Invalid cache size: %s\n", args[2]);
+                    exit(EXIT_FAILURE);
+
+                }
+
+            }
+
+        }
+
+        status = cache_gc(directory, cfg_cache_workers, max_age, max_size);
+
+    } else {
+
+        printf("Unknown cache action! Expected: cache compact|stats|gc [days [KB]]\n");
+
+    }
+
+    exit((status == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
+
+/*
+    Shared between build_bundle and the threads collecting the year of
+    every location.
+*/
+struct bundle_fill {
+
+    const char *directory;
+    int year;
+    int ndays;
+    int update;
+
+    struct bundle_location *locations;
+    uint16_t (*times)[PRAYER_TIME_NUM];
+    struct bundle_hijri *dates;
+    int have_dates;
+
+    int next;
+    pthread_mutex_t lock;
+
+};
+
+/*
+    Collects the whole year of one location from its twelve months,
+    returning 0 on success.
+*/
+static int collect_year(struct bundle_fill *fill, int id)
+{
+
+    char location[VAKTIJA_LOCATION_ID_MAX];
+    snprintf(location, sizeof location, "%d", id);
+
+    uint16_t (*times)[PRAYER_TIME_NUM] = fill->times + (size_t) id * fill->ndays;
+    struct bundle_hijri *dates = malloc(sizeof *dates * fill->ndays);
+
+    if (dates == NULL) {
+        return -1;
+    }
+
+    int yday = 0;
+
+    for (int mon = 1; mon <= 12; mon++) {
+
+        char *vdata = load_data(fill->directory, location, fill->year, mon, 0, fill->update);
+
+        if (vdata == NULL) {
+            break;
+        }
+
+        int count;
+        struct vaktija **days = parse_month(vdata, &count);
+        vfree(vdata);
+
+        /* A bad month leaves the location out of the bundle, the other workers go on */
+        if (days == NULL) {
+            break;
+        }
+
+        if (count != days_in_month(fill->year, mon)) {
+
+            delete_month(days, count);
+            break;
+
+        }
+
+        if (mon == 1) {
+            fill->locations[id].name = strdup(days[0]->location);
+        }
+
+        for (int d = 0; d < count; d++, yday++) {
+
+            for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+                times[yday][i] = days[d]->times[i] / 60;
+            }
+
+            if (!parse_hijri(days[d]->dates[0], &dates[yday])) {
+                memset(&dates[yday], 0, sizeof dates[yday]);
+            }
+
+        }
+
+        delete_month(days, count);
+
+    }
+
+    if (yday == fill->ndays) {
+
+        pthread_mutex_lock(&fill->lock);
+
+        if (!fill->have_dates) {
+
+            memcpy(fill->dates, dates, sizeof *dates * fill->ndays);
+            fill->have_dates = 1;
+
+        }
+
+        pthread_mutex_unlock(&fill->lock);
+
+    }
+
+    free(dates);
+
+    return (yday == fill->ndays) ? 0 : -1;
+
+}
+
+static void *bundle_worker(void *arg)
+{
+
+    struct bundle_fill *fill = arg;
+
+    while (1) {
+
+        pthread_mutex_lock(&fill->lock);
+        int id = fill->next++;
+        pthread_mutex_unlock(&fill->lock);
+
+        if (id >= VAKTIJA_LOCATIONS) {
+            break;
+        }
+
+        if (collect_year(fill, id) == 0) {
+
+            fill->locations[id].id = id;
+
+        } else {
+
+            printf("Could not get the whole year for location %d, leaving it out!\n", id);
+            fill->locations[id].id = -1;
+
+        }
+
+    }
+
+    return NULL;
+
+}
+
+/*
+    Runs the bundle build action, which puts the whole year (this year
+    by default) of every location into one bundle file. The months are
+    taken from the cache or downloaded (and cached) if missing, by
+    cfg_range_workers threads at once.
+
+    Never returns.
+*/
+static void build_bundle(const char *directory, const char *yearstr, const char *path, int update)
+{
+
+    struct tm today;
+    clock_localtime(&today);
+    int year = today.tm_year + 1900;
+
+    if (yearstr != NULL && (validate_date(yearstr) == 0 || strlen(yearstr) != 4)) {
+
+        printf("Invalid year provided!\n");
+        exit(EXIT_FAILURE);
+
+    } else if (yearstr != NULL) {
+
+        year = atoi(yearstr);
+
+    }
+
+    char defpath[CACHE_PATH_MAX];
+
+    if (path == NULL) {
+
+        if (!bundle_path(defpath, directory, year)) {
+
+            printf("Cache path is too long!\n");
+            exit(EXIT_FAILURE);
+
+        }
+
+        path = defpath;
+
+    }
+
+    struct bundle_fill fill;
+    fill.directory = directory;
+    fill.year = year;
+    fill.ndays = (days_in_month(year, 2) == 29) ? 366 : 365;
+    fill.update = update;
+    fill.locations = calloc(VAKTIJA_LOCATIONS, sizeof *fill.locations);
+    fill.times = malloc(sizeof *fill.times * VAKTIJA_LOCATIONS * fill.ndays);
+    fill.dates = calloc(fill.ndays, sizeof *fill.dates);
+    fill.have_dates = 0;
+    fill.next = 0;
+    pthread_mutex_init(&fill.lock, NULL);
+
+    if (fill.locations == NULL || fill.times == NULL || fill.dates == NULL) {
+
+        printf("Could not allocate enough memory to build the bundle!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    int nworkers = (cfg_range_workers > 0) ? cfg_range_workers : 1;
+    pthread_t workers[nworkers];
+
+    for (int i = 0; i < nworkers; i++) {
+
+        if (pthread_create(&workers[i], NULL, bundle_worker, &fill) != 0) {
+            nworkers = i;
+        }
+
+    }
+
+    if (nworkers == 0) {
+        bundle_worker(&fill);
+    }
+
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    /* Only the locations with a whole year go in */
+    int count = 0;
+
+    for (int id = 0; id < VAKTIJA_LOCATIONS; id++) {
+
+        if (fill.locations[id].id == id && fill.locations[id].name != NULL) {
+
+            fill.locations[count] = fill.locations[id];
+            fill.locations[count].times = fill.times + (size_t) id * fill.ndays;
+            count++;
+
+        } else {
+
+            free((char *) fill.locations[id].name);
+
+        }
+
+    }
+
+    int failed = count == 0 ||
+        bundle_write(path, year, fill.ndays, fill.locations, count, fill.dates) != 0;
+
+    if (failed) {
+        printf("Could not build the bundle!\n");
+    } else {
+        printf("Wrote %d locations for %d to %s\n", count, year, path);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free((char *) fill.locations[i].name);
+    }
+
+    free(fill.locations);
+    free(fill.times);
+    free(fill.dates);
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+
+}
+
+/*
+    Builds the path of the cache file for the location on the given day
+    with the extension ext into buf (of CACHE_PATH_MAX bytes).
+
+    Returns 1 on success and 0 if the path is too long.
+*/
+static int day_path(char *buf, const char *directory, const char *location,
+        int year, int mon, int mday, const char *ext)
+{
+
+    char key[CACHE_KEY_MAX];
+
+    return cache_key(key, sizeof key, location, year, mon, mday) > 0 &&
+        cache_path(buf, CACHE_PATH_MAX, directory, key, ext) > 0;
+
+}
+
+/*
+    Downloads the next cfg_prefetch_days days into the cache, if they
+    are not there yet, in a background process so the current run does
+    not wait on it. Called after isha, so the first run after midnight
+    finds tomorrow's data already in the cache.
+
+    Runs called in a loop (prompts, status bars) must not pile up
+    downloaders: only the process holding prefetch.lock in the cache
+    directory downloads, and after a failed attempt (prefetch.failed)
+    none is started for cfg_prefetch_backoff seconds.
+*/
+static void prefetch(const char *directory, const char *location, struct tm today)
+{
+
+    if (cfg_nocache || cfg_prefetch_days <= 0) {
+        return;
+    }
+
+    int missing = 0;
+    for (int d = 1; d <= cfg_prefetch_days && !missing; d++) {
+
+        struct tm date = today;
+        add_days(&date, d);
+
+        char key[CACHE_KEY_MAX];
+        char path[CACHE_PATH_MAX];
+
+        if (cache_key(key, sizeof key, location, date.tm_year + 1900, date.tm_mon + 1, date.tm_mday) > 0 &&
+            cache_path(path, sizeof path, directory, key, "json") > 0) {
+
+            struct pack *pack = cache_pack(directory);
+            missing = cache_exists(path) != 1 && (pack == NULL || pack_find(pack, key) < 0);
+
+        }
+
+    }
+
+    if (!missing) {
+        return;
+    }
+
+    char lockpath[CACHE_PATH_MAX];
+    char failpath[CACHE_PATH_MAX];
+
+    if (cache_path(lockpath, sizeof lockpath, directory, "prefetch", "lock") < 0 ||
+        cache_path(failpath, sizeof failpath, directory, "prefetch", "failed") < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(failpath, &st) == 0 && time(NULL) - st.st_mtime < cfg_prefetch_backoff) {
+        return;
+    }
+
+    /* Held by the child from here on, the parent's copy is closed below */
+    int lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (lockfd < 0) {
+        return;
+    }
+
+    if (flock(lockfd, LOCK_EX | LOCK_NB) != 0) {
+
+        close(lockfd); /* another run is already at it */
+        return;
+
+    }
+
+    /* Whatever was printed so far must not be printed by the child again */
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid != 0) {
+
+        close(lockfd);
+        return; /* parent (or fork failed, in which case we just skip it) */
+
+    }
+
+    setsid();
+
+    if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+
+    int failed = 0;
+
+    for (int d = 1; d <= cfg_prefetch_days; d++) {
+
+        struct tm date = today;
+        add_days(&date, d);
+
+        struct vaktija *v = load_day(directory, location, date, 0, 0, 0);
+
+        if (v == NULL && (v = fetch_day(directory, location, date, 0)) == NULL) {
+
+            failed = 1;
+            continue;
+
+        }
+
+        delete_vaktija(v);
+
+    }
+
+    if (failed) {
+
+        int fd = open(failpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+    } else {
+
+        unlink(failpath);
+
+    }
+
+    exit(EXIT_SUCCESS);
+
+}
+
+static int validate_date(const char *date)
+{
+
+    /* date format <yyyy>[/mm[/dd]] */
+
+    int len = strlen(date);
+
+    if (len == 4 || len == 7 || len == 10) {
+
+        for (int i = 0; date[i] != '\0'; i++) {
+
+            if (i == 4 || i == 7) {
+                
+                if (date[i] != '/') {
+
+                    return 0;
+
+                }
+
+            } else {
+
+                if (!isdigit(date[i])) {
+
+                    return 0;
+
+                }
+
+            }
+
+        }
+
+    } else {
+
+        return 0;
+
+    }
+
+    return 1;
+
+}
+
+/*
+    Runs the serve action. http holds the optional [addr:]port argument
+    of --http, defaulting to the values from config.h.
+
+    Never returns.
+*/
+static void serve(const char *directory, const char *http)
+{
+
+    char addr[64];
+    snprintf(addr, sizeof addr, "%s", cfg_serve_addr);
+    int port = cfg_serve_port;
+
+    if (http != NULL) {
+
+        const char *colon = strrchr(http, ':');
+        const char *portstr = http;
+
+        if (colon != NULL) {
+
+            snprintf(addr, sizeof addr, "%.*s", (int) (colon - http), http);
+            portstr = colon + 1;
+
+        }
+
+        char *end;
+        long val = strtol(portstr, &end, 10);
+
+        if (end == portstr || *end != '\0' || val < 1 || val > 65535) {
+
+            printf("Invalid port provided for --http: %s\n", http);
+            exit(EXIT_FAILURE);
+
+        }
+
+        port = (int) val;
+
+    }
+
+    struct serve_options opts;
+    opts.addr = addr;
+    opts.port = port;
+    opts.workers = cfg_serve_workers;
+    opts.ttl = cfg_serve_ttl;
+    opts.negative_ttl = cfg_serve_negative_ttl;
+    opts.prefetch_days = cfg_prefetch_days;
+    opts.prefetch_before = cfg_serve_prefetch_before;
+    opts.cachedir = cfg_nocache ? NULL : directory;
+
+    exit(serve_http(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
+
+static const char *lazy_directory;
+
+/*
+    Returns the path of the daemon socket: VACTIJA_SOCKET, else
+    cfg_daemon_socket, else vactija.sock in $XDG_RUNTIME_DIR or, without
+    one, in /tmp/vactija-<uid>, which is made for the user alone if it
+    is missing. Exits if that directory could be used by anyone else.
+*/
+static const char *daemon_socket(void)
+{
+
+    const char *path = getenv("VACTIJA_SOCKET");
+
+    if (path != NULL && path[0] != '\0') {
+        return path;
+    }
+
+    if (cfg_daemon_socket != NULL) {
+        return cfg_daemon_socket;
+    }
+
+    static char buf[sizeof ((struct sockaddr_un *) 0)->sun_path];
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime != NULL && runtime[0] == '/') {
+
+        snprintf(buf, sizeof buf, "%s/vactija.sock", runtime);
+        return buf;
+
+    }
+
+    char dir[64];
+    snprintf(dir, sizeof dir, "/tmp/vactija-%lu", (unsigned long) getuid());
+
+    struct stat st;
+
+    if ((mkdir(dir, 0700) != 0 && errno != EEXIST) || lstat(dir, &st) != 0) {
+
+        printf("Could not create the socket directory %s: %s\n", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+
+    }
+
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+
+        printf("%s is not a directory of ours alone, not using it!\n", dir);
+        exit(EXIT_FAILURE);
+
+    }
+
+    snprintf(buf, sizeof buf, "%s/vactija.sock", dir);
+
+    return buf;
+
+}
+
+/*
+    Loads a day for the modes which go on from day to day (the daemon
+    and upcoming), from lazy_directory or else the API. The daemon has
+    to keep running when it can not be downloaded, so there is no
+    fallback to other days.
+*/
+static struct vaktija *lazy_load(int location, struct tm date)
+{
+
+    char id[16];
+    snprintf(id, sizeof id, "%d", location);
+
+    struct vaktija *v = load_day(lazy_directory, id, date, 0, 0, 0);
+
+    return (v != NULL) ? v : fetch_day(lazy_directory, id, date, 0);
+
+}
+
+/*
+    Runs the daemon action with the hooks file (cfg_hooks_file if NULL).
+
+    Never returns.
+*/
+static void daemon_action(const char *directory, const char *hooks)
+{
+
+    lazy_directory = directory;
+
+    /* Without hooks it is only there for the subscribers */
+    if (hooks == NULL && cache_exists(cfg_hooks_file)) {
+        hooks = cfg_hooks_file;
+    }
+
+    struct daemon_options opts;
+    opts.hooks = hooks;
+    opts.socket = daemon_socket();
+    opts.metrics_addr = cfg_daemon_metrics_addr;
+    opts.metrics_port = cfg_daemon_metrics_port;
+    opts.grace = cfg_daemon_grace;
+    opts.retry = cfg_daemon_retry;
+    opts.load = lazy_load;
+
+    exit(run_daemon(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
+
+/*
+    Runs the subscribe action: subscribes to the location on the daemon
+    socket and copies what the daemon pushes to stdout, line by line,
+    until the daemon goes away.
+
+    Never returns.
+*/
+static void subscribe(int location, const char *ticks)
+{
+
+    if (ticks != NULL && strcmp(ticks, "ticks") != 0) {
+
+        printf("Unknown subscription! Expected: subscribe [ticks]\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    const char *path = daemon_socket();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0) {
+
+        printf("Could not connect to the daemon on %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+
+    }
+
+    char request[32];
+    int len = snprintf(request, sizeof request, "subscribe %d%s\n", location, (ticks != NULL) ? " ticks" : "");
+
+    if (write(fd, request, len) != len) {
+
+        printf("Could not subscribe: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+
+    }
+
+    /* Lines come whole, so they are passed on as they come */
+    char buf[4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof buf)) > 0 || (n < 0 && errno == EINTR)) {
+
+        if (n > 0 && write(STDOUT_FILENO, buf, n) != n) {
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    printf("The daemon closed the subscription.\n");
+    exit(EXIT_FAILURE);
+
+}
+
+/*
+    Runs the upcoming action: prints the next countstr (-n, or
+    cfg_upcoming_count if it is NULL) vakats after now with the format,
+    of the locations in args merged in time order, or just of location
+    if there are none. Every argument is a location, so 77 is the
+    location and not a count.
+
+    Never returns.
+*/
+static void upcoming_action(const char *directory, int location, const char *countstr,
+        char **args, const struct format *fmt, int colour)
+{
+
+    int count = cfg_upcoming_count;
+
+    if (countstr != NULL) {
+
+        char *end;
+        count = (int) strtol(countstr, &end, 10);
+
+        if (*end != '\0' || end == countstr || count < 1) {
+
+            printf("Invalid number of vakats: %s\n", countstr);
+            exit(EXIT_FAILURE);
+
+        }
+
+    }
+
+    int nlocations = 0;
+    while (args[nlocations] != NULL) {
+        nlocations++;
+    }
+
+    int *locations = malloc(sizeof *locations * (nlocations > 0 ? nlocations : 1));
+
+    if (locations == NULL) {
+
+        printf("Could not allocate enough memory for the locations!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    for (int i = 0; i < nlocations; i++) {
+
+        if ((locations[i] = location_parse(args[i])) < 0) {
+
+            printf("Unknown location: %s\n", args[i]);
+            exit(EXIT_FAILURE);
+
+        }
+
+    }
+
+    if (nlocations == 0) {
+
+        locations[0] = location;
+        nlocations = 1;
+
+    }
+
+    lazy_directory = directory;
+
+    time_t now = clock_now();
+
+    struct upcoming it;
+    upcoming_init(&it, locations, nlocations, now, lazy_load);
+
+    struct format_ctx ctx = { 0 };
+    ctx.now = now;
+
+    struct upcoming_event ev;
+    int printed = 0;
+
+    while (printed < count && upcoming_next(&it, &ev) == 0) {
+
+        ctx.day = ev.day;
+        ctx.location = location_name(ev.location);
+        ctx.vakat = (struct format_vakat) { ev.day, ev.vakat, ev.at };
+
+        format_print(fmt, &ctx, colour);
+        printed++;
+
+    }
+
+    upcoming_free(&it);
+    free(locations);
+
+    if (printed == 0) {
+
+        printf("Could not load the vaktija of any of the locations!\n");
+        exit(EXIT_FAILURE);
+
+    }
+
+    exit(EXIT_SUCCESS);
+
+}
+
+/*
+    Prints what the run allocated through the library (see util/alloc.h)
+    to stderr, so it does not get in the way of the output.
+*/
+static void print_alloc_stats(void)
+{
+
+    fprintf(stderr, "allocations: %lld, reallocations: %lld, frees: %lld, bytes: %lld\n",
+            (long long) alloc_stats.allocs, (long long) alloc_stats.reallocs,
+            (long long) alloc_stats.frees, (long long) alloc_stats.bytes);
 
 }
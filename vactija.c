@@ -5,12 +5,20 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
-#include <curl/curl.h>
+#include <strings.h>
 
 #define JSMN_HEADER
 #include "jsmn/jsmn.h"
 #include "vactija.h"
+#include "derived.h"
+#include "fetch.h"
+#include "format.h"
+#include "locations.h"
+#include "metrics.h"
 #include "util/temporal.h"
+#include "util/clocksource.h"
+#include "util/hijri.h"
+#include "util/alloc.h"
 #include "util/jsmnutil.h"
 #include "util/cachefile.h"
 
@@ -29,12 +37,12 @@
     Allocates a new vaktija to the heap. All pointers
     inside it are unassigned.
 
-    Has to be freed manually once it is no longer useful.
+    Has to be freed with delete_vaktija once it is no longer useful.
 */
 struct vaktija *create_vaktija()
 {
 
-    struct vaktija *v = malloc(sizeof *v);
+    struct vaktija *v = vmalloc(sizeof *v);
 
     if (v == NULL) {
 
@@ -48,6 +56,10 @@ struct vaktija *create_vaktija()
 
     }
 
+    v->year = 0;
+    v->month = 0;
+    v->day = 0;
+
     return v;
 
 }
@@ -60,40 +72,42 @@ struct vaktija *create_vaktija()
 void delete_vaktija(struct vaktija *vaktija)
 {
 
-	free(vaktija->location);
+	vfree(vaktija->location);
 	free_array(vaktija->dates, DATUM_NUM);
 	free_array(vaktija->prayers, PRAYER_TIME_NUM);
 	
-	free(vaktija);
+	vfree(vaktija);
 
 }
 
-struct mem_struct {
-    char *mem;
-    size_t size;
-};
-
-static size_t write_callback(char *contents, size_t size, size_t nmemb, char *userp)
+/*
+    Frees every day of a month returned by parse_month, together
+    with the array holding them.
+*/
+void delete_month(struct vaktija **days, int count)
 {
 
-    size_t realsize = size * nmemb;
-    struct mem_struct *memory = (struct mem_struct *) userp;
+    for (int i = 0; i < count; i++) {
+        delete_vaktija(days[i]);
+    }
 
-    char *ptr = realloc(memory->mem, memory->size + (realsize + 1));
-    if (ptr == NULL) {
-        
-        int errcode = errno;
-        printf("Could not allocate enough memory to store JSON data. Download aborted!\n");
-        vactija_error(errcode);
+    vfree(days);
 
-    }
+}
 
-    memory->mem = ptr;
-    memcpy(&(memory->mem[memory->size]), contents, realsize);
-    memory->size += realsize;
-    memory->mem[realsize] = 0;
+/*
+    Returns the base URL of the vaktija API.
 
-    return realsize;
+    It can be overridden at runtime through the VACTIJA_API_URL environment
+    variable (e.g to point at a "vactija serve --http" proxy on the local
+    network), otherwise VAKTIJA_API_URL is used. The URL must end with /.
+*/
+const char *vaktija_api_url(void)
+{
+
+    const char *env = getenv("VACTIJA_API_URL");
+
+    return (env != NULL && env[0] != '\0') ? env : VAKTIJA_API_URL;
 
 }
 
@@ -109,103 +123,199 @@ static size_t write_callback(char *contents, size_t size, size_t nmemb, char *us
     in their place). If it is not present (i.e NULL is passed), then it shall
     download the particular vaktija data for the current day.
 
+    Timeouts, retries and hedging follow the policy set with
+    fetch_set_policy (see fetch.h). Unlike download_vaktija, failures are
+    reported by returning NULL (after printing the reason), which is what
+    long-running modes and the cache fallback need. Location IDs which
+    do not exist are rejected without a request.
+
     Examples page: https://api.vaktija.ba/vaktija/v1
 */
+char *fetch_vaktija(const char *loc, const char *date)
+{
+
+    if (location_id(loc) < 0) {
+
+        printf("Unknown location ID %s!\n", loc);
+        return NULL;
+
+    }
+
+    const char *api = vaktija_api_url();
+
+    size_t apilen = strlen(api);
+    size_t loclen = strlen(loc);
+    size_t datelen = (date != NULL) ? strlen(date) : 0;
+
+    char *url = vmalloc(sizeof *url * (apilen + loclen + datelen + 2)); /* for extra / */
+
+    if (url == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store URL. Download aborted!\n");
+        vactija_error(errcode);
+
+    }
+    url[0] = '\0';
+
+    /* The API URL ends with /, so we can just append location ID */
+    strncat(url, api, apilen);
+    strncat(url, loc, loclen);
+
+    if (date != NULL) {
+
+        strncat(url, "/", 2); /* since ID doesn't end with / */
+        strncat(url, date, datelen);
+
+    }
+
+    uint64_t start = metrics_clock();
+    char *json = fetch_url(url);
+    vfree(url);
+
+    metric_observe(HISTOGRAM_UPSTREAM, metrics_clock() - start);
+    metric_add(METRIC_UPSTREAM_REQUESTS, 1);
+
+    if (json == NULL) {
+        metric_add(METRIC_UPSTREAM_ERRORS, 1);
+    }
+
+    return json;
+
+}
+
+/*
+    Same as fetch_vaktija, except that any failure terminates the program.
+*/
 char *download_vaktija(const char *loc, const char *date)
 {
 
-    CURL *curl = curl_easy_init();
+    char *json = fetch_vaktija(loc, date);
 
-    if (curl) {
+    if (json == NULL) {
+        exit(EXIT_FAILURE);
+    }
 
-        char *url;
+    return json;
 
-        size_t apilen = strlen(VAKTIJA_API_URL);
-        size_t loclen = strlen(loc);
+}
 
-        if (date != NULL) {
+/*
+    Checks that json is a vaktija for a single day which parse_data can
+    take, without exiting like parse_data would if it is not.
 
-            size_t datelen = strlen(date);
-            url = malloc(sizeof *url * (apilen + loclen + datelen + 2)); /* for extra / */
+    Returns 1 iff it is.
+*/
+int valid_vaktija(const char *json)
+{
 
-        } else {
+    jsmn_parser pars;
+    jsmntok_t tok[VACTIJA_JSMN_TOKENS];
 
-            url = malloc(sizeof *url * (apilen + loclen + 1));
+    jsmn_init(&pars);
+    int result = jsmn_parse(&pars, json, strlen(json), tok, VACTIJA_JSMN_TOKENS);
 
-        }
+    if (result != 17 && result != 23) {
+        return 0;
+    }
 
-        if (url == NULL) {
+    int dati = find_idx_by_key(json, "datum", tok, result);
+    int vakati = find_idx_by_key(json, "vakat", tok, result);
 
-            int errcode = errno;
-            printf("Could not allocate enough memory to store URL. Download aborted!\n");
-            vactija_error(errcode);
+    return find_by_key(json, "lokacija", tok, result) != NULL &&
+        dati >= 0 && dati < result && tok[dati].type == JSMN_ARRAY && tok[dati].size == DATUM_NUM &&
+        vakati >= 0 && vakati < result && tok[vakati].type == JSMN_ARRAY && tok[vakati].size == PRAYER_TIME_NUM;
+
+}
+
+/*
+    Checks the tokens of a whole month (see parse_month): the location,
+    year and month have to be there, followed by an array of at most 31
+    day objects, each with a full datum and vakat array.
+
+    Returns the index of the "dan" array if they are fine, otherwise -1.
+*/
+static int check_month(const char *json, jsmntok_t *tok, int toklen)
+{
+
+    int loci = find_idx_by_key(json, "lokacija", tok, toklen);
+    int yeari = find_idx_by_key(json, "godina", tok, toklen);
+    int moni = find_idx_by_key(json, "mjesec", tok, toklen);
+    int dani = find_idx_by_key(json, "dan", tok, toklen);
+
+    if (toklen < 1 || tok[0].type != JSMN_OBJECT ||
+        loci < 0 || loci >= toklen || tok[loci].type != JSMN_STRING ||
+        yeari < 0 || yeari >= toklen || tok[yeari].type != JSMN_PRIMITIVE ||
+        moni < 0 || moni >= toklen || tok[moni].type != JSMN_PRIMITIVE ||
+        dani < 0 || dani >= toklen || tok[dani].type != JSMN_ARRAY ||
+        tok[dani].size < 1 || tok[dani].size > 31) {
+
+        return -1;
+
+    }
 
+    /* Every day object spans the tokens up to its sibling */
+    int obj = dani + 1;
+    for (int d = 0; d < tok[dani].size; d++) {
+
+        if (obj >= toklen || tok[obj].type != JSMN_OBJECT) {
+            return -1;
         }
-        url[0] = '\0';
 
-        /* VAKTIJA_API_URL ends with /, so we can just append location ID */
-        strncat(url, VAKTIJA_API_URL, apilen);
-        strncat(url, loc, loclen);        
-    
-        if (date != NULL) {
+        int next = skip_token(tok, obj, toklen);
+        jsmntok_t *daytok = &tok[obj];
+        int daylen = next - obj;
+
+        int dati = find_idx_by_key(json, "datum", daytok, daylen);
+        int vakati = find_idx_by_key(json, "vakat", daytok, daylen);
+
+        if (dati < 0 || dati >= daylen || daytok[dati].type != JSMN_ARRAY || daytok[dati].size != DATUM_NUM ||
+            vakati < 0 || vakati >= daylen || daytok[vakati].type != JSMN_ARRAY || daytok[vakati].size != PRAYER_TIME_NUM) {
 
-            strncat(url, "/", 1); /* since ID doesn't end with / */
-            strncat(url, date, strlen(date));
+            return -1;
 
         }
 
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        
-        /* callback will reallocate enough memory */
-        struct mem_struct dw_json;
-        dw_json.mem = malloc(sizeof(char *) * 1);
-        dw_json.size = 0;
+        obj = next;
 
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &dw_json);
+    }
 
-        char errbuf[CURL_ERROR_SIZE];
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-        errbuf[0] = 0;
+    return dani;
 
-        CURLcode result = curl_easy_perform(curl);
+}
 
-        if (result == CURLE_OK) {
-            
-            curl_easy_cleanup(curl);
+/*
+    Checks that json is a whole month which parse_month can take,
+    without building the days.
 
-            return dw_json.mem;
-            
-        } else {
-            
-            size_t errlen = strlen(errbuf); 
-            printf("Encountered an error with libcurl!\n");
-            printf("libcurl error code: %d\n", result);
-            
-            if (errlen) {
-            
-                printf("libcurl error: %s%s", errbuf, 
-                        (errbuf[errlen - 1] != '\n' ? "\n" : ""));
-            
-            } else {
-            
-                printf("libcurl (generic) error: %s\n", curl_easy_strerror(result));
-            
-            }
-            
-            curl_easy_cleanup(curl);
-            exit(EXIT_FAILURE);
+    Returns 1 iff it is.
+*/
+int valid_month(const char *json)
+{
 
-        }
-        
-    } else {
-    
-        printf("Could not initialise libcurl handle!\n");
+    jsmn_parser pars;
+    jsmn_init(&pars);
 
-        exit(EXIT_FAILURE);
+    int toklen = jsmn_parse(&pars, json, strlen(json), NULL, 0);
 
+    if (toklen <= 0) {
+        return 0;
     }
 
+    jsmntok_t *tok = vmalloc(sizeof *tok * toklen);
+
+    if (tok == NULL) {
+        return 0;
+    }
+
+    jsmn_init(&pars);
+    jsmn_parse(&pars, json, strlen(json), tok, toklen);
+
+    int valid = check_month(json, tok, toklen) >= 0;
+    vfree(tok);
+
+    return valid;
+
 }
 
 /*
@@ -238,12 +348,15 @@ struct vaktija *parse_data(const char *json)
         
         case JSMN_ERROR_NOMEM:
             errstr = "JSMN_ERROR_NOMEM";
+            break;
 
         case JSMN_ERROR_INVAL:
             errstr = "JSMN_ERROR_INVALID_JSON";
-        
-        case JSMN_ERROR_PART:
+            break;
+
+        default:
             errstr = "JSMN_ERROR_NOT_FULL_JSON_STRING";
+            break;
 
         }
 
@@ -273,23 +386,196 @@ struct vaktija *parse_data(const char *json)
     v->dates = datums;
     v->prayers = vakats;
 
+    /* Only present if the data was downloaded for a particular date */
+    if (result == 23) {
+
+        v->year = get_number(json, find_by_key(json, "godina", tok, VACTIJA_JSMN_TOKENS));
+        v->month = get_number(json, find_by_key(json, "mjesec", tok, VACTIJA_JSMN_TOKENS));
+        v->day = get_number(json, find_by_key(json, "dan", tok, VACTIJA_JSMN_TOKENS));
+
+    }
+
+    ingest_vaktija(v, NULL);
+
     return v;
 
 }
 
+/*
+    Replaces the Hijri date of the vaktija (dates[0]) with the one
+    computed locally for its day (see util/hijri.h). Nothing changes
+    if the vaktija does not know its date.
+*/
+void compute_hijri(struct vaktija *vaktija)
+{
+
+    if (vaktija->year == 0 || vaktija->dates == NULL) {
+        return;
+    }
+
+    struct hijri_date hijri;
+    hijri_from_gregorian(vaktija->year, vaktija->month, vaktija->day, &hijri);
+
+    char buf[64];
+    hijri_format(buf, sizeof buf, &hijri);
+
+    char *str = vstrdup(buf);
+
+    if (str == NULL) {
+
+        int errcode = errno;
+        printf("Could not allocate enough memory to store vaktija data!\n");
+        vactija_error(errcode);
+
+    }
+
+    vfree(vaktija->dates[0]);
+    vaktija->dates[0] = str;
+
+}
+
+/*
+    Does all the work that only depends on the data itself once, when it
+    is loaded: parses the vakat strings into times and computes the
+    derived times, so that later queries only read them. Days without a
+    Hijri date (e.g from a bundle built without one) get a computed one.
+
+    next is the following day, if it is known (may be NULL).
+*/
+void ingest_vaktija(struct vaktija *vaktija, const struct vaktija *next)
+{
+
+    if (vaktija->dates != NULL && (vaktija->dates[0] == NULL || vaktija->dates[0][0] == '\0')) {
+        compute_hijri(vaktija);
+    }
+
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+
+        struct tm tm;
+        parse_timestr(vaktija->prayers[i], &tm);
+
+        vaktija->times[i] = tm.tm_hour * 3600 + tm.tm_min * 60;
+
+    }
+
+    derive_times(vaktija, next);
+
+}
+
+/*
+    Parses the JSON the API returns for a whole month (i.e for a
+    'year/month' date), which holds the location once and then an
+    array ("dan") of objects with the datum and vakat of every day.
+
+    Returns an array of count days, which has to be freed with
+    delete_month once it is no longer useful, or NULL (after printing
+    why) if the data is not a month. Unlike parse_data it does not
+    exit, as the bundle workers call it.
+*/
+struct vaktija **parse_month(const char *json, int *count)
+{
+
+    jsmn_parser pars;
+    jsmn_init(&pars);
+
+    /* Month data is large and varies in size, so count the tokens first */
+    int toklen = jsmn_parse(&pars, json, strlen(json), NULL, 0);
+
+    if (toklen <= 0) {
+
+        printf("Encountered an error while parsing monthly vaktija JSON!\n");
+        return NULL;
+
+    }
+
+    jsmntok_t *tok = vmalloc(sizeof *tok * toklen);
+
+    if (tok == NULL) {
+
+        printf("Could not allocate enough memory to parse monthly vaktija JSON!\n");
+        return NULL;
+
+    }
+
+    jsmn_init(&pars);
+    jsmn_parse(&pars, json, strlen(json), tok, toklen);
+
+    int dani = check_month(json, tok, toklen);
+
+    if (dani < 0) {
+
+        printf("Monthly vaktija JSON has an unexpected structure!\n");
+        vfree(tok);
+
+        return NULL;
+
+    }
+
+    jsmntok_t *loctok = find_by_key(json, "lokacija", tok, toklen);
+    int year = get_number(json, find_by_key(json, "godina", tok, toklen));
+    int month = get_number(json, find_by_key(json, "mjesec", tok, toklen));
+
+    int ndays = tok[dani].size;
+    struct vaktija **days = vmalloc(sizeof *days * ndays);
+
+    if (days == NULL) {
+
+        printf("Could not allocate enough memory to store monthly vaktija!\n");
+        vfree(tok);
+
+        return NULL;
+
+    }
+
+    /* Walk the day objects (checked above), each spanning the tokens up to its sibling */
+    int obj = dani + 1;
+    for (int d = 0; d < ndays; d++) {
+
+        int next = skip_token(tok, obj, toklen);
+        jsmntok_t *daytok = &tok[obj];
+        size_t daylen = next - obj;
+
+        int dati = find_idx_by_key(json, "datum", daytok, daylen);
+        int vakati = find_idx_by_key(json, "vakat", daytok, daylen);
+
+        struct vaktija *v = create_vaktija();
+        v->location = get_simple(json, loctok);
+        v->dates = get_array(json, dati, daytok, DATUM_NUM);
+        v->prayers = get_array(json, vakati, daytok, PRAYER_TIME_NUM);
+        v->year = year;
+        v->month = month;
+        v->day = d + 1;
+
+        days[d] = v;
+        obj = next;
+
+    }
+
+    vfree(tok);
+
+    /* Backwards, so every day's successor is already ingested */
+    for (int d = ndays - 1; d >= 0; d--) {
+        ingest_vaktija(days[d], (d + 1 < ndays) ? days[d + 1] : NULL);
+    }
+
+    *count = ndays;
+
+    return days;
+
+}
+
 /*
     Returns the index of the next vakat based on provided time.
 */
 int next_vakat(const struct vaktija *vaktija, struct tm time)
 {
 
-    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+    /* Same minute resolution as compare_time */
+    int now = time.tm_hour * 3600 + time.tm_min * 60;
 
-        char *vakatstr = vaktija->prayers[i];
-        struct tm vakattime;
-        parse_timestr(vakatstr, &vakattime);
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
 
-        if (compare_time(time, vakattime) < 0) {
+        if (now < vaktija->times[i]) {
 
             return i;
 
@@ -330,52 +616,38 @@ int current_vakat(const struct vaktija *vaktija, struct tm time)
 
 }
 
-void calculate_midnight(const struct vaktija *vaktija, struct tm *midnight)
+static void seconds_to_tm(int secs, struct tm *res)
 {
-    
-    struct tm fajr; 
-    parse_timestr(vaktija->prayers[0], &fajr);
 
-    struct tm maghrib;
-    parse_timestr(vaktija->prayers[4], &maghrib);
+    secs %= 86400;
 
-    struct tm sub;
-    subtract_time(fajr, maghrib, &sub);
+    res->tm_hour = secs / 3600;
+    res->tm_min = (secs / 60) % 60;
+    res->tm_sec = secs % 60;
 
-    struct tm div;
-    divide_time(sub, 2, &div);
-
-    subtract_time(fajr, div, midnight);
-    
-} 
+}
 
-void calculate_third(const struct vaktija *vaktija, struct tm *third)
+/*
+    Calculates the middle of the night between the maghrib of the vaktija
+    and the fajr of next (the following day, may be NULL).
+*/
+void calculate_midnight(const struct vaktija *vaktija, const struct vaktija *next, struct tm *midnight)
 {
-    
-    struct tm fajr; 
-    parse_timestr(vaktija->prayers[0], &fajr);
-
-    struct tm maghrib;
-    parse_timestr(vaktija->prayers[4], &maghrib);
 
-    struct tm sub;
-    subtract_time(fajr, maghrib, &sub);
+    seconds_to_tm(derive_night(vaktija, next, 1, 2), midnight);
 
-    struct tm div;
-    divide_time(sub, 3, &div);
-
-    subtract_time(fajr, div, third);
-    
 }
 
-#ifdef USE_ANSI_COLOR
+/*
+    Calculates the beginning of the last third of the night between the
+    maghrib of the vaktija and the fajr of next (the following day, may be NULL).
+*/
+void calculate_third(const struct vaktija *vaktija, const struct vaktija *next, struct tm *third)
+{
 
-#define ANSI_YELLOW(str) "\x1b[33m" str "\x1b[0m"
-#define ANSI_CYAN(str) "\x1b[36m" str "\x1b[0m"
-#define ANSI_GREEN(str) "\x1b[32m" str "\x1b[0m"
-#define ANSI_RED(str) "\x1b[31m" str "\x1b[0m"
+    seconds_to_tm(derive_night(vaktija, next, 2, 3), third);
 
-#endif
+}
 
 static char *vakat_names[PRAYER_TIME_NUM] = {
     "Dawn",
@@ -386,6 +658,72 @@ static char *vakat_names[PRAYER_TIME_NUM] = {
     "Isha"
 };
 
+/*
+    Appends text to the template in buf, of which n bytes are used, with
+    the braces and backslashes in it escaped if escape is set (for names
+    and labels which are to come out as they are).
+
+    Returns the new length, or -1 if it does not fit (or n is already -1),
+    so that a run of appends only needs checking at the end.
+*/
+static int template_append(char *buf, size_t len, int n, const char *text, int escape)
+{
+
+    if (n < 0) {
+        return -1;
+    }
+
+    size_t at = n;
+
+    for (; *text != '\0'; text++) {
+
+        int twice = escape && (*text == '{' || *text == '}' || *text == '\\');
+
+        if (at + 1 + twice >= len) {
+
+            buf[n] = '\0';
+            return -1;
+
+        }
+
+        if (twice) {
+            buf[at++] = *text;
+        }
+
+        buf[at++] = *text;
+
+    }
+
+    buf[at] = '\0';
+
+    return (int) at;
+
+}
+
+/*
+    Prints a built-in template, compiling it on first use.
+*/
+static void print_builtin(struct format **fmt, const char *template, const struct format_ctx *ctx, int colour)
+{
+
+    if (*fmt == NULL) {
+
+        char err[FORMAT_ERR_MAX];
+        *fmt = format_compile(template, err, sizeof err);
+
+        if (*fmt == NULL) {
+
+            printf("Invalid built-in format: %s\n", err);
+            exit(EXIT_FAILURE);
+
+        }
+
+    }
+
+    format_print(*fmt, ctx, colour);
+
+}
+
 /*
     vakat has to be a valid vaktija index (0 - 5)
 
@@ -394,29 +732,58 @@ static char *vakat_names[PRAYER_TIME_NUM] = {
 void print_vakat(const struct vaktija *vaktija, int vakat, int raw)
 {
 
+    static struct format *fmt_raw = NULL;
+    static struct format *fmt = NULL;
+
     if (vakat < 0 || vakat > (PRAYER_TIME_NUM - 1)) {
         printf("Could not print the current vakat. Invalid index passed! (idx: %d)\n", vakat);
         exit(EXIT_FAILURE);
     }
 
-    if (raw) {
-        
-        printf("%s", vaktija->prayers[vakat]);
+    struct format_ctx ctx = { 0 };
+    ctx.day = vaktija;
+    ctx.vakat.day = vaktija;
+    ctx.vakat.vakat = vakat;
 
+    if (raw) {
+        print_builtin(&fmt_raw, "{vakat.time}", &ctx, 0);
     } else {
+        print_builtin(&fmt, "{cyan}{vakat.name}{reset}: {yellow}{vakat.time}{reset}\n", &ctx, format_colour());
+    }
+
+}
+
+/*
+    Returns the (English) name of the vakat with the given index (0 - 5).
+*/
+const char *vakat_name(int vakat)
+{
+
+    return vakat_names[vakat];
 
-	#ifdef USE_ANSI_COLOR
+}
 
-	printf(ANSI_CYAN("%s") ": " ANSI_YELLOW("%s") "\n", vakat_names[vakat], vaktija->prayers[vakat]);
+/*
+    Returns the index of the vakat called name (ignoring case, and fajr
+    for dawn), or -1 if there is none.
+*/
+int vakat_find(const char *name)
+{
 
-	#else
+    if (strcasecmp(name, "fajr") == 0) {
+        return 0;
+    }
 
-        printf("%s: %s\n", vakat_names[vakat], vaktija->prayers[vakat]);
+    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
 
-	#endif
+        if (strcasecmp(name, vakat_names[i]) == 0) {
+            return i;
+        }
 
     }
 
+    return -1;
+
 }
 
 /*
@@ -427,92 +794,139 @@ void print_vakat(const struct vaktija *vaktija, int vakat, int raw)
 void print_vaktija(const struct vaktija *vaktija)
 {
 
-    time_t curr;
-    time(&curr);
-    struct tm current = *localtime(&curr);
+    static const char *fields[PRAYER_TIME_NUM] = {
+        "dawn", "sunrise", "dhuhr", "asr", "maghrib", "isha"
+    };
 
-    char currstr[6];
-    currstr[0] = '\0';
-    strftime(currstr, 6, "%H:%M", &current);
-   
-    #ifdef USE_ANSI_COLOR
+    /* Compiled again only if another set of derived times is registered */
+    static struct format *fmt = NULL;
+    static const struct derived_time *fmt_derived = NULL;
+    static int fmt_nderived = -1;
 
-    printf(ANSI_CYAN("Current time is") ": " ANSI_YELLOW("%s") "\n", currstr);
-   
-    #else
-    
-    printf("Current time is: %s\n", currstr);
+    int nderived = derived_count();
+    const struct derived_time *derived = (nderived > 0) ? derived_get(0) : NULL;
 
-    #endif
+    char template[FORMAT_BUF_MAX] = "";
 
-    printf("\n");
+    if (fmt == NULL || derived != fmt_derived || nderived != fmt_nderived) {
 
-    #ifdef USE_ANSI_COLOR
+        format_free(fmt);
+        fmt = NULL;
+        fmt_derived = derived;
+        fmt_nderived = nderived;
 
-    printf(ANSI_CYAN("Today's date is ") ANSI_RED("%s ") "(" ANSI_GREEN("%s") "):\n", 
-		    vaktija->dates[0], vaktija->dates[1]);
+        int n = template_append(template, sizeof template, 0,
+                "{cyan}Current time is{reset}: {yellow}{time}{reset}\n\n"
+                "{cyan}Today's date is {red}{hijri} {reset}({green}{date}{reset}):\n\n"
+                "{cyan}Vaktija for{reset}: {yellow}{location}{reset}\n\n", 0);
 
-    #else
+        for (int i = 0; i < PRAYER_TIME_NUM && n >= 0; i++) {
 
-    printf("Today's date is %s (%s):\n", vaktija->dates[0], vaktija->dates[1]);
+            n = template_append(template, sizeof template, n, "{cyan}", 0);
+            n = template_append(template, sizeof template, n, vakat_names[i], 1);
+            n = template_append(template, sizeof template, n, "{reset}: {yellow}{", 0);
+            n = template_append(template, sizeof template, n, fields[i], 0);
+            n = template_append(template, sizeof template, n, "}{reset}\n", 0);
 
-    #endif
+        }
 
-    printf("\n");
+        n = template_append(template, sizeof template, n, "\n", 0);
 
-    #ifdef USE_ANSI_COLOR
+        /* Derived times were computed on load, this only formats them */
+        for (int i = 0; i < nderived && n >= 0; i++) {
 
-    printf(ANSI_CYAN("Vaktija for") ": " ANSI_YELLOW("%s") "\n", vaktija->location); 
+            /* A row which does not fit is left out whole */
+            int row = template_append(template, sizeof template, n, "{cyan}", 0);
+            row = template_append(template, sizeof template, row, derived_get(i)->label, 1);
+            row = template_append(template, sizeof template, row, "{reset}: {yellow}{", 0);
+            row = template_append(template, sizeof template, row, derived_get(i)->name, 0);
+            row = template_append(template, sizeof template, row, "}{reset}\n", 0);
 
-    #else
+            if (row < 0) {
 
-    printf("Vaktija for %s:\n", vaktija->location);
+                template[n] = '\0';
+                break;
 
-    #endif
+            }
 
-    printf("\n");
+            n = row;
+
+        }
 
-    for (int i = 0; i < PRAYER_TIME_NUM; i++) {
-        print_vakat(vaktija, i, 0);
     }
 
-    printf("\n");
+    struct format_ctx ctx = { 0 };
+    ctx.day = vaktija;
+    ctx.now = clock_now();
 
-    struct tm midnight;
-    parse_timestr("00:00", &midnight);
-    calculate_midnight(vaktija, &midnight);
+    print_builtin(&fmt, template, &ctx, format_colour());
 
-    char midstr[6];
-    midstr[0] = '\0';
-    strftime(midstr, 6, "%H:%M", &midnight);
+}
 
-    #ifdef USE_ANSI_COLOR
+/*
+    Prints the title and column names of a table with one row per day
+    (see print_table_row). span says which days the table is for.
+*/
+void print_table_header(const char *location, const char *span)
+{
 
-    printf(ANSI_CYAN("Midnight is on") ": " ANSI_YELLOW("%s") "\n", midstr);
+    static struct format *fmt = NULL;
+    char template[512] = "";
 
-    #else
+    if (fmt == NULL) {
 
-    printf("Midnight is on: %s\n", midstr);
+        size_t n = snprintf(template, sizeof template,
+                "{cyan}Vaktija for{reset}: {yellow}{location}{reset} ({green}{title}{reset})\n\n"
+                "{cyan}%-10s{reset}", "Date");
 
-    #endif
+        for (int i = 0; i < PRAYER_TIME_NUM; i++) {
+            n += snprintf(template + n, sizeof template - n, "  {cyan}%-7s{reset}", vakat_names[i]);
+        }
 
-    struct tm third;
-    parse_timestr("00:00", &third);
-    calculate_third(vaktija, &third);
+        snprintf(template + n, sizeof template - n, "  {cyan}Hijri{reset}\n");
 
-    char thirdstr[6];
-    thirdstr[0] = '\0';
-    strftime(thirdstr, 6, "%H:%M", &third);
+    }
 
-    #ifdef USE_ANSI_COLOR
+    struct format_ctx ctx = { 0 };
+    ctx.location = location;
+    ctx.title = span;
 
-    printf(ANSI_CYAN("Last third of the night is on") ": " ANSI_YELLOW("%s") "\n", thirdstr);
+    print_builtin(&fmt, template, &ctx, format_colour());
 
-    #else
+}
+
+void print_table_row(const struct vaktija *v)
+{
 
-    printf("Last third of the night is on: %s\n", thirdstr);
+    static struct format *fmt = NULL;
 
-    #endif
+    struct format_ctx ctx = { 0 };
+    ctx.day = v;
 
+    print_builtin(&fmt, "{green}{gdate}{reset}"
+            "  {yellow}{dawn:-7}{reset}  {yellow}{sunrise:-7}{reset}  {yellow}{dhuhr:-7}{reset}"
+            "  {yellow}{asr:-7}{reset}  {yellow}{maghrib:-7}{reset}  {yellow}{isha:-7}{reset}"
+            "  {red}{hijri}{reset}\n", &ctx, format_colour());
+
+}
+
+/*
+    Prints the vaktija of every day in a month as a table, one row per day.
+*/
+void print_month(struct vaktija **days, int count)
+{
+
+    if (count == 0) {
+        return;
+    }
+
+    char span[16];
+    snprintf(span, sizeof span, "%02d/%04d", days[0]->month, days[0]->year);
+
+    print_table_header(days[0]->location, span);
+
+    for (int d = 0; d < count; d++) {
+        print_table_row(days[d]);
+    }
 
 }
@@ -20,6 +20,24 @@
 #define PRAYER_TIME_NUM 6
 #define DATUM_NUM 2
 
+/*
+    Location IDs go from 0 to VAKTIJA_LOCATIONS - 1 (see locations.txt,
+    from which locations.h is generated).
+*/
+#define VAKTIJA_LOCATIONS 118
+
+/*
+    Sizes of the date part of an API path ("yyyy/mm/dd") and of a
+    location ID written out, which fit whatever ints they are made of.
+*/
+#define VAKTIJA_DATE_PATH_MAX 36
+#define VAKTIJA_LOCATION_ID_MAX 12
+
+/*
+    Maximum number of derived times (see derived.h).
+*/
+#define DERIVED_MAX 8
+
 struct vaktija {
 
     char **prayers;
@@ -28,22 +46,59 @@ struct vaktija {
 
     char **dates;
 
+    /*
+        Gregorian date the vaktija is for (month in range 1 - 12),
+        or all 0 if the data did not say.
+    */
+    int year;
+    int month;
+    int day;
+
+    /*
+        Vakat times in seconds since 00:00, parsed once on load.
+    */
+    int times[PRAYER_TIME_NUM];
+
+    /*
+        Derived times (see derived.h) in seconds since 00:00 of the day,
+        computed on load. derived_exact is 1 if they were computed with
+        the following day known, rather than approximated without it.
+    */
+    int derived[DERIVED_MAX];
+    int derived_exact;
+
 };
 
+const char *vaktija_api_url(void);
+
+char *fetch_vaktija(const char *loc, const char *date);
 char *download_vaktija(const char *loc, const char *date);
 
+int valid_vaktija(const char *json);
+int valid_month(const char *json);
 struct vaktija *parse_data(const char *json);
+struct vaktija **parse_month(const char *json, int *count);
+
+void ingest_vaktija(struct vaktija *vaktija, const struct vaktija *next);
+void compute_hijri(struct vaktija *vaktija);
 
 int next_vakat(const struct vaktija *vaktija, struct tm time);
 int current_vakat(const struct vaktija *vaktija, struct tm time);
 
-void calculate_midnight(const struct vaktija *vaktija, struct tm *midnight);
-void calculate_third(const struct vaktija *vaktija, struct tm *third);
+void calculate_midnight(const struct vaktija *vaktija, const struct vaktija *next, struct tm *midnight);
+void calculate_third(const struct vaktija *vaktija, const struct vaktija *next, struct tm *third);
+
+const char *vakat_name(int vakat);
+int vakat_find(const char *name);
 
 void print_vakat(const struct vaktija *vaktija, int vakat, int raw);
 void print_vaktija(const struct vaktija *vaktija);
+void print_table_header(const char *location, const char *span);
+void print_table_row(const struct vaktija *vaktija);
+void print_month(struct vaktija **days, int count);
 
 struct vaktija *create_vaktija(void);
 void delete_vaktija(struct vaktija *vaktija);
+void delete_month(struct vaktija **days, int count);
 
 #endif